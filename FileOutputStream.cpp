@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 
 
@@ -39,36 +40,14 @@ FileOutputStream::~FileOutputStream()
 //virtual
 bool FileOutputStream::initialize(const char *fileName)
 {
-	bool result;
-
-	result = false;
-
-	if (fileName != NULL)
-	{
-		FILE *fp;
-
-		fp = fopen(fileName,"wb");
-
-
-		if (fp != NULL)
-		{
-			struct PrivateFileOutputStreamData *opaque;
-
-			opaque = (struct PrivateFileOutputStreamData *)malloc(sizeof(struct PrivateFileOutputStreamData));
-			opaque->mFileName = strdup(fileName);
-			opaque->mFP = fp;
+	return open(fileName,"wb");
+}
 
-			mOpaque = (void *)opaque;
 
-			result = true;
-		}
-		else
-		{
-			printf("Problem opening file [%s].\n", fileName);
-		}
-	}
-
-	return result;
+//virtual
+bool FileOutputStream::initializeForUpdate(const char *fileName)
+{
+	return open(fileName,"r+b");
 }
 
 
@@ -168,9 +147,61 @@ int FileOutputStream::write(void *buffer,int size,int count)
 }
 
 
+//virtual
+bool FileOutputStream::truncate()
+{
+	bool result;
+
+	result = false;
+
+	if (mOpaque != NULL)
+	{
+		struct PrivateFileOutputStreamData *alias;
+
+		alias = (struct PrivateFileOutputStreamData *)mOpaque;
+
+		result = fflush(alias->mFP) == 0 && ftruncate(fileno(alias->mFP),ftell(alias->mFP)) == 0;
+	}
+
+	return result;
+}
+
+
 
 
 
 ////////////////////
 //private methods
+bool FileOutputStream::open(const char *fileName,const char *mode)
+{
+	bool result;
+
+	result = false;
+
+	if (fileName != NULL)
+	{
+		FILE *fp;
+
+		fp = fopen(fileName,mode);
 
+
+		if (fp != NULL)
+		{
+			struct PrivateFileOutputStreamData *opaque;
+
+			opaque = (struct PrivateFileOutputStreamData *)malloc(sizeof(struct PrivateFileOutputStreamData));
+			opaque->mFileName = strdup(fileName);
+			opaque->mFP = fp;
+
+			mOpaque = (void *)opaque;
+
+			result = true;
+		}
+		else
+		{
+			printf("Problem opening file [%s].\n", fileName);
+		}
+	}
+
+	return result;
+}
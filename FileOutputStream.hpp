@@ -13,15 +13,20 @@ class FileOutputStream : public OutputStream
 
 
 		virtual bool initialize(const char *fileName);
+		// opens an existing file without truncating it, writes land wherever seek() puts them
+		virtual bool initializeForUpdate(const char *fileName);
 		virtual void shutdown();
 
 		virtual int tell();
 		virtual bool seek(int delta,SEEK_MODE mode);
 		virtual int write(void *buffer,int size,int count);		
+		virtual bool truncate();
 
 
 	private:
 
+		bool open(const char *fileName,const char *mode);
+
 		void *mOpaque;
 
 };
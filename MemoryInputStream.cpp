@@ -0,0 +1,158 @@
+#include "MemoryInputStream.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+/////////////////
+//private structs
+struct PrivateMemoryInputStreamData
+{
+	const BYTE *mBuffer;
+	int mSize;
+	int mPosition;
+};
+
+
+
+
+///////////////////
+//public methods
+MemoryInputStream::MemoryInputStream()
+{
+	mOpaque = NULL;
+}
+
+
+MemoryInputStream::~MemoryInputStream()
+{
+	assert(mOpaque == NULL);
+}
+
+
+bool MemoryInputStream::initialize(const BYTE *buffer,int size)
+{
+	bool result;
+
+	result = false;
+
+	if (buffer != NULL || size == 0)
+	{
+		struct PrivateMemoryInputStreamData *opaque;
+
+		opaque = (struct PrivateMemoryInputStreamData *)malloc(sizeof(struct PrivateMemoryInputStreamData));
+		opaque->mBuffer = buffer;
+		opaque->mSize = size;
+		opaque->mPosition = 0;
+
+		mOpaque = (void *)opaque;
+
+		result = true;
+	}
+
+	return result;
+}
+
+
+void MemoryInputStream::shutdown()
+{
+	if (mOpaque != NULL)
+	{
+		free(mOpaque);
+		mOpaque = NULL;
+	}
+}
+
+
+
+
+int MemoryInputStream::tell()
+{
+	int result;
+
+	result = -1;
+
+	if (mOpaque != NULL)
+	{
+		struct PrivateMemoryInputStreamData *alias;
+
+		alias = (struct PrivateMemoryInputStreamData *)mOpaque;
+
+		result = alias->mPosition;
+	}
+
+	return result;
+}
+
+
+bool MemoryInputStream::seek(int delta,SEEK_MODE mode)
+{
+	bool result;
+
+	result = false;
+
+	if (mOpaque != NULL)
+	{
+		struct PrivateMemoryInputStreamData *alias;
+		int position;
+
+		alias = (struct PrivateMemoryInputStreamData *)mOpaque;
+
+		switch (mode)
+		{
+			case SEEK_BEGINNING :
+				position = delta;
+				break;
+			case SEEK_CURRENT :
+				position = alias->mPosition + delta;
+				break;
+			case SEEK_ENDING :
+				position = alias->mSize + delta;
+				break;
+			default:
+				assert(!"huh??  MemoryInputStream::seek\n");
+				position = alias->mPosition;
+				break;
+		}
+
+		if (position >= 0 && position <= alias->mSize)
+		{
+			alias->mPosition = position;
+			result = true;
+		}
+	}
+
+	return result;
+}
+
+
+int MemoryInputStream::read(void *buffer,int size,int count)
+{
+	int result;
+
+	result = -1;
+
+	if (mOpaque != NULL)
+	{
+		struct PrivateMemoryInputStreamData *alias;
+		int available;
+
+		alias = (struct PrivateMemoryInputStreamData *)mOpaque;
+
+		// same contract as fread, only whole items are returned
+		available = (alias->mSize - alias->mPosition) / size;
+		result = count < available ? count : available;
+
+		memcpy(buffer,&(alias->mBuffer[alias->mPosition]),result * size);
+		alias->mPosition += result * size;
+	}
+
+	return result;
+}
+
+
+
+////////////////////////
+//private methods
@@ -0,0 +1,33 @@
+#ifndef MEMORY_INPUT_STREAM__HPP
+#define MEMORY_INPUT_STREAM__HPP
+
+#include "InputStream.hpp"
+
+
+
+
+class MemoryInputStream : public InputStream
+{
+	public:
+		MemoryInputStream();
+		virtual ~MemoryInputStream();
+
+		// the stream reads straight out of the caller's buffer, which has to outlive it
+		virtual bool initialize(const BYTE *buffer,int size);
+		virtual void shutdown();
+
+		virtual int tell();
+		virtual bool seek(int delta,SEEK_MODE mode);
+		virtual int read(void *buffer,int size,int count);
+
+
+	private:
+
+
+		void *mOpaque;
+
+
+
+};
+
+#endif // MEMORY_INPUT_STREAM__HPP
@@ -0,0 +1,254 @@
+#include "MemoryOutputStream.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+
+
+/////////////////
+//private structs
+struct PrivateMemoryOutputStreamData
+{
+	BYTE *mBuffer;
+	int mCapacity;
+	int mSize;
+	int mPosition;
+};
+
+
+////////////////////
+//public methods
+
+//virtual
+MemoryOutputStream::MemoryOutputStream()
+{
+	mOpaque = NULL;
+}
+
+
+//virtual
+MemoryOutputStream::~MemoryOutputStream()
+{
+	assert(mOpaque == NULL);
+}
+
+
+
+
+//virtual
+bool MemoryOutputStream::initialize(int initialCapacity)
+{
+	struct PrivateMemoryOutputStreamData *opaque;
+
+	if (initialCapacity < 1)
+	{
+		initialCapacity = 1;
+	}
+
+	opaque = (struct PrivateMemoryOutputStreamData *)malloc(sizeof(struct PrivateMemoryOutputStreamData));
+	opaque->mBuffer = (BYTE *)malloc(initialCapacity);
+	opaque->mCapacity = initialCapacity;
+	opaque->mSize = 0;
+	opaque->mPosition = 0;
+
+	mOpaque = (void *)opaque;
+
+	return opaque->mBuffer != NULL;
+}
+
+
+//virtual
+void MemoryOutputStream::shutdown()
+{
+	if (mOpaque != NULL)
+	{
+		struct PrivateMemoryOutputStreamData *alias;
+
+		alias = (struct PrivateMemoryOutputStreamData *)mOpaque;
+
+		free(alias->mBuffer);
+		alias->mBuffer = NULL;
+
+		free(mOpaque);
+		mOpaque = NULL;
+	}
+
+}
+
+//virtual
+int MemoryOutputStream::tell()
+{
+	int result;
+
+	result = -1;
+
+	if (mOpaque != NULL)
+	{
+		struct PrivateMemoryOutputStreamData *alias;
+
+		alias = (struct PrivateMemoryOutputStreamData *)mOpaque;
+
+		result = alias->mPosition;
+	}
+
+	return result;
+}
+
+
+//virtual
+bool MemoryOutputStream::seek(int delta,SEEK_MODE mode)
+{
+	bool result;
+
+	result = false;
+
+	if (mOpaque != NULL)
+	{
+		struct PrivateMemoryOutputStreamData *alias;
+		int position;
+
+		alias = (struct PrivateMemoryOutputStreamData *)mOpaque;
+
+		switch (mode)
+		{
+			case SEEK_BEGINNING :
+				position = delta;
+				break;
+			case SEEK_CURRENT :
+				position = alias->mPosition + delta;
+				break;
+			case SEEK_ENDING :
+				position = alias->mSize + delta;
+				break;
+			default:
+				assert(!"huh??  MemoryOutputStream::seek\n");
+				position = alias->mPosition;
+				break;
+		}
+
+		if (position >= 0 && position <= alias->mSize)
+		{
+			alias->mPosition = position;
+			result = true;
+		}
+	}
+
+	return result;
+}
+
+
+//virtual
+int MemoryOutputStream::write(void *buffer,int size,int count)
+{
+	int result;
+
+	result = -1;
+
+	if (mOpaque != NULL)
+	{
+		struct PrivateMemoryOutputStreamData *alias;
+		int num_bytes;
+
+		alias = (struct PrivateMemoryOutputStreamData *)mOpaque;
+		num_bytes = size * count;
+
+		if (alias->mPosition + num_bytes > alias->mCapacity)
+		{
+			int capacity;
+
+			capacity = alias->mCapacity;
+			while (alias->mPosition + num_bytes > capacity)
+			{
+				capacity *= 2;
+			}
+
+			alias->mBuffer = (BYTE *)realloc(alias->mBuffer,capacity);
+			alias->mCapacity = capacity;
+		}
+
+		memcpy(&(alias->mBuffer[alias->mPosition]),buffer,num_bytes);
+		alias->mPosition += num_bytes;
+
+		if (alias->mPosition > alias->mSize)
+		{
+			alias->mSize = alias->mPosition;
+		}
+
+		result = count;
+	}
+
+	return result;
+}
+
+
+//virtual
+void MemoryOutputStream::reserve(int size)
+{
+	if (mOpaque != NULL)
+	{
+		struct PrivateMemoryOutputStreamData *alias;
+
+		alias = (struct PrivateMemoryOutputStreamData *)mOpaque;
+
+		if (alias->mPosition + size > alias->mCapacity)
+		{
+			alias->mBuffer = (BYTE *)realloc(alias->mBuffer,alias->mPosition + size);
+			alias->mCapacity = alias->mPosition + size;
+		}
+	}
+}
+
+
+//virtual
+void MemoryOutputStream::rewind()
+{
+	if (mOpaque != NULL)
+	{
+		struct PrivateMemoryOutputStreamData *alias;
+
+		alias = (struct PrivateMemoryOutputStreamData *)mOpaque;
+
+		alias->mSize = 0;
+		alias->mPosition = 0;
+	}
+}
+
+
+const BYTE *MemoryOutputStream::getBuffer()
+{
+	const BYTE *result;
+
+	result = NULL;
+
+	if (mOpaque != NULL)
+	{
+		result = ((struct PrivateMemoryOutputStreamData *)mOpaque)->mBuffer;
+	}
+
+	return result;
+}
+
+
+int MemoryOutputStream::getSize()
+{
+	int result;
+
+	result = 0;
+
+	if (mOpaque != NULL)
+	{
+		result = ((struct PrivateMemoryOutputStreamData *)mOpaque)->mSize;
+	}
+
+	return result;
+}
+
+
+
+
+
+////////////////////
+//private methods
@@ -0,0 +1,37 @@
+#ifndef MEMORY_OUTPUT_STREAM__HPP
+#define MEMORY_OUTPUT_STREAM__HPP
+
+#include "OutputStream.hpp"
+
+
+class MemoryOutputStream : public OutputStream
+{
+	public:
+
+		MemoryOutputStream();
+		~MemoryOutputStream();
+
+
+		virtual bool initialize(int initialCapacity);
+		virtual void shutdown();
+
+		virtual int tell();
+		virtual bool seek(int delta,SEEK_MODE mode);
+		virtual int write(void *buffer,int size,int count);		
+		virtual void reserve(int size);
+
+		// empties the stream but keeps its buffer, so a reused stream stops allocating
+		virtual void rewind();
+
+		const BYTE *getBuffer();
+		int getSize();
+
+
+	private:
+
+		void *mOpaque;
+
+};
+
+
+#endif // MEMORY_OUTPUT_STREAM__HPP
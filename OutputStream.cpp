@@ -8,4 +8,18 @@
 OutputStream::~OutputStream()
 {
 	
+}
+
+
+// virtual
+void OutputStream::reserve(int size)
+{
+
+}
+
+
+// virtual
+bool OutputStream::truncate()
+{
+	return false;
 }
\ No newline at end of file
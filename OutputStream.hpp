@@ -17,6 +17,12 @@ class OutputStream
 		virtual int tell() = 0;
 		virtual bool seek(int delta,SEEK_MODE mode) = 0;
 		virtual int write(void *buffer,int size,int count) = 0;		
+
+		// a hint that about size bytes are coming, streams that can use it make room up front
+		virtual void reserve(int size);
+
+		// drops everything past the current position, false for streams that can't
+		virtual bool truncate();
 	
 	private:
 
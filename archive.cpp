@@ -0,0 +1,949 @@
+#include "./archive.h"
+#include "./compressor.h"
+#include "./checksum.h"
+#include "./FileInputStream.hpp"
+#include "./FileOutputStream.hpp"
+#include "./MemoryInputStream.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/////////////////////////////
+// private defines
+
+// a batch stops at whichever comes first, enough files to keep every worker busy without holding the tree in memory
+#define ARCHIVE_BATCH_FILES 4096
+#define ARCHIVE_BATCH_BYTES (64 * 1024 * 1024)
+#define MAX_ARCHIVE_PATH_LENGTH 4096
+#define INITIAL_FILENAMES_CAPACITY 256
+#define CHECK_BUFFER_SIZE (64 * 1024)
+
+// directory offset, number of files and the crc of the directory
+#define ARCHIVE_FOOTER_SIZE (sizeof(DWORD) + 2 * sizeof(WORD))
+
+// offsets go through the streams' int tell() and seek(), so an archive stops short of where they'd wrap
+#define MAX_ARCHIVE_SIZE ((DWORD)INT_MAX)
+
+// what a stream streamed from a file of a given size could come to at most: blocks never grow past their
+// input, on top of which come a header and an index entry per block and the stream's own header and trailer
+#define STREAM_SIZE_BOUND(size) ((size) + (size) / 8 + 64 * 1024)
+
+
+/////////////////////////////
+// Private Structures
+struct archive_entry
+{
+	char *m_name; // malloc()ed, relative, '/' between directories
+	DWORD m_offset; // of the file's compressed stream, from the start of the archive
+	DWORD m_compressed_size;
+	DWORD m_original_size;
+	WORD m_crc; // of the original bytes, seeded with CHECKSUM_SEED
+};
+
+struct archive_directory
+{
+	struct archive_entry *m_entries;
+	int m_num_entries;
+	DWORD m_directory_size; // what the entries come to written out, while the archive is being created
+	bool m_full; // a file didn't fit under MAX_ARCHIVE_SIZE, nothing more goes in
+};
+
+
+/////////////////////////////
+// Private Prototypes
+bool collect_files(const char *path, bool top_level, char ***filenames, int *num_filenames, int *capacity);
+int compare_archive_paths(const void *a, const void *b);
+char *stored_name(const char *path);
+bool read_whole_file(const char *filename, BYTE **bytes, int *size);
+bool write_archive_batch(BYTE algorithm_id, char **filenames, int num_filenames, int num_threads, OutputStream *dest, struct archive_directory *directory);
+bool write_archive_file(BYTE algorithm_id, const char *filename, OutputStream *dest, struct archive_directory *directory);
+bool checksum_file(const char *path, DWORD *size, WORD *crc);
+DWORD directory_entry_size(const char *name);
+bool archive_has_room(OutputStream *dest, struct archive_directory *directory, const char *name, DWORD size);
+void write_directory_field(OutputStream *dest, WORD *crc, const void *field, int size);
+bool read_directory_field(const BYTE **cursor, const BYTE *end, void *field, int size);
+bool read_archive_directory(InputStream *source, struct archive_directory *directory);
+void free_archive_directory(struct archive_directory *directory);
+bool is_safe_name(const char *name);
+void make_parent_directories(char *path);
+bool extract_entry(InputStream *source, const struct archive_entry *entry, const char *directory);
+bool check_extracted_file(const struct archive_entry *entry, const char *path, bool decoded);
+
+
+/////////////////////////////
+// Public Functions
+bool create_archive(BYTE algorithm_id, const char **paths, int num_paths, int num_threads, OutputStream *dest)
+{
+	struct archive_directory directory;
+	DWORD magic_number;
+	WORD version_number;
+	char **filenames;
+	int num_filenames;
+	int filenames_capacity;
+	DWORD directory_offset;
+	WORD directory_crc;
+	WORD num_entries;
+	DWORD batch_limit;
+	bool result;
+	int first;
+	int i;
+
+	result = true;
+	filenames = NULL;
+	num_filenames = 0;
+	filenames_capacity = 0;
+
+	for (i = 0; i < num_paths; i++)
+	{
+		if (collect_files(paths[i], true, &filenames, &num_filenames, &filenames_capacity) == false)
+		{
+			result = false;
+		}
+	}
+
+	// directory order isn't stable across machines, and sorted names keep neighbouring files together
+	qsort(filenames, num_filenames, sizeof(char *), compare_archive_paths);
+
+	directory.m_entries = (struct archive_entry *)malloc(sizeof(struct archive_entry) * (num_filenames > 0 ? num_filenames : 1));
+	directory.m_num_entries = 0;
+	directory.m_directory_size = 0;
+	directory.m_full = false;
+
+	magic_number = ARCHIVE_MAGIC_NUMBER;
+	version_number = ARCHIVE_VERSION;
+
+	dest->write(&magic_number,sizeof(magic_number),1);
+	dest->write(&version_number,sizeof(version_number),1);
+
+	// a batch is held twice, as read and as compressed, so under a memory cap it gets a quarter of it
+	batch_limit = ARCHIVE_BATCH_BYTES;
+	if (get_max_memory() != 0 && get_max_memory() / 4 < batch_limit)
+	{
+		batch_limit = get_max_memory() / 4;
+	}
+
+	first = 0;
+	while (first < num_filenames && directory.m_full == false)
+	{
+		int num_batch;
+		DWORD batch_bytes;
+		struct stat info;
+
+		// a file bigger than a whole batch goes from disk into the archive a block at a time instead
+		if (stat(filenames[first], &info) == 0 && (DWORD)info.st_size > batch_limit)
+		{
+			if (write_archive_file(algorithm_id, filenames[first], dest, &directory) == false)
+			{
+				result = false;
+			}
+
+			first++;
+			continue;
+		}
+
+		// sizes from stat() are only for sizing the batch, whatever is read is what gets stored
+		num_batch = 0;
+		batch_bytes = 0;
+		while (first + num_batch < num_filenames && num_batch < ARCHIVE_BATCH_FILES)
+		{
+			DWORD size;
+
+			size = stat(filenames[first + num_batch], &info) == 0 ? info.st_size : 0;
+			if (num_batch > 0 && batch_bytes + size > batch_limit)
+			{
+				break;
+			}
+
+			batch_bytes += size;
+			num_batch++;
+		}
+
+		if (write_archive_batch(algorithm_id, &(filenames[first]), num_batch, num_threads, dest, &directory) == false)
+		{
+			result = false;
+		}
+
+		first += num_batch;
+	}
+
+	directory_offset = dest->tell();
+	directory_crc = CHECKSUM_SEED;
+
+	for (i = 0; i < directory.m_num_entries; i++)
+	{
+		struct archive_entry *alias;
+		WORD name_length;
+
+		alias = &(directory.m_entries[i]);
+		name_length = strlen(alias->m_name);
+
+		write_directory_field(dest, &directory_crc, &name_length, sizeof(name_length));
+		write_directory_field(dest, &directory_crc, alias->m_name, name_length);
+		write_directory_field(dest, &directory_crc, &alias->m_offset, sizeof(alias->m_offset));
+		write_directory_field(dest, &directory_crc, &alias->m_compressed_size, sizeof(alias->m_compressed_size));
+		write_directory_field(dest, &directory_crc, &alias->m_original_size, sizeof(alias->m_original_size));
+		write_directory_field(dest, &directory_crc, &alias->m_crc, sizeof(alias->m_crc));
+	}
+
+	num_entries = directory.m_num_entries;
+
+	dest->write(&directory_offset,sizeof(directory_offset),1);
+	dest->write(&num_entries,sizeof(num_entries),1);
+	dest->write(&directory_crc,sizeof(directory_crc),1);
+
+	printf("archived [%d] of [%d] files in [%llu] bytes\n", directory.m_num_entries, num_filenames, (DWORD)dest->tell());
+
+	free_archive_directory(&directory);
+
+	for (i = 0; i < num_filenames; i++)
+	{
+		free(filenames[i]);
+	}
+	free(filenames);
+
+	return result;
+}
+
+
+bool extract_archive(InputStream *source, const char *directory, const char **names, int num_names)
+{
+	struct archive_directory contents;
+	bool *found;
+	int num_extracted;
+	bool result;
+	int i;
+
+	if (read_archive_directory(source, &contents) == false)
+	{
+		return false;
+	}
+
+	result = true;
+	num_extracted = 0;
+	found = (bool *)calloc(num_names > 0 ? num_names : 1, sizeof(bool));
+
+	// a progress bar per file drowns out everything else
+	set_verbose(false);
+
+	for (i = 0; i < contents.m_num_entries; i++)
+	{
+		struct archive_entry *alias;
+		bool wanted;
+		int j;
+
+		alias = &(contents.m_entries[i]);
+		wanted = (num_names == 0);
+
+		for (j = 0; j < num_names; j++)
+		{
+			if (strcmp(names[j], alias->m_name) == 0)
+			{
+				found[j] = true;
+				wanted = true;
+			}
+		}
+
+		if (wanted == false)
+		{
+			continue;
+		}
+
+		if (extract_entry(source, alias, directory))
+		{
+			num_extracted++;
+		}
+		else
+		{
+			result = false;
+		}
+	}
+
+	for (i = 0; i < num_names; i++)
+	{
+		if (found[i] == false)
+		{
+			printf("Problem: [%s] isn't in the archive\n", names[i]);
+			result = false;
+		}
+	}
+
+	set_verbose(true);
+
+	printf("extracted [%d] files\n", num_extracted);
+
+	free(found);
+	free_archive_directory(&contents);
+
+	return result;
+}
+
+
+bool list_archive(InputStream *source)
+{
+	struct archive_directory contents;
+	DWORD total_compressed;
+	DWORD total_original;
+	int i;
+
+	if (read_archive_directory(source, &contents) == false)
+	{
+		return false;
+	}
+
+	total_compressed = 0;
+	total_original = 0;
+
+	for (i = 0; i < contents.m_num_entries; i++)
+	{
+		struct archive_entry *alias;
+
+		alias = &(contents.m_entries[i]);
+
+		printf("offset[%llu] compressed[%llu] original[%llu] crc[%08x] %s\n", alias->m_offset, alias->m_compressed_size, alias->m_original_size, alias->m_crc, alias->m_name);
+
+		total_compressed += alias->m_compressed_size;
+		total_original += alias->m_original_size;
+	}
+
+	printf("files[%d] compressed[%llu] original[%llu]\n", contents.m_num_entries, total_compressed, total_original);
+
+	free_archive_directory(&contents);
+
+	return true;
+}
+
+
+/////////////////////////////
+// Private Functions
+
+// regular files and directories; links found inside a directory are left out so a loop can't be walked forever
+bool collect_files(const char *path, bool top_level, char ***filenames, int *num_filenames, int *capacity)
+{
+	struct stat info;
+	bool result;
+
+	if ((top_level ? stat(path,&info) : lstat(path,&info)) != 0)
+	{
+		printf("Problem opening [%s].\n", path);
+		return false;
+	}
+
+	result = true;
+
+	if (S_ISDIR(info.st_mode))
+	{
+		DIR *directory;
+		struct dirent *item;
+		int path_length;
+
+		directory = opendir(path);
+		if (directory == NULL)
+		{
+			printf("Problem opening [%s].\n", path);
+			return false;
+		}
+
+		path_length = strlen(path);
+
+		while ((item = readdir(directory)) != NULL)
+		{
+			char filename[MAX_ARCHIVE_PATH_LENGTH];
+
+			if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+			{
+				continue;
+			}
+
+			snprintf(filename,sizeof(filename),path_length > 0 && path[path_length - 1] == '/' ? "%s%s" : "%s/%s",path,item->d_name);
+
+			if (collect_files(filename, false, filenames, num_filenames, capacity) == false)
+			{
+				result = false;
+			}
+		}
+
+		closedir(directory);
+	}
+	else if (S_ISREG(info.st_mode))
+	{
+		if (*num_filenames == *capacity)
+		{
+			*capacity = *capacity == 0 ? INITIAL_FILENAMES_CAPACITY : *capacity * 2;
+			*filenames = (char **)realloc(*filenames,sizeof(char *) * (*capacity));
+		}
+
+		(*filenames)[*num_filenames] = strdup(path);
+		(*num_filenames)++;
+	}
+
+	return result;
+}
+
+
+int compare_archive_paths(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a,*(const char **)b);
+}
+
+
+// the path made relative and resolved the way tar does it: empty and "." components go, and a ".." takes
+// the component before it with it, or is dropped when there's none left to take; malloc()ed
+char *stored_name(const char *path)
+{
+	char *result;
+	int length;
+
+	result = (char *)malloc(strlen(path) + 1);
+	length = 0;
+
+	while (*path != '\0')
+	{
+		int component_length;
+
+		while (*path == '/')
+		{
+			path++;
+		}
+
+		component_length = 0;
+		while (path[component_length] != '\0' && path[component_length] != '/')
+		{
+			component_length++;
+		}
+
+		if (component_length == 2 && path[0] == '.' && path[1] == '.')
+		{
+			while (length > 0 && result[length - 1] != '/')
+			{
+				length--;
+			}
+			if (length > 0)
+			{
+				length--;
+			}
+		}
+		else if (component_length > 0 && (component_length != 1 || path[0] != '.'))
+		{
+			if (length > 0)
+			{
+				result[length] = '/';
+				length++;
+			}
+
+			memcpy(&(result[length]), path, component_length);
+			length += component_length;
+		}
+
+		path += component_length;
+	}
+
+	result[length] = '\0';
+
+	return result;
+}
+
+
+bool read_whole_file(const char *filename, BYTE **bytes, int *size)
+{
+	FileInputStream *source;
+	bool result;
+
+	result = false;
+	source = new FileInputStream();
+
+	if (source->initialize(filename))
+	{
+		source->seek(0,SEEK_ENDING);
+		*size = source->tell();
+		source->seek(0,SEEK_BEGINNING);
+
+		*bytes = (BYTE *)malloc(*size > 0 ? *size : 1);
+		result = (source->read(*bytes,sizeof(BYTE),*size) == *size);
+
+		if (result == false)
+		{
+			printf("Problem reading file [%s].\n", filename);
+			free(*bytes);
+		}
+	}
+
+	source->shutdown();
+	delete source, source = NULL;
+
+	return result;
+}
+
+
+// reads the files, codes them all at once through compress_batch() and writes them in order
+bool write_archive_batch(BYTE algorithm_id, char **filenames, int num_filenames, int num_threads, OutputStream *dest, struct archive_directory *directory)
+{
+	struct batch_item *items;
+	const char **item_names;
+	int num_items;
+	bool result;
+	int i;
+
+	result = true;
+	items = (struct batch_item *)malloc(sizeof(struct batch_item) * num_filenames);
+	item_names = (const char **)malloc(sizeof(const char *) * num_filenames);
+	num_items = 0;
+
+	for (i = 0; i < num_filenames; i++)
+	{
+		BYTE *bytes;
+		int size;
+
+		// a file that went away since the walk is reported and left out, the rest still get archived
+		if (read_whole_file(filenames[i], &bytes, &size) == false)
+		{
+			result = false;
+			continue;
+		}
+
+		items[num_items].m_source = bytes;
+		items[num_items].m_source_size = size;
+		item_names[num_items] = filenames[i];
+		num_items++;
+	}
+
+	compress_batch(algorithm_id, items, num_items, num_threads);
+
+	for (i = 0; i < num_items; i++)
+	{
+		struct batch_item *item;
+
+		item = &(items[i]);
+
+		if (item->m_succeeded && directory->m_full)
+		{
+			result = false;
+		}
+		else if (item->m_succeeded)
+		{
+			struct archive_entry *entry;
+			char *name;
+
+			name = stored_name(item_names[i]);
+			if (archive_has_room(dest, directory, name, item->m_compressed_size) == false)
+			{
+				free(name);
+				free(item->m_compressed);
+				free((void *)item->m_source);
+				result = false;
+				continue;
+			}
+
+			entry = &(directory->m_entries[directory->m_num_entries]);
+			directory->m_num_entries++;
+			directory->m_directory_size += directory_entry_size(name);
+
+			entry->m_name = name;
+			entry->m_offset = dest->tell();
+			entry->m_compressed_size = item->m_compressed_size;
+			entry->m_original_size = item->m_source_size;
+			entry->m_crc = update_checksum(CHECKSUM_SEED, item->m_source, item->m_source_size);
+
+			dest->write(item->m_compressed, sizeof(BYTE), item->m_compressed_size);
+		}
+		else
+		{
+			printf("Problem compressing file [%s].\n", item_names[i]);
+			result = false;
+		}
+
+		free(item->m_compressed);
+		free((void *)item->m_source);
+	}
+
+	free(item_names);
+	free(items);
+
+	return result;
+}
+
+// one file streamed through perform_compression, so only its blocks are ever in memory; the crc is taken on
+// a pass of its own beforehand
+bool write_archive_file(BYTE algorithm_id, const char *filename, OutputStream *dest, struct archive_directory *directory)
+{
+	FileInputStream source;
+	struct archive_entry *entry;
+	char *name;
+	DWORD offset;
+	DWORD size;
+	WORD crc;
+	bool result;
+
+	if (checksum_file(filename, &size, &crc) == false)
+	{
+		return false;
+	}
+
+	// how big the stream will be isn't known until it's written, so there has to be room for the most it could be
+	name = stored_name(filename);
+	if (archive_has_room(dest, directory, name, STREAM_SIZE_BOUND(size)) == false || source.initialize(filename) == false)
+	{
+		free(name);
+		return false;
+	}
+
+	offset = dest->tell();
+	result = perform_compression(algorithm_id, &source, dest);
+	source.shutdown();
+
+	// whatever went out before a failure stays behind as dead space, no entry points at it
+	if (result == false)
+	{
+		printf("Problem compressing file [%s].\n", filename);
+		free(name);
+		return false;
+	}
+
+	entry = &(directory->m_entries[directory->m_num_entries]);
+	directory->m_num_entries++;
+	directory->m_directory_size += directory_entry_size(name);
+
+	entry->m_name = name;
+	entry->m_offset = offset;
+	entry->m_compressed_size = dest->tell() - offset;
+	entry->m_original_size = size;
+	entry->m_crc = crc;
+
+	return true;
+}
+
+
+// the name's length, the name, the offset, both sizes and the crc
+DWORD directory_entry_size(const char *name)
+{
+	return sizeof(WORD) + strlen(name) + 3 * sizeof(DWORD) + sizeof(WORD);
+}
+
+
+// whether size more bytes for name, then the directory with its entry and the footer, still end inside
+// MAX_ARCHIVE_SIZE; once one doesn't the archive is full and what's in it so far is all it holds
+bool archive_has_room(OutputStream *dest, struct archive_directory *directory, const char *name, DWORD size)
+{
+	DWORD needed;
+
+	needed = (DWORD)dest->tell() + size + directory->m_directory_size + directory_entry_size(name) + ARCHIVE_FOOTER_SIZE;
+	if (needed > MAX_ARCHIVE_SIZE)
+	{
+		printf("Problem: archive too large, [%s] would take it past [%llu] bytes; the files before it are archived\n", name, MAX_ARCHIVE_SIZE);
+		directory->m_full = true;
+		return false;
+	}
+
+	return true;
+}
+
+
+void write_directory_field(OutputStream *dest, WORD *crc, const void *field, int size)
+{
+	*crc = update_checksum(*crc, (const BYTE *)field, size);
+	dest->write((void *)field, size, 1);
+}
+
+
+bool read_directory_field(const BYTE **cursor, const BYTE *end, void *field, int size)
+{
+	if (end - *cursor < size)
+	{
+		return false;
+	}
+
+	memcpy(field, *cursor, size);
+	*cursor += size;
+
+	return true;
+}
+
+
+// finds the directory through the footer and checks it against its crc before trusting any offset in it
+bool read_archive_directory(InputStream *source, struct archive_directory *directory)
+{
+	DWORD magic_number;
+	WORD version_number;
+	DWORD source_size;
+	DWORD directory_offset;
+	WORD num_entries;
+	WORD directory_crc;
+	BYTE *buffer;
+	const BYTE *cursor;
+	const BYTE *end;
+	int buffer_size;
+	int i;
+
+	directory->m_entries = NULL;
+	directory->m_num_entries = 0;
+
+	source->seek(0,SEEK_ENDING);
+	source_size = source->tell();
+	source->seek(0,SEEK_BEGINNING);
+
+	if (source->read(&magic_number,sizeof(magic_number),1) != 1 || magic_number != ARCHIVE_MAGIC_NUMBER ||
+		source->read(&version_number,sizeof(version_number),1) != 1)
+	{
+		printf("Problem: not an archive\n");
+		return false;
+	}
+
+	if (version_number != ARCHIVE_VERSION)
+	{
+		printf("Problem: archive version [%u] isn't [%u]\n", version_number, ARCHIVE_VERSION);
+		return false;
+	}
+
+	if (source_size < sizeof(magic_number) + sizeof(version_number) + ARCHIVE_FOOTER_SIZE)
+	{
+		printf("Problem: archive footer is damaged\n");
+		return false;
+	}
+
+	source->seek(source_size - ARCHIVE_FOOTER_SIZE,SEEK_BEGINNING);
+
+	if (source->read(&directory_offset,sizeof(directory_offset),1) != 1 ||
+		source->read(&num_entries,sizeof(num_entries),1) != 1 ||
+		source->read(&directory_crc,sizeof(directory_crc),1) != 1 ||
+		directory_offset < sizeof(magic_number) + sizeof(version_number) ||
+		directory_offset > source_size - ARCHIVE_FOOTER_SIZE)
+	{
+		printf("Problem: archive footer is damaged\n");
+		return false;
+	}
+
+	buffer_size = source_size - ARCHIVE_FOOTER_SIZE - directory_offset;
+	buffer = (BYTE *)malloc(buffer_size > 0 ? buffer_size : 1);
+
+	source->seek(directory_offset,SEEK_BEGINNING);
+
+	if (source->read(buffer,sizeof(BYTE),buffer_size) != buffer_size || update_checksum(CHECKSUM_SEED, buffer, buffer_size) != directory_crc)
+	{
+		printf("Problem: archive directory is damaged\n");
+		free(buffer);
+		return false;
+	}
+
+	directory->m_entries = (struct archive_entry *)calloc(num_entries > 0 ? num_entries : 1, sizeof(struct archive_entry));
+
+	cursor = buffer;
+	end = buffer + buffer_size;
+
+	for (i = 0; i < (int)num_entries; i++)
+	{
+		struct archive_entry *alias;
+		WORD name_length;
+
+		alias = &(directory->m_entries[i]);
+
+		if (read_directory_field(&cursor, end, &name_length, sizeof(name_length)) == false || end - cursor < name_length)
+		{
+			break;
+		}
+
+		alias->m_name = (char *)malloc(name_length + 1);
+		read_directory_field(&cursor, end, alias->m_name, name_length);
+		alias->m_name[name_length] = '\0';
+		directory->m_num_entries++;
+
+		if (read_directory_field(&cursor, end, &alias->m_offset, sizeof(alias->m_offset)) == false ||
+			read_directory_field(&cursor, end, &alias->m_compressed_size, sizeof(alias->m_compressed_size)) == false ||
+			read_directory_field(&cursor, end, &alias->m_original_size, sizeof(alias->m_original_size)) == false ||
+			read_directory_field(&cursor, end, &alias->m_crc, sizeof(alias->m_crc)) == false ||
+			alias->m_offset + alias->m_compressed_size > directory_offset)
+		{
+			break;
+		}
+	}
+
+	free(buffer);
+
+	if (i != (int)num_entries || cursor != end)
+	{
+		printf("Problem: archive directory doesn't match its footer\n");
+		free_archive_directory(directory);
+		return false;
+	}
+
+	return true;
+}
+
+
+void free_archive_directory(struct archive_directory *directory)
+{
+	int i;
+
+	for (i = 0; i < directory->m_num_entries; i++)
+	{
+		free(directory->m_entries[i].m_name);
+	}
+
+	free(directory->m_entries);
+	directory->m_entries = NULL;
+	directory->m_num_entries = 0;
+}
+
+
+// relative, and no ".." anywhere that could climb out of the directory being extracted into
+bool is_safe_name(const char *name)
+{
+	const char *component;
+
+	if (name[0] == '\0' || name[0] == '/')
+	{
+		return false;
+	}
+
+	component = name;
+	while (component != NULL)
+	{
+		if (component[0] == '.' && component[1] == '.' && (component[2] == '/' || component[2] == '\0'))
+		{
+			return false;
+		}
+
+		component = strchr(component, '/');
+		if (component != NULL)
+		{
+			component++;
+		}
+	}
+
+	return true;
+}
+
+
+void make_parent_directories(char *path)
+{
+	char *separator;
+
+	for (separator = strchr(path + 1, '/'); separator != NULL; separator = strchr(separator + 1, '/'))
+	{
+		*separator = '\0';
+
+		// one that's already there is fine, anything else shows up when the file can't be opened
+		mkdir(path, 0777);
+
+		*separator = '/';
+	}
+}
+
+
+bool extract_entry(InputStream *source, const struct archive_entry *entry, const char *directory)
+{
+	char path[MAX_ARCHIVE_PATH_LENGTH];
+	MemoryInputStream member;
+	FileOutputStream dest;
+	BYTE *compressed;
+	bool result;
+
+	if (is_safe_name(entry->m_name) == false)
+	{
+		printf("Problem: won't write [%s] outside [%s]\n", entry->m_name, directory);
+		return false;
+	}
+
+	snprintf(path,sizeof(path),"%s/%s",directory,entry->m_name);
+	make_parent_directories(path);
+
+	// under a memory cap the member is decoded straight off the archive a block at a time instead of read in whole
+	if (get_max_memory() != 0)
+	{
+		source->seek(entry->m_offset,SEEK_BEGINNING);
+
+		result = false;
+
+		if (dest.initialize(path))
+		{
+			result = perform_decompression(source, &dest);
+		}
+
+		dest.shutdown();
+
+		return check_extracted_file(entry, path, result);
+	}
+
+	compressed = (BYTE *)malloc(entry->m_compressed_size > 0 ? entry->m_compressed_size : 1);
+
+	source->seek(entry->m_offset,SEEK_BEGINNING);
+
+	if (source->read(compressed,sizeof(BYTE),entry->m_compressed_size) != (int)entry->m_compressed_size)
+	{
+		printf("Problem: archive is truncated at [%s]\n", entry->m_name);
+		free(compressed);
+		return false;
+	}
+
+	result = false;
+	member.initialize(compressed, entry->m_compressed_size);
+
+	if (dest.initialize(path))
+	{
+		result = perform_decompression(&member, &dest);
+	}
+
+	dest.shutdown();
+	member.shutdown();
+	free(compressed);
+
+	return check_extracted_file(entry, path, result);
+}
+
+// the file as it landed on disk against the size and crc the directory has for it, so a member that decodes
+// cleanly but isn't the file that was packed doesn't go unnoticed
+bool check_extracted_file(const struct archive_entry *entry, const char *path, bool decoded)
+{
+	DWORD size;
+	WORD crc;
+
+	if (decoded == false || checksum_file(path, &size, &crc) == false)
+	{
+		return false;
+	}
+
+	if (size != entry->m_original_size)
+	{
+		printf("Problem: [%s] came out at [%llu] bytes instead of [%llu]\n", entry->m_name, size, entry->m_original_size);
+		return false;
+	}
+
+	if (crc != entry->m_crc)
+	{
+		printf("Problem: [%s] came out with crc [%08x] instead of [%08x]\n", entry->m_name, crc, entry->m_crc);
+		return false;
+	}
+
+	return true;
+}
+
+
+// the size and crc of everything in the file, read a piece at a time
+bool checksum_file(const char *path, DWORD *size, WORD *crc)
+{
+	FileInputStream source;
+	BYTE *buffer;
+	int amount_read;
+
+	if (source.initialize(path) == false)
+	{
+		return false;
+	}
+
+	buffer = (BYTE *)malloc(CHECK_BUFFER_SIZE);
+	*size = 0;
+	*crc = CHECKSUM_SEED;
+
+	while ((amount_read = source.read(buffer, sizeof(BYTE), CHECK_BUFFER_SIZE)) > 0)
+	{
+		*crc = update_checksum(*crc, buffer, amount_read);
+		*size += amount_read;
+	}
+
+	source.shutdown();
+	free(buffer);
+
+	return true;
+}
@@ -0,0 +1,27 @@
+#ifndef ARCHIVE__H
+#define ARCHIVE__H
+
+
+#include "./common.h"
+#include "./InputStream.hpp"
+#include "./OutputStream.hpp"
+
+
+// an archive is a short header, every file as an ordinary compressed stream one after the other, a central
+// directory of names, offsets, sizes and crcs, and a fixed size footer at the very end that points at the
+// directory; perform_decompression() reads any one file back given its offset and compressed size
+
+// compresses every file named, and every file under every directory named, on up to num_threads workers
+// (0 for one per cpu) with the settings in compressor.h; files are read and coded a batch at a time, so
+// memory is bounded by the batch and not by the archive
+bool create_archive(BYTE algorithm_id, const char **paths, int num_paths, int num_threads, OutputStream *dest);
+
+// writes every file, or only the ones in names, under directory, making the directories they need;
+// each one is found through the directory and decoded on its own, nothing in front of it is read
+bool extract_archive(InputStream *source, const char *directory, const char **names, int num_names);
+
+// prints the directory
+bool list_archive(InputStream *source);
+
+
+#endif // ARCHIVE__H
@@ -0,0 +1,161 @@
+#include "./arena.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+/////////////////////////////
+// private defines
+
+#define ARENA_ALIGNMENT 16
+#define ALIGN_UP(size) (((size) + (ARENA_ALIGNMENT - 1)) & ~(DWORD)(ARENA_ALIGNMENT - 1))
+
+/////////////////////////////
+// Private Structures
+struct arena_chunk
+{
+	struct arena_chunk *m_next;
+	DWORD m_size;
+	DWORD m_used;
+	BYTE *m_bytes;
+};
+
+struct arena_internal
+{
+	struct arena_chunk *m_chunks; // most recent chunk first
+	DWORD m_capacity;
+};
+
+
+/////////////////////////////
+// Private Prototypes
+struct arena_chunk *make_arena_chunk(DWORD size);
+void free_arena_chunks(struct arena_chunk *chunk);
+
+
+/////////////////////////////
+// Public Functions
+ARENA create_arena(int initial_size)
+{
+	struct arena_internal *addition;
+
+	addition = (struct arena_internal *)malloc(sizeof(struct arena_internal));
+
+	addition->m_chunks = NULL;
+	addition->m_capacity = 0;
+
+	if (initial_size > 0)
+	{
+		addition->m_chunks = make_arena_chunk(ALIGN_UP((DWORD)initial_size));
+		addition->m_capacity = addition->m_chunks->m_size;
+	}
+
+	return (ARENA)addition;
+}
+
+void destroy_arena(ARENA arena)
+{
+	struct arena_internal *alias;
+
+	alias = (struct arena_internal *)arena;
+
+	if (alias != NULL)
+	{
+		free_arena_chunks(alias->m_chunks);
+		free(alias);
+	}
+}
+
+
+void *arena_allocate(ARENA arena,int size)
+{
+	struct arena_internal *alias;
+	DWORD aligned_size;
+	void *result;
+
+	alias = (struct arena_internal *)arena;
+	aligned_size = ALIGN_UP((DWORD)size);
+
+	if (alias->m_chunks == NULL || alias->m_chunks->m_used + aligned_size > alias->m_chunks->m_size)
+	{
+		struct arena_chunk *addition;
+		DWORD chunk_size;
+
+		// grow geometrically so a block that outgrows the arena costs a handful of mallocs, not one per request
+		chunk_size = alias->m_capacity > aligned_size ? alias->m_capacity : aligned_size;
+
+		addition = make_arena_chunk(chunk_size);
+		addition->m_next = alias->m_chunks;
+		alias->m_chunks = addition;
+		alias->m_capacity += chunk_size;
+	}
+
+	result = &(alias->m_chunks->m_bytes[alias->m_chunks->m_used]);
+	alias->m_chunks->m_used += aligned_size;
+
+	return result;
+}
+
+
+// releases everything allocated since the last reset; once the arena has been through
+// a block of a given size it holds one chunk big enough for it, so steady state never mallocs
+void arena_reset(ARENA arena)
+{
+	struct arena_internal *alias;
+
+	alias = (struct arena_internal *)arena;
+
+	if (alias->m_chunks != NULL && alias->m_chunks->m_next != NULL)
+	{
+		DWORD capacity;
+
+		capacity = alias->m_capacity;
+
+		free_arena_chunks(alias->m_chunks);
+		alias->m_chunks = make_arena_chunk(capacity);
+		alias->m_capacity = capacity;
+	}
+
+	if (alias->m_chunks != NULL)
+	{
+		alias->m_chunks->m_used = 0;
+	}
+}
+
+
+DWORD arena_capacity(ARENA arena)
+{
+	struct arena_internal *alias;
+
+	alias = (struct arena_internal *)arena;
+
+	return alias->m_capacity;
+}
+
+
+/////////////////////////////
+// Private Functions
+struct arena_chunk *make_arena_chunk(DWORD size)
+{
+	struct arena_chunk *result;
+
+	// header and bytes share one allocation, the bytes start at the first aligned offset past the header
+	result = (struct arena_chunk *)malloc(ALIGN_UP(sizeof(struct arena_chunk)) + size);
+	result->m_next = NULL;
+	result->m_size = size;
+	result->m_used = 0;
+	result->m_bytes = ((BYTE *)result) + ALIGN_UP(sizeof(struct arena_chunk));
+
+	return result;
+}
+
+void free_arena_chunks(struct arena_chunk *chunk)
+{
+	while (chunk != NULL)
+	{
+		struct arena_chunk *next;
+
+		next = chunk->m_next;
+		free(chunk);
+		chunk = next;
+	}
+}
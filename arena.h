@@ -0,0 +1,20 @@
+#ifndef ARENA__H
+#define ARENA__H
+
+
+#include "./common.h"
+
+
+typedef void * ARENA;
+
+
+ARENA create_arena(int initial_size);
+void destroy_arena(ARENA arena);
+
+void *arena_allocate(ARENA arena,int size);
+void arena_reset(ARENA arena);
+
+DWORD arena_capacity(ARENA arena);
+
+
+#endif // ARENA__H
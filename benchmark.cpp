@@ -0,0 +1,561 @@
+#include "./benchmark.h"
+#include "./compressor.h"
+#include "./FileInputStream.hpp"
+#include "./MemoryInputStream.hpp"
+#include "./MemoryOutputStream.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+/////////////////////////////
+// private defines
+
+#define BENCHMARK_RUNS 5
+#define SYNTHETIC_SIZE (256 * 1024)
+#define DEFAULT_JSON_FILENAME "benchmark.json"
+#define MAX_CORPUS_NAME_LENGTH 256
+
+/////////////////////////////
+// Private Structures
+struct corpus_entry
+{
+	char m_name[MAX_CORPUS_NAME_LENGTH];
+	BYTE *m_bytes;
+	int m_size;
+};
+
+struct benchmark_row
+{
+	const char *m_input_name;
+	int m_level;
+	BYTE m_algorithm_id;
+	int m_block_size;
+	int m_original_size;
+	int m_compressed_size;
+	double m_compress_seconds;
+	double m_decompress_seconds;
+	long m_peak_rss_kb;
+	bool m_verified;
+};
+
+/////////////////////////////
+// Global Variables
+
+// each forced at each block size on the default level's other settings, next to the level rows
+static const BYTE g_algorithm_ids[] = {ALGORITHM_HUFFMAN, ALGORITHM_ARITHMETIC, ALGORITHM_STORED, ALGORITHM_AUTO};
+static const int g_block_sizes[] = {64 * 1024, 1024 * 1024};
+
+static const struct synthetic_parameters g_synthetic_corpus[] =
+{
+	// size, alphabet, skew, run length, seed
+	{SYNTHETIC_SIZE, 256, 0.0f, 1, 1},
+	{SYNTHETIC_SIZE, 64, 0.1f, 1, 2},
+	{SYNTHETIC_SIZE, 16, 0.5f, 1, 3},
+	{SYNTHETIC_SIZE, 8, 0.2f, 32, 4},
+};
+
+/////////////////////////////
+// Private Prototypes
+WORD next_random(WORD *state);
+bool load_corpus_file(const char *filename,struct corpus_entry *entry);
+int load_corpus(const char *path,struct corpus_entry **entries);
+int compare_names(const void *a,const void *b);
+long peak_rss_kb();
+bool benchmark_entry(const struct corpus_entry *entry,int level,BYTE algorithm_id,int block_size,struct benchmark_row *row);
+void print_row(const struct benchmark_row *row);
+bool write_json(const char *filename,const struct benchmark_row *rows,int num_rows);
+
+
+/////////////////////////////
+// Public Functions
+
+
+
+void generate_synthetic_data(const struct synthetic_parameters *parameters,BYTE *dest)
+{
+	float cumulative[256];
+	float total;
+	WORD state;
+	int alphabet_size;
+	int i;
+
+	alphabet_size = parameters->m_alphabet_size;
+	if (alphabet_size < 1)
+	{
+		alphabet_size = 1;
+	}
+	if (alphabet_size > 256)
+	{
+		alphabet_size = 256;
+	}
+
+	total = 0.0f;
+	for (i = 0; i < alphabet_size; i++)
+	{
+		total += expf(-parameters->m_skew * i);
+		cumulative[i] = total;
+	}
+
+	// xorshift is reproducible everywhere, unlike rand()
+	state = parameters->m_seed != 0 ? parameters->m_seed : 1;
+
+	i = 0;
+	while (i < parameters->m_size)
+	{
+		float pick;
+		int value;
+		int run;
+
+		pick = (next_random(&state) / 4294967296.0f) * total;
+
+		value = 0;
+		while (value < alphabet_size - 1 && cumulative[value] <= pick)
+		{
+			value++;
+		}
+
+		// geometric run lengths with the requested mean
+		run = 1;
+		while (parameters->m_mean_run_length > 1 && (next_random(&state) % parameters->m_mean_run_length) != 0)
+		{
+			run++;
+		}
+
+		// spread the alphabet over the printable range so small alphabets still look like text
+		for (; run > 0 && i < parameters->m_size; run--, i++)
+		{
+			dest[i] = (BYTE)((alphabet_size <= 64 ? ' ' : 0) + value);
+		}
+	}
+}
+
+
+bool run_benchmark(const char *path,const char *json_filename)
+{
+	struct corpus_entry *entries;
+	struct benchmark_row *rows;
+	int num_entries;
+	int num_algorithm_rows;
+	int num_rows;
+	bool result;
+	int i;
+
+	result = true;
+
+	num_entries = load_corpus(path,&entries);
+	if (num_entries < 0)
+	{
+		return false;
+	}
+
+	set_verbose(false);
+
+	num_algorithm_rows = sizeof(g_algorithm_ids) * (sizeof(g_block_sizes) / sizeof(g_block_sizes[0]));
+	rows = (struct benchmark_row *)malloc(sizeof(struct benchmark_row) * num_entries * (MAX_COMPRESSION_LEVEL - MIN_COMPRESSION_LEVEL + 1 + num_algorithm_rows));
+	num_rows = 0;
+
+	printf("%-28s %5s %-10s %8s %10s %10s %7s %10s %10s %9s %s\n", "input", "level", "algorithm", "block", "bytes", "packed", "ratio", "comp MB/s", "decomp MB/s", "rss MB", "ok");
+
+	for (i = 0; i < num_entries; i++)
+	{
+		int level;
+		int a;
+
+		for (level = MIN_COMPRESSION_LEVEL; level <= MAX_COMPRESSION_LEVEL; level++)
+		{
+			struct benchmark_row *row;
+
+			row = &(rows[num_rows]);
+			num_rows++;
+
+			if (benchmark_entry(&(entries[i]),level,ALGORITHM_AUTO,0,row) == false)
+			{
+				result = false;
+			}
+
+			print_row(row);
+			fflush(stdout);
+		}
+
+		for (a = 0; a < (int)sizeof(g_algorithm_ids); a++)
+		{
+			int b;
+
+			for (b = 0; b < (int)(sizeof(g_block_sizes) / sizeof(g_block_sizes[0])); b++)
+			{
+				struct benchmark_row *row;
+
+				row = &(rows[num_rows]);
+				num_rows++;
+
+				if (benchmark_entry(&(entries[i]),0,g_algorithm_ids[a],g_block_sizes[b],row) == false)
+				{
+					result = false;
+				}
+
+				print_row(row);
+				fflush(stdout);
+			}
+		}
+	}
+
+	apply_compression_level(DEFAULT_COMPRESSION_LEVEL);
+
+	if (write_json(json_filename != NULL ? json_filename : DEFAULT_JSON_FILENAME,rows,num_rows) == false)
+	{
+		result = false;
+	}
+
+	for (i = 0; i < num_entries; i++)
+	{
+		free(entries[i].m_bytes);
+	}
+	free(entries);
+	free(rows);
+
+	set_verbose(true);
+
+	return result;
+}
+
+
+/////////////////////////////
+// Private Functions
+WORD next_random(WORD *state)
+{
+	WORD x;
+
+	x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x;
+}
+
+
+bool load_corpus_file(const char *filename,struct corpus_entry *entry)
+{
+	FileInputStream *source;
+	bool result;
+
+	result = false;
+	source = new FileInputStream();
+
+	if (source->initialize(filename))
+	{
+		source->seek(0,SEEK_ENDING);
+		entry->m_size = source->tell();
+		source->seek(0,SEEK_BEGINNING);
+
+		entry->m_bytes = (BYTE *)malloc(entry->m_size > 0 ? entry->m_size : 1);
+		result = (source->read(entry->m_bytes,sizeof(BYTE),entry->m_size) == entry->m_size);
+
+		snprintf(entry->m_name,sizeof(entry->m_name),"%s",filename);
+
+		if (result == false)
+		{
+			free(entry->m_bytes);
+		}
+	}
+
+	source->shutdown();
+	delete source, source = NULL;
+
+	return result;
+}
+
+
+int load_corpus(const char *path,struct corpus_entry **entries)
+{
+	struct stat info;
+	char **filenames;
+	int num_filenames;
+	int num_synthetic;
+	int result;
+	int i;
+
+	if (stat(path,&info) != 0)
+	{
+		printf("Problem opening [%s].\n", path);
+		return -1;
+	}
+
+	filenames = NULL;
+	num_filenames = 0;
+
+	if (S_ISDIR(info.st_mode))
+	{
+		DIR *directory;
+		struct dirent *item;
+
+		directory = opendir(path);
+		while (directory != NULL && (item = readdir(directory)) != NULL)
+		{
+			char filename[MAX_CORPUS_NAME_LENGTH];
+			struct stat item_info;
+
+			// a name that doesn't fit would stat some other file, or none
+			if (snprintf(filename,sizeof(filename),"%s/%s",path,item->d_name) >= (int)sizeof(filename))
+			{
+				printf("Problem: path [%s/%s] is too long, left out\n", path, item->d_name);
+				continue;
+			}
+
+			if (stat(filename,&item_info) == 0 && S_ISREG(item_info.st_mode))
+			{
+				filenames = (char **)realloc(filenames,sizeof(char *) * (num_filenames + 1));
+				filenames[num_filenames] = strdup(filename);
+				num_filenames++;
+			}
+		}
+
+		if (directory != NULL)
+		{
+			closedir(directory);
+		}
+
+		// directory order isn't stable across machines
+		qsort(filenames,num_filenames,sizeof(char *),compare_names);
+	}
+	else
+	{
+		filenames = (char **)malloc(sizeof(char *));
+		filenames[0] = strdup(path);
+		num_filenames = 1;
+	}
+
+	num_synthetic = sizeof(g_synthetic_corpus) / sizeof(g_synthetic_corpus[0]);
+	*entries = (struct corpus_entry *)malloc(sizeof(struct corpus_entry) * (num_filenames + num_synthetic));
+	result = 0;
+
+	for (i = 0; i < num_filenames; i++)
+	{
+		if (load_corpus_file(filenames[i],&((*entries)[result])))
+		{
+			result++;
+		}
+		free(filenames[i]);
+	}
+	free(filenames);
+
+	for (i = 0; i < num_synthetic; i++)
+	{
+		const struct synthetic_parameters *parameters;
+		struct corpus_entry *entry;
+
+		parameters = &(g_synthetic_corpus[i]);
+		entry = &((*entries)[result]);
+		result++;
+
+		snprintf(entry->m_name,sizeof(entry->m_name),"synthetic-a%d-s%.1f-r%d",parameters->m_alphabet_size,parameters->m_skew,parameters->m_mean_run_length);
+		entry->m_size = parameters->m_size;
+		entry->m_bytes = (BYTE *)malloc(entry->m_size);
+		generate_synthetic_data(parameters,entry->m_bytes);
+	}
+
+	return result;
+}
+
+
+int compare_names(const void *a,const void *b)
+{
+	return strcmp(*(const char **)a,*(const char **)b);
+}
+
+
+int compare_doubles(const void *a,const void *b)
+{
+	double x;
+	double y;
+
+	x = *(const double *)a;
+	y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+double now_in_seconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC,&now);
+
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+
+long peak_rss_kb()
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF,&usage);
+
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024; // bytes on darwin
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+
+// a level of 0 codes with algorithm_id at block_size on the default level's other settings,
+// any other level with everything the level sets
+bool benchmark_entry(const struct corpus_entry *entry,int level,BYTE algorithm_id,int block_size,struct benchmark_row *row)
+{
+	double compress_times[BENCHMARK_RUNS];
+	double decompress_times[BENCHMARK_RUNS];
+	MemoryOutputStream *compressed;
+	MemoryOutputStream *decompressed;
+	int run;
+
+	if (level == 0)
+	{
+		apply_compression_level(DEFAULT_COMPRESSION_LEVEL);
+		set_block_size(block_size);
+	}
+	else
+	{
+		algorithm_id = apply_compression_level(level);
+	}
+
+	row->m_input_name = entry->m_name;
+	row->m_level = level;
+	row->m_algorithm_id = algorithm_id;
+	row->m_block_size = get_block_size();
+	row->m_original_size = entry->m_size;
+	row->m_verified = true;
+
+	compressed = new MemoryOutputStream();
+	decompressed = new MemoryOutputStream();
+	compressed->initialize(entry->m_size + 1024);
+	decompressed->initialize(entry->m_size + 1);
+
+	for (run = 0; run < BENCHMARK_RUNS; run++)
+	{
+		MemoryInputStream *source;
+		double start;
+
+		compressed->rewind();
+		decompressed->rewind();
+
+		source = new MemoryInputStream();
+		source->initialize(entry->m_bytes,entry->m_size);
+
+		start = now_in_seconds();
+		perform_compression(algorithm_id,source,compressed);
+		compress_times[run] = now_in_seconds() - start;
+
+		source->shutdown();
+		source->initialize(compressed->getBuffer(),compressed->getSize());
+
+		start = now_in_seconds();
+		perform_decompression(source,decompressed);
+		decompress_times[run] = now_in_seconds() - start;
+
+		source->shutdown();
+		delete source, source = NULL;
+
+		if (decompressed->getSize() != entry->m_size || memcmp(decompressed->getBuffer(),entry->m_bytes,entry->m_size) != 0)
+		{
+			row->m_verified = false;
+		}
+	}
+
+	qsort(compress_times,BENCHMARK_RUNS,sizeof(double),compare_doubles);
+	qsort(decompress_times,BENCHMARK_RUNS,sizeof(double),compare_doubles);
+
+	row->m_compressed_size = compressed->getSize();
+	row->m_compress_seconds = compress_times[BENCHMARK_RUNS / 2];
+	row->m_decompress_seconds = decompress_times[BENCHMARK_RUNS / 2];
+	row->m_peak_rss_kb = peak_rss_kb();
+
+	compressed->shutdown();
+	decompressed->shutdown();
+	delete compressed, compressed = NULL;
+	delete decompressed, decompressed = NULL;
+
+	return row->m_verified;
+}
+
+
+void print_row(const struct benchmark_row *row)
+{
+	char level[16];
+
+	if (row->m_level == 0)
+	{
+		snprintf(level,sizeof(level),"-");
+	}
+	else
+	{
+		snprintf(level,sizeof(level),"%d",row->m_level);
+	}
+
+	printf("%-28s %5s %-10s %8d %10d %10d %7.3f %10.2f %10.2f %9.1f %s\n",
+		row->m_input_name,
+		level,
+		algorithm_name(row->m_algorithm_id),
+		row->m_block_size,
+		row->m_original_size,
+		row->m_compressed_size,
+		row->m_original_size > 0 ? (double)row->m_compressed_size / row->m_original_size : 0.0,
+		row->m_compress_seconds > 0 ? row->m_original_size / row->m_compress_seconds / 1e6 : 0.0,
+		row->m_decompress_seconds > 0 ? row->m_original_size / row->m_decompress_seconds / 1e6 : 0.0,
+		row->m_peak_rss_kb / 1024.0,
+		row->m_verified ? "yes" : "NO");
+}
+
+
+bool write_json(const char *filename,const struct benchmark_row *rows,int num_rows)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen(filename,"w");
+	if (fp == NULL)
+	{
+		printf("Problem opening file [%s].\n", filename);
+		return false;
+	}
+
+	fprintf(fp,"{\n  \"runs\": %d,\n  \"results\": [\n",BENCHMARK_RUNS);
+
+	for (i = 0; i < num_rows; i++)
+	{
+		const struct benchmark_row *row;
+
+		row = &(rows[i]);
+
+		fprintf(fp,"    {\"input\": \"%s\", \"level\": %d, \"algorithm\": \"%s\", \"block_size\": %d, \"original_bytes\": %d, \"compressed_bytes\": %d, "
+			"\"ratio\": %.6f, \"compress_mb_per_s\": %.3f, \"decompress_mb_per_s\": %.3f, \"peak_rss_kb\": %ld, \"verified\": %s}%s\n",
+			row->m_input_name,
+			row->m_level,
+			algorithm_name(row->m_algorithm_id),
+			row->m_block_size,
+			row->m_original_size,
+			row->m_compressed_size,
+			row->m_original_size > 0 ? (double)row->m_compressed_size / row->m_original_size : 0.0,
+			row->m_compress_seconds > 0 ? row->m_original_size / row->m_compress_seconds / 1e6 : 0.0,
+			row->m_decompress_seconds > 0 ? row->m_original_size / row->m_decompress_seconds / 1e6 : 0.0,
+			row->m_peak_rss_kb,
+			row->m_verified ? "true" : "false",
+			i + 1 < num_rows ? "," : "");
+	}
+
+	fprintf(fp,"  ]\n}\n");
+	fclose(fp);
+
+	printf("wrote [%s]\n", filename);
+
+	return true;
+}
@@ -0,0 +1,29 @@
+#ifndef BENCHMARK__H
+#define BENCHMARK__H
+
+
+#include "./common.h"
+
+
+struct synthetic_parameters
+{
+	int m_size;
+	int m_alphabet_size; // how many distinct byte values show up, 1 to 256
+	float m_skew; // 0 is uniform over the alphabet, larger values fall off geometrically and lower the entropy
+	int m_mean_run_length; // 1 draws every byte independently, n repeats each draw n times on average
+	WORD m_seed;
+};
+
+
+double now_in_seconds();
+int compare_doubles(const void *a,const void *b); // qsort ascending
+
+void generate_synthetic_data(const struct synthetic_parameters *parameters,BYTE *dest);
+
+// round trips the file, or every file in the directory, plus the built-in synthetic corpus
+// at every level, then with each algorithm forced at each of a few block sizes; prints a table and writes
+// the rows as JSON, a forced row with level 0
+bool run_benchmark(const char *path,const char *json_filename);
+
+
+#endif // BENCHMARK__H
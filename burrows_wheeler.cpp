@@ -1,20 +1,68 @@
 #include "burrows_wheeler.h"
+#include "arena.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 
 #define SYMBOL_BATCH_COUNT 10
 #define WORKING_SIZE_IN_BYTES 512
 #define MAX_SYMBOL_COUNT 512
 
+#define MIN_SYMBOLS_PER_THREAD (64 * 1024) // below this a sorting thread costs more to start than it saves
+#define BUCKETS_PER_THREAD 4 // a thread left with a big bucket still has others to balance it
+#define SAMPLES_PER_BUCKET 32
+
 
 /////////////////////////////
 // Private Structures
 
+// a rotation as the suffix sort sees it: the ranks of its leading symbols so far, and where it starts
+struct rotation_key
+{
+	DWORD m_key;
+	int m_position;
+};
+
+// what every thread of a suffix sort shares; keys are ordered by key and then position, so the sort is
+// stable and the buckets are fixed by a sample alone; thread 0 does the serial steps between barriers
+struct suffix_sort
+{
+	const BYTE *m_source;
+	int m_symbol_size;
+	int m_symbol_count;
+	bool m_symbols_only; // inverting only needs the symbols ranked, not the rotations
+
+	int m_num_threads;
+	int m_start; // 0 until every thread is running, then 1 to sort or -1 to leave it to thread 0 alone
+	pthread_barrier_t m_barrier;
+
+	struct rotation_key *m_keys; // in order after every round
+	struct rotation_key *m_scratch; // the buckets scatter into it and the radix passes go back and forth
+	int *m_ranks; // by position, dense from 0, equal for rotations that agree as far as they're sorted
+	int m_num_groups; // distinct ranks, m_symbol_count once every rotation is told apart
+
+	int m_num_buckets;
+	struct rotation_key *m_samples; // sorted, every SAMPLES_PER_BUCKET'th one splits two buckets
+	int *m_bucket_counts; // by thread then bucket, then where each thread's share of each bucket goes
+	int *m_bucket_starts; // m_num_buckets + 1 of them
+	int *m_group_counts; // by thread, new ranks in its range, then the rank its range carries on from
+};
+
+struct suffix_sort_thread
+{
+	struct suffix_sort *m_sort;
+	int m_thread;
+	pthread_t m_handle;
+};
+
+
 /////////////////////////////
 // Global Variables
 static int g_encoding_input_symbols_current;
@@ -34,13 +82,16 @@ static bool g_encoding;
 
 static int g_symbol_size;
 
+static ARENA g_arena = NULL; // per-batch working memory for the rotation matrices, reset after every batch
+
+static int g_sort_id = BWT_SORT_AUTO;
+static int g_sort_threads = 0;
 
 
 /////////////////////////////
 // Private Prototypes
 bool bwt_flush_batchs(bool require_batch_count);
-bool bwt_encode(const BYTE *source, int symbol_size, int symbol_count, BYTE *dest, int *index,int *bytes_written);
-bool bwt_decode(const BYTE *source, int symbol_size, int symbol_count, int index, BYTE *dest,int *symbols_written);
+BYTE **allocate_matrix(int symbol_size, int symbol_count);
 
 void print_row(const BYTE *row, int symbol_size, int symbol_count);
 void print_matrix(BYTE **matrix, int symbol_size, int symbol_count);
@@ -48,6 +99,15 @@ void in_place_quicksort(BYTE **matrix, int lo, int hi, int symbol_size, int symb
 int partition(BYTE **matrix, int lo, int hi, int symbol_size, int symbol_count);
 int row_compare(const BYTE *row1, const BYTE *row2, int symbol_size, int symbol_count);
 
+bool start_suffix_sort(struct suffix_sort *sort, const BYTE *source, int symbol_size, int symbol_count, bool symbols_only);
+void finish_suffix_sort(struct suffix_sort *sort);
+void *rank_rotations(void *opaque);
+void sort_and_rank(struct suffix_sort *sort, int thread);
+void radix_sort_keys(struct rotation_key *keys, struct rotation_key *scratch, int count);
+int find_bucket(const struct suffix_sort *sort, const struct rotation_key *key);
+int compare_rotation_keys(const void *key1, const void *key2);
+WORD pack_symbol_bytes(const BYTE *bytes, int count);
+
 
 
 /////////////////////////////
@@ -56,6 +116,12 @@ void bwt_initialize(int symbol_size,bool encode)
 {
 	g_symbol_size = symbol_size;
 	g_encoding = encode;
+
+	if (g_arena == NULL)
+	{
+		g_arena = create_arena(SYMBOL_BATCH_COUNT * (sizeof(BYTE *) + SYMBOL_BATCH_COUNT * g_symbol_size));
+	}
+	arena_reset(g_arena);
 	g_encoding_input_symbols_buffer = (BYTE *)malloc(MAX_SYMBOL_COUNT * g_symbol_size);
 	g_encoding_output_bytes_buffer = (BYTE *)malloc(WORKING_SIZE_IN_BYTES);
 
@@ -167,6 +233,13 @@ bool bwt_flush()
 }
 
 
+void bwt_set_sort(int sort_id,int num_threads)
+{
+	g_sort_id = sort_id;
+	g_sort_threads = num_threads;
+}
+
+
 
 
 /////////////////////////////
@@ -336,15 +409,41 @@ bool bwt_encode(const BYTE *source, int symbol_size, int symbol_count, BYTE *des
 	{
 		result = false;
 	}
-	else // no errors, begin bwt process
+	else if (g_sort_id == BWT_SORT_DOUBLING || (g_sort_id == BWT_SORT_AUTO && symbol_count > BWT_MATRIX_LIMIT))
 	{
-		// initialize matrix
-		matrix = (BYTE**)malloc(symbol_count*sizeof(BYTE*));
+		struct suffix_sort sort;
 
-		for(i=0; i<symbol_count; i++)
+		// the rotations in order with no matrix behind them, so the last column is read back off the source
+		result = start_suffix_sort(&sort, source, symbol_size, symbol_count, false);
+		if (result)
 		{
-			matrix[i] = (BYTE*)malloc(symbol_size*symbol_count);
+			*index = -1;
+
+			for (i = 0; i < symbol_count; i++)
+			{
+				int position;
+
+				position = sort.m_keys[i].m_position;
+
+				// the first of the rotations equal to the source, the same row the matrix sort finds
+				if (*index < 0 && sort.m_ranks[position] == sort.m_ranks[0])
+				{
+					*index = i;
+				}
+
+				position = position == 0 ? symbol_count - 1 : position - 1;
+				memcpy(&(dest[i * symbol_size]), &(source[position * symbol_size]), symbol_size);
+			}
+
+			*bytes_written = symbol_size * symbol_count;
+
+			finish_suffix_sort(&sort);
 		}
+	}
+	else // no errors, begin bwt process
+	{
+		// initialize matrix
+		matrix = allocate_matrix(symbol_size, symbol_count);
 
 		// built matrix of rotations
 		for(i=0; i<symbol_count; i++)
@@ -390,12 +489,8 @@ bool bwt_encode(const BYTE *source, int symbol_size, int symbol_count, BYTE *des
 
 		*bytes_written = symbol_size * symbol_count;
 
-		// free matrix memory
-		for(i=0; i<symbol_count; i++)
-		{
-			free(matrix[i]);
-		}
-		free(matrix);
+		// release matrix memory
+		arena_reset(g_arena);
 	}
 
 	// printf("\nleaving bwt encode[%c]\n", "NY"[!!result]);
@@ -408,15 +503,37 @@ bool bwt_decode(const BYTE *source, int symbol_size, int symbol_count, int index
 	int i;
 	int j;
 
-//	printf("entering bwt_decode[%d][%d]\n",symbol_size,symbol_count);
-	// initialize matrix
-	matrix = (BYTE**)malloc(symbol_count*sizeof(BYTE*));
-
-	for(i=0; i<symbol_count; i++)
+	// a matrix of this many rows would take symbol_count cubed time to rebuild; instead the last column
+	// ranked stably by symbol maps each row to the row one rotation further on, so the source is walked
+	// out from the index
+	if (symbol_count > BWT_MATRIX_LIMIT)
 	{
-		matrix[i] = (BYTE*)malloc(symbol_size*symbol_count);
+		struct suffix_sort sort;
+		int row;
+
+		if (index < 0 || index >= symbol_count || start_suffix_sort(&sort, source, symbol_size, symbol_count, true) == false)
+		{
+			return false;
+		}
+
+		row = index;
+		for (i = 0; i < symbol_count; i++)
+		{
+			row = sort.m_keys[row].m_position;
+			memcpy(&(dest[i * symbol_size]), &(source[row * symbol_size]), symbol_size);
+		}
+
+		*symbols_written = symbol_count;
+
+		finish_suffix_sort(&sort);
+
+		return true;
 	}
 
+//	printf("entering bwt_decode[%d][%d]\n",symbol_size,symbol_count);
+	// initialize matrix
+	matrix = allocate_matrix(symbol_size, symbol_count);
+
 //	 print_row(source, symbol_size, symbol_count);
 
 	// printf("\n" );
@@ -446,12 +563,8 @@ bool bwt_decode(const BYTE *source, int symbol_size, int symbol_count, int index
 	memcpy(dest, matrix[index], symbol_size*symbol_count);
 	*symbols_written = symbol_count;
 
-	// free matrix memory
-	for(i=0; i<symbol_count; i++)
-	{
-		free(matrix[i]);
-	}
-	free(matrix);
+	// release matrix memory
+	arena_reset(g_arena);
 
 	// print_row(dest, symbol_size, symbol_count);
 
@@ -461,6 +574,24 @@ bool bwt_decode(const BYTE *source, int symbol_size, int symbol_count, int index
 
 }
 
+// the row pointers and every row come out of the arena as a single piece
+BYTE **allocate_matrix(int symbol_size, int symbol_count)
+{
+	BYTE **result;
+	BYTE *rows;
+	int i;
+
+	result = (BYTE **)arena_allocate(g_arena, symbol_count * sizeof(BYTE *) + symbol_count * symbol_size * symbol_count);
+	rows = (BYTE *)&(result[symbol_count]);
+
+	for (i=0; i<symbol_count; i++)
+	{
+		result[i] = &(rows[i * symbol_size * symbol_count]);
+	}
+
+	return result;
+}
+
 void print_row(const BYTE *row, int symbol_size, int symbol_count)
 {
 	int j;
@@ -539,4 +670,424 @@ int row_compare(const BYTE *row1, const BYTE *row2, int symbol_size, int symbol_
 }
 
 
+// ranks source's rotations, or only its symbols, on as many threads as the block is worth; the caller
+// reads m_keys and m_ranks and then calls finish_suffix_sort(), false when the memory isn't there
+bool start_suffix_sort(struct suffix_sort *sort, const BYTE *source, int symbol_size, int symbol_count, bool symbols_only)
+{
+	struct suffix_sort_thread *threads;
+	int num_threads;
+	int num_started;
+	int i;
+
+	num_threads = g_sort_threads > 0 ? g_sort_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads > symbol_count / MIN_SYMBOLS_PER_THREAD)
+	{
+		num_threads = symbol_count / MIN_SYMBOLS_PER_THREAD;
+	}
+	if (num_threads < 1)
+	{
+		num_threads = 1;
+	}
+
+	memset(sort, 0, sizeof(struct suffix_sort));
+
+	sort->m_source = source;
+	sort->m_symbol_size = symbol_size;
+	sort->m_symbol_count = symbol_count;
+	sort->m_symbols_only = symbols_only;
+	sort->m_num_threads = num_threads;
+	sort->m_num_buckets = num_threads * BUCKETS_PER_THREAD;
+
+	sort->m_keys = (struct rotation_key *)malloc(sizeof(struct rotation_key) * symbol_count);
+	sort->m_scratch = (struct rotation_key *)malloc(sizeof(struct rotation_key) * symbol_count);
+	sort->m_ranks = (int *)malloc(sizeof(int) * symbol_count);
+	sort->m_samples = (struct rotation_key *)malloc(sizeof(struct rotation_key) * sort->m_num_buckets * SAMPLES_PER_BUCKET);
+	sort->m_bucket_counts = (int *)malloc(sizeof(int) * num_threads * sort->m_num_buckets);
+	sort->m_bucket_starts = (int *)malloc(sizeof(int) * (sort->m_num_buckets + 1));
+	sort->m_group_counts = (int *)malloc(sizeof(int) * num_threads);
+
+	if (sort->m_keys == NULL || sort->m_scratch == NULL || sort->m_ranks == NULL)
+	{
+		printf("Problem: not enough memory to sort [%d] rotations\n", symbol_count);
+		finish_suffix_sort(sort);
+		return false;
+	}
+
+	threads = (struct suffix_sort_thread *)malloc(sizeof(struct suffix_sort_thread) * num_threads);
+
+	for (num_started = 1; num_started < num_threads; num_started++)
+	{
+		threads[num_started].m_sort = sort;
+		threads[num_started].m_thread = num_started;
+
+		if (pthread_create(&(threads[num_started].m_handle), NULL, rank_rotations, &(threads[num_started])) != 0)
+		{
+			break;
+		}
+	}
+
+	// a thread that can't be had leaves the whole sort to this one, it's slower but the same sort
+	if (num_started < num_threads)
+	{
+		__atomic_store_n(&(sort->m_start), -1, __ATOMIC_RELEASE);
+
+		for (i = 1; i < num_started; i++)
+		{
+			pthread_join(threads[i].m_handle, NULL);
+		}
+
+		num_threads = 1;
+		sort->m_num_threads = 1;
+	}
+
+	pthread_barrier_init(&(sort->m_barrier), NULL, num_threads);
+	__atomic_store_n(&(sort->m_start), 1, __ATOMIC_RELEASE);
+
+	threads[0].m_sort = sort;
+	threads[0].m_thread = 0;
+	rank_rotations(&(threads[0]));
+
+	for (i = 1; i < num_threads; i++)
+	{
+		pthread_join(threads[i].m_handle, NULL);
+	}
+
+	pthread_barrier_destroy(&(sort->m_barrier));
+	free(threads);
+
+	return true;
+}
+
+void finish_suffix_sort(struct suffix_sort *sort)
+{
+	free(sort->m_keys);
+	free(sort->m_scratch);
+	free(sort->m_ranks);
+	free(sort->m_samples);
+	free(sort->m_bucket_counts);
+	free(sort->m_bucket_starts);
+	free(sort->m_group_counts);
+	memset(sort, 0, sizeof(struct suffix_sort));
+}
+
+
+// one sorting thread's share: the symbols ranked four bytes at a time, then rounds of prefix doubling,
+// each ranking rotations by their first 2h symbols from the ranks of their first h and the h after
+void *rank_rotations(void *opaque)
+{
+	struct suffix_sort_thread *self;
+	struct suffix_sort *sort;
+	int first;
+	int last;
+	int offset;
+	int i;
+
+	self = (struct suffix_sort_thread *)opaque;
+	sort = self->m_sort;
+
+	while (__atomic_load_n(&(sort->m_start), __ATOMIC_ACQUIRE) == 0)
+	{
+		sched_yield();
+	}
+
+	if (__atomic_load_n(&(sort->m_start), __ATOMIC_ACQUIRE) < 0)
+	{
+		return NULL;
+	}
+
+	first = (int)((DWORD)sort->m_symbol_count * self->m_thread / sort->m_num_threads);
+	last = (int)((DWORD)sort->m_symbol_count * (self->m_thread + 1) / sort->m_num_threads);
+
+	for (offset = 0; offset < sort->m_symbol_size; offset += 4)
+	{
+		int count;
+
+		count = sort->m_symbol_size - offset < 4 ? sort->m_symbol_size - offset : 4;
+
+		for (i = first; i < last; i++)
+		{
+			sort->m_keys[i].m_key = (offset > 0 ? (DWORD)sort->m_ranks[i] << 32 : 0) | pack_symbol_bytes(&(sort->m_source[i * sort->m_symbol_size + offset]), count);
+			sort->m_keys[i].m_position = i;
+		}
+
+		sort_and_rank(sort, self->m_thread);
+	}
+
+	if (sort->m_symbols_only)
+	{
+		return NULL;
+	}
+
+	// every thread reads the same m_num_groups after the barrier that ended the round, so they all stop together
+	for (offset = 1; offset < sort->m_symbol_count && sort->m_num_groups < sort->m_symbol_count; offset *= 2)
+	{
+		for (i = first; i < last; i++)
+		{
+			int next;
 
+			next = i + offset < sort->m_symbol_count ? i + offset : i + offset - sort->m_symbol_count;
+
+			sort->m_keys[i].m_key = ((DWORD)sort->m_ranks[i] << 32) | (DWORD)sort->m_ranks[next];
+			sort->m_keys[i].m_position = i;
+		}
+
+		sort_and_rank(sort, self->m_thread);
+	}
+
+	return NULL;
+}
+
+
+// every thread's m_keys put in order, then m_ranks and m_num_groups from them: a sample sort whose buckets
+// come from a sample of the keys and are radix sorted a thread each; returns past a barrier, so every
+// thread sees all of it
+void sort_and_rank(struct suffix_sort *sort, int thread)
+{
+	struct rotation_key *keys;
+	int *counts;
+	int num_samples;
+	int first;
+	int last;
+	int rank;
+	int b;
+	int i;
+
+	keys = sort->m_keys;
+	counts = &(sort->m_bucket_counts[thread * sort->m_num_buckets]);
+
+	first = (int)((DWORD)sort->m_symbol_count * thread / sort->m_num_threads);
+	last = (int)((DWORD)sort->m_symbol_count * (thread + 1) / sort->m_num_threads);
+
+	pthread_barrier_wait(&(sort->m_barrier));
+
+	if (thread == 0)
+	{
+		num_samples = sort->m_num_buckets * SAMPLES_PER_BUCKET;
+
+		for (i = 0; i < num_samples; i++)
+		{
+			sort->m_samples[i] = keys[(DWORD)sort->m_symbol_count * i / num_samples];
+		}
+
+		qsort(sort->m_samples, num_samples, sizeof(struct rotation_key), compare_rotation_keys);
+	}
+
+	pthread_barrier_wait(&(sort->m_barrier));
+
+	memset(counts, 0, sizeof(int) * sort->m_num_buckets);
+	for (i = first; i < last; i++)
+	{
+		counts[find_bucket(sort, &(keys[i]))]++;
+	}
+
+	pthread_barrier_wait(&(sort->m_barrier));
+
+	// bucket by bucket, and within one thread by thread, so a bucket's keys keep their position order
+	if (thread == 0)
+	{
+		int total;
+
+		total = 0;
+		for (b = 0; b < sort->m_num_buckets; b++)
+		{
+			int t;
+
+			sort->m_bucket_starts[b] = total;
+
+			for (t = 0; t < sort->m_num_threads; t++)
+			{
+				int count;
+
+				count = sort->m_bucket_counts[t * sort->m_num_buckets + b];
+				sort->m_bucket_counts[t * sort->m_num_buckets + b] = total;
+				total += count;
+			}
+		}
+
+		sort->m_bucket_starts[sort->m_num_buckets] = total;
+	}
+
+	pthread_barrier_wait(&(sort->m_barrier));
+
+	for (i = first; i < last; i++)
+	{
+		sort->m_scratch[counts[find_bucket(sort, &(keys[i]))]++] = keys[i];
+	}
+
+	pthread_barrier_wait(&(sort->m_barrier));
+
+	for (b = thread; b < sort->m_num_buckets; b += sort->m_num_threads)
+	{
+		int start;
+
+		start = sort->m_bucket_starts[b];
+		radix_sort_keys(&(sort->m_scratch[start]), &(keys[start]), sort->m_bucket_starts[b + 1] - start);
+	}
+
+	pthread_barrier_wait(&(sort->m_barrier));
+
+	// radix_sort_keys() left everything in m_scratch
+	sort->m_group_counts[thread] = 0;
+	for (i = first; i < last; i++)
+	{
+		keys[i] = sort->m_scratch[i];
+
+		if (i == 0 || sort->m_scratch[i].m_key != sort->m_scratch[i - 1].m_key)
+		{
+			sort->m_group_counts[thread]++;
+		}
+	}
+
+	pthread_barrier_wait(&(sort->m_barrier));
+
+	if (thread == 0)
+	{
+		int total;
+		int t;
+
+		total = 0;
+		for (t = 0; t < sort->m_num_threads; t++)
+		{
+			int count;
+
+			count = sort->m_group_counts[t];
+			sort->m_group_counts[t] = total;
+			total += count;
+		}
+
+		sort->m_num_groups = total;
+	}
+
+	pthread_barrier_wait(&(sort->m_barrier));
+
+	rank = sort->m_group_counts[thread] - 1;
+	for (i = first; i < last; i++)
+	{
+		if (i == 0 || keys[i].m_key != keys[i - 1].m_key)
+		{
+			rank++;
+		}
+
+		sort->m_ranks[keys[i].m_position] = rank;
+	}
+
+	pthread_barrier_wait(&(sort->m_barrier));
+}
+
+
+// stable least significant byte first over the whole key, so keys that came in by position stay that way
+// among equals; a byte every key shares is skipped, and the result always ends up back in keys
+void radix_sort_keys(struct rotation_key *keys, struct rotation_key *scratch, int count)
+{
+	struct rotation_key *from;
+	struct rotation_key *to;
+	struct rotation_key *temp;
+	int shift;
+
+	from = keys;
+	to = scratch;
+
+	for (shift = 0; shift < 64; shift += 8)
+	{
+		int counts[256];
+		int total;
+		int i;
+
+		memset(counts, 0, sizeof(counts));
+		for (i = 0; i < count; i++)
+		{
+			counts[(from[i].m_key >> shift) & 0xff]++;
+		}
+
+		if (count == 0 || counts[(from[0].m_key >> shift) & 0xff] == count)
+		{
+			continue;
+		}
+
+		total = 0;
+		for (i = 0; i < 256; i++)
+		{
+			int bucket_count;
+
+			bucket_count = counts[i];
+			counts[i] = total;
+			total += bucket_count;
+		}
+
+		for (i = 0; i < count; i++)
+		{
+			to[counts[(from[i].m_key >> shift) & 0xff]++] = from[i];
+		}
+
+		temp = from;
+		from = to;
+		to = temp;
+	}
+
+	if (from != keys)
+	{
+		memcpy(keys, from, sizeof(struct rotation_key) * count);
+	}
+}
+
+
+// how many of the splitting samples come before key
+int find_bucket(const struct suffix_sort *sort, const struct rotation_key *key)
+{
+	int low;
+	int high;
+
+	low = 0;
+	high = sort->m_num_buckets - 1;
+
+	while (low < high)
+	{
+		int middle;
+
+		middle = (low + high) / 2;
+
+		if (compare_rotation_keys(&(sort->m_samples[(middle + 1) * SAMPLES_PER_BUCKET - 1]), key) < 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+
+int compare_rotation_keys(const void *key1, const void *key2)
+{
+	const struct rotation_key *alias1;
+	const struct rotation_key *alias2;
+
+	alias1 = (const struct rotation_key *)key1;
+	alias2 = (const struct rotation_key *)key2;
+
+	if (alias1->m_key != alias2->m_key)
+	{
+		return alias1->m_key < alias2->m_key ? -1 : 1;
+	}
+
+	return alias1->m_position - alias2->m_position;
+}
+
+
+// up to four bytes as a number that orders the way memcmp() does
+WORD pack_symbol_bytes(const BYTE *bytes, int count)
+{
+	WORD result;
+	int i;
+
+	result = 0;
+	for (i = 0; i < 4; i++)
+	{
+		result = (result << 8) | (i < count ? bytes[i] : 0);
+	}
+
+	return result;
+}
@@ -3,6 +3,13 @@
 #include "common.h"
 
 
+// how bwt_encode() puts a batch's rotations in order
+#define BWT_SORT_AUTO 0 // the rotation matrix up to BWT_MATRIX_LIMIT symbols, prefix doubling above
+#define BWT_SORT_MATRIX 1 // every rotation copied out and quicksorted, symbol_count squared symbols of memory
+#define BWT_SORT_DOUBLING 2 // a suffix array by prefix doubling over as many threads as there are cpus, about 36 bytes a symbol
+#define BWT_MATRIX_LIMIT 512
+
+
 void bwt_initialize(int symbol_size,bool encode);
 
 void bwt_encoding_write_symbols(const BYTE *source,int symbol_count,int *symbols_written);
@@ -14,5 +21,13 @@ void bwt_decoding_read_symbols(BYTE *dest,int *symbol_count,int buffer_size);
 bool bwt_flush();
 bool bwt_finish();
 
+// picks the sort, and the threads prefix doubling spreads one batch over, 0 for one per cpu; whatever the
+// sort, bwt_decode() inverts batches over BWT_MATRIX_LIMIT symbols from ranks instead of a matrix
+void bwt_set_sort(int sort_id,int num_threads);
+
+// single batch transforms underneath the streaming calls above, bwt_initialize() has to run first
+bool bwt_encode(const BYTE *source, int symbol_size, int symbol_count, BYTE *dest, int *index,int *bytes_written);
+bool bwt_decode(const BYTE *source, int symbol_size, int symbol_count, int index, BYTE *dest,int *symbols_written);
+
 
 #endif //BURROWS_WHEELER__H
\ No newline at end of file
@@ -0,0 +1,193 @@
+#include "./checksum.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	include <nmmintrin.h>
+#	define CHECKSUM_HAS_SSE42_PATH 1
+#else
+#	define CHECKSUM_HAS_SSE42_PATH 0
+#endif
+
+/////////////////////////////
+// private defines
+
+#define CRC32C_POLYNOMIAL 0x82F63B78 // reflected Castagnoli polynomial
+#define NUM_SLICES 8
+
+
+/////////////////////////////
+// Global Variables
+static WORD g_slice_tables[NUM_SLICES][256];
+static bool g_hardware_support = false;
+static pthread_once_t g_checksum_once = PTHREAD_ONCE_INIT; // the cpu is asked, and the tables built, by whichever thread gets there first
+
+
+/////////////////////////////
+// Private Prototypes
+void initialize_checksum();
+void build_slice_tables();
+WORD update_checksum_software(WORD crc,const BYTE *data,int length);
+#if CHECKSUM_HAS_SSE42_PATH
+WORD update_checksum_hardware(WORD crc,const BYTE *data,int length);
+#endif
+
+
+/////////////////////////////
+// Public Functions
+WORD update_checksum(WORD checksum,const BYTE *data,int length)
+{
+	WORD crc;
+
+	crc = ~checksum;
+
+	if (checksum_is_hardware_accelerated())
+	{
+#if CHECKSUM_HAS_SSE42_PATH
+		crc = update_checksum_hardware(crc,data,length);
+#endif
+	}
+	else
+	{
+		crc = update_checksum_software(crc,data,length);
+	}
+
+	return ~crc;
+}
+
+bool checksum_is_hardware_accelerated()
+{
+	pthread_once(&g_checksum_once, initialize_checksum);
+
+	return g_hardware_support;
+}
+
+
+/////////////////////////////
+// Private Functions
+void initialize_checksum()
+{
+#if CHECKSUM_HAS_SSE42_PATH
+	g_hardware_support = __builtin_cpu_supports("sse4.2");
+#else
+	g_hardware_support = false;
+#endif
+
+	if (g_hardware_support == false)
+	{
+		build_slice_tables();
+	}
+}
+
+void build_slice_tables()
+{
+	int i;
+	int slice;
+
+	for (i = 0; i < 256; i++)
+	{
+		WORD crc;
+		int bit;
+
+		crc = i;
+		for (bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+		}
+
+		g_slice_tables[0][i] = crc;
+	}
+
+	// table k advances a byte that still has k more bytes to pass through the register
+	for (i = 0; i < 256; i++)
+	{
+		for (slice = 1; slice < NUM_SLICES; slice++)
+		{
+			WORD previous;
+
+			previous = g_slice_tables[slice - 1][i];
+			g_slice_tables[slice][i] = (previous >> 8) ^ g_slice_tables[0][previous & 0xFF];
+		}
+	}
+}
+
+
+WORD update_checksum_software(WORD crc,const BYTE *data,int length)
+{
+	// eight bytes per step: fold the register into the first four, then look every byte up in its own table
+	while (length >= NUM_SLICES)
+	{
+		WORD low;
+		WORD high;
+
+		memcpy(&low,data,sizeof(low));
+		memcpy(&high,data + sizeof(low),sizeof(high));
+		low ^= crc;
+
+		crc = g_slice_tables[7][low & 0xFF] ^
+			g_slice_tables[6][(low >> 8) & 0xFF] ^
+			g_slice_tables[5][(low >> 16) & 0xFF] ^
+			g_slice_tables[4][low >> 24] ^
+			g_slice_tables[3][high & 0xFF] ^
+			g_slice_tables[2][(high >> 8) & 0xFF] ^
+			g_slice_tables[1][(high >> 16) & 0xFF] ^
+			g_slice_tables[0][high >> 24];
+
+		data += NUM_SLICES;
+		length -= NUM_SLICES;
+	}
+
+	while (length > 0)
+	{
+		crc = (crc >> 8) ^ g_slice_tables[0][(crc ^ *data) & 0xFF];
+		data++;
+		length--;
+	}
+
+	return crc;
+}
+
+
+#if CHECKSUM_HAS_SSE42_PATH
+__attribute__((target("sse4.2")))
+WORD update_checksum_hardware(WORD crc,const BYTE *data,int length)
+{
+#if defined(__x86_64__)
+	DWORD wide_crc;
+
+	wide_crc = crc;
+	while (length >= 8)
+	{
+		DWORD chunk;
+
+		memcpy(&chunk,data,sizeof(chunk));
+		wide_crc = _mm_crc32_u64(wide_crc,chunk);
+
+		data += 8;
+		length -= 8;
+	}
+	crc = (WORD)wide_crc;
+#endif
+
+	while (length >= 4)
+	{
+		WORD chunk;
+
+		memcpy(&chunk,data,sizeof(chunk));
+		crc = _mm_crc32_u32(crc,chunk);
+
+		data += 4;
+		length -= 4;
+	}
+
+	while (length > 0)
+	{
+		crc = _mm_crc32_u8(crc,*data);
+		data++;
+		length--;
+	}
+
+	return crc;
+}
+#endif
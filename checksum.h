@@ -0,0 +1,17 @@
+#ifndef CHECKSUM__H
+#define CHECKSUM__H
+
+
+#include "./common.h"
+
+
+// starting value for a fresh checksum; feed the result of one call into the next to cover more bytes
+#define CHECKSUM_SEED 0
+
+
+// CRC32C (Castagnoli), with SSE4.2 when the cpu has it and slicing-by-8 tables otherwise
+WORD update_checksum(WORD checksum,const BYTE *data,int length);
+bool checksum_is_hardware_accelerated();
+
+
+#endif // CHECKSUM__H
@@ -2,9 +2,22 @@
 #define COMMON__H
 
 #define MAGIC_NUMBER 0xC0EDBABE
-#define VERSION 1
+#define VERSION 7
+#define UNANCHORED_VERSION 6 // laid out like VERSION except for delta streams, which it can't have
+#define TRAINED_MAGIC_NUMBER 0xC0EDD1C7
+#define TRAINED_VERSION 1
+#define ARCHIVE_MAGIC_NUMBER 0xC0EDA4C1
+#define ARCHIVE_VERSION 1
+#define ALGORITHM_AUTO 0 // picked per block from the block's own statistics
 #define ALGORITHM_HUFFMAN 1
 #define ALGORITHM_ARITHMETIC 2
+#define ALGORITHM_STORED 3 // the block's bytes as they are
+#define ALGORITHM_LZ77 4 // LZ77 parse whose literal, length and distance streams go through the coders above
+#define ALGORITHM_TRAINED 5 // coded with a dictionary trained ahead of time and loaded separately, see perform_training()
+#define ALPHABET_AUTO 0 // only ever asked for, every block records the one it was coded with
+#define ALPHABET_BYTE 1
+#define ALPHABET_PAIR 2 // 16-bit little-endian symbols
+#define ALPHABET_WORD 3 // whole words, whitespace runs and punctuation, as hashed tokens
 #define EPSILON 0.0001f
 
 
@@ -18,7 +31,7 @@ enum SEEK_MODE {SEEK_BEGINNING, SEEK_CURRENT, SEEK_ENDING};
 
 struct symbol
 {
-	BYTE m_value;
+	WORD m_value; // the byte itself for ALPHABET_BYTE, otherwise a position in the dictionary's token table
 };
 
 struct symbol_info
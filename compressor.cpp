@@ -1,30 +1,132 @@
 #include "common.h"
-#include "burrows_wheeler.h"
+#include "compressor.h"
 #include "dictionary.h"
-#include "FileInputStream.hpp"
-#include "FileOutputStream.hpp"
+#include "arena.h"
+#include "checksum.h"
+#include "lz77.h"
+#include "stats.h"
+#include "ring.h"
+#include "MemoryInputStream.hpp"
+#include "MemoryOutputStream.hpp"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
 
 
 #define NUM_PROGRESS_BARS 20
+#define DRIVER_ARENA_SIZE (64 * 1024)
+#define DEFAULT_BLOCK_SIZE (1024 * 1024)
+#define DEFAULT_SELECTION_MARGIN 2
+#define NUM_ALGORITHM_IDS 6
+#define MAX_TRAINED_DICTIONARY_SIZE (64 * 1024)
+#define DEFAULT_MATCH_WINDOW_SIZE (1024 * 1024)
+#define DEFAULT_MATCH_CHAIN_LENGTH 64
+#define DEFAULT_MATCH_NICE_LENGTH 256
+#define NUM_LZ77_STREAMS 4
+#define FOUR_STREAM_MIN_SIZE (4 * 1024) // smaller byte huffman streams stay whole, the jump table would cost more than it saves
+#define PACKED_CHUNK_SIZE (16 * 1024) // coded bits go out to the stream this many bytes at a time
+#define INITIAL_INDEX_CAPACITY 64
+#define MAX_RESERVE_SIZE (1024 * 1024 * 1024) // a header claiming more than this isn't taken at its word
+
+#define STREAM_FLAG_INDEX 0x01 // a block index trailer follows the stream crc
+#define STREAM_FLAG_DELTA 0x02 // lz77 blocks match against a reference file, see load_reference()
+#define STREAM_FLAG_UNSIZED 0x04 // the original size is left at 0, the push encoder can't go back and fill it in
+#define STREAM_FLAG_SINGLE 0x08 // the whole input is one block of the block size, see begin_stream()
+#define KNOWN_STREAM_FLAGS (STREAM_FLAG_INDEX | STREAM_FLAG_DELTA | STREAM_FLAG_UNSIZED | STREAM_FLAG_SINGLE)
+#define DELTA_REFERENCE_MARGIN (1024 * 1024) // how far either side of where a block lines up its piece of the reference reaches
+#define DELTA_ANCHOR_LENGTH 32 // bytes hashed for every anchor, shorter runs in common don't say where a block lines up
+#define DELTA_ANCHOR_STRIDE 64 // the reference gets an anchor every this many bytes
+#define DELTA_MAX_VOTES 4096 // anchors found in a block past this many don't change where it lines up
+#define DELTA_ANCHOR_BASE 0x01000193 // of the rolling hash
+#define SPLIT_SEGMENT_SIZE (16 * 1024) // statistics drift is looked for at this granularity
+#define SPLIT_MIN_SIZE (64 * 1024) // no piece of a split block is smaller, lz77 loses its reach across every split
+#define SPLIT_TABLE_BITS (256 * 8 + 11 * 8) // about what a new block costs in dictionary and header
+#define SPLIT_GAIN_DIVISOR 8 // a split also has to save this fraction of the segment, only clear drift is worth a trial
+#define BASE_MEMORY_SIZE (3 * 1024 * 1024) // code, stacks, stdio and the c library, what a run holds before its first block
+#define ENCODE_BYTES_PER_BLOCK_BYTE 12 // block buffer, payload and trial streams, lz77 streams and every alphabet's model
+#define WORD_ALPHABET_BYTES_PER_BLOCK_BYTE 8 // on top, a word alphabet's tokens on data with few repeats
+#define ENCODE_BYTES_PER_WINDOW_BYTE 8 // the match finder's chains and hash heads, twice over for an arena that grows by doubling
+#define DECODE_BYTES_PER_BLOCK_BYTE 3 // block buffer, payload and the lz77 streams rebuilt from it
+#define PIPELINE_SLOTS 4 // blocks in flight: one being read, one coded, one written and one to even out the stages
+#define PIPELINE_BYTES_PER_BLOCK_BYTE (2 * PIPELINE_SLOTS) // every slot's input and output
+#define PUSH_PAYLOAD_SLACK (64 * 1024) // a push decoder can't see where the stream ends, so no payload is taken past twice the block size and this
+
+#define PUSH_STATE_HEADER 0 // what a push decoder is waiting for next
+#define PUSH_STATE_BLOCK_HEADER 1
+#define PUSH_STATE_PAYLOAD 2
+#define PUSH_STATE_TRAILER 3 // the stream crc and the index
+#define PUSH_STATE_DONE 4
+#define PUSH_STATE_FAILED 5
 
 /*
-	- definition of compressed file format
+	- definition of compressed file format (version 7)
 		- magic number: 1 DWORD
 		- version number: 1 WORD
-		- algorithm: 1 BYTE
-		- algorithm data:
-			- symbol length in bits: 1 WORD
-			- dictionary size in bytes: 1 DWORD
-			- dictionary bytes
-			- number of remainder bits at last BYTE of the bitstream: 2 bits
-			- compressed bitstream
-		- crc: 1 DWORD
+		- algorithm asked for, possibly ALGORITHM_AUTO: 1 BYTE
+		- flags, the STREAM_FLAG_ bits: 1 BYTE
+		- block size, with STREAM_FLAG_SINGLE the size of the one block and so of the whole input: 1 WORD
+		- original size, the sum of the blocks' uncompressed sizes, 0 with STREAM_FLAG_UNSIZED and left out
+		  with STREAM_FLAG_SINGLE: 1 DWORD
+		- with STREAM_FLAG_DELTA, the reference every lz77 block matches against:
+			- reference size in bytes: 1 DWORD
+			- id, the crc of the reference: 1 WORD
+		- blocks, each one coded on its own:
+			- uncompressed size: 1 WORD, zero marks the end of the blocks
+			- payload size in bytes: 1 WORD
+			- crc of the uncompressed block: 1 WORD
+			- algorithm this block was coded with: 1 BYTE
+			- payload, the raw bytes for ALGORITHM_STORED, for ALGORITHM_LZ77:
+				- with STREAM_FLAG_DELTA, where the piece of the reference the block matches against starts: 1 DWORD
+				- number of literals: 1 WORD
+				- number of matches: 1 WORD
+				- number of extra bit bytes: 1 WORD
+				- literal, run code, length code and distance code streams, see lz77.h, each:
+					- algorithm: 1 BYTE, ALGORITHM_HUFFMAN, ALGORITHM_ARITHMETIC or ALGORITHM_STORED
+					- payload size in bytes: 1 WORD
+					- payload as for a block coded with that algorithm
+				- extra bits
+				- with STREAM_FLAG_DELTA the parse starts after that piece of the reference, so matches can
+				  reach back into it; it's as long as reference_slice() makes it for the block's size
+			  for ALGORITHM_TRAINED:
+				- id of the trained dictionary: 1 WORD
+				- bitstream
+			  and otherwise:
+				- dictionary size in bytes: 1 int
+				- dictionary bytes
+				- bitstream
+			- bitstream, for ALPHABET_BYTE huffman streams of at least FOUR_STREAM_MIN_SIZE bytes:
+				- sizes in bytes of the first three of four bitstreams: 3 WORDs
+				- four bitstreams, each padded to a whole byte, coding the stream's four quarters (the
+				  first three (size + 3) / 4 bytes long, the last one whatever is left) so they decode together
+			  and otherwise:
+				- number of remainder bits at last BYTE of the bitstream: 1 BYTE
+				- compressed bitstream
+		- with STREAM_FLAG_SINGLE nothing follows the one block, its own crc stands for the stream's
+		- crc of the whole uncompressed stream: 1 WORD
+		- with STREAM_FLAG_INDEX, a trailer indexing the blocks:
+			- for every block:
+				- offset of its header from the magic number: 1 DWORD
+				- offset of its first byte in the uncompressed stream: 1 DWORD
+			- number of blocks: 1 WORD
+			- trailer size in bytes, this field included: 1 WORD, so the trailer can be found from the end
+
+	crcs are CRC32C, see checksum.h
+
+	version 6 (UNANCHORED_VERSION) differs only in leaving out the start of the reference's piece, which it
+	placed around the block's own offset instead; a stream without STREAM_FLAG_DELTA reads the same under
+	either, so version 6 ones still decode and take appends, and version 6 delta streams are refused
+
+	- definition of trained dictionary file format
+		- magic number: 1 DWORD
+		- version number: 1 WORD
+		- id, the crc of the dictionary bytes: 1 WORD
+		- dictionary size in bytes: 1 int
+		- dictionary bytes, always ALPHABET_BYTE with a code for every byte value
 */
 
 /////////////////////////////
@@ -35,524 +137,4200 @@ struct compressed_stream
 	BYTE *m_bytestream;
 };
 
+struct block_header
+{
+	WORD m_uncompressed_size;
+	WORD m_payload_size;
+	WORD m_crc;
+	BYTE m_algorithm_id;
+};
+
+// one anchor of the reference: the hash of the DELTA_ANCHOR_LENGTH bytes at m_position, -1 for an empty slot
+struct reference_anchor
+{
+	WORD m_hash;
+	int m_position;
+};
+
+struct index_entry
+{
+	DWORD m_offset;
+	DWORD m_uncompressed_offset;
+};
+
+struct level_preset
+{
+	BYTE m_algorithm_id;
+	int m_block_size;
+	BYTE m_alphabet_id;
+	int m_selection_margin;
+	struct lz77_parameters m_match_finder;
+};
+
+// the coding settings as they were when a stream began, so changing them only affects streams begun after
+struct coder_settings
+{
+	BYTE m_alphabet_id;
+	int m_selection_margin;
+	struct lz77_parameters m_match_finder;
+	bool m_split_blocks;
+	BYTE *m_trained_dictionary; // a copy of the serialized one, NULL when none was loaded
+	int m_trained_dictionary_size;
+	WORD m_trained_dictionary_id;
+};
+
 struct compressed_file_format
 {
 	DWORD m_magic_number;
 	WORD m_version_number;
 	BYTE m_algorithm_id;
+	BYTE m_flags;
+	WORD m_block_size;
+	DWORD m_original_size;
+	DWORD m_reference_size;
+	WORD m_reference_id;
 	DICTIONARY m_dictionary;
 	struct compressed_stream m_compressed_stream;
-	DWORD crc;
+	WORD crc;
+};
+
+// everything a single compression or decompression changes as it goes; the settings below it stay
+// shared, so threads each working with their own context never touch the same memory
+struct coder_context
+{
+	struct compressed_file_format m_meta;
+	int m_blocks_per_algorithm[NUM_ALGORITHM_IDS];
+
+	ARENA m_arena; // dictionaries and transient buffers, reset for every block
+
+	BYTE *m_block_buffer; // one uncompressed block, on either side of the coder
+	int m_block_buffer_capacity;
+	int m_block_fill; // decoded bytes so far in m_block_buffer
+	DWORD m_block_offset; // of the block being coded in the uncompressed stream, for picking its piece of the reference
+	int m_reference_anchor; // where in the reference the last block with anchors in it lined up
+	DWORD m_reference_anchor_offset; // and that block's offset, so the next block without any carries on from it
+	MemoryOutputStream *m_payload_stream; // a block's payload is assembled here before its header goes out
+	MemoryOutputStream *m_trial_streams[2]; // a drifting block coded whole and in pieces, the smaller one is kept
+	struct index_entry *m_index; // where every block so far starts, for the trailer
+	int m_index_size;
+	int m_index_capacity;
+	int m_block_size; // new streams get blocks this size, 0 for the setting; a memory cap fits it to one call
+	struct coder_settings m_settings; // encoding only, see capture_settings()
+	bool m_verbose; // progress bar and block summary, never for batch workers
+	bool m_pipeline; // reading and writing on threads of their own, never for batch workers either
+	bool m_buffering_writes; // blocks go into a pipeline slot or a trial stream, what times the real write is what moves them on
+	struct coder_stats *m_stats; // NULL unless stats are being collected
+};
+
+struct batch_structure
+{
+	BYTE m_algorithm_id;
+	struct batch_item *m_items;
+	int m_num_items;
+	int m_next_item; // claimed with an atomic add, so workers that draw small items take more of them
+	int m_block_size; // fitted to the memory cap for this batch
+};
+
+// one stream coded a piece at a time, see create_push_encoder(); the encoder's output waits in m_output,
+// the decoder's in the context's block buffer, and both are read out from m_output_read
+struct push_stream_internal
+{
+	struct coder_context m_context;
+	bool m_encoding;
+	BYTE m_algorithm_id;
+	int m_state; // PUSH_STATE_, the encoder only uses DONE and FAILED
+	BYTE *m_input; // the decoder's part of a header, payload or trailer that hasn't all come in yet
+	int m_input_fill; // of m_input, or of the block buffer for the encoder
+	int m_input_capacity;
+	MemoryOutputStream *m_output;
+	int m_output_read;
+	DWORD m_position; // bytes of the compressed stream in front of m_output, or in front of m_input
+	struct block_header m_header; // the decoder's next payload belongs to it
+	WORD m_stream_crc;
+	DWORD m_total_out;
+	int m_num_blocks;
+};
+
+// one block on its way through a pipeline; the reader fills m_input, the coder leaves what goes out in
+// m_output_bytes, and the writer hands it on and sends the slot back round
+struct pipeline_slot
+{
+	BYTE *m_input; // a block as read, or a block's payload
+	int m_input_size;
+	int m_input_capacity;
+	struct block_header m_header; // decoding, of the payload in m_input
+	DWORD m_offset; // decoding, of the block header from the start of the stream
+	MemoryOutputStream *m_coded; // compressing, the block or blocks coded from m_input
+	BYTE *m_decoded; // decoding, the block decoded from m_input
+	const BYTE *m_output_bytes;
+	int m_output_size;
+	bool m_last; // the input ran out or went bad, nothing follows this slot
+	bool m_failed;
+};
+
+// three stages on three threads, handing slots round through single producer single consumer rings:
+// reader -> m_filled -> coder -> m_coded -> writer -> m_free -> reader
+struct pipeline_structure
+{
+	struct coder_context *m_context; // only the coder changes it, the reader just looks at m_meta
+	InputStream *m_source;
+	OutputStream *m_dest; // NULL when decoding only to verify
+	int m_stream_start;
+	DWORD m_source_size;
+	RING m_filled;
+	RING m_coded;
+	RING m_free;
+	struct pipeline_slot m_slots[PIPELINE_SLOTS];
+	bool m_decoding;
+	int m_abort; // set by the coder once it fails, the reader stops at its next slot
+};
+
+/////////////////////////////
+// Global Variables
+static int g_block_size = DEFAULT_BLOCK_SIZE;
+static bool g_verbose = true;
+static bool g_write_index = true;
+static bool g_split_blocks = true;
+static bool g_pipeline = true;
+static DWORD g_max_memory = 0; // 0 for no cap
+static BYTE g_alphabet_id = ALPHABET_BYTE;
+static int g_selection_margin = DEFAULT_SELECTION_MARGIN;
+
+static struct lz77_parameters g_match_finder = {DEFAULT_MATCH_WINDOW_SIZE, DEFAULT_MATCH_CHAIN_LENGTH, DEFAULT_MATCH_NICE_LENGTH, true};
+
+// low levels skip the slow coder and the model search and only glance at a few match candidates,
+// high ones take bigger blocks and windows, search longer chains and let every block try each
+// alphabet; level 5 matches the defaults above
+static const struct level_preset g_level_presets[MAX_COMPRESSION_LEVEL] =
+{
+	// algorithm, block size, alphabet, selection margin, {window, chain length, nice length, lazy}
+	{ALGORITHM_HUFFMAN, 64 * 1024, ALPHABET_BYTE, 0, {64 * 1024, 4, 16, false}},
+	{ALGORITHM_HUFFMAN, 256 * 1024, ALPHABET_BYTE, 0, {256 * 1024, 8, 32, false}},
+	{ALGORITHM_AUTO, 256 * 1024, ALPHABET_BYTE, 10, {256 * 1024, 16, 64, true}},
+	{ALGORITHM_AUTO, 1024 * 1024, ALPHABET_BYTE, 5, {1024 * 1024, 32, 128, true}},
+	{ALGORITHM_AUTO, DEFAULT_BLOCK_SIZE, ALPHABET_BYTE, DEFAULT_SELECTION_MARGIN, {DEFAULT_MATCH_WINDOW_SIZE, DEFAULT_MATCH_CHAIN_LENGTH, DEFAULT_MATCH_NICE_LENGTH, true}},
+	{ALGORITHM_AUTO, 2 * 1024 * 1024, ALPHABET_BYTE, 1, {2 * 1024 * 1024, 128, 512, true}},
+	{ALGORITHM_AUTO, 4 * 1024 * 1024, ALPHABET_AUTO, 1, {4 * 1024 * 1024, 256, 1024, true}},
+	{ALGORITHM_AUTO, 8 * 1024 * 1024, ALPHABET_AUTO, 0, {8 * 1024 * 1024, 1024, 4096, true}},
+	{ALGORITHM_AUTO, MAX_BLOCK_SIZE, ALPHABET_AUTO, 0, {LZ77_MAX_WINDOW_SIZE, 4096, LZ77_MAX_MATCH, true}},
 };
+static struct coder_context g_context; // what the perform_ calls work with
+static bool g_collect_stats = false;
+static struct coder_stats g_stats; // the last perform_ call's, when collecting
+static BYTE *g_trained_dictionary = NULL; // serialized; while it's loaded every block is coded with it instead of its own
+static int g_trained_dictionary_size = 0;
+static WORD g_trained_dictionary_id = 0;
+static BYTE *g_reference = NULL; // while it's loaded new streams are coded against it, and streams that were need it
+static int g_reference_size = 0;
+static WORD g_reference_id = 0;
+static struct reference_anchor *g_reference_anchors = NULL; // open addressed on the hash, see index_reference()
+static int g_reference_anchor_capacity = 0;
+
+/////////////////////////////
+// Private Prototypes
+bool compress_stream(struct coder_context *context, BYTE algorithm_id, InputStream *source, OutputStream *dest);
+bool compress_blocks(struct coder_context *context, BYTE algorithm_id, InputStream *source, OutputStream *dest, int dest_start);
+void *batch_worker(void *opaque);
+void release_context(struct coder_context *context);
+void capture_settings(struct coder_context *context);
+
+
+int begin_stream(struct coder_context *context, BYTE algorithm_id, BYTE extra_flags, DWORD source_size, OutputStream *dest);
+bool compress_buffer(struct coder_context *context, BYTE algorithm_id, const BYTE *buffer, int size, OutputStream *dest, DWORD position, int *num_blocks);
+void end_stream(struct coder_context *context, OutputStream *dest);
+bool compress_block(struct coder_context *context, OutputStream *dest, BYTE algorithm_id, const BYTE *block, int block_size);
+bool compress_split_block(struct coder_context *context, OutputStream *dest, DWORD position, BYTE algorithm_id, const BYTE *block, int size, int first_piece, int *num_blocks);
+int encode_lz77_payload(struct coder_context *context, BYTE algorithm_id, const BYTE *block, int block_size);
+BYTE model_stream(struct coder_context *context, BYTE algorithm_id, BYTE alphabet_id, const BYTE *source, int size, DWORD *estimated_bits);
+bool encode_stream(struct coder_context *context, OutputStream *dest, BYTE algorithm_id, const BYTE *source, int size);
+bool encode_symbols(struct coder_context *context, OutputStream *dest, const BYTE *source, int size);
+bool encode_one_stream(struct coder_context *context, OutputStream *dest, const BYTE *source, int size);
+bool encode_four_streams(struct coder_context *context, OutputStream *dest, const BYTE *source, int size);
+bool write_packed_stream(struct coder_context *context, OutputStream *dest, const BYTE *source, int size, bool flush, BYTE *remainder_bits);
+bool uses_four_streams(DICTIONARY dictionary, int size);
+void four_stream_sizes(int size, int *sizes);
+bool compress_trained_block(struct coder_context *context, OutputStream *dest, const BYTE *block, int block_size);
+DICTIONARY build_block_dictionary(struct coder_context *context, BYTE algorithm_id, BYTE requested_alphabet_id, const BYTE *block, int block_size);
+BYTE choose_block_algorithm(struct coder_context *context, BYTE algorithm_id, int block_size, DWORD *estimated_bits);
+bool write_block(struct coder_context *context, OutputStream *dest, BYTE algorithm_id, const BYTE *block, int block_size, const BYTE *payload, int payload_size);
+bool decompress_block(struct coder_context *context, const struct block_header *header, const BYTE *payload);
+bool decompress_lz77_block(struct coder_context *context, const struct block_header *header, const BYTE *payload);
+bool decompress_trained_block(struct coder_context *context, const struct block_header *header, const BYTE *payload);
+bool decode_stream(struct coder_context *context, BYTE algorithm_id, const BYTE *payload, int payload_size, BYTE *dest, int size);
+bool decode_symbols(struct coder_context *context, const BYTE *payload, int payload_size, BYTE *dest, int size);
+bool decode_one_stream(struct coder_context *context, const BYTE *payload, int payload_size, BYTE *dest, int size);
+bool decode_four_streams(struct coder_context *context, const BYTE *payload, int payload_size, BYTE *dest, int size);
+bool decode_blocks(struct coder_context *context, InputStream *source, OutputStream *dest);
+bool reframe_single_block(struct coder_context *context, BYTE algorithm_id, const BYTE *stream, int stream_size, OutputStream *dest, int *original_size_position);
+bool check_block_header(struct coder_context *context, const struct block_header *header, DWORD max_payload_size);
+bool decode_payload(struct coder_context *context, const struct block_header *header, const BYTE *payload, int block_number, WORD *stream_crc);
+bool check_decode_memory(struct coder_context *context, bool pipelined);
+bool decodes_pipelined(struct coder_context *context, DWORD source_size, int stream_start);
+int read_fully(InputStream *source, BYTE *buffer, int size);
+bool read_stream_header(struct coder_context *context, InputStream *source);
+void add_index_entry(struct coder_context *context, DWORD offset, DWORD uncompressed_offset);
+void write_index(struct coder_context *context, OutputStream *dest);
+bool check_index(struct coder_context *context, InputStream *source);
+bool skip_block(InputStream *source, DWORD source_size, struct block_header *header);
+bool find_stream_end(struct coder_context *context, InputStream *source, int stream_start, DWORD source_size, int *end_position);
+bool check_reference(struct coder_context *context);
+void reference_slice(DWORD anchor, int block_size, int *start, int *size);
+void index_reference();
+int find_reference_anchor(struct coder_context *context, const BYTE *block, int block_size);
+int compare_anchor_votes(const void *a, const void *b);
+DWORD reference_memory();
+void reserve_block_buffer(struct coder_context *context, int size);
+int next_block_split(struct coder_context *context, const BYTE *block, int size);
+double histogram_cost(const int *counts, int total);
+DWORD encode_working_set(int block_size);
+DWORD decode_working_set(int block_size);
+DWORD compression_memory(DWORD largest_input, int block_size, int num_contexts, DWORD held, bool pipeline);
+bool fit_block_size(DWORD largest_input, int num_contexts, DWORD held, bool pipeline, int *block_size);
+
+bool compress_serially(struct coder_context *context, BYTE algorithm_id, InputStream *source, OutputStream *dest, DWORD position, DWORD source_size, int *num_blocks);
+bool compress_pipelined(struct coder_context *context, BYTE algorithm_id, InputStream *source, OutputStream *dest, DWORD position, DWORD source_size, int *num_blocks);
+bool decode_serially(struct coder_context *context, InputStream *source, OutputStream *dest, int stream_start, DWORD source_size, int *num_blocks, WORD *stream_crc, DWORD *total_out);
+bool decode_pipelined(struct coder_context *context, InputStream *source, OutputStream *dest, int stream_start, DWORD source_size, int *num_blocks, WORD *stream_crc, DWORD *total_out);
+bool start_pipeline(struct pipeline_structure *pipeline, struct coder_context *context, InputStream *source, OutputStream *dest, int stream_start, DWORD source_size, bool decoding, pthread_t *reader, pthread_t *writer);
+void free_pipeline(struct pipeline_structure *pipeline);
+void finish_pipeline(struct pipeline_structure *pipeline, pthread_t reader, pthread_t writer);
+void *pipeline_block_reader(void *opaque);
+void *pipeline_payload_reader(void *opaque);
+void *pipeline_writer(void *opaque);
+
+void print_progress_start();
+void print_progress(float *current_bar_percentile, DWORD amount, DWORD total);
+void print_progress_end();
+
+DWORD get_file_size(InputStream *source);
+void reset_driver_arena(struct coder_context *context);
+
+int push_pending_size(struct push_stream_internal *alias);
+bool push_encode(struct push_stream_internal *alias, const BYTE *buffer, int size);
+int push_unit_size(struct push_stream_internal *alias, const BYTE *bytes, int available);
+bool push_take_unit(struct push_stream_internal *alias, const BYTE *unit, int size);
+
+
+/////////////////////////////
+// Public Functions
+bool perform_compression(BYTE algorithm_id, InputStream *source, OutputStream *dest)
+{
+	g_context.m_verbose = g_verbose;
+	g_context.m_pipeline = g_pipeline;
+	g_context.m_stats = g_collect_stats ? &g_stats : NULL;
+
+	if (fit_block_size(get_file_size(source), 1, 0, g_context.m_pipeline, &g_context.m_block_size) == false)
+	{
+		return false;
+	}
+
+	return compress_stream(&g_context, algorithm_id, source, dest);
+}
+
+
+bool compress_batch(BYTE algorithm_id, struct batch_item *items, int num_items, int num_threads)
+{
+	struct batch_structure batch;
+	pthread_t *threads;
+	int num_started;
+	DWORD largest_input;
+	DWORD held;
+	bool result;
+	int i;
+
+	if (num_threads <= 0)
+	{
+		num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	if (num_threads > num_items)
+	{
+		num_threads = num_items;
+	}
+
+	if (num_threads < 1)
+	{
+		num_threads = 1;
+	}
+
+	batch.m_algorithm_id = algorithm_id;
+	batch.m_items = items;
+	batch.m_num_items = num_items;
+	batch.m_next_item = 0;
+
+	largest_input = 0;
+	held = 0;
+
+	for (i = 0; i < num_items; i++)
+	{
+		items[i].m_compressed = NULL;
+		items[i].m_compressed_size = 0;
+		items[i].m_succeeded = false;
+
+		// every input is in memory already and its output will be, which leaves the rest for the workers
+		held += 2 * (DWORD)items[i].m_source_size;
+		if ((DWORD)items[i].m_source_size > largest_input)
+		{
+			largest_input = items[i].m_source_size;
+		}
+	}
+
+	// under a memory cap fewer workers come before smaller blocks, the output doesn't change with their number
+	while (g_max_memory != 0 && num_threads > 1 && compression_memory(largest_input, g_block_size, num_threads, held, false) > g_max_memory)
+	{
+		num_threads--;
+	}
+
+	if (fit_block_size(largest_input, num_threads, held, false, &batch.m_block_size) == false)
+	{
+		return false;
+	}
+
+	// the calling thread is a worker too, so a batch of one never starts a thread
+	threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+	num_started = 0;
+
+	for (i = 1; i < num_threads; i++)
+	{
+		if (pthread_create(&threads[num_started], NULL, batch_worker, &batch) != 0)
+		{
+			break;
+		}
+
+		num_started++;
+	}
+
+	batch_worker(&batch);
+
+	for (i = 0; i < num_started; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	free(threads);
+
+	result = true;
+
+	for (i = 0; i < num_items; i++)
+	{
+		if (items[i].m_succeeded == false)
+		{
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+
+bool perform_decompression(InputStream *source, OutputStream *dest)
+{
+	g_context.m_pipeline = g_pipeline;
+	g_context.m_stats = g_collect_stats ? &g_stats : NULL;
+
+	return decode_blocks(&g_context, source, dest);
+}
+
+
+PUSH_STREAM create_push_encoder(BYTE algorithm_id)
+{
+	struct push_stream_internal *addition;
+
+	addition = (struct push_stream_internal *)malloc(sizeof(struct push_stream_internal));
+	memset(addition, 0, sizeof(struct push_stream_internal));
+
+	if (fit_block_size((DWORD)g_block_size, 1, 0, false, &(addition->m_context.m_block_size)) == false)
+	{
+		free(addition);
+		return NULL;
+	}
+
+	addition->m_encoding = true;
+	addition->m_algorithm_id = algorithm_id;
+	addition->m_output = new MemoryOutputStream();
+	addition->m_output->initialize(addition->m_context.m_block_size);
+
+	// the header goes out first, and with nothing to seek back to the original size in it stays 0
+	begin_stream(&(addition->m_context), algorithm_id, STREAM_FLAG_UNSIZED, 0, addition->m_output);
+	reserve_block_buffer(&(addition->m_context), addition->m_context.m_meta.m_block_size);
+
+	return (PUSH_STREAM)addition;
+}
+
+PUSH_STREAM create_push_decoder()
+{
+	struct push_stream_internal *addition;
+
+	addition = (struct push_stream_internal *)malloc(sizeof(struct push_stream_internal));
+	memset(addition, 0, sizeof(struct push_stream_internal));
+
+	addition->m_encoding = false;
+	addition->m_state = PUSH_STATE_HEADER;
+	addition->m_stream_crc = CHECKSUM_SEED;
+
+	return (PUSH_STREAM)addition;
+}
+
+void destroy_push_stream(PUSH_STREAM stream)
+{
+	struct push_stream_internal *alias;
+
+	alias = (struct push_stream_internal *)stream;
+
+	if (alias != NULL)
+	{
+		if (alias->m_output != NULL)
+		{
+			alias->m_output->shutdown();
+			delete alias->m_output;
+		}
+
+		release_context(&(alias->m_context));
+		free(alias->m_input);
+		free(alias);
+	}
+}
+
+
+int push_write(PUSH_STREAM stream, const BYTE *source, int size)
+{
+	struct push_stream_internal *alias;
+	int consumed;
+
+	alias = (struct push_stream_internal *)stream;
+
+	if (alias->m_state == PUSH_STATE_FAILED || (alias->m_encoding && alias->m_state == PUSH_STATE_DONE))
+	{
+		return -1;
+	}
+
+	consumed = 0;
+
+	// nothing more is taken while output waits, which bounds both the work per call and the memory
+	while (push_pending_size(alias) == 0)
+	{
+		if (alias->m_encoding)
+		{
+			int block_size;
+			int amount;
+
+			if (consumed == size)
+			{
+				break;
+			}
+
+			block_size = alias->m_context.m_meta.m_block_size;
+
+			// a whole block in the caller's buffer is coded from there
+			if (alias->m_input_fill == 0 && size - consumed >= block_size)
+			{
+				if (push_encode(alias, source + consumed, block_size) == false)
+				{
+					return -1;
+				}
+
+				consumed += block_size;
+				continue;
+			}
+
+			amount = block_size - alias->m_input_fill < size - consumed ? block_size - alias->m_input_fill : size - consumed;
+			memcpy(alias->m_context.m_block_buffer + alias->m_input_fill, source + consumed, amount);
+			alias->m_input_fill += amount;
+			consumed += amount;
+
+			if (alias->m_input_fill == block_size)
+			{
+				alias->m_input_fill = 0;
+
+				if (push_encode(alias, alias->m_context.m_block_buffer, block_size) == false)
+				{
+					return -1;
+				}
+			}
+		}
+		else
+		{
+			const BYTE *unit;
+			int unit_size;
+
+			if (alias->m_state == PUSH_STATE_DONE)
+			{
+				break;
+			}
+
+			// a unit that's all in the caller's buffer is taken from there, the rest are gathered in m_input
+			unit = NULL;
+			unit_size = 0;
+
+			if (alias->m_input_fill == 0 && consumed < size)
+			{
+				unit_size = push_unit_size(alias, source + consumed, size - consumed);
+				if (unit_size <= size - consumed)
+				{
+					unit = source + consumed;
+					consumed += unit_size;
+				}
+			}
+
+			if (unit == NULL)
+			{
+				// a header only says how long it is once its flags are in, so the size is asked again every time
+				unit_size = push_unit_size(alias, alias->m_input, alias->m_input_fill);
+
+				if (alias->m_input_fill < unit_size)
+				{
+					int amount;
+
+					if (consumed == size)
+					{
+						break;
+					}
+
+					if (unit_size > alias->m_input_capacity)
+					{
+						alias->m_input = (BYTE *)realloc(alias->m_input, unit_size);
+						alias->m_input_capacity = unit_size;
+					}
+
+					amount = unit_size - alias->m_input_fill < size - consumed ? unit_size - alias->m_input_fill : size - consumed;
+					memcpy(alias->m_input + alias->m_input_fill, source + consumed, amount);
+					alias->m_input_fill += amount;
+					consumed += amount;
+					continue;
+				}
+
+				unit = alias->m_input;
+				alias->m_input_fill = 0;
+			}
+
+			if (push_take_unit(alias, unit, unit_size) == false)
+			{
+				alias->m_state = PUSH_STATE_FAILED;
+				return -1;
+			}
+		}
+	}
+
+	return consumed;
+}
+
+int push_read(PUSH_STREAM stream, BYTE *dest, int size)
+{
+	struct push_stream_internal *alias;
+	const BYTE *pending;
+	int amount;
+
+	alias = (struct push_stream_internal *)stream;
+
+	amount = push_pending_size(alias);
+	if (amount > size)
+	{
+		amount = size;
+	}
+
+	pending = alias->m_encoding ? alias->m_output->getBuffer() : alias->m_context.m_block_buffer;
+	memcpy(dest, pending + alias->m_output_read, amount);
+	alias->m_output_read += amount;
+
+	return amount;
+}
+
+bool push_finish(PUSH_STREAM stream)
+{
+	struct push_stream_internal *alias;
+
+	alias = (struct push_stream_internal *)stream;
+
+	if (alias->m_state == PUSH_STATE_FAILED)
+	{
+		return false;
+	}
+
+	if (alias->m_encoding == false)
+	{
+		if (alias->m_state != PUSH_STATE_DONE)
+		{
+			printf("Problem: stream is truncated\n");
+			return false;
+		}
+
+		return true;
+	}
+
+	if (alias->m_state == PUSH_STATE_DONE)
+	{
+		return true;
+	}
+
+	// the last block and the end of the stream go after whatever output still waits
+	if (alias->m_input_fill > 0 && push_encode(alias, alias->m_context.m_block_buffer, alias->m_input_fill) == false)
+	{
+		return false;
+	}
+
+	alias->m_input_fill = 0;
+
+	end_stream(&(alias->m_context), alias->m_output);
+	alias->m_state = PUSH_STATE_DONE;
+
+	return true;
+}
+
+bool push_done(PUSH_STREAM stream)
+{
+	struct push_stream_internal *alias;
+
+	alias = (struct push_stream_internal *)stream;
+
+	return alias->m_state == PUSH_STATE_DONE && push_pending_size(alias) == 0;
+}
+
+
+bool perform_verification(InputStream *source)
+{
+	g_context.m_pipeline = g_pipeline;
+	g_context.m_stats = g_collect_stats ? &g_stats : NULL;
+
+	return decode_blocks(&g_context, source, NULL);
+}
+
+
+bool perform_append(BYTE algorithm_id, InputStream *archive, OutputStream *dest, InputStream *source)
+{
+	struct stage_timer total_timer;
+	DWORD archive_size;
+	int original_size_position;
+	int end_position;
+	BYTE *tail;
+	int tail_size;
+	bool result;
+
+	g_context.m_verbose = g_verbose;
+	g_context.m_pipeline = g_pipeline;
+	g_context.m_stats = g_collect_stats ? &g_stats : NULL;
+
+	reset_stats(g_context.m_stats, true);
+	start_stage(g_context.m_stats, &total_timer);
+
+	archive_size = get_file_size(archive);
+	archive->seek(0, SEEK_BEGINNING);
+
+	if (read_stream_header(&g_context, archive) == false || check_reference(&g_context) == false)
+	{
+		return false;
+	}
+
+	// with no original size to carry on from, the one patched in would be wrong
+	if (g_context.m_meta.m_flags & STREAM_FLAG_UNSIZED)
+	{
+		printf("Problem: can't append to a stream written without its original size\n");
+		return false;
+	}
+
+	// a single block stream's block size is just that block's, so it's written out again from the top
+	if (g_context.m_meta.m_flags & STREAM_FLAG_SINGLE)
+	{
+		if (fit_block_size(get_file_size(source) + g_context.m_meta.m_original_size, 1, 0, g_context.m_pipeline, &g_context.m_block_size) == false)
+		{
+			return false;
+		}
+
+		original_size_position = 0;
+		end_position = 0;
+	}
+	else
+	{
+		// the archive's block size can't shrink to fit, its header covers every block
+		if (g_max_memory != 0 && compression_memory(get_file_size(source), g_context.m_meta.m_block_size, 1, 0, g_context.m_pipeline) > g_max_memory)
+		{
+			printf("Problem: appending blocks of [%u] bytes needs about [%llu] bytes of memory, over the cap of [%llu]\n", g_context.m_meta.m_block_size,
+				compression_memory(get_file_size(source), g_context.m_meta.m_block_size, 1, 0, g_context.m_pipeline), g_max_memory);
+			return false;
+		}
+
+		// new blocks follow the archive's flags, a reference loaded for a stream without one goes unused
+		original_size_position = archive->tell() - sizeof(g_context.m_meta.m_original_size);
+		if (g_context.m_meta.m_flags & STREAM_FLAG_DELTA)
+		{
+			original_size_position -= sizeof(g_context.m_meta.m_reference_size) + sizeof(g_context.m_meta.m_reference_id);
+		}
+
+		if (find_stream_end(&g_context, archive, 0, archive_size, &end_position) == false)
+		{
+			printf("Problem: can't find the end of the blocks\n");
+			return false;
+		}
+	}
+
+	capture_settings(&g_context);
+
+	// the new blocks line up with the reference from the start again until their anchors say otherwise
+	g_context.m_reference_anchor = 0;
+	g_context.m_reference_anchor_offset = 0;
+
+	// the end marker, the crc and the trailer are kept aside, a failed append puts them back
+	tail_size = archive_size - end_position;
+	tail = (BYTE *)malloc(tail_size > 0 ? tail_size : 1);
+
+	archive->seek(end_position, SEEK_BEGINNING);
+	if (read_fully(archive, tail, tail_size) != tail_size)
+	{
+		printf("Problem: can't read the end of the stream\n");
+		free(tail);
+		return false;
+	}
+
+	// the new blocks go over them, and end with longer ones; the block size stays the archive's, whatever
+	// the level asks for, so the header still holds for every block
+	source->seek(0, SEEK_BEGINNING);
+	dest->seek(end_position, SEEK_BEGINNING);
+
+	result = true;
+	if (g_context.m_meta.m_flags & STREAM_FLAG_SINGLE)
+	{
+		result = reframe_single_block(&g_context, algorithm_id, tail, tail_size, dest, &original_size_position);
+	}
+
+	if (result)
+	{
+		result = compress_blocks(&g_context, algorithm_id, source, dest, 0);
+	}
+
+	// a stream framed again can come out shorter than the one it replaces
+	if (result && dest->truncate() == false)
+	{
+		printf("Problem: couldn't cut the stream off at its new end\n");
+		result = false;
+	}
+
+	if (result)
+	{
+		dest->seek(original_size_position, SEEK_BEGINNING);
+		dest->write(&g_context.m_meta.m_original_size,sizeof(g_context.m_meta.m_original_size),1);
+		dest->seek(0, SEEK_ENDING);
+	}
+	else
+	{
+		dest->seek(end_position, SEEK_BEGINNING);
+		if (dest->write(tail, sizeof(BYTE), tail_size) != tail_size || dest->truncate() == false)
+		{
+			printf("Problem: couldn't put the end of the stream back, it's damaged\n");
+		}
+	}
+
+	free(tail);
+
+	finish_stats(g_context.m_stats, &total_timer, get_file_size(source), dest->tell() - end_position);
+
+	return result;
+}
+
+
+bool perform_listing(InputStream *source)
+{
+	DWORD source_size;
+	int stream_start;
+	int num_blocks;
+
+	source_size = get_file_size(source);
+	stream_start = source->tell();
+
+	if (read_stream_header(&g_context, source) == false)
+	{
+		return false;
+	}
+
+	printf("algorithm[%s] block size[%u] original size[%llu] index[%s]\n", algorithm_name(g_context.m_meta.m_algorithm_id), g_context.m_meta.m_block_size,
+		g_context.m_meta.m_original_size, (g_context.m_meta.m_flags & STREAM_FLAG_INDEX) ? "yes" : "no");
+
+	if (g_context.m_meta.m_flags & STREAM_FLAG_UNSIZED)
+	{
+		printf("original size not recorded, the stream was written a piece at a time\n");
+	}
+
+	if (g_context.m_meta.m_flags & STREAM_FLAG_DELTA)
+	{
+		printf("reference[%08x] of [%llu] bytes\n", g_context.m_meta.m_reference_id, g_context.m_meta.m_reference_size);
+	}
+
+	num_blocks = 0;
+
+	while (true)
+	{
+		struct block_header header;
+		int offset;
+
+		offset = source->tell() - stream_start;
+
+		if (skip_block(source, source_size, &header) == false)
+		{
+			printf("Problem: bad header on block[%d]\n", num_blocks);
+			return false;
+		}
+
+		if (header.m_uncompressed_size == 0)
+		{
+			break;
+		}
+
+		printf("block[%d] offset[%d] uncompressed[%u] payload[%u] algorithm[%s] crc[%08x]\n", num_blocks, offset, header.m_uncompressed_size,
+			header.m_payload_size, algorithm_name(header.m_algorithm_id), header.m_crc);
+
+		num_blocks++;
+
+		if (g_context.m_meta.m_flags & STREAM_FLAG_SINGLE)
+		{
+			break;
+		}
+	}
+
+	printf("blocks[%d]\n", num_blocks);
+
+	return true;
+}
+
+
+bool perform_training(BYTE algorithm_id, InputStream **samples, int num_samples, OutputStream *dest)
+{
+	DICTIONARY dictionary;
+	DWORD total_size;
+	BYTE every_byte[256];
+	int num_dictionary_bytes;
+	BYTE *dictionary_bytes;
+	DWORD magic_number;
+	WORD version_number;
+	WORD id;
+	int i;
+
+	if (algorithm_id != ALGORITHM_AUTO && algorithm_id != ALGORITHM_HUFFMAN && algorithm_id != ALGORITHM_ARITHMETIC)
+	{
+		printf("Problem: a trained dictionary needs huffman or arithmetic coding\n");
+		return false;
+	}
+
+	reset_driver_arena(&g_context);
+	reserve_block_buffer(&g_context, g_block_size);
+
+	dictionary = create_dictionary(ALGORITHM_HUFFMAN,ALPHABET_BYTE,g_context.m_arena);
+	total_size = 0;
+
+	for (i = 0; i < num_samples; i++)
+	{
+		int amount_read;
+
+		samples[i]->seek(0, SEEK_BEGINNING);
+
+		while ((amount_read = read_fully(samples[i], g_context.m_block_buffer, g_block_size)) > 0)
+		{
+			update_dictionary_buffer(dictionary,g_context.m_block_buffer,amount_read);
+			total_size += amount_read;
+		}
+	}
+
+	// the files this will code weren't among the samples, so every byte value needs a code
+	for (i = 0; i < 256; i++)
+	{
+		every_byte[i] = i;
+	}
+	update_dictionary_buffer(dictionary,every_byte,sizeof(every_byte));
+
+	if (algorithm_id == ALGORITHM_AUTO)
+	{
+		DWORD huffman_bits;
+		DWORD arithmetic_bits;
+
+		estimate_encoded_bits(dictionary, &huffman_bits, &arithmetic_bits);
+		algorithm_id = arithmetic_bits * 100 < huffman_bits * (100 - g_selection_margin) ? ALGORITHM_ARITHMETIC : ALGORITHM_HUFFMAN;
+	}
+
+	set_dictionary_algorithm(dictionary, algorithm_id);
+	finalize_dictionary(dictionary);
+	serialize_dictionary_to_bytes(dictionary,&num_dictionary_bytes,&dictionary_bytes);
+
+	magic_number = TRAINED_MAGIC_NUMBER;
+	version_number = TRAINED_VERSION;
+	id = update_checksum(CHECKSUM_SEED, dictionary_bytes, num_dictionary_bytes);
+
+	dest->write(&magic_number,sizeof(magic_number),1);
+	dest->write(&version_number,sizeof(version_number),1);
+	dest->write(&id,sizeof(id),1);
+	dest->write(&num_dictionary_bytes,sizeof(num_dictionary_bytes),1);
+
+	if (dest->write(dictionary_bytes,sizeof(BYTE),num_dictionary_bytes) != num_dictionary_bytes)
+	{
+		printf("Problem: couldn't write the trained dictionary\n");
+		return false;
+	}
+
+	if (g_verbose)
+	{
+		printf("trained dictionary[%08x] from [%d] samples of [%llu] bytes, %s coded\n", id, num_samples, total_size,
+			algorithm_id == ALGORITHM_HUFFMAN ? "huffman" : "arithmetic");
+	}
+
+	return true;
+}
+
+
+bool load_trained_dictionary(InputStream *source)
+{
+	DWORD magic_number;
+	WORD version_number;
+	WORD id;
+	int num_dictionary_bytes;
+	BYTE *dictionary_bytes;
+
+	if (source->read(&magic_number,sizeof(magic_number),1) != 1 || magic_number != TRAINED_MAGIC_NUMBER)
+	{
+		printf("Problem: not a trained dictionary\n");
+		return false;
+	}
+
+	if (source->read(&version_number,sizeof(version_number),1) != 1 || version_number != TRAINED_VERSION)
+	{
+		printf("Problem: unsupported trained dictionary version[%u]\n", version_number);
+		return false;
+	}
+
+	if (source->read(&id,sizeof(id),1) != 1 ||
+		source->read(&num_dictionary_bytes,sizeof(num_dictionary_bytes),1) != 1 ||
+		num_dictionary_bytes <= 0 || num_dictionary_bytes > MAX_TRAINED_DICTIONARY_SIZE)
+	{
+		printf("Problem: bad trained dictionary header\n");
+		return false;
+	}
+
+	dictionary_bytes = (BYTE *)malloc(num_dictionary_bytes);
+
+	if (read_fully(source, dictionary_bytes, num_dictionary_bytes) != num_dictionary_bytes ||
+		update_checksum(CHECKSUM_SEED, dictionary_bytes, num_dictionary_bytes) != id)
+	{
+		printf("Problem: trained dictionary[%08x] is damaged\n", id);
+		free(dictionary_bytes);
+		return false;
+	}
+
+	reset_driver_arena(&g_context);
+
+	if (deserialize_bytes_to_dictionary(num_dictionary_bytes,dictionary_bytes,g_context.m_arena) == NULL)
+	{
+		printf("Problem: trained dictionary[%08x] doesn't load\n", id);
+		free(dictionary_bytes);
+		return false;
+	}
+
+	unload_trained_dictionary();
+
+	g_trained_dictionary = dictionary_bytes;
+	g_trained_dictionary_size = num_dictionary_bytes;
+	g_trained_dictionary_id = id;
+
+	return true;
+}
+
+
+void unload_trained_dictionary()
+{
+	free(g_trained_dictionary);
+
+	g_trained_dictionary = NULL;
+	g_trained_dictionary_size = 0;
+	g_trained_dictionary_id = 0;
+}
+
+
+bool load_reference(InputStream *source)
+{
+	BYTE *reference;
+	int size;
+
+	size = get_file_size(source);
+	source->seek(0, SEEK_BEGINNING);
+
+	reference = (BYTE *)malloc(size > 0 ? size : 1);
+
+	if (read_fully(source, reference, size) != size)
+	{
+		printf("Problem reading the reference\n");
+		free(reference);
+		return false;
+	}
+
+	unload_reference();
+
+	g_reference = reference;
+	g_reference_size = size;
+	g_reference_id = update_checksum(CHECKSUM_SEED, reference, size);
+
+	index_reference();
+
+	return true;
+}
+
+
+void unload_reference()
+{
+	free(g_reference);
+	free(g_reference_anchors);
+
+	g_reference = NULL;
+	g_reference_size = 0;
+	g_reference_id = 0;
+	g_reference_anchors = NULL;
+	g_reference_anchor_capacity = 0;
+}
+
+
+void set_block_size(int size)
+{
+	if (size < MIN_BLOCK_SIZE)
+	{
+		size = MIN_BLOCK_SIZE;
+	}
+
+	if (size > MAX_BLOCK_SIZE)
+	{
+		size = MAX_BLOCK_SIZE;
+	}
+
+	g_block_size = size;
+}
+
+int get_block_size()
+{
+	return g_block_size;
+}
+
+BYTE apply_compression_level(int level)
+{
+	const struct level_preset *preset;
+
+	if (level < MIN_COMPRESSION_LEVEL)
+	{
+		level = MIN_COMPRESSION_LEVEL;
+	}
+
+	if (level > MAX_COMPRESSION_LEVEL)
+	{
+		level = MAX_COMPRESSION_LEVEL;
+	}
+
+	preset = &(g_level_presets[level - MIN_COMPRESSION_LEVEL]);
+
+	set_block_size(preset->m_block_size);
+	set_alphabet(preset->m_alphabet_id);
+	set_selection_margin(preset->m_selection_margin);
+	set_match_finder(&(preset->m_match_finder));
+
+	return preset->m_algorithm_id;
+}
+
+void set_selection_margin(int percent)
+{
+	if (percent < 0)
+	{
+		percent = 0;
+	}
+
+	if (percent > 100)
+	{
+		percent = 100;
+	}
+
+	g_selection_margin = percent;
+}
+
+int get_selection_margin()
+{
+	return g_selection_margin;
+}
+
+void set_alphabet(BYTE alphabet_id)
+{
+	if (alphabet_id == ALPHABET_AUTO || alphabet_id == ALPHABET_BYTE || alphabet_id == ALPHABET_PAIR || alphabet_id == ALPHABET_WORD)
+	{
+		g_alphabet_id = alphabet_id;
+	}
+}
+
+BYTE get_alphabet()
+{
+	return g_alphabet_id;
+}
+
+void set_match_finder(const struct lz77_parameters *parameters)
+{
+	g_match_finder = *parameters;
+
+	if (g_match_finder.m_window_size < LZ77_MIN_WINDOW_SIZE)
+	{
+		g_match_finder.m_window_size = LZ77_MIN_WINDOW_SIZE;
+	}
+
+	if (g_match_finder.m_window_size > LZ77_MAX_WINDOW_SIZE)
+	{
+		g_match_finder.m_window_size = LZ77_MAX_WINDOW_SIZE;
+	}
+
+	if (g_match_finder.m_max_chain_length < 0)
+	{
+		g_match_finder.m_max_chain_length = 0;
+	}
+}
+
+void get_match_finder(struct lz77_parameters *parameters)
+{
+	*parameters = g_match_finder;
+}
+
+void set_write_index(bool write_index)
+{
+	g_write_index = write_index;
+}
+
+
+void set_block_splitting(bool split)
+{
+	g_split_blocks = split;
+}
+
+void set_pipelining(bool pipeline)
+{
+	g_pipeline = pipeline;
+}
+
+void set_max_memory(DWORD bytes)
+{
+	g_max_memory = bytes;
+}
+
+DWORD get_max_memory()
+{
+	return g_max_memory;
+}
+
+
+void set_verbose(bool verbose)
+{
+	g_verbose = verbose;
+}
+
+void set_collect_stats(bool collect)
+{
+	g_collect_stats = collect;
+}
+
+const struct coder_stats *get_last_stats()
+{
+	return g_collect_stats ? &g_stats : NULL;
+}
+
+
+/////////////////////////////
+// Private Functions
+void *batch_worker(void *opaque)
+{
+	struct batch_structure *batch;
+	struct coder_context context;
+	MemoryInputStream source;
+	MemoryOutputStream dest;
+
+	batch = (struct batch_structure *)opaque;
+	memset(&context, 0, sizeof(context));
+	context.m_block_size = batch->m_block_size;
+	dest.initialize(batch->m_block_size);
+
+	while (true)
+	{
+		struct batch_item *item;
+		int index;
+
+		index = __sync_fetch_and_add(&batch->m_next_item, 1);
+		if (index >= batch->m_num_items)
+		{
+			break;
+		}
+
+		item = &batch->m_items[index];
+
+		source.initialize(item->m_source, item->m_source_size);
+		dest.rewind();
+		item->m_succeeded = compress_stream(&context, batch->m_algorithm_id, &source, &dest);
+		source.shutdown();
+
+		if (item->m_succeeded == false)
+		{
+			printf("Problem: batch item[%d] didn't compress\n", index);
+			continue;
+		}
+
+		item->m_compressed_size = dest.getSize();
+		item->m_compressed = (BYTE *)malloc(item->m_compressed_size);
+		memcpy(item->m_compressed, dest.getBuffer(), item->m_compressed_size);
+	}
+
+	dest.shutdown();
+	release_context(&context);
+
+	return NULL;
+}
+
+
+void release_context(struct coder_context *context)
+{
+	int i;
+
+	if (context->m_arena != NULL)
+	{
+		destroy_arena(context->m_arena);
+	}
+
+	if (context->m_payload_stream != NULL)
+	{
+		context->m_payload_stream->shutdown();
+		delete context->m_payload_stream;
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		if (context->m_trial_streams[i] != NULL)
+		{
+			context->m_trial_streams[i]->shutdown();
+			delete context->m_trial_streams[i];
+		}
+	}
+
+	free(context->m_block_buffer);
+	free(context->m_index);
+	free(context->m_settings.m_trained_dictionary);
+	memset(context, 0, sizeof(*context));
+}
+
+
+// copies what coding reads into the context, so a stream keeps the settings it began with; a trained
+// dictionary is only copied again when it isn't the one already held
+void capture_settings(struct coder_context *context)
+{
+	struct coder_settings *alias;
+
+	alias = &(context->m_settings);
+
+	alias->m_alphabet_id = g_alphabet_id;
+	alias->m_selection_margin = g_selection_margin;
+	alias->m_match_finder = g_match_finder;
+	alias->m_split_blocks = g_split_blocks;
+
+	if (g_trained_dictionary == NULL || alias->m_trained_dictionary == NULL ||
+		alias->m_trained_dictionary_id != g_trained_dictionary_id || alias->m_trained_dictionary_size != g_trained_dictionary_size)
+	{
+		free(alias->m_trained_dictionary);
+		alias->m_trained_dictionary = NULL;
+		alias->m_trained_dictionary_size = 0;
+		alias->m_trained_dictionary_id = 0;
+
+		if (g_trained_dictionary != NULL)
+		{
+			alias->m_trained_dictionary = (BYTE *)malloc(g_trained_dictionary_size);
+			memcpy(alias->m_trained_dictionary, g_trained_dictionary, g_trained_dictionary_size);
+			alias->m_trained_dictionary_size = g_trained_dictionary_size;
+			alias->m_trained_dictionary_id = g_trained_dictionary_id;
+		}
+	}
+}
+
+
+bool compress_stream(struct coder_context *context, BYTE algorithm_id, InputStream *source, OutputStream *dest)
+{
+	bool result;
+	struct stage_timer total_timer;
+	int dest_start;
+	int original_size_position;
+
+	reset_stats(context->m_stats, true);
+	start_stage(context->m_stats, &total_timer);
+
+	source->seek(0, SEEK_BEGINNING);
+	dest_start = dest->tell();
+
+	// patched once the input has run out, a stream being read can't be trusted to know its size up front
+	original_size_position = begin_stream(context, algorithm_id, 0, get_file_size(source), dest);
+
+	result = compress_blocks(context, algorithm_id, source, dest, dest_start);
+
+	if ((context->m_meta.m_flags & STREAM_FLAG_SINGLE) == 0)
+	{
+		dest->seek(original_size_position,SEEK_BEGINNING);
+		dest->write(&context->m_meta.m_original_size,sizeof(context->m_meta.m_original_size),1);
+		dest->seek(0, SEEK_ENDING);
+	}
+
+	finish_stats(context->m_stats, &total_timer, context->m_meta.m_original_size, dest->tell() - dest_start);
+
+	return result;
+}
+
+
+// sets m_meta up for a new stream with the current settings and writes its header, returning where
+// in dest the original size went so it can be patched once it's known. An input of source_size bytes
+// that fits in one block is framed as just that block, which for small records is most of the stream
+int begin_stream(struct coder_context *context, BYTE algorithm_id, BYTE extra_flags, DWORD source_size, OutputStream *dest)
+{
+	int result;
+
+	context->m_meta.m_magic_number = MAGIC_NUMBER;
+	context->m_meta.m_version_number = VERSION;
+	context->m_meta.m_algorithm_id = algorithm_id;
+	context->m_meta.m_flags = (g_write_index ? STREAM_FLAG_INDEX : 0) | (g_reference != NULL ? STREAM_FLAG_DELTA : 0) | extra_flags;
+	context->m_meta.m_block_size = context->m_block_size > 0 ? context->m_block_size : g_block_size;
+	context->m_meta.m_original_size = 0;
+
+	if ((extra_flags & STREAM_FLAG_UNSIZED) == 0 && source_size > 0 && source_size <= (DWORD)context->m_meta.m_block_size)
+	{
+		context->m_meta.m_flags = (context->m_meta.m_flags & ~STREAM_FLAG_INDEX) | STREAM_FLAG_SINGLE;
+		context->m_meta.m_block_size = (WORD)source_size;
+	}
+
+	context->m_meta.m_reference_size = g_reference_size;
+	context->m_meta.m_reference_id = g_reference_id;
+	context->m_meta.crc = CHECKSUM_SEED;
+	context->m_index_size = 0;
+	context->m_reference_anchor = 0;
+	context->m_reference_anchor_offset = 0;
+
+	capture_settings(context);
+
+	dest->write(&context->m_meta.m_magic_number,sizeof(context->m_meta.m_magic_number),1);
+	dest->write(&context->m_meta.m_version_number,sizeof(context->m_meta.m_version_number),1);
+	dest->write(&context->m_meta.m_algorithm_id,sizeof(context->m_meta.m_algorithm_id),1);
+	dest->write(&context->m_meta.m_flags,sizeof(context->m_meta.m_flags),1);
+	dest->write(&context->m_meta.m_block_size,sizeof(context->m_meta.m_block_size),1);
+
+	result = dest->tell();
+	if ((context->m_meta.m_flags & STREAM_FLAG_SINGLE) == 0)
+	{
+		dest->write(&context->m_meta.m_original_size,sizeof(context->m_meta.m_original_size),1);
+	}
+
+	if (context->m_meta.m_flags & STREAM_FLAG_DELTA)
+	{
+		dest->write(&context->m_meta.m_reference_size,sizeof(context->m_meta.m_reference_size),1);
+		dest->write(&context->m_meta.m_reference_id,sizeof(context->m_meta.m_reference_id),1);
+	}
+
+	return result;
+}
+
+
+// codes up to a block's worth of input as the next block, or several where its statistics drift;
+// position is where dest is in the stream, for the index
+bool compress_buffer(struct coder_context *context, BYTE algorithm_id, const BYTE *buffer, int size, OutputStream *dest, DWORD position, int *num_blocks)
+{
+	struct stage_timer timer;
+	int first_piece;
+	bool result;
+
+	start_stage(context->m_stats, &timer);
+	context->m_meta.crc = update_checksum(context->m_meta.crc, buffer, size);
+	stop_stage(context->m_stats, STAGE_CHECKSUM, &timer, size, 0);
+
+	// a single block stream has promised its reader exactly one
+	first_piece = (context->m_meta.m_flags & STREAM_FLAG_SINGLE) ? size : next_block_split(context, buffer, size);
+
+	if (first_piece < size)
+	{
+		result = compress_split_block(context, dest, position, algorithm_id, buffer, size, first_piece, num_blocks);
+	}
+	else
+	{
+		add_index_entry(context, position, context->m_meta.m_original_size);
+		context->m_block_offset = context->m_meta.m_original_size;
+
+		result = compress_block(context, dest, algorithm_id, buffer, size);
+		(*num_blocks)++;
+	}
+
+	if (result)
+	{
+		context->m_meta.m_original_size += size;
+	}
+
+	return result;
+}
+
+
+// the end marker, the crc of everything coded and the index, none of which a single block stream has
+void end_stream(struct coder_context *context, OutputStream *dest)
+{
+	WORD end_marker;
+
+	if (context->m_meta.m_flags & STREAM_FLAG_SINGLE)
+	{
+		return;
+	}
+
+	end_marker = 0;
+	dest->write(&end_marker,sizeof(end_marker),1);
+	dest->write(&context->m_meta.crc,sizeof(context->m_meta.crc),1);
+
+	if (context->m_meta.m_flags & STREAM_FLAG_INDEX)
+	{
+		write_index(context, dest);
+	}
+}
+
+
+// codes source as blocks of m_meta's block size from wherever dest is, then ends the stream with the
+// end marker, the crc and the index; m_meta's crc and original size and m_index carry on from the
+// blocks already in front, whose offsets are counted from dest_start
+bool compress_blocks(struct coder_context *context, BYTE algorithm_id, InputStream *source, OutputStream *dest, int dest_start)
+{
+	bool result;
+	DWORD source_size;
+	int num_blocks;
+
+	source_size = get_file_size(source);
+
+	num_blocks = 0;
+	memset(context->m_blocks_per_algorithm, 0, sizeof(context->m_blocks_per_algorithm));
+	if (context->m_verbose)
+	{
+		print_progress_start();
+	}
+
+	// with more than one block to code, reading the next one and writing the last overlap with the coding
+	if (context->m_pipeline && source_size > (DWORD)context->m_meta.m_block_size)
+	{
+		result = compress_pipelined(context, algorithm_id, source, dest, dest->tell() - dest_start, source_size, &num_blocks);
+	}
+	else
+	{
+		result = compress_serially(context, algorithm_id, source, dest, dest->tell() - dest_start, source_size, &num_blocks);
+	}
+
+	if (context->m_verbose)
+	{
+		print_progress_end();
+	}
+
+	end_stream(context, dest);
+
+	if (context->m_verbose)
+	{
+		printf("blocks[%d] of up to [%d] bytes  lz77[%d] huffman[%d] arithmetic[%d] trained[%d] stored[%d]  stream crc[%08x]\n", num_blocks, context->m_meta.m_block_size,
+			context->m_blocks_per_algorithm[ALGORITHM_LZ77], context->m_blocks_per_algorithm[ALGORITHM_HUFFMAN], context->m_blocks_per_algorithm[ALGORITHM_ARITHMETIC],
+			context->m_blocks_per_algorithm[ALGORITHM_TRAINED], context->m_blocks_per_algorithm[ALGORITHM_STORED], context->m_meta.crc);
+	}
+
+	return result;
+}
+
+
+// reads a block, codes it, writes it and only then reads the next; position is dest's offset in the stream
+bool compress_serially(struct coder_context *context, BYTE algorithm_id, InputStream *source, OutputStream *dest, DWORD position, DWORD source_size, int *num_blocks)
+{
+	float current_bar_percentile;
+	bool result;
+
+	reserve_block_buffer(context, context->m_meta.m_block_size);
+
+	result = true;
+	current_bar_percentile = 0.0f;
+
+	while (true)
+	{
+		struct stage_timer timer;
+		int amount_read;
+		int dest_before;
+
+		start_stage(context->m_stats, &timer);
+		amount_read = read_fully(source, context->m_block_buffer, context->m_meta.m_block_size);
+		stop_stage(context->m_stats, STAGE_READ, &timer, amount_read, amount_read);
+
+		if (amount_read == 0)
+		{
+			break;
+		}
+
+		dest_before = dest->tell();
+
+		result = compress_buffer(context, algorithm_id, context->m_block_buffer, amount_read, dest, position, num_blocks);
+		if (result == false)
+		{
+			break;
+		}
+
+		position += dest->tell() - dest_before;
+
+		if (context->m_verbose)
+		{
+			print_progress(&current_bar_percentile, amount_read, source_size);
+		}
+
+		// an input that grew since its size was taken can't spill into a block the header didn't allow for
+		if (context->m_meta.m_flags & STREAM_FLAG_SINGLE)
+		{
+			break;
+		}
+	}
+
+	return result;
+}
+
+
+// the same as compress_serially(), with the reading and the writing on threads of their own; the coding
+// stays on this one, in order, so the stream comes out byte for byte the same
+bool compress_pipelined(struct coder_context *context, BYTE algorithm_id, InputStream *source, OutputStream *dest, DWORD position, DWORD source_size, int *num_blocks)
+{
+	struct pipeline_structure pipeline;
+	pthread_t reader;
+	pthread_t writer;
+	float current_bar_percentile;
+	bool result;
+
+	if (start_pipeline(&pipeline, context, source, dest, 0, source_size, false, &reader, &writer) == false)
+	{
+		return compress_serially(context, algorithm_id, source, dest, position, source_size, num_blocks);
+	}
+
+	result = true;
+	current_bar_percentile = 0.0f;
+	context->m_buffering_writes = true;
+
+	while (true)
+	{
+		struct pipeline_slot *slot;
+
+		slot = (struct pipeline_slot *)ring_pop(pipeline.m_filled);
+
+		if (slot->m_last)
+		{
+			ring_push(pipeline.m_coded, slot);
+			break;
+		}
+
+		slot->m_output_size = 0;
+
+		// once coding has failed the rest of the input goes by unwritten
+		if (result)
+		{
+			slot->m_coded->rewind();
+
+			result = compress_buffer(context, algorithm_id, slot->m_input, slot->m_input_size, slot->m_coded, position, num_blocks);
+			if (result)
+			{
+				slot->m_output_bytes = slot->m_coded->getBuffer();
+				slot->m_output_size = slot->m_coded->getSize();
+				position += slot->m_output_size;
+			}
+			else
+			{
+				__atomic_store_n(&(pipeline.m_abort), 1, __ATOMIC_RELEASE);
+			}
+
+			if (context->m_verbose)
+			{
+				print_progress(&current_bar_percentile, slot->m_input_size, source_size);
+			}
+		}
+
+		ring_push(pipeline.m_coded, slot);
+	}
+
+	context->m_buffering_writes = false;
+	finish_pipeline(&pipeline, reader, writer);
+
+	return result;
+}
+
+
+bool compress_block(struct coder_context *context, OutputStream *dest, BYTE algorithm_id, const BYTE *block, int block_size)
+{
+	int lz77_payload_size;
+	DWORD estimated_bits;
+	BYTE alphabet_id;
+	BYTE coder_id;
+
+	reset_driver_arena(context);
+
+	if (algorithm_id == ALGORITHM_STORED)
+	{
+		return write_block(context, dest, ALGORITHM_STORED, block, block_size, block, block_size);
+	}
+
+	if (context->m_payload_stream == NULL)
+	{
+		context->m_payload_stream = new MemoryOutputStream();
+		context->m_payload_stream->initialize(context->m_meta.m_block_size);
+	}
+
+	context->m_payload_stream->rewind();
+
+	if (context->m_settings.m_trained_dictionary != NULL)
+	{
+		return compress_trained_block(context, dest, block, block_size);
+	}
+
+	// the lz77 payload is built first and only loses to coding the block on its own when the
+	// counting pass says that comes out smaller
+	lz77_payload_size = encode_lz77_payload(context, algorithm_id, block, block_size);
+	if (lz77_payload_size < 0)
+	{
+		return false;
+	}
+
+	// with ALPHABET_AUTO the bytes are counted alone first: the pair and word counts take several times
+	// as long and are only worth it when the lz77 payload doesn't already beat what the bytes would cost
+	alphabet_id = context->m_settings.m_alphabet_id;
+	if (alphabet_id == ALPHABET_AUTO && lz77_payload_size > 0)
+	{
+		alphabet_id = ALPHABET_BYTE;
+	}
+
+	coder_id = model_stream(context, algorithm_id, alphabet_id, block, block_size, &estimated_bits);
+
+	if (lz77_payload_size > 0 && (DWORD)lz77_payload_size * 8 <= estimated_bits)
+	{
+		if (lz77_payload_size >= block_size)
+		{
+			return write_block(context, dest, ALGORITHM_STORED, block, block_size, block, block_size);
+		}
+
+		return write_block(context, dest, ALGORITHM_LZ77, block, block_size, context->m_payload_stream->getBuffer(), lz77_payload_size);
+	}
+
+	if (alphabet_id != context->m_settings.m_alphabet_id)
+	{
+		coder_id = model_stream(context, algorithm_id, ALPHABET_AUTO, block, block_size, &estimated_bits);
+	}
+
+	algorithm_id = coder_id;
+
+	if (algorithm_id == ALGORITHM_STORED)
+	{
+		return write_block(context, dest, ALGORITHM_STORED, block, block_size, block, block_size);
+	}
+
+	context->m_payload_stream->rewind();
+
+	if (encode_stream(context, context->m_payload_stream, algorithm_id, block, block_size) == false)
+	{
+		return false;
+	}
+
+	// whatever was asked for, a block never goes out bigger than it came in
+	if (context->m_payload_stream->getSize() >= block_size)
+	{
+		return write_block(context, dest, ALGORITHM_STORED, block, block_size, block, block_size);
+	}
+
+	return write_block(context, dest, algorithm_id, block, block_size, context->m_payload_stream->getBuffer(), context->m_payload_stream->getSize());
+}
+
+
+// a block whose statistics drift is coded both whole and in the pieces next_block_split() cuts it into,
+// and whichever comes out smaller goes to dest; order-0 costs say where the tables should change, only
+// coding it says what the lz77 matches across the cuts were worth. pieces are ordinary blocks, the
+// decoder switches tables at each one's header
+bool compress_split_block(struct coder_context *context, OutputStream *dest, DWORD position, BYTE algorithm_id, const BYTE *block, int size, int first_piece, int *num_blocks)
+{
+	int counts_before[NUM_ALGORITHM_IDS];
+	int counts_whole[NUM_ALGORITHM_IDS];
+	int stats_before;
+	MemoryOutputStream *whole;
+	MemoryOutputStream *split;
+	MemoryOutputStream *kept;
+	struct block_header header;
+	const BYTE *cursor;
+	const BYTE *end;
+	DWORD uncompressed_offset;
+	struct stage_timer timer;
+	bool buffering_writes;
+	bool result;
+	int offset;
+	int piece_size;
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		if (context->m_trial_streams[i] == NULL)
+		{
+			context->m_trial_streams[i] = new MemoryOutputStream();
+			context->m_trial_streams[i]->initialize(context->m_meta.m_block_size);
+		}
+
+		context->m_trial_streams[i]->rewind();
+	}
+
+	whole = context->m_trial_streams[0];
+	split = context->m_trial_streams[1];
+
+	memcpy(counts_before, context->m_blocks_per_algorithm, sizeof(counts_before));
+	stats_before = context->m_stats != NULL ? context->m_stats->m_num_blocks : 0;
+
+	context->m_block_offset = context->m_meta.m_original_size;
+
+	buffering_writes = context->m_buffering_writes;
+	context->m_buffering_writes = true;
+
+	if (compress_block(context, whole, algorithm_id, block, size) == false)
+	{
+		context->m_buffering_writes = buffering_writes;
+		return false;
+	}
+
+	memcpy(counts_whole, context->m_blocks_per_algorithm, sizeof(counts_whole));
+
+	offset = 0;
+	piece_size = first_piece;
+
+	while (true)
+	{
+		context->m_block_offset = context->m_meta.m_original_size + offset;
+
+		if (compress_block(context, split, algorithm_id, block + offset, piece_size) == false)
+		{
+			context->m_buffering_writes = buffering_writes;
+			return false;
+		}
+
+		offset += piece_size;
+		if (offset >= size)
+		{
+			break;
+		}
+
+		piece_size = next_block_split(context, block + offset, size - offset);
+	}
+
+	context->m_buffering_writes = buffering_writes;
+
+	// the counts and block stats of the coding that loses are taken back
+	if (whole->getSize() <= split->getSize())
+	{
+		kept = whole;
+		memcpy(context->m_blocks_per_algorithm, counts_whole, sizeof(counts_whole));
+		drop_block_stats(context->m_stats, stats_before + 1, context->m_stats != NULL ? context->m_stats->m_num_blocks - stats_before - 1 : 0);
+	}
+	else
+	{
+		kept = split;
+		for (i = 0; i < NUM_ALGORITHM_IDS; i++)
+		{
+			context->m_blocks_per_algorithm[i] -= counts_whole[i] - counts_before[i];
+		}
+		drop_block_stats(context->m_stats, stats_before, 1);
+	}
+
+	// the index learns where each kept block starts from the headers on the way out
+	cursor = kept->getBuffer();
+	end = cursor + kept->getSize();
+	uncompressed_offset = context->m_meta.m_original_size;
+
+	while (cursor < end)
+	{
+		memcpy(&header.m_uncompressed_size, cursor, sizeof(header.m_uncompressed_size));
+		memcpy(&header.m_payload_size, cursor + sizeof(header.m_uncompressed_size), sizeof(header.m_payload_size));
+
+		add_index_entry(context, position + (cursor - kept->getBuffer()), uncompressed_offset);
+
+		uncompressed_offset += header.m_uncompressed_size;
+		cursor += sizeof(header.m_uncompressed_size) + sizeof(header.m_payload_size) + sizeof(header.m_crc) + sizeof(header.m_algorithm_id) + header.m_payload_size;
+		(*num_blocks)++;
+	}
+
+	start_stage(context->m_buffering_writes ? NULL : context->m_stats, &timer);
+	result = dest->write((void *)kept->getBuffer(), sizeof(BYTE), kept->getSize()) == kept->getSize();
+	stop_stage(context->m_buffering_writes ? NULL : context->m_stats, STAGE_WRITE, &timer, kept->getSize(), kept->getSize());
+
+	return result;
+}
+
+
+// parses the block with the match finder and codes each of its streams with whichever coder
+// suits that stream; returns the payload size, 0 when the finder is off or found nothing, and
+// -1 when a stream can't be coded
+int encode_lz77_payload(struct coder_context *context, BYTE algorithm_id, const BYTE *block, int block_size)
+{
+	struct lz77_streams streams;
+	const BYTE *sources[NUM_LZ77_STREAMS];
+	int sizes[NUM_LZ77_STREAMS];
+	WORD num_literals;
+	WORD num_matches;
+	WORD num_extra_bytes;
+	struct stage_timer timer;
+	struct lz77_parameters parameters;
+	int prefix_start;
+	int prefix_size;
+	bool parsed;
+	int i;
+
+	start_stage(context->m_stats, &timer);
+
+	parameters = context->m_settings.m_match_finder;
+	prefix_start = 0;
+	prefix_size = 0;
+
+	// the block goes in right after its piece of the reference, with a window that takes in both
+	if (context->m_meta.m_flags & STREAM_FLAG_DELTA)
+	{
+		BYTE *buffer;
+
+		reference_slice(find_reference_anchor(context, block, block_size), block_size, &prefix_start, &prefix_size);
+
+		buffer = (BYTE *)arena_allocate(context->m_arena, prefix_size + block_size);
+		memcpy(buffer, g_reference + prefix_start, prefix_size);
+		memcpy(buffer + prefix_size, block, block_size);
+
+		block = buffer + prefix_size;
+
+		if (parameters.m_window_size < prefix_size + block_size)
+		{
+			parameters.m_window_size = prefix_size + block_size;
+		}
+	}
+
+	parsed = lz77_parse(block, block_size, prefix_size, &parameters, context->m_arena, &streams);
+	stop_stage(context->m_stats, STAGE_LZ77, &timer, block_size, parsed ? streams.m_num_literals + 3 * streams.m_num_matches + 1 + streams.m_num_extra_bytes : 0);
+
+	if (parsed == false || streams.m_num_matches == 0)
+	{
+		return 0;
+	}
+
+	num_literals = streams.m_num_literals;
+	num_matches = streams.m_num_matches;
+	num_extra_bytes = streams.m_num_extra_bytes;
+
+	if (context->m_meta.m_flags & STREAM_FLAG_DELTA)
+	{
+		DWORD slice_start;
+
+		slice_start = prefix_start;
+		context->m_payload_stream->write(&slice_start,sizeof(slice_start),1);
+	}
+
+	context->m_payload_stream->write(&num_literals,sizeof(num_literals),1);
+	context->m_payload_stream->write(&num_matches,sizeof(num_matches),1);
+	context->m_payload_stream->write(&num_extra_bytes,sizeof(num_extra_bytes),1);
+
+	sources[0] = streams.m_literals;
+	sizes[0] = streams.m_num_literals;
+	sources[1] = streams.m_run_codes;
+	sizes[1] = streams.m_num_matches + 1;
+	sources[2] = streams.m_length_codes;
+	sizes[2] = streams.m_num_matches;
+	sources[3] = streams.m_distance_codes;
+	sizes[3] = streams.m_num_matches;
+
+	for (i = 0; i < NUM_LZ77_STREAMS; i++)
+	{
+		BYTE stream_algorithm_id;
+		WORD stream_size;
+		DWORD estimated_bits;
+		int header_position;
+
+		stream_algorithm_id = model_stream(context, algorithm_id, ALPHABET_BYTE, sources[i], sizes[i], &estimated_bits);
+
+		header_position = context->m_payload_stream->getSize();
+		stream_size = 0;
+		context->m_payload_stream->write(&stream_algorithm_id,sizeof(stream_algorithm_id),1);
+		context->m_payload_stream->write(&stream_size,sizeof(stream_size),1);
+
+		if (encode_stream(context, context->m_payload_stream, stream_algorithm_id, sources[i], sizes[i]) == false)
+		{
+			return -1;
+		}
+
+		stream_size = context->m_payload_stream->getSize() - header_position - sizeof(stream_algorithm_id) - sizeof(stream_size);
+
+		context->m_payload_stream->seek(header_position + sizeof(stream_algorithm_id),SEEK_BEGINNING);
+		context->m_payload_stream->write(&stream_size,sizeof(stream_size),1);
+		context->m_payload_stream->seek(0, SEEK_ENDING);
+	}
+
+	context->m_payload_stream->write(streams.m_extra_bits,sizeof(BYTE),streams.m_num_extra_bytes);
+
+//	printf("lz77 block[%d] payload[%d]\n", block_size, context->m_payload_stream->getSize());
+
+	return context->m_payload_stream->getSize();
+}
+
+
+// counts source into context->m_meta.m_dictionary and picks the coder for it, which may be ALGORITHM_STORED;
+// estimated_bits is what the payload should come to with that coder
+BYTE model_stream(struct coder_context *context, BYTE algorithm_id, BYTE alphabet_id, const BYTE *source, int size, DWORD *estimated_bits)
+{
+	struct stage_timer timer;
+	BYTE result;
+
+	if (size == 0)
+	{
+		*estimated_bits = 0;
+		return ALGORITHM_STORED;
+	}
+
+	start_stage(context->m_stats, &timer);
+
+	context->m_meta.m_dictionary = build_block_dictionary(context, algorithm_id, alphabet_id, source, size);
+	result = choose_block_algorithm(context, algorithm_id, size, estimated_bits);
+
+	stop_stage(context->m_stats, STAGE_HISTOGRAM, &timer, size, 0);
+
+	return result;
+}
+
+
+// appends the payload for source coded with algorithm_id, using the dictionary model_stream(context) just built
+bool encode_stream(struct coder_context *context, OutputStream *dest, BYTE algorithm_id, const BYTE *source, int size)
+{
+	if (algorithm_id == ALGORITHM_STORED)
+	{
+		return dest->write((void *)source,sizeof(BYTE),size) == size;
+	}
+
+	{
+		struct stage_timer timer;
+		int num_dictionary_bytes;
+		BYTE *dictionary_bytes;
+
+		start_stage(context->m_stats, &timer);
+
+		set_dictionary_algorithm(context->m_meta.m_dictionary, algorithm_id);
+
+		finalize_dictionary(context->m_meta.m_dictionary);
+//		print_dictionary(context->m_meta.m_dictionary);
+
+		serialize_dictionary_to_bytes(context->m_meta.m_dictionary,&num_dictionary_bytes,&dictionary_bytes);
+		dest->write(&num_dictionary_bytes,sizeof(num_dictionary_bytes),1);
+		dest->write(dictionary_bytes,sizeof(dictionary_bytes[0]),num_dictionary_bytes);
+
+		stop_stage(context->m_stats, STAGE_MODEL, &timer, 0, sizeof(num_dictionary_bytes) + num_dictionary_bytes);
+	}
+
+	return encode_symbols(context, dest, source, size);
+}
+
+
+// appends the bitstream for source, coded with the finalized context->m_meta.m_dictionary
+bool encode_symbols(struct coder_context *context, OutputStream *dest, const BYTE *source, int size)
+{
+	struct stage_timer timer;
+	int start_position;
+	bool result;
+
+	start_stage(context->m_stats, &timer);
+	start_position = dest->tell();
+
+	if (uses_four_streams(context->m_meta.m_dictionary, size))
+	{
+		result = encode_four_streams(context, dest, source, size);
+	}
+	else
+	{
+		result = encode_one_stream(context, dest, source, size);
+	}
+
+	stop_stage(context->m_stats, STAGE_CODING, &timer, size, dest->tell() - start_position);
+
+	return result;
+}
+
+
+// the remainder bits count, then one bitstream
+bool encode_one_stream(struct coder_context *context, OutputStream *dest, const BYTE *source, int size)
+{
+	int remainder_bits_position;
+
+	remainder_bits_position = dest->tell();
+
+	//write some dummy data to acount for what could be
+	context->m_meta.m_compressed_stream.m_number_of_remainder_bits = 0;
+	dest->write(&context->m_meta.m_compressed_stream.m_number_of_remainder_bits, sizeof(BYTE), 1);
+
+	// in case the compressor in question requires a final flush
+	if (write_packed_stream(context, dest, source, size, true, &context->m_meta.m_compressed_stream.m_number_of_remainder_bits) == false)
+	{
+		return false;
+	}
+
+	if (context->m_meta.m_compressed_stream.m_number_of_remainder_bits != 0)
+	{
+		dest->seek(remainder_bits_position,SEEK_BEGINNING);
+		dest->write(&context->m_meta.m_compressed_stream.m_number_of_remainder_bits, sizeof(BYTE), 1);
+		dest->seek(0, SEEK_ENDING);
+	}
+
+//	printf("remainder bits[%d]\n", context->m_meta.m_compressed_stream.m_number_of_remainder_bits);
+
+	return true;
+}
+
+
+bool encode_four_streams(struct coder_context *context, OutputStream *dest, const BYTE *source, int size)
+{
+	WORD stream_sizes[HUFFMAN_NUM_STREAMS - 1];
+	int sizes[HUFFMAN_NUM_STREAMS];
+	int jump_table_position;
+	int i;
+
+	four_stream_sizes(size, sizes);
+
+	jump_table_position = dest->tell();
+	memset(stream_sizes, 0, sizeof(stream_sizes));
+	dest->write(stream_sizes, sizeof(stream_sizes[0]), HUFFMAN_NUM_STREAMS - 1);
+
+	for (i = 0; i < HUFFMAN_NUM_STREAMS; i++)
+	{
+		BYTE remainder_bits;
+		int stream_start;
+
+		stream_start = dest->tell();
+
+		if (write_packed_stream(context, dest, source, sizes[i], false, &remainder_bits) == false)
+		{
+			return false;
+		}
+
+		if (i < HUFFMAN_NUM_STREAMS - 1)
+		{
+			stream_sizes[i] = dest->tell() - stream_start;
+		}
+
+		source += sizes[i];
+	}
+
+	dest->seek(jump_table_position,SEEK_BEGINNING);
+	dest->write(stream_sizes, sizeof(stream_sizes[0]), HUFFMAN_NUM_STREAMS - 1);
+	dest->seek(0, SEEK_ENDING);
+
+	return true;
+}
+
+
+// codes a stream a chunk at a time, so dest sees one write per chunk rather than one per byte;
+// the last byte is padded out and remainder_bits says how much of it is used, 0 for all of it
+bool write_packed_stream(struct coder_context *context, OutputStream *dest, const BYTE *source, int size, bool flush, BYTE *remainder_bits)
+{
+	BYTE chunk[PACKED_CHUNK_SIZE];
+	struct packed_bit_writer writer;
+
+	writer.m_bits = 0;
+	writer.m_num_bits = 0;
+
+	while (size > 0)
+	{
+		int used;
+
+		writer.m_cursor = chunk;
+		writer.m_end = chunk + PACKED_CHUNK_SIZE;
+
+		used = encode_buffer_packed(context->m_meta.m_dictionary, &writer, source, size);
+		if (used < 0)
+		{
+			printf("Problem: block has a symbol its own dictionary doesn't know\n");
+			return false;
+		}
+
+		dest->write(chunk, sizeof(BYTE), writer.m_cursor - chunk);
+
+		source += used;
+		size -= used;
+	}
+
+	writer.m_cursor = chunk;
+	writer.m_end = chunk + PACKED_CHUNK_SIZE;
+
+	if (flush == true)
+	{
+		encode_flush_packed(context->m_meta.m_dictionary, &writer);
+	}
+
+	*remainder_bits = (BYTE)finish_packed_bits(&writer);
+
+	dest->write(chunk, sizeof(BYTE), writer.m_cursor - chunk);
+
+	return true;
+}
+
+
+bool uses_four_streams(DICTIONARY dictionary, int size)
+{
+	return size >= FOUR_STREAM_MIN_SIZE && get_dictionary_algorithm(dictionary) == ALGORITHM_HUFFMAN && get_dictionary_alphabet(dictionary) == ALPHABET_BYTE;
+}
+
+
+void four_stream_sizes(int size, int *sizes)
+{
+	int quarter;
+	int i;
+
+	quarter = (size + HUFFMAN_NUM_STREAMS - 1) / HUFFMAN_NUM_STREAMS;
+
+	for (i = 0; i < HUFFMAN_NUM_STREAMS - 1; i++)
+	{
+		sizes[i] = quarter;
+	}
+
+	sizes[HUFFMAN_NUM_STREAMS - 1] = size - quarter * (HUFFMAN_NUM_STREAMS - 1);
+}
+
+
+// no counting pass and no table in the payload, the trained dictionary's id stands in for it
+bool compress_trained_block(struct coder_context *context, OutputStream *dest, const BYTE *block, int block_size)
+{
+	struct stage_timer timer;
+
+	start_stage(context->m_stats, &timer);
+	context->m_meta.m_dictionary = deserialize_bytes_to_dictionary(context->m_settings.m_trained_dictionary_size,context->m_settings.m_trained_dictionary,context->m_arena);
+	stop_stage(context->m_stats, STAGE_MODEL, &timer, context->m_settings.m_trained_dictionary_size, 0);
+
+	context->m_payload_stream->write(&context->m_settings.m_trained_dictionary_id,sizeof(context->m_settings.m_trained_dictionary_id),1);
+
+	if (encode_symbols(context, context->m_payload_stream, block, block_size) == false)
+	{
+		return false;
+	}
+
+	if (context->m_payload_stream->getSize() >= block_size)
+	{
+		return write_block(context, dest, ALGORITHM_STORED, block, block_size, block, block_size);
+	}
+
+	return write_block(context, dest, ALGORITHM_TRAINED, block, block_size, context->m_payload_stream->getBuffer(), context->m_payload_stream->getSize());
+}
+
+
+// counts the block with the requested alphabet, or with each of them for ALPHABET_AUTO, keeping
+// the one whose estimate comes out smallest for the coder that will be used
+DICTIONARY build_block_dictionary(struct coder_context *context, BYTE algorithm_id, BYTE requested_alphabet_id, const BYTE *block, int block_size)
+{
+	DICTIONARY result;
+	DWORD best_bits;
+	BYTE alphabet_id;
+
+	result = NULL;
+	best_bits = 0;
+
+	for (alphabet_id = ALPHABET_BYTE; alphabet_id <= ALPHABET_WORD; alphabet_id++)
+	{
+		DWORD huffman_bits;
+		DWORD arithmetic_bits;
+		DWORD bits;
+
+		if (requested_alphabet_id != ALPHABET_AUTO && requested_alphabet_id != alphabet_id)
+		{
+			continue;
+		}
+
+		context->m_meta.m_dictionary = create_dictionary(algorithm_id == ALGORITHM_AUTO ? ALGORITHM_HUFFMAN : algorithm_id,alphabet_id,context->m_arena);
+		update_dictionary_buffer(context->m_meta.m_dictionary, block, block_size);
+
+		if (requested_alphabet_id != ALPHABET_AUTO)
+		{
+			return context->m_meta.m_dictionary;
+		}
+
+		estimate_encoded_bits(context->m_meta.m_dictionary, &huffman_bits, &arithmetic_bits);
+
+		if (algorithm_id == ALGORITHM_HUFFMAN)
+		{
+			bits = huffman_bits;
+		}
+		else if (algorithm_id == ALGORITHM_ARITHMETIC)
+		{
+			bits = arithmetic_bits;
+		}
+		else
+		{
+			bits = huffman_bits < arithmetic_bits ? huffman_bits : arithmetic_bits;
+		}
+
+		if (result == NULL || bits < best_bits)
+		{
+			result = context->m_meta.m_dictionary;
+			best_bits = bits;
+		}
+	}
+
+	return result;
+}
+
+
+// the dictionary has counted the block but isn't finalized yet; the slower coders only win when
+// they beat the faster choice by more than the selection margin, and a coder that was asked for
+// by name is skipped only when it can't beat storing the block at all
+BYTE choose_block_algorithm(struct coder_context *context, BYTE algorithm_id, int block_size, DWORD *estimated_bits)
+{
+	BYTE result;
+	DWORD huffman_bits;
+	DWORD arithmetic_bits;
+	DWORD stored_bits;
+	DWORD best_bits;
+
+	estimate_encoded_bits(context->m_meta.m_dictionary, &huffman_bits, &arithmetic_bits);
+
+	// the payload's dictionary size and remainder byte
+	huffman_bits += (sizeof(int) + 1) * 8;
+	arithmetic_bits += (sizeof(int) + 1) * 8;
+
+	// four huffman streams swap the remainder byte for the jump table and a padding byte each
+	if (block_size >= FOUR_STREAM_MIN_SIZE && get_dictionary_alphabet(context->m_meta.m_dictionary) == ALPHABET_BYTE)
+	{
+		huffman_bits += (sizeof(WORD) * (HUFFMAN_NUM_STREAMS - 1) + HUFFMAN_NUM_STREAMS - 1) * 8;
+	}
+	stored_bits = (DWORD)block_size * 8;
+
+	result = ALGORITHM_STORED;
+	best_bits = stored_bits;
+
+	if (algorithm_id == ALGORITHM_HUFFMAN)
+	{
+		if (huffman_bits < stored_bits)
+		{
+			result = ALGORITHM_HUFFMAN;
+			best_bits = huffman_bits;
+		}
+	}
+	else if (algorithm_id == ALGORITHM_ARITHMETIC)
+	{
+		if (arithmetic_bits < stored_bits)
+		{
+			result = ALGORITHM_ARITHMETIC;
+			best_bits = arithmetic_bits;
+		}
+	}
+	else
+	{
+		if (huffman_bits * 100 < best_bits * (100 - context->m_settings.m_selection_margin))
+		{
+			result = ALGORITHM_HUFFMAN;
+			best_bits = huffman_bits;
+		}
+
+		if (arithmetic_bits * 100 < best_bits * (100 - context->m_settings.m_selection_margin))
+		{
+			result = ALGORITHM_ARITHMETIC;
+			best_bits = arithmetic_bits;
+		}
+	}
+
+//	printf("block[%d] huffman[%llu] arithmetic[%llu] chose[%d]\n", block_size, huffman_bits, arithmetic_bits, result);
+
+	*estimated_bits = best_bits;
+
+	return result;
+}
+
+
+bool write_block(struct coder_context *context, OutputStream *dest, BYTE algorithm_id, const BYTE *block, int block_size, const BYTE *payload, int payload_size)
+{
+	struct block_header header;
+	struct stage_timer timer;
+	bool result;
+
+	start_stage(context->m_stats, &timer);
+	header.m_crc = update_checksum(CHECKSUM_SEED, block, block_size);
+	stop_stage(context->m_stats, STAGE_CHECKSUM, &timer, block_size, 0);
+
+	header.m_uncompressed_size = block_size;
+	header.m_payload_size = payload_size;
+	header.m_algorithm_id = algorithm_id;
+
+	context->m_blocks_per_algorithm[algorithm_id]++;
+
+	// a copy into a pipeline slot or a trial stream isn't the write, STAGE_WRITE is only what reaches the output
+	start_stage(context->m_buffering_writes ? NULL : context->m_stats, &timer);
+
+	dest->write(&header.m_uncompressed_size,sizeof(header.m_uncompressed_size),1);
+	dest->write(&header.m_payload_size,sizeof(header.m_payload_size),1);
+	dest->write(&header.m_crc,sizeof(header.m_crc),1);
+	dest->write(&header.m_algorithm_id,sizeof(header.m_algorithm_id),1);
+	result = dest->write((void *)payload,sizeof(BYTE),payload_size) == payload_size;
+
+	stop_stage(context->m_buffering_writes ? NULL : context->m_stats, STAGE_WRITE, &timer, payload_size, sizeof(header) + payload_size);
+
+	add_block_stats(context->m_stats, block, block_size, payload_size, algorithm_id);
+
+	return result;
+}
+
+
+bool decompress_block(struct coder_context *context, const struct block_header *header, const BYTE *payload)
+{
+	if (header->m_algorithm_id == ALGORITHM_LZ77)
+	{
+		return decompress_lz77_block(context, header, payload);
+	}
+
+	if (header->m_algorithm_id == ALGORITHM_TRAINED)
+	{
+		return decompress_trained_block(context, header, payload);
+	}
+
+	if (decode_stream(context, header->m_algorithm_id, payload, header->m_payload_size, context->m_block_buffer, header->m_uncompressed_size) == false)
+	{
+		return false;
+	}
+
+	context->m_block_fill = header->m_uncompressed_size;
+
+	return true;
+}
+
+
+bool decompress_lz77_block(struct coder_context *context, const struct block_header *header, const BYTE *payload)
+{
+	struct lz77_streams streams;
+	BYTE *buffers[NUM_LZ77_STREAMS];
+	int sizes[NUM_LZ77_STREAMS];
+	WORD num_literals;
+	WORD num_matches;
+	WORD num_extra_bytes;
+	DWORD slice_start;
+	const BYTE *cursor;
+	const BYTE *end;
+	int i;
+
+	cursor = payload;
+	end = payload + header->m_payload_size;
+	slice_start = 0;
+
+	if (context->m_meta.m_flags & STREAM_FLAG_DELTA)
+	{
+		if (end - cursor < (int)sizeof(slice_start))
+		{
+			return false;
+		}
+
+		memcpy(&slice_start,cursor,sizeof(slice_start));
+		cursor += sizeof(slice_start);
+	}
+
+	if (end - cursor < (int)(3 * sizeof(WORD)))
+	{
+		return false;
+	}
+
+	memcpy(&num_literals,cursor,sizeof(num_literals));
+	cursor += sizeof(num_literals);
+	memcpy(&num_matches,cursor,sizeof(num_matches));
+	cursor += sizeof(num_matches);
+	memcpy(&num_extra_bytes,cursor,sizeof(num_extra_bytes));
+	cursor += sizeof(num_extra_bytes);
+
+	if (num_literals > header->m_uncompressed_size || num_matches > header->m_uncompressed_size / LZ77_MIN_MATCH)
+	{
+		return false;
+	}
+
+	streams.m_num_literals = num_literals;
+	streams.m_num_matches = num_matches;
+	streams.m_literals = (BYTE *)arena_allocate(context->m_arena,num_literals);
+	streams.m_run_codes = (BYTE *)arena_allocate(context->m_arena,num_matches + 1);
+	streams.m_length_codes = (BYTE *)arena_allocate(context->m_arena,num_matches);
+	streams.m_distance_codes = (BYTE *)arena_allocate(context->m_arena,num_matches);
+
+	buffers[0] = streams.m_literals;
+	sizes[0] = num_literals;
+	buffers[1] = streams.m_run_codes;
+	sizes[1] = num_matches + 1;
+	buffers[2] = streams.m_length_codes;
+	sizes[2] = num_matches;
+	buffers[3] = streams.m_distance_codes;
+	sizes[3] = num_matches;
+
+	for (i = 0; i < NUM_LZ77_STREAMS; i++)
+	{
+		BYTE stream_algorithm_id;
+		WORD stream_size;
+
+		if (end - cursor < (int)(sizeof(stream_algorithm_id) + sizeof(stream_size)))
+		{
+			return false;
+		}
+
+		stream_algorithm_id = *cursor;
+		cursor += sizeof(stream_algorithm_id);
+		memcpy(&stream_size,cursor,sizeof(stream_size));
+		cursor += sizeof(stream_size);
+
+		if (stream_size > (WORD)(end - cursor))
+		{
+			return false;
+		}
+
+		if (decode_stream(context, stream_algorithm_id, cursor, stream_size, buffers[i], sizes[i]) == false)
+		{
+			return false;
+		}
+
+		cursor += stream_size;
+	}
+
+	if (end - cursor != (int)num_extra_bytes)
+	{
+		return false;
+	}
+
+	streams.m_extra_bits = (BYTE *)cursor;
+	streams.m_num_extra_bytes = num_extra_bytes;
+
+	{
+		struct stage_timer timer;
+		BYTE *dest;
+		int prefix_size;
+		bool reconstructed;
+
+		start_stage(context->m_stats, &timer);
+
+		dest = context->m_block_buffer;
+		prefix_size = 0;
+
+		if (context->m_meta.m_flags & STREAM_FLAG_DELTA)
+		{
+			int prefix_start;
+
+			// the encoder's choice of piece, only its length follows from what's known here
+			reference_slice(0, header->m_uncompressed_size, &prefix_start, &prefix_size);
+			if (slice_start > (DWORD)(g_reference_size - prefix_size))
+			{
+				return false;
+			}
+			prefix_start = (int)slice_start;
+
+			dest = (BYTE *)arena_allocate(context->m_arena, prefix_size + header->m_uncompressed_size);
+			memcpy(dest, g_reference + prefix_start, prefix_size);
+			dest += prefix_size;
+		}
+
+		reconstructed = lz77_reconstruct(&streams, dest, header->m_uncompressed_size, prefix_size);
+
+		if (reconstructed && dest != context->m_block_buffer)
+		{
+			memcpy(context->m_block_buffer, dest, header->m_uncompressed_size);
+		}
+
+		stop_stage(context->m_stats, STAGE_LZ77, &timer, num_literals + 3 * num_matches + 1 + num_extra_bytes, header->m_uncompressed_size);
+
+		if (reconstructed == false)
+		{
+			return false;
+		}
+	}
+
+	context->m_block_fill = header->m_uncompressed_size;
+
+	return true;
+}
+
+
+bool decompress_trained_block(struct coder_context *context, const struct block_header *header, const BYTE *payload)
+{
+	WORD id;
+
+	if (header->m_payload_size < sizeof(id))
+	{
+		return false;
+	}
+
+	memcpy(&id,payload,sizeof(id));
+
+	if (g_trained_dictionary == NULL || id != g_trained_dictionary_id)
+	{
+		printf("Problem: block needs trained dictionary[%08x]\n", id);
+		return false;
+	}
+
+	{
+		struct stage_timer timer;
+
+		start_stage(context->m_stats, &timer);
+		context->m_meta.m_dictionary = deserialize_bytes_to_dictionary(g_trained_dictionary_size,g_trained_dictionary,context->m_arena);
+		stop_stage(context->m_stats, STAGE_MODEL, &timer, g_trained_dictionary_size, 0);
+	}
+
+	if (decode_symbols(context, payload + sizeof(id), header->m_payload_size - sizeof(id), context->m_block_buffer, header->m_uncompressed_size) == false)
+	{
+		return false;
+	}
+
+	context->m_block_fill = header->m_uncompressed_size;
+
+	return true;
+}
+
+
+// decodes exactly size bytes into dest from a payload coded with algorithm_id
+bool decode_stream(struct coder_context *context, BYTE algorithm_id, const BYTE *payload, int payload_size, BYTE *dest, int size)
+{
+	int num_dictionary_bytes;
+
+	if (algorithm_id == ALGORITHM_STORED)
+	{
+		if (payload_size != size)
+		{
+			return false;
+		}
+
+		memcpy(dest,payload,size);
+		return true;
+	}
+
+	if (algorithm_id != ALGORITHM_HUFFMAN && algorithm_id != ALGORITHM_ARITHMETIC)
+	{
+		return false;
+	}
+
+	if (payload_size < (int)sizeof(num_dictionary_bytes) + 1)
+	{
+		return false;
+	}
+
+	memcpy(&num_dictionary_bytes,payload,sizeof(num_dictionary_bytes));
+	if (num_dictionary_bytes < 0 || num_dictionary_bytes > (int)(payload_size - sizeof(num_dictionary_bytes) - 1))
+	{
+		return false;
+	}
+
+	{
+		struct stage_timer timer;
+
+		start_stage(context->m_stats, &timer);
+		context->m_meta.m_dictionary = deserialize_bytes_to_dictionary(num_dictionary_bytes,(BYTE *)payload + sizeof(num_dictionary_bytes),context->m_arena);
+		stop_stage(context->m_stats, STAGE_MODEL, &timer, sizeof(num_dictionary_bytes) + num_dictionary_bytes, 0);
+	}
+
+	if (context->m_meta.m_dictionary == NULL)
+	{
+		return false;
+	}
+
+	return decode_symbols(context, payload + sizeof(num_dictionary_bytes) + num_dictionary_bytes, payload_size - sizeof(num_dictionary_bytes) - num_dictionary_bytes, dest, size);
+}
+
+
+// payload starts at the bitstream, decoded with context->m_meta.m_dictionary
+bool decode_symbols(struct coder_context *context, const BYTE *payload, int payload_size, BYTE *dest, int size)
+{
+	struct stage_timer timer;
+	bool result;
+
+	start_stage(context->m_stats, &timer);
+
+	if (uses_four_streams(context->m_meta.m_dictionary, size))
+	{
+		result = decode_four_streams(context, payload, payload_size, dest, size);
+	}
+	else
+	{
+		result = decode_one_stream(context, payload, payload_size, dest, size);
+	}
+
+	stop_stage(context->m_stats, STAGE_CODING, &timer, payload_size, size);
+
+	return result;
+}
+
+
+bool decode_one_stream(struct coder_context *context, const BYTE *payload, int payload_size, BYTE *dest, int size)
+{
+	if (payload_size < 1)
+	{
+		return false;
+	}
+
+	// the table decoder stops after exactly size symbols, so it doesn't need the remainder count
+	if (get_dictionary_algorithm(context->m_meta.m_dictionary) == ALGORITHM_HUFFMAN && get_dictionary_alphabet(context->m_meta.m_dictionary) == ALPHABET_BYTE)
+	{
+		return decode_huffman_bytes(context->m_meta.m_dictionary, payload + 1, payload_size - 1, dest, size);
+	}
+
+	context->m_meta.m_compressed_stream.m_number_of_remainder_bits = payload[0];
+//	printf("number of remainder bits existing in block[%d]\n", context->m_meta.m_compressed_stream.m_number_of_remainder_bits);
+
+	return decode_buffer_packed(context->m_meta.m_dictionary, payload + 1, payload_size - 1, context->m_meta.m_compressed_stream.m_number_of_remainder_bits, dest, size) == size;
+}
+
+
+bool decode_four_streams(struct coder_context *context, const BYTE *payload, int payload_size, BYTE *dest, int size)
+{
+	WORD stream_sizes[HUFFMAN_NUM_STREAMS - 1];
+	const BYTE *sources[HUFFMAN_NUM_STREAMS];
+	int source_sizes[HUFFMAN_NUM_STREAMS];
+	int sizes[HUFFMAN_NUM_STREAMS];
+	int remaining;
+	int i;
+
+	if (payload_size < (int)sizeof(stream_sizes))
+	{
+		return false;
+	}
+
+	memcpy(stream_sizes, payload, sizeof(stream_sizes));
+	payload += sizeof(stream_sizes);
+	remaining = payload_size - sizeof(stream_sizes);
+
+	for (i = 0; i < HUFFMAN_NUM_STREAMS - 1; i++)
+	{
+		if (stream_sizes[i] > (WORD)remaining)
+		{
+			return false;
+		}
+
+		sources[i] = payload;
+		source_sizes[i] = stream_sizes[i];
+		payload += stream_sizes[i];
+		remaining -= stream_sizes[i];
+	}
+
+	sources[HUFFMAN_NUM_STREAMS - 1] = payload;
+	source_sizes[HUFFMAN_NUM_STREAMS - 1] = remaining;
+
+	four_stream_sizes(size, sizes);
+
+	return decode_huffman_bytes_x4(context->m_meta.m_dictionary, sources, source_sizes, dest, sizes);
+}
+
+
+// dest may be NULL, which checks every block and the stream crc without writing anything
+bool decode_blocks(struct coder_context *context, InputStream *source, OutputStream *dest)
+{
+	bool result;
+	DWORD source_size;
+	int num_blocks;
+	WORD stream_crc;
+	struct stage_timer total_timer;
+	DWORD total_out;
+	int stream_start;
+
+	reset_stats(context->m_stats, false);
+	start_stage(context->m_stats, &total_timer);
+	total_out = 0;
+
+	source_size = get_file_size(source);
+	stream_start = source->tell();
+
+	if (read_stream_header(context, source) == false || check_reference(context) == false)
+	{
+		return false;
+	}
+
+	if (check_decode_memory(context, decodes_pipelined(context, source_size, stream_start)) == false)
+	{
+		return false;
+	}
+
+	reserve_block_buffer(context, context->m_meta.m_block_size);
+
+	// the whole output is known up front, so a memory destination grows once instead of doubling its way there
+	if (dest != NULL && context->m_meta.m_original_size <= MAX_RESERVE_SIZE)
+	{
+		dest->reserve((int)context->m_meta.m_original_size);
+	}
+
+	context->m_index_size = 0;
+
+	num_blocks = 0;
+	stream_crc = CHECKSUM_SEED;
+	print_progress_start();
+
+	// with more than one block to decode, reading the next one and writing the last overlap with the decoding
+	if (decodes_pipelined(context, source_size, stream_start))
+	{
+		result = decode_pipelined(context, source, dest, stream_start, source_size, &num_blocks, &stream_crc, &total_out);
+	}
+	else
+	{
+		result = decode_serially(context, source, dest, stream_start, source_size, &num_blocks, &stream_crc, &total_out);
+	}
+
+	print_progress_end();
+
+	// the block checked its own crc, all that's left is that it was the size the header said
+	if (result == true && (context->m_meta.m_flags & STREAM_FLAG_SINGLE))
+	{
+		if (total_out != context->m_meta.m_original_size)
+		{
+			printf("Problem: stream holds [%llu] bytes, its header says [%llu]\n", total_out, context->m_meta.m_original_size);
+			result = false;
+		}
+		else if (g_verbose)
+		{
+			printf("blocks[%d] verified  stream crc[%08x]\n", num_blocks, stream_crc);
+		}
+	}
+	else if (result == true)
+	{
+		// the entry for the end marker isn't a block
+		context->m_index_size--;
+
+		if (source->read(&context->m_meta.crc,sizeof(context->m_meta.crc),1) != 1 || context->m_meta.crc != stream_crc)
+		{
+			printf("Problem: stream crc mismatch\n");
+			result = false;
+		}
+		else if ((context->m_meta.m_flags & STREAM_FLAG_UNSIZED) == 0 && total_out != context->m_meta.m_original_size)
+		{
+			printf("Problem: stream holds [%llu] bytes, its header says [%llu]\n", total_out, context->m_meta.m_original_size);
+			result = false;
+		}
+		else if ((context->m_meta.m_flags & STREAM_FLAG_INDEX) && check_index(context, source) == false)
+		{
+			printf("Problem: block index doesn't match the blocks\n");
+			result = false;
+		}
+		else if (g_verbose)
+		{
+			printf("blocks[%d] verified  stream crc[%08x]\n", num_blocks, stream_crc);
+		}
+	}
+
+	finish_stats(context->m_stats, &total_timer, source_size, total_out);
+
+	return result;
+}
+
+
+
+// decodes a single block stream and starts a stream with the usual framing in dest, its first block coded
+// from what was decoded, so more blocks can follow it
+bool reframe_single_block(struct coder_context *context, BYTE algorithm_id, const BYTE *stream, int stream_size, OutputStream *dest, int *original_size_position)
+{
+	MemoryInputStream source;
+	MemoryOutputStream decoded;
+	int num_blocks;
+	bool result;
+
+	source.initialize(stream, stream_size);
+	decoded.initialize(stream_size);
+
+	result = decode_blocks(context, &source, &decoded);
+
+	if (result)
+	{
+		*original_size_position = begin_stream(context, algorithm_id, 0, 0, dest);
+		reserve_block_buffer(context, context->m_meta.m_block_size);
+
+		num_blocks = 0;
+		result = compress_buffer(context, algorithm_id, decoded.getBuffer(), decoded.getSize(), dest, dest->tell(), &num_blocks);
+	}
+
+	decoded.shutdown();
+	source.shutdown();
+
+	return result;
+}
+
+// reads a block, decodes it, writes it and only then reads the next, up to and including the end marker
+bool decode_serially(struct coder_context *context, InputStream *source, OutputStream *dest, int stream_start, DWORD source_size, int *num_blocks, WORD *stream_crc, DWORD *total_out)
+{
+	float current_bar_percentile;
+	bool result;
+
+	result = true;
+	current_bar_percentile = 0.0f;
+
+	while (true)
+	{
+		struct block_header header;
+		struct stage_timer timer;
+		BYTE *payload;
+
+		start_stage(context->m_stats, &timer);
+
+		add_index_entry(context, source->tell() - stream_start, *total_out);
+
+		if (source->read(&header.m_uncompressed_size,sizeof(header.m_uncompressed_size),1) != 1)
+		{
+			printf("Problem: stream is truncated\n");
+			result = false;
+			break;
+		}
+
+		if (header.m_uncompressed_size == 0)
+		{
+			break;
+		}
+
+		if (source->read(&header.m_payload_size,sizeof(header.m_payload_size),1) != 1 ||
+			source->read(&header.m_crc,sizeof(header.m_crc),1) != 1 ||
+			source->read(&header.m_algorithm_id,sizeof(header.m_algorithm_id),1) != 1 ||
+			check_block_header(context, &header, source_size) == false)
+		{
+			printf("Problem: bad header on block[%d]\n", *num_blocks);
+			result = false;
+			break;
+		}
+
+		reset_driver_arena(context);
+		context->m_block_offset = *total_out;
+
+		// nothing to decode in a stored block, the payload lands straight in the block buffer
+		if (header.m_algorithm_id == ALGORITHM_STORED)
+		{
+			payload = context->m_block_buffer;
+		}
+		else
+		{
+			payload = (BYTE *)arena_allocate(context->m_arena,header.m_payload_size);
+		}
+
+		if (read_fully(source, payload, header.m_payload_size) != (int)header.m_payload_size)
+		{
+			printf("Problem: block[%d] is truncated\n", *num_blocks);
+			result = false;
+			break;
+		}
+
+		stop_stage(context->m_stats, STAGE_READ, &timer, sizeof(header) + header.m_payload_size, header.m_payload_size);
+
+		if (decode_payload(context, &header, payload, *num_blocks, stream_crc) == false)
+		{
+			result = false;
+			break;
+		}
+
+		if (dest != NULL)
+		{
+			start_stage(context->m_stats, &timer);
+			dest->write(context->m_block_buffer,sizeof(BYTE),context->m_block_fill);
+			stop_stage(context->m_stats, STAGE_WRITE, &timer, context->m_block_fill, context->m_block_fill);
+		}
+
+		add_block_stats(context->m_stats, context->m_block_buffer, context->m_block_fill, header.m_payload_size, header.m_algorithm_id);
+		*total_out += context->m_block_fill;
+
+		(*num_blocks)++;
+		print_progress(&current_bar_percentile, sizeof(header) + header.m_payload_size, source_size);
+
+		if (context->m_meta.m_flags & STREAM_FLAG_SINGLE)
+		{
+			break;
+		}
+	}
+
+
+	return result;
+}
+
+
+// the same as decode_serially(), with the reading and the writing on threads of their own; the reader
+// stops after the end marker, so the crc and the index are still there for the caller
+bool decode_pipelined(struct coder_context *context, InputStream *source, OutputStream *dest, int stream_start, DWORD source_size, int *num_blocks, WORD *stream_crc, DWORD *total_out)
+{
+	struct pipeline_structure pipeline;
+	pthread_t reader;
+	pthread_t writer;
+	float current_bar_percentile;
+	BYTE *block_buffer;
+	bool result;
+
+	if (start_pipeline(&pipeline, context, source, dest, stream_start, source_size, true, &reader, &writer) == false)
+	{
+		return decode_serially(context, source, dest, stream_start, source_size, num_blocks, stream_crc, total_out);
+	}
+
+	result = true;
+	current_bar_percentile = 0.0f;
+	block_buffer = context->m_block_buffer;
+
+	while (true)
+	{
+		struct pipeline_slot *slot;
+
+		slot = (struct pipeline_slot *)ring_pop(pipeline.m_filled);
+
+		if (result)
+		{
+			add_index_entry(context, slot->m_offset, *total_out);
+		}
+
+		if (slot->m_last)
+		{
+			result = result && slot->m_failed == false;
+			ring_push(pipeline.m_coded, slot);
+			break;
+		}
+
+		slot->m_output_size = 0;
+
+		if (result)
+		{
+			reset_driver_arena(context);
+			context->m_block_offset = *total_out;
+
+			// the block decodes straight into the slot, which the writer then has to itself
+			context->m_block_buffer = slot->m_decoded;
+
+			result = decode_payload(context, &slot->m_header, slot->m_input, *num_blocks, stream_crc);
+			if (result)
+			{
+				slot->m_output_bytes = slot->m_decoded;
+				slot->m_output_size = context->m_block_fill;
+
+				add_block_stats(context->m_stats, slot->m_decoded, context->m_block_fill, slot->m_header.m_payload_size, slot->m_header.m_algorithm_id);
+				*total_out += context->m_block_fill;
+
+				(*num_blocks)++;
+				print_progress(&current_bar_percentile, sizeof(slot->m_header) + slot->m_header.m_payload_size, source_size);
+			}
+			else
+			{
+				__atomic_store_n(&(pipeline.m_abort), 1, __ATOMIC_RELEASE);
+			}
+
+			context->m_block_buffer = block_buffer;
+		}
+
+		ring_push(pipeline.m_coded, slot);
+	}
+
+	finish_pipeline(&pipeline, reader, writer);
+
+	return result;
+}
+
+
+// the slots and rings, then the writer and the reader; false, with nothing left running, when a thread
+// can't be had, and the caller goes without
+bool start_pipeline(struct pipeline_structure *pipeline, struct coder_context *context, InputStream *source, OutputStream *dest, int stream_start, DWORD source_size, bool decoding, pthread_t *reader, pthread_t *writer)
+{
+	int block_size;
+	int i;
+
+	memset(pipeline, 0, sizeof(struct pipeline_structure));
+
+	pipeline->m_context = context;
+	pipeline->m_source = source;
+	pipeline->m_dest = dest;
+	pipeline->m_stream_start = stream_start;
+	pipeline->m_source_size = source_size;
+	pipeline->m_decoding = decoding;
+
+	pipeline->m_filled = create_ring(PIPELINE_SLOTS);
+	pipeline->m_coded = create_ring(PIPELINE_SLOTS);
+	pipeline->m_free = create_ring(PIPELINE_SLOTS);
+
+	block_size = context->m_meta.m_block_size;
+
+	for (i = 0; i < PIPELINE_SLOTS; i++)
+	{
+		struct pipeline_slot *alias;
+
+		alias = &(pipeline->m_slots[i]);
+
+		// a payload is mostly smaller than its block, the reader grows the slot for the rest
+		alias->m_input = (BYTE *)malloc(block_size);
+		alias->m_input_capacity = block_size;
+
+		if (decoding)
+		{
+			alias->m_decoded = (BYTE *)malloc(block_size);
+		}
+		else
+		{
+			alias->m_coded = new MemoryOutputStream();
+			alias->m_coded->initialize(block_size);
+		}
+
+		ring_push(pipeline->m_free, alias);
+	}
+
+	if (pthread_create(writer, NULL, pipeline_writer, pipeline) != 0)
+	{
+		free_pipeline(pipeline);
+		return false;
+	}
+
+	if (pthread_create(reader, NULL, decoding ? pipeline_payload_reader : pipeline_block_reader, pipeline) != 0)
+	{
+		// a last slot sends the writer home
+		pipeline->m_slots[0].m_last = true;
+		ring_push(pipeline->m_coded, &(pipeline->m_slots[0]));
+		pthread_join(*writer, NULL);
+
+		free_pipeline(pipeline);
+		return false;
+	}
+
+	return true;
+}
+
+// the reader has already sent its last slot through, so both threads are on their way out
+void finish_pipeline(struct pipeline_structure *pipeline, pthread_t reader, pthread_t writer)
+{
+	pthread_join(reader, NULL);
+	pthread_join(writer, NULL);
+
+	free_pipeline(pipeline);
+}
+
+void free_pipeline(struct pipeline_structure *pipeline)
+{
+	int i;
+
+	for (i = 0; i < PIPELINE_SLOTS; i++)
+	{
+		struct pipeline_slot *alias;
+
+		alias = &(pipeline->m_slots[i]);
+
+		free(alias->m_input);
+		free(alias->m_decoded);
+
+		if (alias->m_coded != NULL)
+		{
+			alias->m_coded->shutdown();
+			delete alias->m_coded;
+		}
+	}
+
+	destroy_ring(pipeline->m_filled);
+	destroy_ring(pipeline->m_coded);
+	destroy_ring(pipeline->m_free);
+}
+
+
+// the reader when compressing, a block of the source to a slot until the source runs out
+void *pipeline_block_reader(void *opaque)
+{
+	struct pipeline_structure *pipeline;
+	struct coder_context *context;
+
+	pipeline = (struct pipeline_structure *)opaque;
+	context = pipeline->m_context;
+
+	while (true)
+	{
+		struct pipeline_slot *slot;
+		struct stage_timer timer;
+
+		slot = (struct pipeline_slot *)ring_pop(pipeline->m_free);
+
+		slot->m_input_size = 0;
+		if (__atomic_load_n(&(pipeline->m_abort), __ATOMIC_ACQUIRE) == 0)
+		{
+			start_stage(context->m_stats, &timer);
+			slot->m_input_size = read_fully(pipeline->m_source, slot->m_input, context->m_meta.m_block_size);
+			stop_stage(context->m_stats, STAGE_READ, &timer, slot->m_input_size, slot->m_input_size);
+		}
+
+		slot->m_last = slot->m_input_size == 0;
+		ring_push(pipeline->m_filled, slot);
+
+		if (slot->m_last)
+		{
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+
+// the reader when decoding, a block header and its payload to a slot until the end marker, which goes
+// through as the last slot; a stream that goes bad ends with a failed last slot
+void *pipeline_payload_reader(void *opaque)
+{
+	struct pipeline_structure *pipeline;
+	struct coder_context *context;
+	InputStream *source;
+	int block_number;
+
+	pipeline = (struct pipeline_structure *)opaque;
+	context = pipeline->m_context;
+	source = pipeline->m_source;
+
+	block_number = 0;
+
+	while (true)
+	{
+		struct pipeline_slot *slot;
+		struct block_header *header;
+		struct stage_timer timer;
+
+		slot = (struct pipeline_slot *)ring_pop(pipeline->m_free);
+		header = &(slot->m_header);
+
+		slot->m_last = true;
+		slot->m_failed = true;
+
+		if (__atomic_load_n(&(pipeline->m_abort), __ATOMIC_ACQUIRE) != 0)
+		{
+			ring_push(pipeline->m_filled, slot);
+			break;
+		}
+
+		start_stage(context->m_stats, &timer);
+
+		slot->m_offset = source->tell() - pipeline->m_stream_start;
+
+		if (source->read(&header->m_uncompressed_size,sizeof(header->m_uncompressed_size),1) != 1)
+		{
+			printf("Problem: stream is truncated\n");
+			ring_push(pipeline->m_filled, slot);
+			break;
+		}
+
+		if (header->m_uncompressed_size == 0)
+		{
+			slot->m_failed = false;
+			ring_push(pipeline->m_filled, slot);
+			break;
+		}
+
+		if (source->read(&header->m_payload_size,sizeof(header->m_payload_size),1) != 1 ||
+			source->read(&header->m_crc,sizeof(header->m_crc),1) != 1 ||
+			source->read(&header->m_algorithm_id,sizeof(header->m_algorithm_id),1) != 1 ||
+			check_block_header(context, header, pipeline->m_source_size) == false)
+		{
+			printf("Problem: bad header on block[%d]\n", block_number);
+			ring_push(pipeline->m_filled, slot);
+			break;
+		}
+
+		if ((int)header->m_payload_size > slot->m_input_capacity)
+		{
+			slot->m_input = (BYTE *)realloc(slot->m_input, header->m_payload_size);
+			slot->m_input_capacity = header->m_payload_size;
+		}
+
+		if (read_fully(source, slot->m_input, header->m_payload_size) != (int)header->m_payload_size)
+		{
+			printf("Problem: block[%d] is truncated\n", block_number);
+			ring_push(pipeline->m_filled, slot);
+			break;
+		}
+
+		stop_stage(context->m_stats, STAGE_READ, &timer, sizeof(struct block_header) + header->m_payload_size, header->m_payload_size);
+
+		slot->m_input_size = header->m_payload_size;
+		slot->m_last = false;
+		slot->m_failed = false;
+		ring_push(pipeline->m_filled, slot);
+
+		block_number++;
+	}
+
+	return NULL;
+}
+
+
+// the writer for both, hands each slot's output to the destination and the slot back to the reader
+void *pipeline_writer(void *opaque)
+{
+	struct pipeline_structure *pipeline;
+
+	pipeline = (struct pipeline_structure *)opaque;
+
+	while (true)
+	{
+		struct pipeline_slot *slot;
+
+		slot = (struct pipeline_slot *)ring_pop(pipeline->m_coded);
+
+		if (slot->m_last)
+		{
+			break;
+		}
+
+		if (slot->m_output_size > 0 && pipeline->m_dest != NULL)
+		{
+			struct stage_timer timer;
+
+			start_stage(pipeline->m_context->m_stats, &timer);
+			pipeline->m_dest->write((void *)slot->m_output_bytes,sizeof(BYTE),slot->m_output_size);
+			stop_stage(pipeline->m_context->m_stats, STAGE_WRITE, &timer, slot->m_output_size, slot->m_output_size);
+		}
+
+		ring_push(pipeline->m_free, slot);
+	}
+
+	return NULL;
+}
+
+
+// whether a block header read from the stream can be taken at its word before anything is allocated for it
+bool check_block_header(struct coder_context *context, const struct block_header *header, DWORD max_payload_size)
+{
+	if (header->m_algorithm_id == ALGORITHM_AUTO || header->m_algorithm_id >= NUM_ALGORITHM_IDS ||
+		header->m_uncompressed_size > context->m_meta.m_block_size || header->m_payload_size > max_payload_size)
+	{
+		return false;
+	}
+
+	return header->m_algorithm_id != ALGORITHM_STORED || header->m_payload_size == header->m_uncompressed_size;
+}
+
+
+// decodes a block whose payload is all in memory into the block buffer, checks its crc and carries it
+// into the stream's; a stored payload already in the block buffer is left where it is
+bool decode_payload(struct coder_context *context, const struct block_header *header, const BYTE *payload, int block_number, WORD *stream_crc)
+{
+	struct stage_timer timer;
+
+	if (header->m_algorithm_id == ALGORITHM_STORED)
+	{
+		if (payload != context->m_block_buffer)
+		{
+			memcpy(context->m_block_buffer, payload, header->m_uncompressed_size);
+		}
+
+		context->m_block_fill = header->m_uncompressed_size;
+	}
+	else if (decompress_block(context, header, payload) == false)
+	{
+		printf("Problem: block[%d] does not decode\n", block_number);
+		return false;
+	}
+
+	start_stage(context->m_stats, &timer);
+
+	if (update_checksum(CHECKSUM_SEED, context->m_block_buffer, context->m_block_fill) != header->m_crc)
+	{
+		printf("Problem: crc mismatch on block[%d]\n", block_number);
+		return false;
+	}
+
+	*stream_crc = update_checksum(*stream_crc, context->m_block_buffer, context->m_block_fill);
+
+	stop_stage(context->m_stats, STAGE_CHECKSUM, &timer, 2 * context->m_block_fill, 0);
+
+	return true;
+}
+
+
+// a block only decodes whole, so a stream whose blocks don't fit under the memory cap is refused up front;
+// the pipeline's slots only count when the stream is going to be pipelined
+bool check_decode_memory(struct coder_context *context, bool pipelined)
+{
+	DWORD block_size;
+	DWORD needed;
+
+	if (g_max_memory == 0)
+	{
+		return true;
+	}
+
+	block_size = context->m_meta.m_block_size;
+	if ((context->m_meta.m_flags & STREAM_FLAG_UNSIZED) == 0 && context->m_meta.m_original_size < block_size)
+	{
+		block_size = context->m_meta.m_original_size;
+	}
+
+	needed = BASE_MEMORY_SIZE + reference_memory() + decode_working_set(block_size) + (pipelined ? (DWORD)PIPELINE_BYTES_PER_BLOCK_BYTE * block_size : 0);
+	if (needed > g_max_memory)
+	{
+		printf("Problem: blocks of [%u] bytes need about [%llu] bytes of memory to decode, over the cap of [%llu]\n", context->m_meta.m_block_size, needed, g_max_memory);
+		return false;
+	}
+
+	return true;
+}
+
+
+// with more than one block to decode, reading the next one and writing the last overlap with the decoding;
+// a single block stream has nothing to overlap
+bool decodes_pipelined(struct coder_context *context, DWORD source_size, int stream_start)
+{
+	if (context->m_pipeline == false || (context->m_meta.m_flags & STREAM_FLAG_SINGLE))
+	{
+		return false;
+	}
+
+	return context->m_meta.m_original_size > context->m_meta.m_block_size || source_size - stream_start > context->m_meta.m_block_size;
+}
+
+
+int read_fully(InputStream *source, BYTE *buffer, int size)
+{
+	int total;
+
+	total = 0;
+	while (total < size)
+	{
+		int amount_read;
+
+		amount_read = source->read(buffer + total, sizeof(BYTE), size - total);
+		if (amount_read <= 0)
+		{
+			break;
+		}
+
+		total += amount_read;
+	}
+
+	return total;
+}
+
+
+// everything before the first block; the original size is only as good as the blocks that follow
+bool read_stream_header(struct coder_context *context, InputStream *source)
+{
+	if (source->read(&context->m_meta.m_magic_number,sizeof(context->m_meta.m_magic_number),1) != 1 || context->m_meta.m_magic_number != MAGIC_NUMBER)
+	{
+		printf("Problem: not a compressed file\n");
+		return false;
+	}
+
+	if (source->read(&context->m_meta.m_version_number,sizeof(context->m_meta.m_version_number),1) != 1 ||
+		(context->m_meta.m_version_number != VERSION && context->m_meta.m_version_number != UNANCHORED_VERSION))
+	{
+		printf("Problem: unsupported format version[%u]\n", context->m_meta.m_version_number);
+		return false;
+	}
+
+	source->read(&context->m_meta.m_algorithm_id,sizeof(context->m_meta.m_algorithm_id),1);
+	if (context->m_meta.m_algorithm_id >= NUM_ALGORITHM_IDS)
+	{
+		printf("Problem: unknown algorithm[%d]\n", context->m_meta.m_algorithm_id);
+		return false;
+	}
+
+	if (source->read(&context->m_meta.m_flags,sizeof(context->m_meta.m_flags),1) != 1 || (context->m_meta.m_flags & ~KNOWN_STREAM_FLAGS) != 0)
+	{
+		printf("Problem: unknown stream flags[%02x]\n", context->m_meta.m_flags);
+		return false;
+	}
+
+	if (context->m_meta.m_version_number == UNANCHORED_VERSION && (context->m_meta.m_flags & STREAM_FLAG_DELTA))
+	{
+		printf("Problem: unsupported format version[%u] for a delta stream\n", context->m_meta.m_version_number);
+		return false;
+	}
+
+	if (source->read(&context->m_meta.m_block_size,sizeof(context->m_meta.m_block_size),1) != 1 || context->m_meta.m_block_size > MAX_BLOCK_SIZE)
+	{
+		printf("Problem: bad block size\n");
+		return false;
+	}
+
+	// a single block stream has nothing more to it than its block, so the block size is the original size
+	if (context->m_meta.m_flags & STREAM_FLAG_SINGLE)
+	{
+		if (context->m_meta.m_flags & (STREAM_FLAG_INDEX | STREAM_FLAG_UNSIZED))
+		{
+			printf("Problem: unknown stream flags[%02x]\n", context->m_meta.m_flags);
+			return false;
+		}
+
+		context->m_meta.m_original_size = context->m_meta.m_block_size;
+	}
+	else if (source->read(&context->m_meta.m_original_size,sizeof(context->m_meta.m_original_size),1) != 1)
+	{
+		printf("Problem: stream is truncated\n");
+		return false;
+	}
+
+	context->m_meta.m_reference_size = 0;
+	context->m_meta.m_reference_id = 0;
+
+	if ((context->m_meta.m_flags & STREAM_FLAG_DELTA) &&
+		(source->read(&context->m_meta.m_reference_size,sizeof(context->m_meta.m_reference_size),1) != 1 ||
+		source->read(&context->m_meta.m_reference_id,sizeof(context->m_meta.m_reference_id),1) != 1))
+	{
+		printf("Problem: stream is truncated\n");
+		return false;
+	}
+
+	return true;
+}
+
+
+// a stream coded against a reference only decodes with that same one loaded
+bool check_reference(struct coder_context *context)
+{
+	if ((context->m_meta.m_flags & STREAM_FLAG_DELTA) == 0)
+	{
+		return true;
+	}
+
+	if (g_reference == NULL)
+	{
+		printf("Problem: stream was compressed against a reference[%08x] of [%llu] bytes, which isn't loaded\n", context->m_meta.m_reference_id, context->m_meta.m_reference_size);
+		return false;
+	}
+
+	if ((DWORD)g_reference_size != context->m_meta.m_reference_size || g_reference_id != context->m_meta.m_reference_id)
+	{
+		printf("Problem: stream was compressed against reference[%08x], not [%08x]\n", context->m_meta.m_reference_id, g_reference_id);
+		return false;
+	}
+
+	return true;
+}
+
+
+// the part of the reference a block can match against: a margin either side of anchor, where the block
+// lines up with the reference, slid back inside the reference when it runs off either end
+void reference_slice(DWORD anchor, int block_size, int *start, int *size)
+{
+	DWORD first;
+
+	*size = block_size + 2 * DELTA_REFERENCE_MARGIN;
+	if (*size > g_reference_size)
+	{
+		*size = g_reference_size;
+	}
+
+	first = anchor > DELTA_REFERENCE_MARGIN ? anchor - DELTA_REFERENCE_MARGIN : 0;
+	if (first > (DWORD)(g_reference_size - *size))
+	{
+		first = g_reference_size - *size;
+	}
+
+	*start = (int)first;
+}
+
+
+// hashes the DELTA_ANCHOR_LENGTH bytes at every DELTA_ANCHOR_STRIDE of the reference into a table twice the
+// size it needs, so a block can be lined up with the reference wherever the two share a run
+void index_reference()
+{
+	int num_anchors;
+	int position;
+	int i;
+
+	num_anchors = g_reference_size >= DELTA_ANCHOR_LENGTH ? (g_reference_size - DELTA_ANCHOR_LENGTH) / DELTA_ANCHOR_STRIDE + 1 : 0;
+
+	g_reference_anchor_capacity = 1;
+	while (g_reference_anchor_capacity < 2 * num_anchors)
+	{
+		g_reference_anchor_capacity *= 2;
+	}
+
+	g_reference_anchors = (struct reference_anchor *)malloc(sizeof(struct reference_anchor) * g_reference_anchor_capacity);
+	for (i = 0; i < g_reference_anchor_capacity; i++)
+	{
+		g_reference_anchors[i].m_position = -1;
+	}
+
+	for (position = 0; position + DELTA_ANCHOR_LENGTH <= g_reference_size; position += DELTA_ANCHOR_STRIDE)
+	{
+		WORD hash;
+		int slot;
+
+		hash = 0;
+		for (i = 0; i < DELTA_ANCHOR_LENGTH; i++)
+		{
+			hash = hash * DELTA_ANCHOR_BASE + g_reference[position + i];
+		}
+
+		slot = (int)(hash & (g_reference_anchor_capacity - 1));
+		while (g_reference_anchors[slot].m_position >= 0)
+		{
+			slot = (slot + 1) & (g_reference_anchor_capacity - 1);
+		}
+
+		g_reference_anchors[slot].m_hash = hash;
+		g_reference_anchors[slot].m_position = position;
+	}
+}
+
+
+// where in the reference the block lines up: a rolling hash over the block looks up every anchor it shares
+// with the reference, each one votes for where the block's first byte would sit, and the most votes win.
+// a block with no anchors in it, such as one that's all new, carries on from the last block that had some,
+// so an insertion or a deletion of any size only costs the blocks it touches
+int find_reference_anchor(struct coder_context *context, const BYTE *block, int block_size)
+{
+	int *votes;
+	int num_votes;
+	WORD hash;
+	WORD outgoing_factor;
+	int result;
+	int best_run;
+	int run;
+	int i;
+
+	votes = (int *)arena_allocate(context->m_arena, sizeof(int) * DELTA_MAX_VOTES);
+	num_votes = 0;
+
+	hash = 0;
+	outgoing_factor = 1;
+	for (i = 0; i < DELTA_ANCHOR_LENGTH && i < block_size; i++)
+	{
+		hash = hash * DELTA_ANCHOR_BASE + block[i];
+		if (i > 0)
+		{
+			outgoing_factor *= DELTA_ANCHOR_BASE;
+		}
+	}
+
+	for (i = 0; i + DELTA_ANCHOR_LENGTH <= block_size && num_votes < DELTA_MAX_VOTES; i++)
+	{
+		int slot;
+
+		if (i > 0)
+		{
+			hash = (hash - block[i - 1] * outgoing_factor) * DELTA_ANCHOR_BASE + block[i + DELTA_ANCHOR_LENGTH - 1];
+		}
+
+		slot = (int)(hash & (g_reference_anchor_capacity - 1));
+		while (g_reference_anchors[slot].m_position >= 0)
+		{
+			const struct reference_anchor *anchor;
+
+			anchor = &(g_reference_anchors[slot]);
+
+			// a run that starts before the reference does can't say where the block is
+			if (anchor->m_hash == hash && anchor->m_position >= i && memcmp(g_reference + anchor->m_position, block + i, DELTA_ANCHOR_LENGTH) == 0)
+			{
+				votes[num_votes] = anchor->m_position - i;
+				num_votes++;
+				break;
+			}
+
+			slot = (slot + 1) & (g_reference_anchor_capacity - 1);
+		}
+	}
+
+	if (num_votes == 0)
+	{
+		DWORD carried;
+
+		carried = context->m_reference_anchor;
+		if (context->m_block_offset > context->m_reference_anchor_offset)
+		{
+			carried += context->m_block_offset - context->m_reference_anchor_offset;
+		}
+
+		return carried < (DWORD)g_reference_size ? (int)carried : g_reference_size;
+	}
+
+	qsort(votes, num_votes, sizeof(int), compare_anchor_votes);
+
+	result = votes[0];
+	best_run = 0;
+	run = 0;
+
+	for (i = 0; i < num_votes; i++)
+	{
+		run = i > 0 && votes[i] == votes[i - 1] ? run + 1 : 1;
+		if (run > best_run)
+		{
+			best_run = run;
+			result = votes[i];
+		}
+	}
+
+	context->m_reference_anchor = result;
+	context->m_reference_anchor_offset = context->m_block_offset;
 
-/////////////////////////////
-// Global Variables
-static int g_total_bits = 0;
-static BYTE g_bitstring = 0;
-static int g_bit_index = 7;
-static struct compressed_file_format g_meta;
-static int g_remainder_bits_position_within_source_buffer = 0;
+	return result;
+}
 
-/////////////////////////////
-// Private Prototypes
-bool perform_compression(BYTE algorithm_id, InputStream *source, OutputStream *dest);
-bool perform_decompression(InputStream *source, OutputStream *dest);
+int compare_anchor_votes(const void *a, const void *b)
+{
+	int left;
+	int right;
 
+	left = *(const int *)a;
+	right = *(const int *)b;
 
-void write_bits_representation(OutputStream *fp, const char *representation);
+	return left < right ? -1 : (left > right ? 1 : 0);
+}
 
 
-int process_update_dictionary(OutputStream *outputFile, const BYTE *source_buffer, int max_size, int process_size);
+// what a loaded reference holds, its anchors included
+DWORD reference_memory()
+{
+	return (DWORD)g_reference_size + (DWORD)g_reference_anchor_capacity * sizeof(struct reference_anchor);
+}
 
-int process_compress_buffer(OutputStream *outputFile, const BYTE *source_buffer, int max_size, int process_size);
-int process_decompress_buffer(OutputStream *outputFile, const BYTE *source_buffer, int max_size, int process_size);
-int process_bwt_encode_buffer(OutputStream *outputFile, const BYTE *source_buffer, int max_size, int process_size);
-int process_bwt_decode_buffer(OutputStream *outputFile, const BYTE *source_buffer, int max_size, int process_size);
 
-bool process_file(InputStream *source, OutputStream *outputFile,  int (*lambda)(OutputStream *outputFile, const BYTE *, int, int), DWORD source_size);
+void add_index_entry(struct coder_context *context, DWORD offset, DWORD uncompressed_offset)
+{
+	if (context->m_index_size == context->m_index_capacity)
+	{
+		context->m_index_capacity = context->m_index_capacity == 0 ? INITIAL_INDEX_CAPACITY : context->m_index_capacity * 2;
+		context->m_index = (struct index_entry *)realloc(context->m_index,sizeof(struct index_entry) * context->m_index_capacity);
+	}
 
-DWORD get_file_size(InputStream *source);
+	context->m_index[context->m_index_size].m_offset = offset;
+	context->m_index[context->m_index_size].m_uncompressed_offset = uncompressed_offset;
+	context->m_index_size++;
+}
 
 
-/////////////////////////////
-// Public Functions
-int main(int argc, char *argv[])
+void write_index(struct coder_context *context, OutputStream *dest)
 {
-	int result = 20;
+	WORD num_blocks;
+	WORD trailer_size;
+	int i;
 
-	if (argc != 4) 
-	{
-		printf("Usage: compressor OPTION source-filename dest-filename.\n");
-		printf("OPTION = c -> compress; OPTION = d -> decompress\n");
-		result = 0;
-	} 
-	else
+	for (i = 0; i < context->m_index_size; i++)
 	{
-		FileInputStream *source;
-		FileOutputStream *dest;
-		bool open_file_1_test;
-		bool open_file_2_test;
-
-		source = new FileInputStream();
-		dest = new FileOutputStream();
-		open_file_1_test = source->initialize(argv[2]);
-		open_file_2_test = dest->initialize(argv[3]);
-
-		if (open_file_1_test && open_file_2_test) 
-		{
-			bool performance_test;
-			bool compress = (argv[1][0] == 'c' || argv[1][0] == 'C');
+		dest->write(&context->m_index[i].m_offset,sizeof(context->m_index[i].m_offset),1);
+		dest->write(&context->m_index[i].m_uncompressed_offset,sizeof(context->m_index[i].m_uncompressed_offset),1);
+	}
 
-			if (compress)
-			{
-				performance_test = perform_compression(ALGORITHM_ARITHMETIC,source,dest);
+	num_blocks = context->m_index_size;
+	trailer_size = context->m_index_size * 2 * sizeof(DWORD) + sizeof(num_blocks) + sizeof(trailer_size);
 
-			}
-			else
-			{
-				performance_test = perform_decompression(source,dest);
-			}
+	dest->write(&num_blocks,sizeof(num_blocks),1);
+	dest->write(&trailer_size,sizeof(trailer_size),1);
+}
 
-			if (performance_test == true)
-			{
-				result = 0;
-			}
-			else
-			{
-				result = 1;
-			}
 
-		}
-		else
-		{
-			result = 1;
-		}
+// reads a block header and steps over its payload without reading it; an m_uncompressed_size of 0
+// is the end marker, with nothing after it read
+bool skip_block(InputStream *source, DWORD source_size, struct block_header *header)
+{
+	if (source->read(&header->m_uncompressed_size,sizeof(header->m_uncompressed_size),1) != 1)
+	{
+		return false;
+	}
 
-		source->shutdown();
-		dest->shutdown();
+	if (header->m_uncompressed_size == 0)
+	{
+		return true;
+	}
 
-		delete source, source = NULL;
-		delete dest, dest = NULL;
+	if (source->read(&header->m_payload_size,sizeof(header->m_payload_size),1) != 1 ||
+		source->read(&header->m_crc,sizeof(header->m_crc),1) != 1 ||
+		source->read(&header->m_algorithm_id,sizeof(header->m_algorithm_id),1) != 1 ||
+		source->tell() + (DWORD)header->m_payload_size > source_size)
+	{
+		return false;
+	}
 
-	} 
+	source->seek(header->m_payload_size, SEEK_CURRENT);
 
-	return result;
+	return true;
 }
 
-/////////////////////////////
-// Private Functions
-bool perform_compression(BYTE algorithm_id, InputStream *source, OutputStream *dest)
-{
-	bool result;
-	bool process_file_test;
 
-	source->seek(0, SEEK_BEGINNING);
+// with a header already read, finds the end marker either through the trailer or by stepping over
+// every block, and loads the stream crc and the index the blocks had so far
+bool find_stream_end(struct coder_context *context, InputStream *source, int stream_start, DWORD source_size, int *end_position)
+{
+	WORD end_marker;
 
-	g_meta.m_dictionary = create_dictionary(algorithm_id);
-	process_file_test = process_file(source, NULL, process_update_dictionary, get_file_size(source));
-	finalize_dictionary(g_meta.m_dictionary);
+	context->m_index_size = 0;
 
-	if (process_file_test)
+	if (context->m_meta.m_flags & STREAM_FLAG_INDEX)
 	{
-		printf("Dictionary built..\n");
-	//					print_dictionary(g_meta.m_dictionary);
-
-		//process the input file to the output file
-		g_meta.m_magic_number = MAGIC_NUMBER;
-		g_meta.m_version_number = VERSION;
-		g_meta.m_algorithm_id = algorithm_id;
-
-		dest->write(&g_meta.m_magic_number,sizeof(g_meta.m_magic_number),1);
-		dest->write(&g_meta.m_version_number,sizeof(g_meta.m_version_number),1);
-//		dest->write(&g_meta.m_algorithm_id,sizeof(g_meta.m_algorithm_id),1);
+		WORD num_blocks;
+		WORD trailer_size;
+		DWORD trailer_start;
+		int i;
 
+		if (source_size < stream_start + 2 * sizeof(WORD))
 		{
-			int num_dictionary_bytes;
-			BYTE *dictionary_bytes;
-
-			serialize_dictionary_to_bytes(g_meta.m_dictionary,&num_dictionary_bytes,&dictionary_bytes);
-			dest->write(&num_dictionary_bytes,sizeof(num_dictionary_bytes),1);
-			dest->write(dictionary_bytes,sizeof(dictionary_bytes[0]),num_dictionary_bytes);
-
-			free(dictionary_bytes);
+			return false;
 		}
 
-		int remainder_bits_position;
-		remainder_bits_position = dest->tell();
-
-		//write some dummy data to acount for what could be
-		g_meta.m_compressed_stream.m_number_of_remainder_bits = 0;
-		dest->write(&g_meta.m_compressed_stream.m_number_of_remainder_bits, sizeof(BYTE), 1);
+		source->seek(source_size - 2 * sizeof(WORD), SEEK_BEGINNING);
 
-		source->seek(0, SEEK_BEGINNING);
+		if (source->read(&num_blocks,sizeof(num_blocks),1) != 1 ||
+			source->read(&trailer_size,sizeof(trailer_size),1) != 1 ||
+			trailer_size != (DWORD)num_blocks * 2 * sizeof(DWORD) + sizeof(num_blocks) + sizeof(trailer_size) ||
+			trailer_size + 2 * sizeof(WORD) > source_size - stream_start)
+		{
+			return false;
+		}
 
-		process_file(source, dest, process_compress_buffer, get_file_size(source));
+		trailer_start = source_size - trailer_size;
+		source->seek(trailer_start, SEEK_BEGINNING);
 
-		// in case the compressor in question requires a final flush
+		for (i = 0; i < (int)num_blocks; i++)
 		{
-			const char *flush_representation;
+			struct index_entry entry;
+
+			if (source->read(&entry.m_offset,sizeof(entry.m_offset),1) != 1 || source->read(&entry.m_uncompressed_offset,sizeof(entry.m_uncompressed_offset),1) != 1)
+			{
+				return false;
+			}
 
-			flush_representation = encode_symbol_to_bitstring_flush(g_meta.m_dictionary);
-			write_bits_representation(dest, flush_representation);
-//			printf("flushed bits represented as [%s]\n\n",flush_representation == NULL ? "NULL" : flush_representation);
+			add_index_entry(context, entry.m_offset, entry.m_uncompressed_offset);
 		}
 
+		*end_position = trailer_start - 2 * sizeof(WORD);
+	}
+	else
+	{
+		struct block_header header;
 
-		if (g_bit_index != 7)
+		do
 		{
-			g_meta.m_compressed_stream.m_number_of_remainder_bits = 7 - g_bit_index;
+			*end_position = source->tell();
 
-			if (g_meta.m_compressed_stream.m_number_of_remainder_bits > 0)
+			if (skip_block(source, source_size, &header) == false)
 			{
-				dest->write(&g_bitstring, sizeof(BYTE), 1);
+				return false;
 			}
-
-			dest->seek(remainder_bits_position,SEEK_BEGINNING);
-			dest->write(&g_meta.m_compressed_stream.m_number_of_remainder_bits, sizeof(BYTE), 1);
-			dest->seek(0, SEEK_ENDING);
 		}
+		while (header.m_uncompressed_size != 0);
+	}
+
+	source->seek(*end_position, SEEK_BEGINNING);
+
+	return source->read(&end_marker,sizeof(end_marker),1) == 1 && end_marker == 0 && source->read(&context->m_meta.crc,sizeof(context->m_meta.crc),1) == 1;
+}
+
+
+// the trailer against the blocks that were just decoded
+bool check_index(struct coder_context *context, InputStream *source)
+{
+	WORD num_blocks;
+	WORD trailer_size;
+	int i;
 
-		printf("total_bits[%d]  remainder bits[%d]\n", g_total_bits,g_meta.m_compressed_stream.m_number_of_remainder_bits);
+	for (i = 0; i < context->m_index_size; i++)
+	{
+		struct index_entry entry;
 
-		result = true;
+		if (source->read(&entry.m_offset,sizeof(entry.m_offset),1) != 1 ||
+			source->read(&entry.m_uncompressed_offset,sizeof(entry.m_uncompressed_offset),1) != 1 ||
+			entry.m_offset != context->m_index[i].m_offset ||
+			entry.m_uncompressed_offset != context->m_index[i].m_uncompressed_offset)
+		{
+			return false;
+		}
 	}
-	else
+
+	if (source->read(&num_blocks,sizeof(num_blocks),1) != 1 || source->read(&trailer_size,sizeof(trailer_size),1) != 1)
 	{
-		result = false;
+		return false;
 	}
 
-	return result;
+	return num_blocks == (WORD)context->m_index_size && trailer_size == context->m_index_size * 2 * sizeof(DWORD) + sizeof(num_blocks) + sizeof(trailer_size);
 }
 
 
-bool perform_decompression(InputStream *source, OutputStream *dest)
+void reserve_block_buffer(struct coder_context *context, int size)
 {
-	bool result;
+	if (size > context->m_block_buffer_capacity)
+	{
+		context->m_block_buffer = (BYTE *)realloc(context->m_block_buffer,size);
+		context->m_block_buffer_capacity = size;
+	}
+}
 
-	result = true; //TODO add error handling, haha
 
+// how much of block goes out as the next block: all of it, unless a segment's byte statistics differ
+// from everything before it by more than a new table costs, in which case the block ends there
+int next_block_split(struct coder_context *context, const BYTE *block, int size)
+{
+	struct stage_timer timer;
+	int run_counts[256];
+	int segment_counts[256];
+	int joint_counts[256];
+	int position;
+	int result;
+
+	if (context->m_settings.m_split_blocks == false || context->m_settings.m_trained_dictionary != NULL || size < 2 * SPLIT_MIN_SIZE)
+	{
+		return size;
+	}
 
-	source->read(&g_meta.m_magic_number,sizeof(g_meta.m_magic_number),1);
-	assert(g_meta.m_magic_number == MAGIC_NUMBER);
-	source->read(&g_meta.m_version_number,sizeof(g_meta.m_version_number),1);
-	assert(g_meta.m_version_number == VERSION);
-//	source->read(&g_meta.m_algorithm_id,sizeof(g_meta.m_algorithm_id),1);
-//	assert(g_meta.m_algorithm_id == ALGORITHM_HUFFMAN || g_meta.m_algorithm_id == ALGORITHM_ARITHMETIC);
+	start_stage(context->m_stats, &timer);
 
+	memset(run_counts, 0, sizeof(run_counts));
+	result = size;
 
+	for (position = 0; position + SPLIT_SEGMENT_SIZE <= size; position += SPLIT_SEGMENT_SIZE)
 	{
-		int num_dictionary_bytes;
-		BYTE *dictionary_bytes;
+		int i;
 
-		source->read(&num_dictionary_bytes,sizeof(num_dictionary_bytes),1);
-		dictionary_bytes = (BYTE *)malloc(sizeof(BYTE) * num_dictionary_bytes);
-		source->read(dictionary_bytes,sizeof(dictionary_bytes[0]),num_dictionary_bytes);
+		memset(segment_counts, 0, sizeof(segment_counts));
+		for (i = 0; i < SPLIT_SEGMENT_SIZE; i++)
+		{
+			segment_counts[block[position + i]]++;
+		}
 
-		g_meta.m_dictionary = deserialize_bytes_to_dictionary(num_dictionary_bytes,dictionary_bytes);
+		if (position >= SPLIT_MIN_SIZE && size - position >= SPLIT_MIN_SIZE)
+		{
+			double apart;
 
-		assert(g_meta.m_dictionary != NULL);
+			for (i = 0; i < 256; i++)
+			{
+				joint_counts[i] = run_counts[i] + segment_counts[i];
+			}
 
-		free(dictionary_bytes);
-	}
+			apart = histogram_cost(run_counts, position) + histogram_cost(segment_counts, SPLIT_SEGMENT_SIZE);
 
+			if (histogram_cost(joint_counts, position + SPLIT_SEGMENT_SIZE) - apart > SPLIT_TABLE_BITS + SPLIT_SEGMENT_SIZE * 8 / SPLIT_GAIN_DIVISOR)
+			{
+				result = position;
+				break;
+			}
+		}
 
+		for (i = 0; i < 256; i++)
+		{
+			run_counts[i] += segment_counts[i];
+		}
+	}
 
-	source->read(&g_meta.m_compressed_stream.m_number_of_remainder_bits, sizeof(g_meta.m_compressed_stream.m_number_of_remainder_bits), 1);
-//	printf("number of remainder bits existing in source file[%d]\n", g_meta.m_compressed_stream.m_number_of_remainder_bits);
+	stop_stage(context->m_stats, STAGE_HISTOGRAM, &timer, result, 0);
 
-	
-	int cur;
+	return result;
+}
 
-	cur = source->tell();
-	source->seek(0,SEEK_ENDING);
-	g_remainder_bits_position_within_source_buffer = source->tell() - cur;
-	source->seek(cur,SEEK_BEGINNING);
 
-//	printf("before process\n");
-	process_file(source, dest, process_decompress_buffer, get_file_size(source)-cur);
-//	printf("after process\n");
+// bits an order-0 coder fit to counts needs for all total of them
+double histogram_cost(const int *counts, int total)
+{
+	double result;
+	int i;
 
+	result = total * log2((double)total);
 
-	bool useful_flush;
-	do
+	for (i = 0; i < 256; i++)
 	{
-		struct symbol decoded_symbol;
-
-		useful_flush = decode_consume_bit_flush(g_meta.m_dictionary,&decoded_symbol);
-
-		if (useful_flush == true)
+		if (counts[i] > 0)
 		{
-			printf("decoded flush symbol[%c]\n", decoded_symbol.m_value);
-			dest->write(&decoded_symbol,sizeof(decoded_symbol),1);
+			result -= counts[i] * log2((double)counts[i]);
 		}
 	}
-	while(useful_flush == true);
 
 	return result;
 }
 
 
+// the most one context holds coding blocks of block_size with the current match finder, scaled from peaks
+// measured at level 9 on incompressible input; a reference adds the slice each block matches against
+DWORD encode_working_set(int block_size)
+{
+	DWORD span;
+	DWORD window;
+	DWORD per_byte;
 
+	span = block_size + (g_reference != NULL ? 2 * DELTA_REFERENCE_MARGIN : 0);
 
-void write_bit(OutputStream *fp, char c)
-{
-	if (c == '1')
+	window = 0;
+	if (g_match_finder.m_max_chain_length > 0)
 	{
-		g_bitstring = g_bitstring | (1 << g_bit_index);
+		window = (DWORD)g_match_finder.m_window_size < span ? g_match_finder.m_window_size : span;
 	}
 
-	g_bit_index--;
-
-	if (g_bit_index == -1)
+	per_byte = ENCODE_BYTES_PER_BLOCK_BYTE;
+	if (g_alphabet_id == ALPHABET_WORD || g_alphabet_id == ALPHABET_AUTO)
 	{
-//		printf("g_bitstring written[%d]\n", g_bitstring);
-		fp->write(&g_bitstring, sizeof(BYTE), 1);
-		g_bitstring = 0;
-		g_bit_index = 7;
+		per_byte += WORD_ALPHABET_BYTES_PER_BLOCK_BYTE;
 	}
+
+	return per_byte * span + ENCODE_BYTES_PER_WINDOW_BYTE * window;
 }
 
-void write_bits_representation(OutputStream *fp, const char *representation)
+DWORD decode_working_set(int block_size)
 {
-	if (representation != NULL)
-	{
-		printf("representation[%s]\n", representation);
-
-		while (*representation != '\0')
-		{
-			write_bit(fp,*representation);
-			representation++;
-			g_total_bits++;
-		}
-	}
+	return DECODE_BYTES_PER_BLOCK_BYTE * (block_size + (g_reference != NULL ? 2 * DELTA_REFERENCE_MARGIN : 0));
 }
 
-int process_update_dictionary(OutputStream *fp, const BYTE *source_buffer, int max_size, int process_size)
+
+// what compressing takes with num_contexts coding at once beside held bytes of buffered input and output;
+// an input smaller than a block only costs its own size, and pipeline only counts when there's more than
+// one block to overlap, the way compress_blocks() decides
+DWORD compression_memory(DWORD largest_input, int block_size, int num_contexts, DWORD held, bool pipeline)
 {
-	int i;
+	bool pipelined;
 
-//	printf("process_update_dictionary[%d]\n",process_size);
-	for (i=0; i<process_size; i++)
-	{
-		struct symbol sym;
-		sym.m_value = source_buffer[i];
+	pipelined = pipeline && num_contexts == 1 && largest_input > (DWORD)block_size;
 
-		update_dictionary(g_meta.m_dictionary,sym);
+	if (largest_input < (DWORD)block_size)
+	{
+		block_size = largest_input > MIN_BLOCK_SIZE ? (int)largest_input : MIN_BLOCK_SIZE;
 	}
 
-	return -1;
+	return BASE_MEMORY_SIZE + reference_memory() + held + num_contexts * encode_working_set(block_size) +
+		(pipelined ? (DWORD)PIPELINE_BYTES_PER_BLOCK_BYTE * block_size : 0);
 }
 
 
-int process_compress_buffer(OutputStream *outputFile, const BYTE *source_buffer, int max_size, int process_size)
+// halves the block size until compressing fits under the memory cap, false when even the smallest doesn't;
+// smaller blocks cost ratio, but a run killed for its memory costs everything. The size found is for the
+// one call asking, the setting stays as it was
+bool fit_block_size(DWORD largest_input, int num_contexts, DWORD held, bool pipeline, int *block_size)
 {
-	int i;
+	*block_size = g_block_size;
 
+	if (g_max_memory == 0)
+	{
+		return true;
+	}
 
-//	printf("process_compress_buffer called[%d]\n",process_size);
-	for (i=0; i<process_size; i++)
+	while (*block_size > MIN_BLOCK_SIZE && compression_memory(largest_input, *block_size, num_contexts, held, pipeline) > g_max_memory)
 	{
-		struct symbol sym;
-		const char *representation;
+		*block_size = *block_size / 2 > MIN_BLOCK_SIZE ? *block_size / 2 : MIN_BLOCK_SIZE;
+	}
 
-		sym.m_value = source_buffer[i];
-		representation = encode_symbol_to_bitstring(g_meta.m_dictionary,sym);
-		write_bits_representation(outputFile,representation);
+	if (compression_memory(largest_input, *block_size, num_contexts, held, pipeline) > g_max_memory)
+	{
+		printf("Problem: compressing needs about [%llu] bytes of memory even with the smallest blocks, over the cap of [%llu]\n",
+			compression_memory(largest_input, *block_size, num_contexts, held, pipeline), g_max_memory);
+		return false;
+	}
 
-//		printf("symbol [%c] is represented as [%s]\n\n",sym.m_value,representation == NULL ? "NULL" : representation);
+	if (*block_size < g_block_size && g_verbose)
+	{
+		printf("blocks of [%d] bytes instead of [%d] to stay under [%llu] bytes of memory\n", *block_size, g_block_size, g_max_memory);
 	}
 
-	return -1;
+	return true;
 }
 
 
-int process_decompress_buffer(OutputStream *outputFile, const BYTE *source_buffer, int max_size, int process_size)
+void print_progress_start()
 {
-	static int s_current_processed_total = 0;
-	int i;
-	struct symbol decoded_symbol;
-
-//	printf("**********decompress buffer\n");
-
-//	printf("s_current_processed_total [%d]  current buffer size[%d]\n", s_current_processed_total,process_size);
-
-	for (i = 0; i < process_size; i++)
+	if (g_verbose)
 	{
-		BYTE cur_byte;
-		int j;
-		s_current_processed_total++;
-
-		cur_byte = source_buffer[i];
-
-//		 printf("cur_byte[%d][%c]\n", cur_byte, cur_byte);
-
+		printf("[");
+	}
+}
 
-		for (j = 7;j >= 0;j--)
-		{
-			char bit;
-			bool test;
+void print_progress(float *current_bar_percentile, DWORD amount, DWORD total)
+{
+	int num_bars;
+	int i;
 
-			if (cur_byte & (1 << j))
-			{
-				bit = '1';
-			}
-			else
-			{
-				bit = '0';
-			}
+	if (g_verbose == false || total == 0)
+	{
+		return;
+	}
 
-			test = decode_consume_bit(g_meta.m_dictionary,bit,&decoded_symbol);
+	*current_bar_percentile += ((float)amount / total) * NUM_PROGRESS_BARS;
 
-			if (test == true)
-			{
-				printf("decoded symbol[%c]\n", decoded_symbol.m_value);
-				
-				outputFile->write(&decoded_symbol,sizeof(decoded_symbol),1);
-			}
+	num_bars = (int)floor(*current_bar_percentile+EPSILON);
 
-			if (s_current_processed_total == g_remainder_bits_position_within_source_buffer)
-			{
-				if (j + g_meta.m_compressed_stream.m_number_of_remainder_bits == 8)
-				{
-	//				printf("[%d][%d][%d]found our last byte and the last legitimate bit\n",j,s_current_processed_total,g_remainder_bits_position_within_source_buffer);
-					break;
-				}
-			}
-		}
+	for (i=0; i<num_bars; i++)
+	{
+		printf("-");
 	}
 
-	return 0;
+	*current_bar_percentile -= num_bars;
 }
 
-
-int process_bwt_encode_buffer(OutputStream *outputFile, const BYTE *source_buffer, int max_size, int process_size)
+void print_progress_end()
 {
-	int symbols_written;
-	int bytes_read;
-	int symbols_pos;
-
-	symbols_pos = 0;
-
-	do
+	if (g_verbose)
 	{
-		BYTE read_buffer[2048];
-
-		bwt_encoding_write_symbols(&(source_buffer[symbols_pos]),process_size,&symbols_written);
-		symbols_pos += symbols_written;
-		process_size -= symbols_written;
+		printf("]\n");
+	}
+}
 
-		bwt_encoding_read_bytes(read_buffer,&bytes_read,sizeof(read_buffer));
 
-		outputFile->write(read_buffer,sizeof(BYTE),bytes_read);
+void reset_driver_arena(struct coder_context *context)
+{
+	if (context->m_arena == NULL)
+	{
+		context->m_arena = create_arena(DRIVER_ARENA_SIZE);
 	}
-	while (symbols_written > 0 || bytes_read > 0);
 
-	return 0;
+	arena_reset(context->m_arena);
 }
 
 
-int process_bwt_decode_buffer(OutputStream *outputFile, const BYTE *source_buffer, int max_size, int process_size)
+DWORD get_file_size(InputStream *source)
 {
-	int bytes_written;
-	int symbols_read;
-	int bytes_pos;
+	DWORD result;
+	DWORD org_pos;
 
-	bytes_pos = 0;
+	org_pos = source->tell();
+	source->seek(0, SEEK_ENDING);
+	result = source->tell();
+	source->seek(org_pos, SEEK_BEGINNING);
 
-//	printf("enter decode\n");
-	do
-	{
-		BYTE read_buffer[2048];
+	return result;	
+}
 
-		bwt_decoding_write_bytes(&(source_buffer[bytes_pos]),process_size,&bytes_written);
-		bytes_pos += bytes_written;
-		process_size -= bytes_written;
 
-		bwt_decoding_read_symbols(read_buffer,&symbols_read,sizeof(read_buffer));
+int push_pending_size(struct push_stream_internal *alias)
+{
+	return (alias->m_encoding ? alias->m_output->getSize() : alias->m_context.m_block_fill) - alias->m_output_read;
+}
 
-		outputFile->write(read_buffer,sizeof(BYTE),symbols_read);
-	//	printf("\t[%d][%d]\n",bytes_written,symbols_read);
 
+// codes a buffer as the next block or blocks; output that has all been read makes room first, otherwise
+// the new blocks go in behind it
+bool push_encode(struct push_stream_internal *alias, const BYTE *buffer, int size)
+{
+	if (alias->m_output_read == alias->m_output->getSize())
+	{
+		alias->m_position += alias->m_output->getSize();
+		alias->m_output->rewind();
+		alias->m_output_read = 0;
 	}
-	while (bytes_written > 0 || symbols_read > 0);
 
-//	printf("leave decode\n");
+	if (compress_buffer(&(alias->m_context), alias->m_algorithm_id, buffer, size, alias->m_output, alias->m_position + alias->m_output->getSize(), &(alias->m_num_blocks)) == false)
+	{
+		alias->m_state = PUSH_STATE_FAILED;
+		return false;
+	}
 
-	return 0;
+	return true;
 }
 
 
-
-bool process_file(InputStream *source, OutputStream *dest, int (*lambda)(OutputStream *fp, const BYTE *, int, int), DWORD source_size)
+// how many bytes the decoder's next unit takes, judged from the first available of them; a header or an
+// end marker only shows its length once enough of it is there, so the answer can grow as more comes in
+int push_unit_size(struct push_stream_internal *alias, const BYTE *bytes, int available)
 {
-	bool result;
-	BYTE source_buffer[64];
-	DWORD amount_left;
-	float current_bar_percentile;
+	struct compressed_file_format *meta;
+	int result;
 
-	result = true;
-	current_bar_percentile = 0.0f;
-	amount_left = source_size;
+	meta = &(alias->m_context.m_meta);
+	result = 0;
 
-	printf("[");
-
-	while (amount_left > 0)
+	switch (alias->m_state)
 	{
-		int amount_read;
-		int processed_status;
-
-		amount_read = source->read(source_buffer, sizeof(source_buffer[0]), sizeof(source_buffer));
-		processed_status = lambda(dest, source_buffer, sizeof(source_buffer), amount_read);
-
-		amount_left -= amount_read;
+		case PUSH_STATE_HEADER :
+		{
+			int flags_offset;
 
-		// printf("amount_read[%d] amount_left[%llu]\n", amount_read, amount_left);
+			flags_offset = sizeof(meta->m_magic_number) + sizeof(meta->m_version_number) + sizeof(meta->m_algorithm_id);
+			result = flags_offset + sizeof(meta->m_flags) + sizeof(meta->m_block_size) + sizeof(meta->m_original_size);
 
-		current_bar_percentile += ((float)amount_read / source_size) * NUM_PROGRESS_BARS;
-		
-		int num_bars = (int)floor(current_bar_percentile+EPSILON);
+			if (available > flags_offset && (bytes[flags_offset] & STREAM_FLAG_SINGLE))
+			{
+				result -= sizeof(meta->m_original_size);
+			}
 
-		int i;
-		for (i=0; i<num_bars; i++)
-		{
-			printf("-");
+			if (available > flags_offset && (bytes[flags_offset] & STREAM_FLAG_DELTA))
+			{
+				result += sizeof(meta->m_reference_size) + sizeof(meta->m_reference_id);
+			}
+			break;
 		}
+		case PUSH_STATE_BLOCK_HEADER :
+		{
+			WORD uncompressed_size;
 
-		current_bar_percentile -= num_bars;
+			result = sizeof(alias->m_header.m_uncompressed_size);
 
-		if ((amount_read == 0) && (amount_left != 0))
-		{
-			result = false;
+			if (available >= result)
+			{
+				memcpy(&uncompressed_size, bytes, sizeof(uncompressed_size));
+				if (uncompressed_size != 0)
+				{
+					result += sizeof(alias->m_header.m_payload_size) + sizeof(alias->m_header.m_crc) + sizeof(alias->m_header.m_algorithm_id);
+				}
+			}
 			break;
 		}
+		case PUSH_STATE_PAYLOAD :
+			result = alias->m_header.m_payload_size;
+			break;
+		case PUSH_STATE_TRAILER :
+			result = sizeof(meta->crc);
+			if (meta->m_flags & STREAM_FLAG_INDEX)
+			{
+				result += alias->m_context.m_index_size * 2 * sizeof(DWORD) + 2 * sizeof(WORD);
+			}
+			break;
+		default:
+			break;
 	}
 
-	printf("]\n");
-
 	return result;
 }
 
 
-
-DWORD get_file_size(InputStream *source)
+// takes in one whole unit of the stream and moves on to the next; a payload leaves its block decoded and
+// waiting to be read
+bool push_take_unit(struct push_stream_internal *alias, const BYTE *unit, int size)
 {
-	DWORD result;
-	DWORD org_pos;
+	struct coder_context *context;
+	MemoryInputStream source;
+	bool result;
 
-	org_pos = source->tell();
-	source->seek(0, SEEK_ENDING);
-	result = source->tell();
-	source->seek(org_pos, SEEK_BEGINNING);
+	context = &(alias->m_context);
+	result = true;
 
-	return result;	
-}
+	switch (alias->m_state)
+	{
+		case PUSH_STATE_HEADER :
+			source.initialize(unit, size);
+			result = read_stream_header(context, &source) && check_reference(context) && check_decode_memory(context, false);
+			source.shutdown();
+
+			if (result)
+			{
+				reserve_block_buffer(context, context->m_meta.m_block_size);
+				context->m_index_size = 0;
+				alias->m_state = PUSH_STATE_BLOCK_HEADER;
+			}
+			break;
+		case PUSH_STATE_BLOCK_HEADER :
+			memcpy(&(alias->m_header.m_uncompressed_size), unit, sizeof(alias->m_header.m_uncompressed_size));
 
+			if (alias->m_header.m_uncompressed_size == 0)
+			{
+				alias->m_state = PUSH_STATE_TRAILER;
+				break;
+			}
 
+			unit += sizeof(alias->m_header.m_uncompressed_size);
+			memcpy(&(alias->m_header.m_payload_size), unit, sizeof(alias->m_header.m_payload_size));
+			unit += sizeof(alias->m_header.m_payload_size);
+			memcpy(&(alias->m_header.m_crc), unit, sizeof(alias->m_header.m_crc));
+			unit += sizeof(alias->m_header.m_crc);
+			memcpy(&(alias->m_header.m_algorithm_id), unit, sizeof(alias->m_header.m_algorithm_id));
+
+			if (check_block_header(context, &(alias->m_header), 2 * (DWORD)context->m_meta.m_block_size + PUSH_PAYLOAD_SLACK) == false)
+			{
+				printf("Problem: bad header on block[%d]\n", alias->m_num_blocks);
+				result = false;
+				break;
+			}
 
+			add_index_entry(context, alias->m_position, alias->m_total_out);
+			alias->m_state = PUSH_STATE_PAYLOAD;
+			break;
+		case PUSH_STATE_PAYLOAD :
+			reset_driver_arena(context);
+			context->m_block_offset = alias->m_total_out;
 
+			result = decode_payload(context, &(alias->m_header), unit, alias->m_num_blocks, &(alias->m_stream_crc));
+			if (result)
+			{
+				alias->m_output_read = 0;
+				alias->m_total_out += context->m_block_fill;
+				alias->m_num_blocks++;
+				alias->m_state = PUSH_STATE_BLOCK_HEADER;
+			}
 
+			// a single block stream ends with its block
+			if (result && (context->m_meta.m_flags & STREAM_FLAG_SINGLE))
+			{
+				alias->m_state = PUSH_STATE_DONE;
 
+				if (alias->m_total_out != context->m_meta.m_original_size)
+				{
+					printf("Problem: stream holds [%llu] bytes, its header says [%llu]\n", alias->m_total_out, context->m_meta.m_original_size);
+					result = false;
+				}
+			}
+			break;
+		case PUSH_STATE_TRAILER :
+			source.initialize(unit, size);
 
+			if (source.read(&(context->m_meta.crc), sizeof(context->m_meta.crc), 1) != 1 || context->m_meta.crc != alias->m_stream_crc)
+			{
+				printf("Problem: stream crc mismatch\n");
+				result = false;
+			}
+			else if ((context->m_meta.m_flags & STREAM_FLAG_UNSIZED) == 0 && alias->m_total_out != context->m_meta.m_original_size)
+			{
+				printf("Problem: stream holds [%llu] bytes, its header says [%llu]\n", alias->m_total_out, context->m_meta.m_original_size);
+				result = false;
+			}
+			else if ((context->m_meta.m_flags & STREAM_FLAG_INDEX) && check_index(context, &source) == false)
+			{
+				printf("Problem: block index doesn't match the blocks\n");
+				result = false;
+			}
 
+			source.shutdown();
+			alias->m_state = PUSH_STATE_DONE;
+			break;
+		default:
+			break;
+	}
 
+	alias->m_position += size;
 
+	return result;
+}
@@ -0,0 +1,138 @@
+#ifndef COMPRESSOR__H
+#define COMPRESSOR__H
+
+
+#include "./common.h"
+#include "./InputStream.hpp"
+#include "./OutputStream.hpp"
+#include "./lz77.h"
+#include "./stats.h"
+
+
+#define MIN_BLOCK_SIZE 1024
+#define MAX_BLOCK_SIZE (16 * 1024 * 1024)
+
+#define MIN_COMPRESSION_LEVEL 1
+#define MAX_COMPRESSION_LEVEL 9
+#define DEFAULT_COMPRESSION_LEVEL 5
+
+
+bool perform_compression(BYTE algorithm_id, InputStream *source, OutputStream *dest);
+bool perform_decompression(InputStream *source, OutputStream *dest);
+
+// one input of compress_batch(); m_compressed is malloc()ed for the caller to free() and holds an ordinary
+// compressed stream, perform_decompression() reads it back like any other
+struct batch_item
+{
+	const BYTE *m_source;
+	int m_source_size;
+	BYTE *m_compressed;
+	int m_compressed_size;
+	bool m_succeeded;
+};
+
+// compresses every item in memory on up to num_threads workers (0 for one per cpu); each worker keeps
+// its arena, buffers and streams from item to item, so small inputs don't pay setup per call.
+// the settings below are shared by all of them and must not change while a batch runs
+bool compress_batch(BYTE algorithm_id, struct batch_item *items, int num_items, int num_threads);
+
+// push-style coding for callers that get input in pieces and want output in their own buffers, such as a
+// server with many connections: every bit of a stream's state is in its handle, so any number of them can
+// be interleaved on one thread. push_write() takes what it can of the input and returns how much, or -1 on
+// error; it stops taking input while output waits, so each call codes or decodes at most one block before
+// push_read() has to drain it. push_finish() says no more input is coming: the encoder codes what it holds
+// and ends the stream, the decoder checks the stream was complete. push_done() is true once finished and
+// drained. an encoder copies the settings below when it's created, a trained dictionary included, so later
+// changes don't reach it; a reference isn't copied and has to stay loaded until the encoder is destroyed.
+// its streams leave the original size out of the header, having nowhere to go back to for it, and can't be
+// appended to
+typedef void * PUSH_STREAM;
+
+PUSH_STREAM create_push_encoder(BYTE algorithm_id);
+PUSH_STREAM create_push_decoder();
+void destroy_push_stream(PUSH_STREAM stream);
+
+int push_write(PUSH_STREAM stream, const BYTE *source, int size);
+int push_read(PUSH_STREAM stream, BYTE *dest, int size);
+bool push_finish(PUSH_STREAM stream);
+bool push_done(PUSH_STREAM stream);
+
+// decodes every block and checks the crcs without writing the output anywhere
+bool perform_verification(InputStream *source);
+
+// codes source as more blocks at the end of the compressed stream in archive, which dest writes to in place,
+// and rewrites the stream crc, original size and index to cover them; nothing already there is decoded,
+// except a stream that was all one block, which is written out again with room for more
+bool perform_append(BYTE algorithm_id, InputStream *archive, OutputStream *dest, InputStream *source);
+
+// prints the stream header and every block header, stepping over the payloads without decoding them
+bool perform_listing(InputStream *source);
+
+// counts every sample into one byte model, coded with algorithm_id (ALGORITHM_AUTO picks one), and
+// writes it to dest as a standalone dictionary file whose id is the crc of the model
+bool perform_training(BYTE algorithm_id, InputStream **samples, int num_samples, OutputStream *dest);
+
+// while a trained dictionary is loaded every block is coded with it, with no counting pass and only
+// its id in the payload; decoding such blocks needs the dictionary with the same id loaded
+bool load_trained_dictionary(InputStream *source);
+void unload_trained_dictionary();
+
+// while a reference is loaded every stream compressed is a delta against it: each block's lz77 stage can
+// copy from the piece of the reference the block lines up with, so what the two share costs only the matches.
+// decoding, verifying or appending to such a stream needs the same reference loaded, checked by its crc
+bool load_reference(InputStream *source);
+void unload_reference();
+
+// sets the block size, alphabet, selection margin and match finder for a level from fastest (1) to smallest (9)
+// and returns the algorithm to hand perform_compression() for it
+BYTE apply_compression_level(int level);
+
+// how many bytes of input each independently coded block covers, clamped to the range above
+void set_block_size(int size);
+int get_block_size();
+
+// how many percent smaller than the next faster choice a block has to get before ALGORITHM_AUTO
+// spends the extra time: huffman over stored, arithmetic over either; 0 always takes the smallest
+void set_selection_margin(int percent);
+int get_selection_margin();
+
+// what the coders count as one symbol, one of the ALPHABET_ ids in common.h; ALPHABET_BYTE by default,
+// ALPHABET_AUTO counts every block each way and keeps the smallest, unless its lz77 payload already beats
+// what the bytes alone would cost
+void set_alphabet(BYTE alphabet_id);
+BYTE get_alphabet();
+
+// how hard the LZ77 stage in front of the coders looks for matches, see lz77.h; a block is only
+// written as ALGORITHM_LZ77 when that beats coding it directly, a chain length of 0 never tries
+void set_match_finder(const struct lz77_parameters *parameters);
+void get_match_finder(struct lz77_parameters *parameters);
+
+// whether compressed streams end with an index of where every block starts, on by default
+void set_write_index(bool write_index);
+
+// whether a block whose byte statistics change partway is written as several blocks, each with tables
+// fit to its own part, on by default; costs a counting pass over every block
+void set_block_splitting(bool split);
+
+// whether a single stream's reading and writing run on threads of their own alongside the coding, on by
+// default; the output is the same either way, pipelining costs a few more blocks of memory
+void set_pipelining(bool pipeline);
+
+// a cap in bytes on what a run holds at once, 0 (the default) for none: compressing halves the block size
+// and compress_batch() runs fewer workers until the estimate fits, decoding and appending refuse streams whose
+// blocks wouldn't; estimates are upper bounds from measured peaks, a loaded reference counts against the cap
+void set_max_memory(DWORD bytes);
+DWORD get_max_memory();
+
+// progress bars and summaries on stdout, on by default
+void set_verbose(bool verbose);
+
+// per stage times and byte counts and per block entropy for the perform_ calls, see stats.h; off by
+// default, collecting costs two clock reads per stage per block and one more pass over every block
+void set_collect_stats(bool collect);
+
+// what the last perform_ call recorded, NULL unless stats are being collected
+const struct coder_stats *get_last_stats();
+
+
+#endif // COMPRESSOR__H
@@ -1,6 +1,8 @@
 #include "./dictionary.h"
 
 #include <strings.h>
+#include <ctype.h>
+#include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
@@ -11,16 +13,32 @@
 
 #define MAX_REPRESENTATION_LENGTH 2048 // the max number of bits an encoded symbol can be
 
+#define HUFFMAN_TABLE_BITS 11 // codes up to this long decode with one lookup, longer ones finish on the tree
+#define HUFFMAN_TABLE_SIZE (1 << HUFFMAN_TABLE_BITS)
+#define HUFFMAN_TABLE_ESCAPE 0 // m_length of a slot whose code is longer than the table
+#define HUFFMAN_TABLE_INVALID 0xFF // m_length of a slot no code starts with
+#define HUFFMAN_SYMBOLS_PER_REFILL 4 // after a refill there are at least 57 bits, enough for four table lookups
+
+#define NUM_BYTE_VALUES 256
+#define NUM_SUB_HISTOGRAMS 4 // interleaved so repeated bytes don't serialize on the same counter
+
+#define MAX_TOKEN_LENGTH 64 // longer words are split, so a token length always fits a BYTE
+#define INITIAL_TOKEN_CAPACITY 256
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
 #define NEWICK_RECURSE_LEFT 97
 #define NEWICK_RECURSE_RIGHT 98
 #define NEWICK_POP 99
 #define NEWICK_SYMBOL 100
 
+// the interval lives in [0, 2^32); the scaling points have to be exact powers of two or the
+// decoder's window drifts away from the bits the encoder shifted out
 #define NONE_OF_THE_WAY (0x0)
-#define ONE_QUARTER (0xFFFFFFFF / 4)
-#define HALF_WAY (0xFFFFFFFF / 2)
-#define THREE_QUARTERS (3 * (0xFFFFFFFF/4))
-#define ALL_THE_WAY (0xFFFFFFFF)
+#define ONE_QUARTER ((DWORD)1 << 30)
+#define HALF_WAY ((DWORD)1 << 31)
+#define THREE_QUARTERS (3 * ONE_QUARTER)
+#define ALL_THE_WAY ((DWORD)1 << 32)
 
 #define SHOULD_SCALE_HALF(high,low) (high < HALF_WAY || low > HALF_WAY)
 #define SHOULD_SCALE_QUARTER(high,low) (low > ONE_QUARTER && high < THREE_QUARTERS)
@@ -34,6 +52,25 @@ struct node
 	struct symbol_info m_symbol_info;
 };
 
+// one slot per HUFFMAN_TABLE_BITS bit prefix of the bitstream
+struct huffman_table_entry
+{
+	unsigned short m_value; // the symbol, or for HUFFMAN_TABLE_ESCAPE the node the prefix leads to
+	BYTE m_length; // bits the code takes
+};
+
+// reads a bitstream most significant bit first; past the end it reads zeros and counts them, so a
+// stream that ran out is only noticed once, after decoding
+struct packed_bit_reader
+{
+	const BYTE *m_cursor;
+	const BYTE *m_end;
+	DWORD m_bits; // the next m_num_bits bits of the stream, from the top down, zeros below them
+	int m_num_bits;
+	int m_padding_bits; // zeros made up past m_end
+	bool m_failed; // a prefix no huffman code starts with turned up
+};
+
 struct newick_structure
 {
 	DWORD m_num_symbols;
@@ -48,11 +85,22 @@ struct newick_structure
 
 struct huffman_structure
 {
+	struct node *m_nodes; // every node of the tree, leaves first, freed together
+	int m_num_nodes;
+
 	struct node *m_head;
 	struct node *m_decode_cursor;
 
-	bool m_found;
-	int m_depth;
+	char *m_codes; // '0'/'1' strings for every node, built once so encoding never walks the tree
+	int *m_code_offsets; // by node
+	int *m_leaf_of_symbol; // by position in m_symbols
+
+	struct huffman_table_entry *m_decode_table; // byte alphabet only, built the first time a table decode runs
+
+	// the codes again as right aligned bits by position in m_symbols, built the first time a packed
+	// encode runs; codes longer than a WORD are left to m_codes
+	WORD *m_code_values;
+	unsigned short *m_code_lengths;
 };
 
 struct arithmetic_structure
@@ -66,12 +114,31 @@ struct arithmetic_structure
 	DWORD m_interval_high;
 	int m_num_splits;
 
-	char m_bit_buffer[32];
-	int m_bit_buffer_index;
+	int m_z_bits; // bits of the first 32 that decode_consume_bit() has shifted into m_z so far
 	DWORD m_z;
 	bool m_is_z_initialized;
+	int m_pending_bits; // low bits of m_z owed by rescales that haven't been read yet
+
+	char m_representation[MAX_REPRESENTATION_LENGTH]; // what encode_symbol_to_bitstring() hands back, per dictionary so threads never share it
+
+
+};
 
+// token alphabets keep the distinct byte strings here and use their position in the table as the
+// symbol value, so m_symbols[i] always describes token i
+struct token_structure
+{
+	BYTE *m_bytes; // every distinct token back to back
+	int m_num_bytes;
+	int m_bytes_capacity;
+
+	int *m_offsets;
+	BYTE *m_lengths;
+	WORD *m_hashes;
+	int m_capacity; // of the three arrays above and of m_symbols
 
+	int *m_slots; // open addressing over token positions, -1 when empty, encoder side only
+	int m_num_slots;
 };
 
 struct dictionary_internal
@@ -79,13 +146,18 @@ struct dictionary_internal
 	int m_num_symbols;
 	struct symbol_info *m_symbols;
 
+	ARENA m_arena; // when set, every allocation below comes from here and is released by arena_reset()
+
+	WORD m_histogram[NUM_SUB_HISTOGRAMS][NUM_BYTE_VALUES]; // raw counts, folded into m_symbols by finalize_dictionary()
+	int m_byte_symbol_index[NUM_BYTE_VALUES]; // byte alphabet only, value to position in m_symbols
+
+	struct token_structure m_tokens;
+
 	BYTE m_algorithm_id;
+	BYTE m_alphabet_id;
 
 	struct huffman_structure m_huffman;
 	struct arithmetic_structure m_arithmetic;
-
-	int m_representation_length;
-	char m_representation[MAX_REPRESENTATION_LENGTH]; // literally the characters '0' or '1' to represent a bit string
 };
 
 
@@ -98,17 +170,60 @@ struct dictionary_internal
 // Private Prototypes
 DWORD round_div(DWORD dividend, DWORD divisor);
 
+void *dictionary_allocate(struct dictionary_internal *dictionary, int size);
+void *dictionary_reallocate(struct dictionary_internal *dictionary, void *memory, int old_size, int new_size);
+void dictionary_free(struct dictionary_internal *dictionary, void *memory);
+
+int token_length(BYTE alphabet_id, const BYTE *source, int length);
+WORD hash_token(const BYTE *token, int length);
+int find_token(struct dictionary_internal *dictionary, const BYTE *token, int length, WORD hash);
+int add_token(struct dictionary_internal *dictionary, const BYTE *token, int length, WORD hash);
+void grow_token_slots(struct dictionary_internal *dictionary);
+void free_tokens(struct dictionary_internal *dictionary);
+
 void initialize_arithmetic_z(DICTIONARY dictionary);
-bool decode_iteration(DICTIONARY dictionary, struct symbol *decoded_symbol, bool advance_z, char bit_representation);
+bool decode_iteration(DICTIONARY dictionary, struct symbol *decoded_symbol);
+
+bool consume_arithmetic_bit(struct dictionary_internal *dictionary, char bit_representation, struct symbol *decoded_symbol);
+void encode_arithmetic_symbol(struct dictionary_internal *dictionary, int symbol_index, struct packed_bit_writer *writer);
+void flush_arithmetic(struct dictionary_internal *dictionary, struct packed_bit_writer *writer);
 
 void rescale_half(struct dictionary_internal *dictionary, char bit_representation);
 void rescale_quarter(struct dictionary_internal *dictionary, char bit_representation);
+void fold_histogram_into_symbols(struct dictionary_internal *dictionary);
+int serialized_size(struct dictionary_internal *dictionary);
+int compare_counts(const void *a, const void *b);
+DWORD huffman_code_bits(struct dictionary_internal *dictionary);
+int varint_size(WORD value);
+BYTE *write_varint(BYTE *cursor, WORD value);
+BYTE *read_varint(BYTE *cursor, BYTE *end, WORD *value);
+void build_byte_symbol_index(struct dictionary_internal *dictionary);
 int find_symbol_index(struct dictionary_internal *dictionary,struct symbol sym);
-void find_symbol(struct dictionary_internal *dictionary,struct symbol sym, struct node *current_node);
 
-int find_min_node(int num_nodes, struct node **nodes);
+int compare_leaf_nodes(const void *a, const void *b);
+struct node *take_min_node(struct node *nodes, int num_leaves, int *leaf_index, int *internal_index, int internal_end);
 void make_tree(struct dictionary_internal *dictionary);
-void free_tree(struct node *head);
+void make_codes(struct dictionary_internal *dictionary);
+void free_tree(struct dictionary_internal *dictionary);
+void make_decode_table(struct dictionary_internal *dictionary);
+void make_encode_table(struct dictionary_internal *dictionary);
+void start_packed_reader(struct packed_bit_reader *reader, const BYTE *source, int source_size);
+void refill_packed_reader(struct packed_bit_reader *reader);
+WORD take_packed_bits(struct packed_bit_reader *reader, int count);
+BYTE decode_huffman_byte(struct dictionary_internal *dictionary, struct packed_bit_reader *reader);
+BYTE decode_huffman_byte_from_tree(struct dictionary_internal *dictionary, struct packed_bit_reader *reader, const struct huffman_table_entry *entry);
+void decode_huffman_run(struct dictionary_internal *dictionary, struct packed_bit_reader *reader, BYTE *dest, int num_symbols);
+bool finish_huffman_reader(struct packed_bit_reader *reader);
+
+void start_packed_writer(struct packed_bit_writer *writer, BYTE *dest, int capacity);
+void put_packed_bits(struct packed_bit_writer *writer, WORD value, int count);
+void put_packed_run(struct packed_bit_writer *writer, int bit, int count);
+const char *unpack_representation(struct dictionary_internal *dictionary, const BYTE *packed, struct packed_bit_writer *writer);
+int next_symbol_index(struct dictionary_internal *dictionary, const BYTE *source, int length, int *symbol_length);
+int encode_huffman_run(struct dictionary_internal *dictionary, struct packed_bit_writer *writer, const BYTE *source, int length);
+int encode_arithmetic_run(struct dictionary_internal *dictionary, struct packed_bit_writer *writer, const BYTE *source, int length);
+int decode_arithmetic_run(struct dictionary_internal *dictionary, struct packed_bit_reader *reader, BYTE *dest, int capacity);
+bool store_decoded_symbol(struct dictionary_internal *dictionary, struct symbol sym, BYTE *dest, int capacity, int *fill);
 
 
 /*void initialize_newick_structure(struct newick_structure *newick);
@@ -124,22 +239,45 @@ struct node *tree_from_newick(struct newick_structure *newick);
 /////////////////////////////
 // Public Functions
 
-DICTIONARY create_dictionary(BYTE algorithm_id)
+DICTIONARY create_dictionary(BYTE algorithm_id,BYTE alphabet_id,ARENA arena)
 {
 	struct dictionary_internal *addition;
 
-	addition = (struct dictionary_internal *)malloc(sizeof(struct dictionary_internal));
+	if (arena != NULL)
+	{
+		addition = (struct dictionary_internal *)arena_allocate(arena,sizeof(struct dictionary_internal));
+	}
+	else
+	{
+		addition = (struct dictionary_internal *)malloc(sizeof(struct dictionary_internal));
+	}
 
+	addition->m_arena = arena;
 	addition->m_algorithm_id = algorithm_id;
+	addition->m_alphabet_id = alphabet_id;
 
 	addition->m_arithmetic.m_lower_precision = NULL;
 	addition->m_arithmetic.m_higher_precision = NULL;
 
 	addition->m_num_symbols = 0;
-	addition->m_representation_length = 0;
 
 	addition->m_symbols = NULL;
+	addition->m_huffman.m_nodes = NULL;
+	addition->m_huffman.m_num_nodes = 0;
 	addition->m_huffman.m_head = NULL;
+	addition->m_huffman.m_codes = NULL;
+	addition->m_huffman.m_code_offsets = NULL;
+	addition->m_huffman.m_leaf_of_symbol = NULL;
+	addition->m_huffman.m_decode_table = NULL;
+	addition->m_huffman.m_code_values = NULL;
+	addition->m_huffman.m_code_lengths = NULL;
+
+	memset(&(addition->m_tokens),0,sizeof(addition->m_tokens));
+
+	if (alphabet_id == ALPHABET_BYTE)
+	{
+		memset(addition->m_histogram,0,sizeof(addition->m_histogram));
+	}
 
 	return (DICTIONARY)addition;
 }
@@ -150,28 +288,28 @@ void destroy_dictonary(DICTIONARY dictionary)
 
 	alias = (struct dictionary_internal *)dictionary;
 
-	free(alias->m_symbols);
+	dictionary_free(alias,alias->m_symbols);
 	alias->m_symbols = NULL;
 
+	free_tokens(alias);
+
 	if (alias->m_algorithm_id == ALGORITHM_HUFFMAN)
 	{
-		free_tree(alias->m_huffman.m_head);
-		alias->m_huffman.m_head = NULL;
-		alias->m_huffman.m_decode_cursor = NULL;
+		free_tree(alias);
 	}
 	else
 	{
 		if (alias->m_algorithm_id == ALGORITHM_ARITHMETIC)
 		{
-			free(alias->m_arithmetic.m_lower_precision);
+			dictionary_free(alias,alias->m_arithmetic.m_lower_precision);
 			alias->m_arithmetic.m_lower_precision = NULL;
 
-			free(alias->m_arithmetic.m_higher_precision);
+			dictionary_free(alias,alias->m_arithmetic.m_higher_precision);
 			alias->m_arithmetic.m_higher_precision = NULL;
 		}
 	}
 
-	free(alias);
+	dictionary_free(alias,alias);
 }
 
 
@@ -181,22 +319,89 @@ void update_dictionary(DICTIONARY dictionary,struct symbol sym)
 
 	alias = (struct dictionary_internal *)dictionary;
 
+	if (alias->m_alphabet_id == ALPHABET_BYTE)
+	{
+		alias->m_histogram[0][(BYTE)sym.m_value]++;
+	}
+	else if ((int)sym.m_value < alias->m_num_symbols)
+	{
+		alias->m_symbols[sym.m_value].m_count++;
+	}
+}
+
+void update_dictionary_buffer(DICTIONARY dictionary,const BYTE *source,int length)
+{
+	struct dictionary_internal *alias;
+	WORD *h0;
+	WORD *h1;
+	WORD *h2;
+	WORD *h3;
 	int i;
-	for (i = 0;i < alias->m_num_symbols;i++)
+
+	alias = (struct dictionary_internal *)dictionary;
+
+	if (alias->m_alphabet_id != ALPHABET_BYTE)
 	{
-		if (alias->m_symbols[i].m_symbol.m_value == sym.m_value) 
+		i = 0;
+		while (i < length)
 		{
-			alias->m_symbols[i].m_count++;
-			break;
+			int length_of_token;
+			WORD hash;
+			int index;
+
+			length_of_token = token_length(alias->m_alphabet_id,&(source[i]),length - i);
+			hash = hash_token(&(source[i]),length_of_token);
+
+			index = find_token(alias,&(source[i]),length_of_token,hash);
+			if (index < 0)
+			{
+				index = add_token(alias,&(source[i]),length_of_token,hash);
+			}
+
+			alias->m_symbols[index].m_count++;
+			i += length_of_token;
 		}
+
+		return;
+	}
+
+	h0 = alias->m_histogram[0];
+	h1 = alias->m_histogram[1];
+	h2 = alias->m_histogram[2];
+	h3 = alias->m_histogram[3];
+
+	// 16 bytes per iteration, loaded as two words and spread over the sub-histograms so
+	// that a run of the same byte never increments the same counter back to back
+	for (i = 0; i + 16 <= length; i += 16)
+	{
+		DWORD w0;
+		DWORD w1;
+
+		memcpy(&w0,&(source[i]),sizeof(w0));
+		memcpy(&w1,&(source[i + 8]),sizeof(w1));
+
+		h0[(BYTE)(w0)]++;
+		h1[(BYTE)(w0 >> 8)]++;
+		h2[(BYTE)(w0 >> 16)]++;
+		h3[(BYTE)(w0 >> 24)]++;
+		h0[(BYTE)(w0 >> 32)]++;
+		h1[(BYTE)(w0 >> 40)]++;
+		h2[(BYTE)(w0 >> 48)]++;
+		h3[(BYTE)(w0 >> 56)]++;
+
+		h0[(BYTE)(w1)]++;
+		h1[(BYTE)(w1 >> 8)]++;
+		h2[(BYTE)(w1 >> 16)]++;
+		h3[(BYTE)(w1 >> 24)]++;
+		h0[(BYTE)(w1 >> 32)]++;
+		h1[(BYTE)(w1 >> 40)]++;
+		h2[(BYTE)(w1 >> 48)]++;
+		h3[(BYTE)(w1 >> 56)]++;
 	}
 
-	if (i == alias->m_num_symbols)
+	for (; i < length; i++)
 	{
-		alias->m_num_symbols++;
-		alias->m_symbols = (struct symbol_info *)realloc(alias->m_symbols, sizeof(struct symbol_info)*alias->m_num_symbols);
-		alias->m_symbols[alias->m_num_symbols - 1].m_count = 1;
-		alias->m_symbols[alias->m_num_symbols - 1].m_symbol.m_value = sym.m_value; 
+		h0[source[i]]++;
 	}
 }
 
@@ -209,9 +414,16 @@ bool finalize_dictionary(DICTIONARY dictionary)
 
 	result = false;
 
+	if (alias->m_alphabet_id == ALPHABET_BYTE)
+	{
+		fold_histogram_into_symbols(alias);
+		build_byte_symbol_index(alias);
+	}
+
 	if (alias->m_algorithm_id == ALGORITHM_HUFFMAN)
 	{
 		make_tree(alias);
+		make_codes(alias);
 
 		if (alias->m_huffman.m_head != NULL)
 		{
@@ -223,16 +435,19 @@ bool finalize_dictionary(DICTIONARY dictionary)
 	{
 		if (alias->m_algorithm_id == ALGORITHM_ARITHMETIC)
 		{
-			alias->m_arithmetic.m_lower_precision = (DWORD *)malloc(sizeof(DWORD) * alias->m_num_symbols);
-			alias->m_arithmetic.m_higher_precision = (DWORD *)malloc(sizeof(DWORD) * alias->m_num_symbols);
+			dictionary_free(alias,alias->m_arithmetic.m_lower_precision);
+			dictionary_free(alias,alias->m_arithmetic.m_higher_precision);
+			alias->m_arithmetic.m_lower_precision = (DWORD *)dictionary_allocate(alias,sizeof(DWORD) * alias->m_num_symbols);
+			alias->m_arithmetic.m_higher_precision = (DWORD *)dictionary_allocate(alias,sizeof(DWORD) * alias->m_num_symbols);
 			alias->m_arithmetic.m_total_symbols = 0;
 			alias->m_arithmetic.m_total_symbols_decoded = 0;
 			alias->m_arithmetic.m_interval_low = NONE_OF_THE_WAY;
 			alias->m_arithmetic.m_interval_high = ALL_THE_WAY;
 			alias->m_arithmetic.m_num_splits = 0;
-			alias->m_arithmetic.m_bit_buffer_index = 0;
+			alias->m_arithmetic.m_z_bits = 0;
 			alias->m_arithmetic.m_is_z_initialized = false;
 			alias->m_arithmetic.m_z = 0;
+			alias->m_arithmetic.m_pending_bits = 0;
 
 			int i;
 			DWORD previous_count = 0;
@@ -287,52 +502,153 @@ void serialize_dictionary_to_bytes(DICTIONARY dictionary,int *num_bytes,BYTE **b
 //	print_dictionary(dictionary);
 	alias = (struct dictionary_internal *)dictionary;
 
-	*num_bytes = sizeof(((struct dictionary_internal *)NULL)->m_algorithm_id);
+	*num_bytes = serialized_size(alias);
 
-	*num_bytes += sizeof(((struct dictionary_internal *)NULL)->m_num_symbols);
-
-	*num_bytes += (alias->m_num_symbols * sizeof(struct symbol_info));
-
-	*bytes = (BYTE *)malloc(sizeof(BYTE) * *num_bytes);
+	*bytes = (BYTE *)dictionary_allocate(alias,sizeof(BYTE) * *num_bytes);
 	cursor = *bytes;
 
 	memcpy(cursor,&(alias->m_algorithm_id),sizeof(((struct dictionary_internal *)NULL)->m_algorithm_id));
 	cursor += sizeof(((struct dictionary_internal *)NULL)->m_algorithm_id);
 
+	memcpy(cursor,&(alias->m_alphabet_id),sizeof(((struct dictionary_internal *)NULL)->m_alphabet_id));
+	cursor += sizeof(((struct dictionary_internal *)NULL)->m_alphabet_id);
+
 	memcpy(cursor,&(alias->m_num_symbols),sizeof(((struct dictionary_internal *)NULL)->m_num_symbols));
 	cursor += sizeof(alias->m_num_symbols);
 
-	memcpy(cursor,alias->m_symbols,(alias->m_num_symbols * sizeof(struct symbol_info)));
-	cursor += alias->m_num_symbols * sizeof(struct symbol_info);
+	if (alias->m_alphabet_id == ALPHABET_BYTE)
+	{
+		memcpy(cursor,alias->m_symbols,(alias->m_num_symbols * sizeof(struct symbol_info)));
+		cursor += alias->m_num_symbols * sizeof(struct symbol_info);
+	}
+	else
+	{
+		int i;
+
+		for (i = 0; i < alias->m_num_symbols; i++)
+		{
+			cursor = write_varint(cursor,alias->m_symbols[i].m_count);
+		}
+
+		memcpy(cursor,alias->m_tokens.m_lengths,alias->m_num_symbols * sizeof(alias->m_tokens.m_lengths[0]));
+		cursor += alias->m_num_symbols * sizeof(alias->m_tokens.m_lengths[0]);
+
+		memcpy(cursor,alias->m_tokens.m_bytes,alias->m_tokens.m_num_bytes);
+		cursor += alias->m_tokens.m_num_bytes;
+	}
 
 //	print_bytes("serialized dictionary bytes",*num_bytes,*bytes);
 }
 
 
-DICTIONARY deserialize_bytes_to_dictionary(int num_bytes,BYTE *bytes)
+DICTIONARY deserialize_bytes_to_dictionary(int num_bytes,BYTE *bytes,ARENA arena)
 {
 	DICTIONARY result;
 	BYTE algorithm_id;
+	BYTE alphabet_id;
+	int num_symbols;
 	BYTE *cursor;
+	BYTE *end;
 	struct dictionary_internal *alias;
 
 //	print_bytes("deserialized dictionary bytes",num_bytes,bytes);
 
 	cursor = bytes;
+	end = bytes + num_bytes;
+
+	if (num_bytes < (int)(sizeof(algorithm_id) + sizeof(alphabet_id) + sizeof(num_symbols)))
+	{
+		return NULL;
+	}
 
 	memcpy(&algorithm_id,cursor,sizeof(((struct dictionary_internal *)NULL)->m_algorithm_id));
 	cursor += sizeof(((struct dictionary_internal *)NULL)->m_algorithm_id);
 
-	result = create_dictionary(algorithm_id);
+	memcpy(&alphabet_id,cursor,sizeof(((struct dictionary_internal *)NULL)->m_alphabet_id));
+	cursor += sizeof(((struct dictionary_internal *)NULL)->m_alphabet_id);
+
+	memcpy(&num_symbols,cursor,sizeof(num_symbols));
+	cursor += sizeof(num_symbols);
+
+	// every symbol takes at least one byte whatever the alphabet, which bounds the allocation below
+	if ((algorithm_id != ALGORITHM_HUFFMAN && algorithm_id != ALGORITHM_ARITHMETIC) ||
+		(alphabet_id != ALPHABET_BYTE && alphabet_id != ALPHABET_PAIR && alphabet_id != ALPHABET_WORD) ||
+		num_symbols < 0 || num_symbols > end - cursor)
+	{
+		return NULL;
+	}
+
+	result = create_dictionary(algorithm_id,alphabet_id,arena);
 	alias = (struct dictionary_internal *)result;
 
-	memcpy(&(alias->m_num_symbols),cursor,sizeof(alias->m_num_symbols));
-	cursor += sizeof(alias->m_num_symbols);
+	alias->m_num_symbols = num_symbols;
+	alias->m_symbols = (struct symbol_info *)dictionary_allocate(alias,sizeof(struct symbol_info) * (alias->m_num_symbols + 1));
+
+	if (alphabet_id == ALPHABET_BYTE)
+	{
+		int i;
+
+		if (num_symbols > (end - cursor) / (int)sizeof(struct symbol_info))
+		{
+			return NULL;
+		}
+
+		memcpy(alias->m_symbols,cursor,sizeof(struct symbol_info) * alias->m_num_symbols);
+		cursor += sizeof(struct symbol_info) * alias->m_num_symbols;
+
+		for (i = 0; i < num_symbols; i++)
+		{
+			if (alias->m_symbols[i].m_symbol.m_value >= NUM_BYTE_VALUES)
+			{
+				return NULL;
+			}
+		}
+	}
+	else
+	{
+		int i;
 
+		for (i = 0; i < num_symbols; i++)
+		{
+			WORD count;
+
+			cursor = read_varint(cursor,end,&count);
+			if (cursor == NULL)
+			{
+				return NULL;
+			}
+
+			alias->m_symbols[i].m_count = count;
+			alias->m_symbols[i].m_symbol.m_value = i;
+		}
+
+		if (end - cursor < num_symbols)
+		{
+			return NULL;
+		}
+
+		alias->m_tokens.m_capacity = num_symbols;
+		alias->m_tokens.m_lengths = (BYTE *)dictionary_allocate(alias,sizeof(BYTE) * (num_symbols + 1));
+		alias->m_tokens.m_offsets = (int *)dictionary_allocate(alias,sizeof(int) * (num_symbols + 1));
+		memcpy(alias->m_tokens.m_lengths,cursor,num_symbols);
+		cursor += num_symbols;
+
+		for (i = 0; i < num_symbols; i++)
+		{
+			alias->m_tokens.m_offsets[i] = alias->m_tokens.m_num_bytes;
+			alias->m_tokens.m_num_bytes += alias->m_tokens.m_lengths[i];
+		}
+
+		if (end - cursor < alias->m_tokens.m_num_bytes)
+		{
+			return NULL;
+		}
 
-	alias->m_symbols = (struct symbol_info *)malloc(sizeof(struct symbol_info) * alias->m_num_symbols);
-	memcpy(alias->m_symbols,cursor,sizeof(struct symbol_info) * alias->m_num_symbols);
-	cursor += sizeof(struct symbol_info) * alias->m_num_symbols;
+		alias->m_tokens.m_bytes = (BYTE *)dictionary_allocate(alias,alias->m_tokens.m_num_bytes + 1);
+		alias->m_tokens.m_bytes_capacity = alias->m_tokens.m_num_bytes + 1;
+		memcpy(alias->m_tokens.m_bytes,cursor,alias->m_tokens.m_num_bytes);
+		cursor += alias->m_tokens.m_num_bytes;
+	}
 
 
 	bool test;
@@ -352,25 +668,73 @@ DICTIONARY deserialize_bytes_to_dictionary(int num_bytes,BYTE *bytes)
 
 
 
-void wonky_fill_in(char *buffer,char first,char rest,int rest_count)
+BYTE get_dictionary_algorithm(DICTIONARY dictionary)
+{
+	struct dictionary_internal *alias;
+
+	alias = (struct dictionary_internal *)dictionary;
+
+	return alias->m_algorithm_id;
+}
+
+BYTE get_dictionary_alphabet(DICTIONARY dictionary)
+{
+	struct dictionary_internal *alias;
+
+	alias = (struct dictionary_internal *)dictionary;
+
+	return alias->m_alphabet_id;
+}
+
+void set_dictionary_algorithm(DICTIONARY dictionary,BYTE algorithm_id)
+{
+	struct dictionary_internal *alias;
+
+	alias = (struct dictionary_internal *)dictionary;
+
+	alias->m_algorithm_id = algorithm_id;
+}
+
+void estimate_encoded_bits(DICTIONARY dictionary,DWORD *huffman_bits,DWORD *arithmetic_bits)
 {
+	struct dictionary_internal *alias;
+	DWORD table_bits;
+	double entropy_bits;
+	int total;
 	int i;
 
+	alias = (struct dictionary_internal *)dictionary;
 
-	buffer[0] = first;
+	if (alias->m_alphabet_id == ALPHABET_BYTE)
+	{
+		fold_histogram_into_symbols(alias);
+	}
 
-	for(i = 0;i < rest_count;i++)
+	total = 0;
+	for (i = 0; i < alias->m_num_symbols; i++)
 	{
-		buffer[i+1] = rest;
+		total += alias->m_symbols[i].m_count;
 	}
 
-	buffer[i+1] = '\0';
-}
+	entropy_bits = 0.0;
+	for (i = 0; i < alias->m_num_symbols; i++)
+	{
+		int count;
 
+		count = alias->m_symbols[i].m_count;
+		if (count > 0)
+		{
+			entropy_bits += count * log2((double)total / count);
+		}
+	}
 
+	table_bits = (DWORD)serialized_size(alias) * 8;
 
+	// the arithmetic coder lands within a couple of bits of the entropy plus its flush
+	*huffman_bits = table_bits + huffman_code_bits(alias);
+	*arithmetic_bits = table_bits + (DWORD)ceil(entropy_bits) + 34;
+}
 
-static char s_working_buffer[MAX_REPRESENTATION_LENGTH];
 
 const char *encode_symbol_to_bitstring(DICTIONARY dictionary,struct symbol sym)
 {
@@ -383,104 +747,26 @@ const char *encode_symbol_to_bitstring(DICTIONARY dictionary,struct symbol sym)
 
 	if (alias->m_algorithm_id == ALGORITHM_HUFFMAN)
 	{
-		alias->m_huffman.m_found = false;
-		alias->m_huffman.m_depth = 0;
+		int symbol_index;
 
-		find_symbol(alias,sym,alias->m_huffman.m_head);
+		symbol_index = find_symbol_index(alias, sym);
 
-		if (alias->m_huffman.m_found == true)
+		if (symbol_index >= 0)
 		{
-			result = alias->m_representation;
+			result = &(alias->m_huffman.m_codes[alias->m_huffman.m_code_offsets[alias->m_huffman.m_leaf_of_symbol[symbol_index]]]);
 		}
 	}
 	else
 	{
 		if (alias->m_algorithm_id == ALGORITHM_ARITHMETIC)
 		{
-			DWORD diff;
-			int symbol_index;
-			int write_index;
-			DWORD higher_precision;
-			DWORD lower_precision;
-
-			diff = alias->m_arithmetic.m_interval_high - alias->m_arithmetic.m_interval_low;
-			symbol_index = find_symbol_index(alias, sym);
-
-
-			printf("before  high[%llu]  low[%llu] symbol[%c]\n",alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low, sym.m_value);
-
-			higher_precision = diff * alias->m_arithmetic.m_higher_precision[symbol_index];
-			lower_precision = diff * alias->m_arithmetic.m_lower_precision[symbol_index];
-
-			printf("HMM hp[%llu]  lp[%llu] diff[%llu]  si[%d]\n",alias->m_arithmetic.m_higher_precision[symbol_index],alias->m_arithmetic.m_lower_precision[symbol_index],diff,symbol_index);
-
-			alias->m_arithmetic.m_interval_high = alias->m_arithmetic.m_interval_low + round_div(higher_precision, alias->m_arithmetic.m_total_symbols);
-			alias->m_arithmetic.m_interval_low = alias->m_arithmetic.m_interval_low + round_div(lower_precision, alias->m_arithmetic.m_total_symbols);
-
-			write_index = 0;
-
-			printf("after  high[%llu]  low[%llu]\n",alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low);
-
-//			printf("after[%llu][%llu][%llu][%llu][%d]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low,higher_precision,lower_precision,symbol_index);
-
-			// rescaling half
-			while (SHOULD_SCALE_HALF(alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low))
-			{
-				printf("\tscaling1 half! [%llu][%llu]  numsplits[%d]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low,alias->m_arithmetic.m_num_splits);
-				assert(write_index < MAX_REPRESENTATION_LENGTH);
-
-				if (alias->m_arithmetic.m_interval_high < HALF_WAY)
-				{
-					printf("\t\thigh is too low\n");
-
-					//flush some encoding back to our caller
-					wonky_fill_in(&(s_working_buffer[write_index]),'0','1',alias->m_arithmetic.m_num_splits);
-					write_index += 1 + alias->m_arithmetic.m_num_splits;
-
-					alias->m_arithmetic.m_interval_low = alias->m_arithmetic.m_interval_low * 2;
-					alias->m_arithmetic.m_interval_high = alias->m_arithmetic.m_interval_high * 2;
-					alias->m_arithmetic.m_num_splits = 0;
-
-					result = s_working_buffer;
-
-					printf("\t\tnew vals[%llu][%llu]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low);
-				}
-				else if (alias->m_arithmetic.m_interval_low > HALF_WAY)
-				{
-					printf("\t\tlow is too high\n");
-
-					wonky_fill_in(&(s_working_buffer[write_index]),'1','0',alias->m_arithmetic.m_num_splits);
-					write_index += 1 + alias->m_arithmetic.m_num_splits;
-
-					alias->m_arithmetic.m_interval_low = 2 * (alias->m_arithmetic.m_interval_low - HALF_WAY);
-					alias->m_arithmetic.m_interval_high = 2 * (alias->m_arithmetic.m_interval_high - HALF_WAY);
-					alias->m_arithmetic.m_num_splits = 0;
-
-					result = s_working_buffer;
-					printf("\t\tnew vals[%llu][%llu]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low);
-				}
-				else
-				{
-					assert(!"shouldn't be here!");
-				}
-			}
-
-			assert(write_index < MAX_REPRESENTATION_LENGTH);
-
-//			printf("finished scaling1!\n");
+			BYTE packed[PACKED_SYMBOL_ROOM];
+			struct packed_bit_writer writer;
 
+			start_packed_writer(&writer, packed, sizeof(packed));
+			encode_arithmetic_symbol(alias, find_symbol_index(alias, sym), &writer);
 
-			// rescaling quarter
-			while (SHOULD_SCALE_QUARTER(alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low))
-			{
-				printf("\tscaling quarter! [%llu][%llu]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low);
-
-				alias->m_arithmetic.m_interval_low = 2 * (alias->m_arithmetic.m_interval_low - ONE_QUARTER);
-				alias->m_arithmetic.m_interval_high = 2 * (alias->m_arithmetic.m_interval_high - ONE_QUARTER);
-				alias->m_arithmetic.m_num_splits++;
-			}
-//			printf("finished scaling2!\n");
-
+			result = (char *)unpack_representation(alias, packed, &writer);
 		}
 	}
 
@@ -492,7 +778,7 @@ const char *encode_symbol_to_bitstring(DICTIONARY dictionary,struct symbol sym)
 const char *encode_symbol_to_bitstring_flush(DICTIONARY dictionary)
 {
 	struct dictionary_internal *alias;
-	char *result;
+	const char *result;
 
 	alias = (struct dictionary_internal *)dictionary;
 
@@ -504,22 +790,15 @@ const char *encode_symbol_to_bitstring_flush(DICTIONARY dictionary)
 	{
 		if (alias->m_algorithm_id == ALGORITHM_ARITHMETIC)
 		{
-			int j;
-
-			alias->m_arithmetic.m_num_splits++;
+			BYTE packed[PACKED_SYMBOL_ROOM];
+			struct packed_bit_writer writer;
 
-			if (alias->m_arithmetic.m_interval_low <= ONE_QUARTER)
-			{
-				wonky_fill_in(s_working_buffer,'0','1',alias->m_arithmetic.m_num_splits);
-			}
-			else
-			{
-				wonky_fill_in(s_working_buffer,'1','0',alias->m_arithmetic.m_num_splits);
-			}
+			start_packed_writer(&writer, packed, sizeof(packed));
+			flush_arithmetic(alias, &writer);
 
-			result = s_working_buffer;
+			result = unpack_representation(alias, packed, &writer);
 
-			printf("flushing [%s]\n",result);
+			//printf("flushing [%s]\n",result);
 		}
 	}
 
@@ -561,369 +840,1813 @@ bool decode_consume_bit(DICTIONARY dictionary,char bit_representation, struct sy
 	{
 		if (alias->m_algorithm_id == ALGORITHM_ARITHMETIC)
 		{
-			if (alias->m_arithmetic.m_bit_buffer_index < 32)
-			{
-//				printf("consume bit[%c][%p][%d]\n",bit_representation,alias->m_arithmetic.m_bit_buffer,alias->m_arithmetic.m_bit_buffer_index);
-				alias->m_arithmetic.m_bit_buffer[alias->m_arithmetic.m_bit_buffer_index] = bit_representation;
-				alias->m_arithmetic.m_bit_buffer_index++;
-			}
-			else
-			{
-				result = decode_iteration(dictionary, decoded_symbol, true, bit_representation);
-			}
+			result = consume_arithmetic_bit(alias, bit_representation, decoded_symbol);
 		}
 	}
 	return result;
 }
 
-bool decode_consume_bit_flush(DICTIONARY dictionary, struct symbol *decoded_symbol)
+bool decode_pending_symbol(DICTIONARY dictionary, struct symbol *decoded_symbol)
 {
 	struct dictionary_internal *alias;
 	bool result;
 
-
-	 printf("decode consume bit flush\n");
-
 	alias = (struct dictionary_internal *)dictionary;
 
 	result = false;
 
+	// a likely symbol can narrow the interval without forcing a rescale, in which case the
+	// bits already read pin down the next symbol too
 	if (alias->m_algorithm_id == ALGORITHM_ARITHMETIC)
 	{
-		result = decode_iteration(dictionary, decoded_symbol, false, '\0');
+		if (alias->m_arithmetic.m_is_z_initialized == true && alias->m_arithmetic.m_pending_bits == 0)
+		{
+			result = decode_iteration(dictionary, decoded_symbol);
+		}
 	}
 
 	return result;
 }
 
-void print_dictionary(DICTIONARY dictionary)
+bool decode_consume_bit_flush(DICTIONARY dictionary, struct symbol *decoded_symbol)
 {
 	struct dictionary_internal *alias;
-	int total;
-	int i;
+	bool result;
 
-	alias = (struct dictionary_internal *)dictionary;
-	total = 0;
 
-	for (i = 0;i < alias->m_num_symbols;i++)
-	{
-		printf("symbol[%d], frequency[%d]\n", alias->m_symbols[i].m_symbol.m_value, alias->m_symbols[i].m_count);
-		total += alias->m_symbols[i].m_count;
-	}
+//	printf("decode consume bit flush\n");
 
-	printf("num distinct symbols[%d]\n", alias->m_num_symbols);
-	printf("total in print freq[%d]\n", total);
-}
+	alias = (struct dictionary_internal *)dictionary;
+
+	result = false;
 
+	if (alias->m_algorithm_id == ALGORITHM_ARITHMETIC)
+	{
+		// the bitstream has ended, every bit still owed to z is a zero
+		alias->m_arithmetic.m_pending_bits = 0;
 
+		result = decode_iteration(dictionary, decoded_symbol);
+	}
 
-/////////////////////////////
-// Private Functions
-DWORD round_div(DWORD dividend, DWORD divisor)
-{
-    return (dividend + (divisor / 2)) / divisor;
+	return result;
 }
 
 
-void initialize_arithmetic_z(DICTIONARY dictionary)
+int encode_buffer_packed(DICTIONARY dictionary,struct packed_bit_writer *writer,const BYTE *source,int length)
 {
 	struct dictionary_internal *alias;
-	int pos;
+	int result;
 
 	alias = (struct dictionary_internal *)dictionary;
 
-	assert(alias->m_arithmetic.m_is_z_initialized == false);
-
-	alias->m_arithmetic.m_z = 0;
+	result = -1;
 
-	for (pos = 0; pos < alias->m_arithmetic.m_bit_buffer_index; pos++)
+	if (alias->m_algorithm_id == ALGORITHM_HUFFMAN)
 	{
-		if (alias->m_arithmetic.m_bit_buffer[pos] == '1')
+		make_encode_table(alias);
+		result = encode_huffman_run(alias, writer, source, length);
+	}
+	else
+	{
+		if (alias->m_algorithm_id == ALGORITHM_ARITHMETIC)
 		{
-			alias->m_arithmetic.m_z = alias->m_arithmetic.m_z | (1 << (32 - pos - 1));
-//			printf("m_bit_buffer[%s] m_z[%lld]  alias->m_arithmetic.m_bit_buffer_index[%d]\n",alias->m_arithmetic.m_bit_buffer,alias->m_arithmetic.m_z, alias->m_arithmetic.m_bit_buffer_index);
+			result = encode_arithmetic_run(alias, writer, source, length);
 		}
 	}
 
-	printf("m_bit_buffer[%s] m_z[%lld]  alias->m_arithmetic.m_bit_buffer_index[%d]\n",alias->m_arithmetic.m_bit_buffer,alias->m_arithmetic.m_z, alias->m_arithmetic.m_bit_buffer_index);
-	printf("final m_z[%lld]\n",alias->m_arithmetic.m_z);
-
-	alias->m_arithmetic.m_is_z_initialized = true;
+	return result;
 }
 
-bool decode_iteration(DICTIONARY dictionary, struct symbol *decoded_symbol, bool advance_z, char bit_representation)
+void encode_flush_packed(DICTIONARY dictionary,struct packed_bit_writer *writer)
 {
 	struct dictionary_internal *alias;
-	bool result;
 
 	alias = (struct dictionary_internal *)dictionary;
-	result = false;
 
-	if (alias->m_arithmetic.m_is_z_initialized == false)
+	if (alias->m_algorithm_id == ALGORITHM_ARITHMETIC)
 	{
-		initialize_arithmetic_z(dictionary);
+		flush_arithmetic(alias, writer);
 	}
+}
 
-	if (alias->m_arithmetic.m_total_symbols_decoded < alias->m_arithmetic.m_total_symbols)
-	{
-		int j;
-
-		printf("before  high[%llu]  low[%llu]\n",alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low);
+int finish_packed_bits(struct packed_bit_writer *writer)
+{
+	int result;
 
+	result = writer->m_num_bits % 8;
 
-		for (j=0; j<alias->m_num_symbols; j++)
-		{
-			// printf("-----------------\n");
-			
-			// printf("trying symbol[%c]\n", alias->m_symbols[j].m_symbol.m_value);
+	while (writer->m_num_bits > 0)
+	{
+		*(writer->m_cursor) = (BYTE)(writer->m_bits >> 56);
+		writer->m_cursor++;
+		writer->m_bits <<= 8;
+		writer->m_num_bits -= writer->m_num_bits < 8 ? writer->m_num_bits : 8;
+	}
 
-			DWORD diff;
-			DWORD higher_precision;
-			DWORD lower_precision;
-			DWORD b0;
-			DWORD a0;
+	return result;
+}
 
 
+int decode_buffer_packed(DICTIONARY dictionary,const BYTE *source,int source_size,int remainder_bits,BYTE *dest,int capacity)
+{
+	struct dictionary_internal *alias;
+	DWORD num_bits;
+	DWORD i;
+	int fill;
 
-			diff = alias->m_arithmetic.m_interval_high - alias->m_arithmetic.m_interval_low;
+	alias = (struct dictionary_internal *)dictionary;
 
+	num_bits = (DWORD)source_size * 8;
+	if (source_size > 0 && remainder_bits > 0)
+	{
+		num_bits -= 8 - remainder_bits;
+	}
+
+	fill = 0;
+
+	if (alias->m_algorithm_id == ALGORITHM_HUFFMAN)
+	{
+		struct node *cursor;
+
+		cursor = alias->m_huffman.m_head;
+
+		for (i = 0; i < num_bits && cursor != NULL; i++)
+		{
+			if (source[i >> 3] & (0x80 >> (i & 7)))
+			{
+				cursor = cursor->m_left;
+			}
+			else
+			{
+				cursor = cursor->m_right;
+			}
+
+			if (cursor != NULL && cursor->m_left == NULL && cursor->m_right == NULL)
+			{
+				if (store_decoded_symbol(alias, cursor->m_symbol_info.m_symbol, dest, capacity, &fill) == false)
+				{
+					return -1;
+				}
+
+				cursor = alias->m_huffman.m_head;
+			}
+		}
+
+		// only a single symbol tree has a missing child, and a bit that asks for it
+		if (cursor == NULL)
+		{
+			return -1;
+		}
+	}
+	else
+	{
+		if (alias->m_algorithm_id == ALGORITHM_ARITHMETIC)
+		{
+			struct packed_bit_reader reader;
+
+			// the padding in the last byte is zeros, the same as the bits past the end the flush leaves
+			// owed, so the reader can run over both and only the symbol count stops the decode
+			start_packed_reader(&reader, source, source_size);
+			fill = decode_arithmetic_run(alias, &reader, dest, capacity);
+		}
+	}
+
+	return fill;
+}
+
+bool decode_huffman_bytes(DICTIONARY dictionary,const BYTE *source,int source_size,BYTE *dest,int num_symbols)
+{
+	struct dictionary_internal *alias;
+	struct packed_bit_reader reader;
+
+	alias = (struct dictionary_internal *)dictionary;
+
+	if (alias->m_algorithm_id != ALGORITHM_HUFFMAN || alias->m_alphabet_id != ALPHABET_BYTE || alias->m_huffman.m_head == NULL)
+	{
+		return false;
+	}
+
+	make_decode_table(alias);
+
+	start_packed_reader(&reader, source, source_size);
+	decode_huffman_run(alias, &reader, dest, num_symbols);
+
+	return finish_huffman_reader(&reader);
+}
+
+
+bool decode_huffman_bytes_x4(DICTIONARY dictionary,const BYTE *const *sources,const int *source_sizes,BYTE *dest,const int *num_symbols)
+{
+	struct dictionary_internal *alias;
+	struct packed_bit_reader readers[HUFFMAN_NUM_STREAMS];
+	BYTE *outputs[HUFFMAN_NUM_STREAMS];
+	BYTE *ends[HUFFMAN_NUM_STREAMS];
+	int num_rounds;
+	bool result;
+	int i;
+
+	alias = (struct dictionary_internal *)dictionary;
+
+	if (alias->m_algorithm_id != ALGORITHM_HUFFMAN || alias->m_alphabet_id != ALPHABET_BYTE || alias->m_huffman.m_head == NULL)
+	{
+		return false;
+	}
+
+	make_decode_table(alias);
+
+	num_rounds = num_symbols[0];
+
+	for (i = 0; i < HUFFMAN_NUM_STREAMS; i++)
+	{
+		start_packed_reader(&readers[i], sources[i], source_sizes[i]);
+		outputs[i] = dest;
+		dest += num_symbols[i];
+		ends[i] = dest;
+
+		if (num_symbols[i] < num_rounds)
+		{
+			num_rounds = num_symbols[i];
+		}
+	}
+
+	num_rounds /= HUFFMAN_SYMBOLS_PER_REFILL;
+
+	// the four streams share nothing, so each step's lookups overlap instead of waiting on the one before
+	while (num_rounds > 0)
+	{
+		int j;
+
+		refill_packed_reader(&readers[0]);
+		refill_packed_reader(&readers[1]);
+		refill_packed_reader(&readers[2]);
+		refill_packed_reader(&readers[3]);
+
+		for (j = 0; j < HUFFMAN_SYMBOLS_PER_REFILL; j++)
+		{
+			*(outputs[0]++) = decode_huffman_byte(alias, &readers[0]);
+			*(outputs[1]++) = decode_huffman_byte(alias, &readers[1]);
+			*(outputs[2]++) = decode_huffman_byte(alias, &readers[2]);
+			*(outputs[3]++) = decode_huffman_byte(alias, &readers[3]);
+		}
+
+		num_rounds--;
+	}
+
+	result = true;
+
+	for (i = 0; i < HUFFMAN_NUM_STREAMS; i++)
+	{
+		decode_huffman_run(alias, &readers[i], outputs[i], (int)(ends[i] - outputs[i]));
+
+		if (finish_huffman_reader(&readers[i]) == false)
+		{
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+
+int read_symbol_from_buffer(DICTIONARY dictionary,const BYTE *source,int length,struct symbol *sym)
+{
+	struct dictionary_internal *alias;
+	int result;
+
+	alias = (struct dictionary_internal *)dictionary;
+
+	if (alias->m_alphabet_id == ALPHABET_BYTE)
+	{
+		sym->m_value = source[0];
+		result = 1;
+	}
+	else
+	{
+		int index;
+
+		result = token_length(alias->m_alphabet_id,source,length);
+		index = find_token(alias,source,result,hash_token(source,result));
+
+		if (index < 0)
+		{
+			result = -1;
+		}
+		else
+		{
+			sym->m_value = index;
+		}
+	}
+
+	return result;
+}
+
+int write_symbol_to_buffer(DICTIONARY dictionary,struct symbol sym,BYTE *dest,int capacity)
+{
+	struct dictionary_internal *alias;
+	int result;
+
+	alias = (struct dictionary_internal *)dictionary;
+
+	result = -1;
+
+	if (alias->m_alphabet_id == ALPHABET_BYTE)
+	{
+		if (capacity >= 1)
+		{
+			dest[0] = (BYTE)sym.m_value;
+			result = 1;
+		}
+	}
+	else if ((int)sym.m_value < alias->m_num_symbols)
+	{
+		int length;
+
+		length = alias->m_tokens.m_lengths[sym.m_value];
+
+		if (capacity >= length)
+		{
+			memcpy(dest,&(alias->m_tokens.m_bytes[alias->m_tokens.m_offsets[sym.m_value]]),length);
+			result = length;
+		}
+	}
+
+	return result;
+}
+
+void print_dictionary(DICTIONARY dictionary)
+{
+	struct dictionary_internal *alias;
+	int total;
+	int i;
+
+	alias = (struct dictionary_internal *)dictionary;
+	total = 0;
+
+	for (i = 0;i < alias->m_num_symbols;i++)
+	{
+		printf("symbol[%d], frequency[%d]\n", alias->m_symbols[i].m_symbol.m_value, alias->m_symbols[i].m_count);
+		total += alias->m_symbols[i].m_count;
+	}
+
+	printf("num distinct symbols[%d]\n", alias->m_num_symbols);
+	printf("total in print freq[%d]\n", total);
+}
+
+
+
+/////////////////////////////
+// Private Functions
+DWORD round_div(DWORD dividend, DWORD divisor)
+{
+    return (dividend + (divisor / 2)) / divisor;
+}
+
+
+void *dictionary_allocate(struct dictionary_internal *dictionary, int size)
+{
+	void *result;
+
+	if (dictionary->m_arena != NULL)
+	{
+		result = arena_allocate(dictionary->m_arena, size);
+	}
+	else
+	{
+		result = malloc(size);
+	}
+
+	return result;
+}
+
+void *dictionary_reallocate(struct dictionary_internal *dictionary, void *memory, int old_size, int new_size)
+{
+	void *result;
+
+	if (dictionary->m_arena != NULL)
+	{
+		// arenas can't grow an allocation in place, the old copy stays behind until the reset
+		result = arena_allocate(dictionary->m_arena, new_size);
+		if (memory != NULL)
+		{
+			memcpy(result, memory, old_size);
+		}
+	}
+	else
+	{
+		result = realloc(memory, new_size);
+	}
+
+	return result;
+}
+
+void dictionary_free(struct dictionary_internal *dictionary, void *memory)
+{
+	// arena memory goes back all at once when the owner resets the arena
+	if (dictionary->m_arena == NULL)
+	{
+		free(memory);
+	}
+}
+
+
+// how many bytes at the front of source make up the next token
+int token_length(BYTE alphabet_id, const BYTE *source, int length)
+{
+	int result;
+
+	if (length > MAX_TOKEN_LENGTH)
+	{
+		length = MAX_TOKEN_LENGTH;
+	}
+
+	result = 1;
+
+	if (alphabet_id == ALPHABET_PAIR)
+	{
+		result = length < 2 ? length : 2;
+	}
+	else if (alphabet_id == ALPHABET_WORD)
+	{
+		// a run of word characters, a run of whitespace, or a single byte of anything else;
+		// bytes above 127 count as word characters so utf-8 text stays in whole words
+		if (isalnum(source[0]) || source[0] == '_' || source[0] >= 0x80)
+		{
+			while (result < length && (isalnum(source[result]) || source[result] == '_' || source[result] >= 0x80))
+			{
+				result++;
+			}
+		}
+		else if (isspace(source[0]))
+		{
+			while (result < length && source[result] == source[0])
+			{
+				result++;
+			}
+		}
+	}
+
+	return result;
+}
+
+// FNV-1a
+WORD hash_token(const BYTE *token, int length)
+{
+	WORD result;
+	int i;
+
+	result = FNV_OFFSET_BASIS;
+
+	for (i = 0; i < length; i++)
+	{
+		result = (result ^ token[i]) * FNV_PRIME;
+	}
+
+	return result;
+}
+
+int find_token(struct dictionary_internal *dictionary, const BYTE *token, int length, WORD hash)
+{
+	struct token_structure *tokens;
+	int slot;
+
+	tokens = &(dictionary->m_tokens);
+
+	if (tokens->m_num_slots == 0)
+	{
+		return -1;
+	}
+
+	slot = hash & (tokens->m_num_slots - 1);
+
+	while (tokens->m_slots[slot] >= 0)
+	{
+		int index;
+
+		index = tokens->m_slots[slot];
+
+		if (tokens->m_hashes[index] == hash && tokens->m_lengths[index] == length &&
+			memcmp(&(tokens->m_bytes[tokens->m_offsets[index]]), token, length) == 0)
+		{
+			return index;
+		}
+
+		slot = (slot + 1) & (tokens->m_num_slots - 1);
+	}
+
+	return -1;
+}
+
+int add_token(struct dictionary_internal *dictionary, const BYTE *token, int length, WORD hash)
+{
+	struct token_structure *tokens;
+	int index;
+	int slot;
+
+	tokens = &(dictionary->m_tokens);
+	index = dictionary->m_num_symbols;
+
+	if (index == tokens->m_capacity)
+	{
+		int capacity;
+
+		capacity = tokens->m_capacity == 0 ? INITIAL_TOKEN_CAPACITY : tokens->m_capacity * 2;
+
+		dictionary->m_symbols = (struct symbol_info *)dictionary_reallocate(dictionary, dictionary->m_symbols, sizeof(struct symbol_info) * tokens->m_capacity, sizeof(struct symbol_info) * capacity);
+		tokens->m_offsets = (int *)dictionary_reallocate(dictionary, tokens->m_offsets, sizeof(int) * tokens->m_capacity, sizeof(int) * capacity);
+		tokens->m_lengths = (BYTE *)dictionary_reallocate(dictionary, tokens->m_lengths, sizeof(BYTE) * tokens->m_capacity, sizeof(BYTE) * capacity);
+		tokens->m_hashes = (WORD *)dictionary_reallocate(dictionary, tokens->m_hashes, sizeof(WORD) * tokens->m_capacity, sizeof(WORD) * capacity);
+		tokens->m_capacity = capacity;
+	}
+
+	if (tokens->m_num_bytes + length > tokens->m_bytes_capacity)
+	{
+		int capacity;
+
+		capacity = tokens->m_bytes_capacity == 0 ? INITIAL_TOKEN_CAPACITY * 8 : tokens->m_bytes_capacity * 2;
+		while (tokens->m_num_bytes + length > capacity)
+		{
+			capacity *= 2;
+		}
+
+		tokens->m_bytes = (BYTE *)dictionary_reallocate(dictionary, tokens->m_bytes, tokens->m_bytes_capacity, capacity);
+		tokens->m_bytes_capacity = capacity;
+	}
+
+	// keep the table at most half full
+	if ((index + 1) * 2 > tokens->m_num_slots)
+	{
+		grow_token_slots(dictionary);
+	}
+
+	memcpy(&(tokens->m_bytes[tokens->m_num_bytes]), token, length);
+	tokens->m_offsets[index] = tokens->m_num_bytes;
+	tokens->m_lengths[index] = (BYTE)length;
+	tokens->m_hashes[index] = hash;
+	tokens->m_num_bytes += length;
+
+	dictionary->m_symbols[index].m_count = 0;
+	dictionary->m_symbols[index].m_symbol.m_value = index;
+	dictionary->m_num_symbols++;
+
+	slot = hash & (tokens->m_num_slots - 1);
+	while (tokens->m_slots[slot] >= 0)
+	{
+		slot = (slot + 1) & (tokens->m_num_slots - 1);
+	}
+	tokens->m_slots[slot] = index;
+
+	return index;
+}
+
+void grow_token_slots(struct dictionary_internal *dictionary)
+{
+	struct token_structure *tokens;
+	int num_slots;
+	int i;
+
+	tokens = &(dictionary->m_tokens);
+
+	num_slots = tokens->m_num_slots == 0 ? INITIAL_TOKEN_CAPACITY * 2 : tokens->m_num_slots * 2;
+
+	dictionary_free(dictionary, tokens->m_slots);
+	tokens->m_slots = (int *)dictionary_allocate(dictionary, sizeof(int) * num_slots);
+	tokens->m_num_slots = num_slots;
+	memset(tokens->m_slots, 0xFF, sizeof(int) * num_slots);
+
+	for (i = 0; i < dictionary->m_num_symbols; i++)
+	{
+		int slot;
+
+		slot = tokens->m_hashes[i] & (num_slots - 1);
+		while (tokens->m_slots[slot] >= 0)
+		{
+			slot = (slot + 1) & (num_slots - 1);
+		}
+		tokens->m_slots[slot] = i;
+	}
+}
+
+void free_tokens(struct dictionary_internal *dictionary)
+{
+	dictionary_free(dictionary, dictionary->m_tokens.m_bytes);
+	dictionary_free(dictionary, dictionary->m_tokens.m_offsets);
+	dictionary_free(dictionary, dictionary->m_tokens.m_lengths);
+	dictionary_free(dictionary, dictionary->m_tokens.m_hashes);
+	dictionary_free(dictionary, dictionary->m_tokens.m_slots);
+	memset(&(dictionary->m_tokens), 0, sizeof(dictionary->m_tokens));
+}
+
+
+// a stream shorter than 32 bits carries on in zeros
+void initialize_arithmetic_z(DICTIONARY dictionary)
+{
+	struct dictionary_internal *alias;
+
+	alias = (struct dictionary_internal *)dictionary;
+
+	assert(alias->m_arithmetic.m_is_z_initialized == false);
+
+	alias->m_arithmetic.m_z <<= 32 - alias->m_arithmetic.m_z_bits;
+	alias->m_arithmetic.m_is_z_initialized = true;
+}
+
+bool decode_iteration(DICTIONARY dictionary, struct symbol *decoded_symbol)
+{
+	struct dictionary_internal *alias;
+	bool result;
+
+	alias = (struct dictionary_internal *)dictionary;
+	result = false;
+
+	if (alias->m_arithmetic.m_is_z_initialized == false)
+	{
+		initialize_arithmetic_z(dictionary);
+	}
+
+	if (alias->m_arithmetic.m_total_symbols_decoded < alias->m_arithmetic.m_total_symbols)
+	{
+		int low_index;
+		int high_index;
+		DWORD diff;
+
+		assert(alias->m_arithmetic.m_pending_bits == 0);
+
+		//printf("before  high[%llu]  low[%llu]\n",alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low);
+
+		diff = alias->m_arithmetic.m_interval_high - alias->m_arithmetic.m_interval_low;
+
+		// the sub-interval starts only grow with the symbol position, so look for the last
+		// symbol whose start is at or below z instead of trying them all in order
+		low_index = 0;
+		high_index = alias->m_num_symbols - 1;
+
+		while (low_index < high_index)
+		{
+			int middle;
+			DWORD a0;
+
+			middle = (low_index + high_index + 1) / 2;
+			a0 = alias->m_arithmetic.m_interval_low + round_div(diff * alias->m_arithmetic.m_lower_precision[middle], alias->m_arithmetic.m_total_symbols);
+
+			if (a0 <= alias->m_arithmetic.m_z)
+			{
+				low_index = middle;
+			}
+			else
+			{
+				high_index = middle - 1;
+			}
+		}
+
+		if (alias->m_num_symbols > 0)
+		{
+			DWORD b0;
+			DWORD a0;
+
+			b0 = alias->m_arithmetic.m_interval_low + round_div(diff * alias->m_arithmetic.m_higher_precision[low_index], alias->m_arithmetic.m_total_symbols);
+			a0 = alias->m_arithmetic.m_interval_low + round_div(diff * alias->m_arithmetic.m_lower_precision[low_index], alias->m_arithmetic.m_total_symbols);
+
+			// printf("z[%llu]\n", alias->m_arithmetic.m_z);
+			// printf("low[%llu]\n", a0);
+			// printf("high[%llu]\n", b0);
+
+			if (a0 <= alias->m_arithmetic.m_z && alias->m_arithmetic.m_z < b0)
+			{
+				//printf("HOWDY  a0[%llu]  z[%llu]  b[%llu]\n",a0,alias->m_arithmetic.m_z,b0);
+				alias->m_arithmetic.m_interval_low = a0;
+				alias->m_arithmetic.m_interval_high = b0;
+				*decoded_symbol = alias->m_symbols[low_index].m_symbol;
+				result = true; // symbol found!
+				alias->m_arithmetic.m_total_symbols_decoded++;
+			}
+		}
+
+
+		//printf("after  high[%llu]  low[%llu]\n",alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low);
+
+
+		// rescaling half
+		while (SHOULD_SCALE_HALF(alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low))
+		{
+			//printf("\tscaling half! [%llu][%llu][%llu]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low,alias->m_arithmetic.m_z);
+
+			if (alias->m_arithmetic.m_interval_high < HALF_WAY)
+			{
+				//printf("\t\thigh is too low\n");
+				alias->m_arithmetic.m_interval_low = alias->m_arithmetic.m_interval_low * 2;
+				alias->m_arithmetic.m_interval_high = alias->m_arithmetic.m_interval_high * 2;
+				alias->m_arithmetic.m_z = alias->m_arithmetic.m_z * 2;
+				//printf("\t\tnew vals[%llu][%llu]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low);
+			}
+
+			else if (alias->m_arithmetic.m_interval_low > HALF_WAY)
+			{
+				//printf("\t\tlow is too high\n");
+				alias->m_arithmetic.m_interval_low = 2 * (alias->m_arithmetic.m_interval_low - HALF_WAY);
+				alias->m_arithmetic.m_interval_high = 2 * (alias->m_arithmetic.m_interval_high - HALF_WAY);
+				alias->m_arithmetic.m_z = 2 * (alias->m_arithmetic.m_z - HALF_WAY);
+				//printf("\t\tnew vals[%llu][%llu]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low);
+			}
+
+			// z is only ever added to and doubled, so the bit for this shift can be added once it arrives
+			alias->m_arithmetic.m_pending_bits++;
+		}
+
+		while (SHOULD_SCALE_QUARTER(alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low))
+		{
+			//printf("\tscaling quarter! [%llu][%llu][%llu]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low,alias->m_arithmetic.m_z);
+
+			alias->m_arithmetic.m_interval_low = 2 * (alias->m_arithmetic.m_interval_low - ONE_QUARTER);
+			alias->m_arithmetic.m_interval_high = 2 * (alias->m_arithmetic.m_interval_high - ONE_QUARTER);
+			alias->m_arithmetic.m_z = 2 * (alias->m_arithmetic.m_z - ONE_QUARTER);
+			alias->m_arithmetic.m_pending_bits++;
+		}
+	}
+
+	return result;
+}
+
+bool consume_arithmetic_bit(struct dictionary_internal *dictionary, char bit_representation, struct symbol *decoded_symbol)
+{
+	bool result;
+
+	result = false;
+
+	if (dictionary->m_arithmetic.m_z_bits < 32)
+	{
+		dictionary->m_arithmetic.m_z = (dictionary->m_arithmetic.m_z << 1) | (bit_representation == '1' ? 1 : 0);
+		dictionary->m_arithmetic.m_z_bits++;
+
+		if (dictionary->m_arithmetic.m_z_bits == 32)
+		{
+			result = decode_iteration(dictionary, decoded_symbol);
+		}
+	}
+	else
+	{
+		// every rescale shifted one unread bit into the bottom of z, fill them in order;
+		// nothing is owed once the last symbol is out, so trailing padding bits are ignored
+		if (dictionary->m_arithmetic.m_pending_bits > 0)
+		{
+			dictionary->m_arithmetic.m_pending_bits--;
+
+			if (bit_representation == '1')
+			{
+				dictionary->m_arithmetic.m_z += ((DWORD)1 << dictionary->m_arithmetic.m_pending_bits);
+			}
+
+			if (dictionary->m_arithmetic.m_pending_bits == 0)
+			{
+				result = decode_iteration(dictionary, decoded_symbol);
+			}
+		}
+	}
+
+	return result;
+}
+
+
+void encode_arithmetic_symbol(struct dictionary_internal *dictionary, int symbol_index, struct packed_bit_writer *writer)
+{
+	struct arithmetic_structure *alias;
+	DWORD diff;
+	DWORD higher_precision;
+	DWORD lower_precision;
+
+	alias = &(dictionary->m_arithmetic);
+
+	diff = alias->m_interval_high - alias->m_interval_low;
+
+	//printf("before  high[%llu]  low[%llu] symbol index[%d]\n",alias->m_interval_high, alias->m_interval_low, symbol_index);
+
+	higher_precision = diff * alias->m_higher_precision[symbol_index];
+	lower_precision = diff * alias->m_lower_precision[symbol_index];
+
+	alias->m_interval_high = alias->m_interval_low + round_div(higher_precision, alias->m_total_symbols);
+	alias->m_interval_low = alias->m_interval_low + round_div(lower_precision, alias->m_total_symbols);
+
+	//printf("after  high[%llu]  low[%llu]\n",alias->m_interval_high, alias->m_interval_low);
+
+	// rescaling half, each one settles a bit and with it the splits waiting on it
+	while (SHOULD_SCALE_HALF(alias->m_interval_high, alias->m_interval_low))
+	{
+		if (alias->m_interval_high < HALF_WAY)
+		{
+			put_packed_bits(writer, 0, 1);
+			put_packed_run(writer, 1, alias->m_num_splits);
+
+			alias->m_interval_low = alias->m_interval_low * 2;
+			alias->m_interval_high = alias->m_interval_high * 2;
+		}
+		else if (alias->m_interval_low > HALF_WAY)
+		{
+			put_packed_bits(writer, 1, 1);
+			put_packed_run(writer, 0, alias->m_num_splits);
+
+			alias->m_interval_low = 2 * (alias->m_interval_low - HALF_WAY);
+			alias->m_interval_high = 2 * (alias->m_interval_high - HALF_WAY);
+		}
+		else
+		{
+			assert(!"shouldn't be here!");
+		}
+
+		alias->m_num_splits = 0;
+	}
+
+	assert(writer->m_cursor <= writer->m_end);
+
+	// rescaling quarter
+	while (SHOULD_SCALE_QUARTER(alias->m_interval_high, alias->m_interval_low))
+	{
+		alias->m_interval_low = 2 * (alias->m_interval_low - ONE_QUARTER);
+		alias->m_interval_high = 2 * (alias->m_interval_high - ONE_QUARTER);
+		alias->m_num_splits++;
+	}
+}
+
+
+void flush_arithmetic(struct dictionary_internal *dictionary, struct packed_bit_writer *writer)
+{
+	dictionary->m_arithmetic.m_num_splits++;
+
+	if (dictionary->m_arithmetic.m_interval_low <= ONE_QUARTER)
+	{
+		put_packed_bits(writer, 0, 1);
+		put_packed_run(writer, 1, dictionary->m_arithmetic.m_num_splits);
+	}
+	else
+	{
+		put_packed_bits(writer, 1, 1);
+		put_packed_run(writer, 0, dictionary->m_arithmetic.m_num_splits);
+	}
+}
+
+
+// converts the raw byte counts into the symbol list; dictionaries that were deserialized
+// already carry their symbol list and have an empty histogram, so they're left alone
+void fold_histogram_into_symbols(struct dictionary_internal *dictionary)
+{
+	int num_symbols;
+	int value;
+
+	num_symbols = 0;
+
+	for (value = 0; value < NUM_BYTE_VALUES; value++)
+	{
+		if (dictionary->m_histogram[0][value] + dictionary->m_histogram[1][value] + dictionary->m_histogram[2][value] + dictionary->m_histogram[3][value] > 0)
+		{
+			num_symbols++;
+		}
+	}
+
+	if (num_symbols > 0)
+	{
+		dictionary_free(dictionary,dictionary->m_symbols);
+		dictionary->m_symbols = (struct symbol_info *)dictionary_allocate(dictionary,sizeof(struct symbol_info) * num_symbols);
+		dictionary->m_num_symbols = 0;
+
+		for (value = 0; value < NUM_BYTE_VALUES; value++)
+		{
+			int count;
+
+			count = dictionary->m_histogram[0][value] + dictionary->m_histogram[1][value] + dictionary->m_histogram[2][value] + dictionary->m_histogram[3][value];
+
+			if (count > 0)
+			{
+				dictionary->m_symbols[dictionary->m_num_symbols].m_count = count;
+				dictionary->m_symbols[dictionary->m_num_symbols].m_symbol.m_value = (BYTE)value;
+				dictionary->m_num_symbols++;
+			}
+		}
+
+		memset(dictionary->m_histogram,0,sizeof(dictionary->m_histogram));
+	}
+}
+
+
+int serialized_size(struct dictionary_internal *dictionary)
+{
+	int result;
+
+	result = sizeof(dictionary->m_algorithm_id);
+
+	result += sizeof(dictionary->m_alphabet_id);
+
+	result += sizeof(dictionary->m_num_symbols);
+
+	if (dictionary->m_alphabet_id == ALPHABET_BYTE)
+	{
+		result += (dictionary->m_num_symbols * sizeof(struct symbol_info));
+	}
+	else
+	{
+		int i;
+
+		// a token's value is its position, so only the counts go out, as varints since large
+		// alphabets are mostly rare tokens; then the lengths so the decoder can find where each
+		// token starts, then the token strings
+		for (i = 0; i < dictionary->m_num_symbols; i++)
+		{
+			result += varint_size(dictionary->m_symbols[i].m_count);
+		}
+
+		result += dictionary->m_num_symbols * sizeof(dictionary->m_tokens.m_lengths[0]);
+		result += dictionary->m_tokens.m_num_bytes;
+	}
+
+	return result;
+}
+
+
+int compare_counts(const void *a, const void *b)
+{
+	int count_a;
+	int count_b;
+
+	count_a = *(const int *)a;
+	count_b = *(const int *)b;
+
+	return (count_a > count_b) - (count_a < count_b);
+}
+
+// every merge adds its weight to the length of every symbol under it, so the total coded length
+// is the sum of the merged weights; the same two-queue walk as make_tree without building nodes
+DWORD huffman_code_bits(struct dictionary_internal *dictionary)
+{
+	int *counts;
+	DWORD *merged;
+	int num_counts;
+	int count_index;
+	int merged_index;
+	int merged_end;
+	DWORD result;
+	int i;
+
+	num_counts = dictionary->m_num_symbols;
+
+	if (num_counts == 1)
+	{
+		return dictionary->m_symbols[0].m_count; // a lone symbol still costs one bit
+	}
+
+	counts = (int *)dictionary_allocate(dictionary, sizeof(int) * (num_counts + 1));
+	merged = (DWORD *)dictionary_allocate(dictionary, sizeof(DWORD) * (num_counts + 1));
+
+	for (i = 0; i < num_counts; i++)
+	{
+		counts[i] = dictionary->m_symbols[i].m_count;
+	}
+
+	qsort(counts, num_counts, sizeof(int), compare_counts);
+
+	result = 0;
+	count_index = 0;
+	merged_index = 0;
+	merged_end = 0;
+
+	for (i = 0; i < num_counts - 1; i++)
+	{
+		DWORD pair[2];
+		int j;
+
+		for (j = 0; j < 2; j++)
+		{
+			if (count_index < num_counts && (merged_index >= merged_end || (DWORD)counts[count_index] <= merged[merged_index]))
+			{
+				pair[j] = counts[count_index];
+				count_index++;
+			}
+			else
+			{
+				pair[j] = merged[merged_index];
+				merged_index++;
+			}
+		}
+
+		merged[merged_end] = pair[0] + pair[1];
+		result += merged[merged_end];
+		merged_end++;
+	}
+
+	dictionary_free(dictionary, counts);
+	dictionary_free(dictionary, merged);
+
+	return result;
+}
+
+
+int varint_size(WORD value)
+{
+	int result;
+
+	result = 1;
+	while (value >= 0x80)
+	{
+		value >>= 7;
+		result++;
+	}
+
+	return result;
+}
+
+// seven bits per byte, low bits first, the top bit set on every byte but the last
+BYTE *write_varint(BYTE *cursor, WORD value)
+{
+	while (value >= 0x80)
+	{
+		*cursor = (BYTE)(value | 0x80);
+		cursor++;
+		value >>= 7;
+	}
+
+	*cursor = (BYTE)value;
+	cursor++;
+
+	return cursor;
+}
+
+// NULL when the varint runs past end
+BYTE *read_varint(BYTE *cursor, BYTE *end, WORD *value)
+{
+	int shift;
+
+	*value = 0;
+	shift = 0;
+
+	while (cursor < end && shift < 32)
+	{
+		BYTE current;
+
+		current = *cursor;
+		cursor++;
+
+		*value |= (WORD)(current & 0x7F) << shift;
+		shift += 7;
+
+		if ((current & 0x80) == 0)
+		{
+			return cursor;
+		}
+	}
+
+	return NULL;
+}
+
+
+void build_byte_symbol_index(struct dictionary_internal *dictionary)
+{
+	int i;
+
+	memset(dictionary->m_byte_symbol_index, 0xFF, sizeof(dictionary->m_byte_symbol_index));
+
+	for (i = 0; i < dictionary->m_num_symbols; i++)
+	{
+		dictionary->m_byte_symbol_index[dictionary->m_symbols[i].m_symbol.m_value] = i;
+	}
+}
+
+
+// position of sym in m_symbols, or -1 when the model never saw it
+int find_symbol_index(struct dictionary_internal *dictionary,struct symbol sym)
+{
+	int result;
+
+	result = -1;
+
+	if (dictionary->m_alphabet_id == ALPHABET_BYTE)
+	{
+		if (sym.m_value < NUM_BYTE_VALUES)
+		{
+			result = dictionary->m_byte_symbol_index[sym.m_value];
+		}
+	}
+	else if ((int)sym.m_value < dictionary->m_num_symbols)
+	{
+		result = sym.m_value;
+	}
+
+	return result;
+}
+
+
+int compare_leaf_nodes(const void *a, const void *b)
+{
+	const struct node *node_a;
+	const struct node *node_b;
+	int result;
+
+	node_a = (const struct node *)a;
+	node_b = (const struct node *)b;
+
+	result = node_a->m_symbol_info.m_count - node_b->m_symbol_info.m_count;
+
+	if (result == 0)
+	{
+		// qsort isn't stable, so break ties on the symbol to keep encoder and decoder trees identical
+		result = (node_a->m_symbol_info.m_symbol.m_value > node_b->m_symbol_info.m_symbol.m_value) - (node_a->m_symbol_info.m_symbol.m_value < node_b->m_symbol_info.m_symbol.m_value);
+	}
+
+	return result;
+}
+
+// two-queue selection: leaves are sorted by count, and internal nodes are created in
+// non-decreasing count order, so the minimum is always at the front of one of the two
+struct node *take_min_node(struct node *nodes, int num_leaves, int *leaf_index, int *internal_index, int internal_end)
+{
+	struct node *result;
+
+	result = NULL;
+
+	if (*leaf_index < num_leaves)
+	{
+		if (*internal_index >= internal_end ||
+			nodes[*leaf_index].m_symbol_info.m_count <= nodes[*internal_index].m_symbol_info.m_count)
+		{
+			result = &(nodes[*leaf_index]);
+			(*leaf_index)++;
+		}
+	}
+
+	if (result == NULL && *internal_index < internal_end)
+	{
+		result = &(nodes[*internal_index]);
+		(*internal_index)++;
+	}
+
+	return result;
+}
+
+void make_tree(struct dictionary_internal *dictionary)
+{
+	struct node *nodes;
+	int num_leaves;
+	int leaf_index;
+	int internal_index;
+	int internal_end;
+	int i;
+
+	free_tree(dictionary);
+
+	num_leaves = dictionary->m_num_symbols;
+
+	// n leaves need n - 1 internal nodes; the extra slot covers the one and zero symbol cases,
+	// where the root still has to be an internal node
+	nodes = (struct node *) dictionary_allocate(dictionary, sizeof(struct node) * (2 * num_leaves + 1));
+
+	for (i=0; i<num_leaves; i++)
+	{
+		nodes[i].m_symbol_info = dictionary->m_symbols[i];
+		nodes[i].m_left = NULL;
+		nodes[i].m_right = NULL;
+	}
+
+	qsort(nodes, num_leaves, sizeof(struct node), compare_leaf_nodes);
+
+	leaf_index = 0;
+	internal_index = num_leaves;
+	internal_end = num_leaves;
+
+	do
+	{
+		struct node *node_1;
+		struct node *node_2;
+		struct node *additional;
+
+		node_1 = take_min_node(nodes, num_leaves, &leaf_index, &internal_index, internal_end);
+		node_2 = take_min_node(nodes, num_leaves, &leaf_index, &internal_index, internal_end);
+
+		additional = &(nodes[internal_end]);
+		internal_end++;
+
+		additional->m_symbol_info.m_count = (node_1 == NULL ? 0 : node_1->m_symbol_info.m_count) + (node_2 == NULL ? 0 : node_2->m_symbol_info.m_count);
+		additional->m_symbol_info.m_symbol.m_value = 0;
+		additional->m_left = node_1;
+		additional->m_right = node_2;
+	}
+	while (leaf_index < num_leaves || internal_index < internal_end - 1);
 
-			higher_precision = diff * alias->m_arithmetic.m_higher_precision[j];
-			lower_precision = diff * alias->m_arithmetic.m_lower_precision[j];
+	dictionary->m_huffman.m_nodes = nodes;
+	dictionary->m_huffman.m_num_nodes = internal_end;
+	dictionary->m_huffman.m_head = &(nodes[internal_end - 1]);
 
-			b0 = alias->m_arithmetic.m_interval_low + round_div(higher_precision, alias->m_arithmetic.m_total_symbols);
-			a0 = alias->m_arithmetic.m_interval_low + round_div(lower_precision, alias->m_arithmetic.m_total_symbols);
+//	printf("root count[%d]\n", dictionary->m_huffman.m_head->m_symbol_info.m_count);
+}
 
 
-			// printf("z[%llu]\n", alias->m_arithmetic.m_z);
-			// printf("low[%llu]\n", a0);
-			// printf("high[%llu]\n", b0);
+// every node's code is its parent's plus one bit; children always sit below their parent in
+// the node array, so walking it from the root down sees each parent before its children
+void make_codes(struct dictionary_internal *dictionary)
+{
+	struct node *nodes;
+	int num_nodes;
+	int *depths;
+	int total_length;
+	int i;
 
+	nodes = dictionary->m_huffman.m_nodes;
+	num_nodes = dictionary->m_huffman.m_num_nodes;
 
+	depths = (int *)dictionary_allocate(dictionary, sizeof(int) * num_nodes);
+	dictionary->m_huffman.m_code_offsets = (int *)dictionary_allocate(dictionary, sizeof(int) * num_nodes);
+	dictionary->m_huffman.m_leaf_of_symbol = (int *)dictionary_allocate(dictionary, sizeof(int) * (dictionary->m_num_symbols + 1));
 
-			if (a0 <= alias->m_arithmetic.m_z && alias->m_arithmetic.m_z < b0)
-			{
-				printf("HOWDY  a0[%llu]  z[%llu]  b[%llu]\n",a0,alias->m_arithmetic.m_z,b0);
-				alias->m_arithmetic.m_interval_low = a0;
-				alias->m_arithmetic.m_interval_high = b0;
-				*decoded_symbol = alias->m_symbols[j].m_symbol;
-				result = true; // symbol found!
-				alias->m_arithmetic.m_total_symbols_decoded++;
-				break;
-			}
+	depths[num_nodes - 1] = 0;
+	for (i = num_nodes - 1; i >= 0; i--)
+	{
+		if (nodes[i].m_left != NULL)
+		{
+			depths[nodes[i].m_left - nodes] = depths[i] + 1;
+		}
+
+		if (nodes[i].m_right != NULL)
+		{
+			depths[nodes[i].m_right - nodes] = depths[i] + 1;
 		}
+	}
+
+	total_length = 0;
+	for (i = 0; i < num_nodes; i++)
+	{
+		assert(depths[i] < MAX_REPRESENTATION_LENGTH);
 
+		dictionary->m_huffman.m_code_offsets[i] = total_length;
+		total_length += depths[i] + 1;
+	}
 
-		printf("after  high[%llu]  low[%llu]\n",alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low);
+	dictionary->m_huffman.m_codes = (char *)dictionary_allocate(dictionary, total_length);
+	dictionary->m_huffman.m_codes[dictionary->m_huffman.m_code_offsets[num_nodes - 1]] = '\0';
 
+	for (i = num_nodes - 1; i >= 0; i--)
+	{
+		const char *code;
+		int depth;
 
-		// rescaling half
-		while (SHOULD_SCALE_HALF(alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low))
+		code = &(dictionary->m_huffman.m_codes[dictionary->m_huffman.m_code_offsets[i]]);
+		depth = depths[i];
+
+		if (nodes[i].m_left != NULL)
 		{
-			printf("\tscaling half! [%llu][%llu][%llu]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low,alias->m_arithmetic.m_z);
+			char *child_code;
 
-			if (alias->m_arithmetic.m_interval_high < HALF_WAY)
-			{
-				printf("\t\thigh is too low\n");
-				alias->m_arithmetic.m_interval_low = alias->m_arithmetic.m_interval_low * 2;
-				alias->m_arithmetic.m_interval_high = alias->m_arithmetic.m_interval_high * 2;
-				alias->m_arithmetic.m_z = alias->m_arithmetic.m_z * 2;
-				printf("\t\tnew vals[%llu][%llu]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low);
+			child_code = &(dictionary->m_huffman.m_codes[dictionary->m_huffman.m_code_offsets[nodes[i].m_left - nodes]]);
+			memcpy(child_code, code, depth);
+			child_code[depth] = '1';
+			child_code[depth + 1] = '\0';
+		}
 
-			}
+		if (nodes[i].m_right != NULL)
+		{
+			char *child_code;
 
-			else if (alias->m_arithmetic.m_interval_low > HALF_WAY)
-			{
-				printf("\t\tlow is too high\n");
-				alias->m_arithmetic.m_interval_low = 2 * (alias->m_arithmetic.m_interval_low - HALF_WAY);
-				alias->m_arithmetic.m_interval_high = 2 * (alias->m_arithmetic.m_interval_high - HALF_WAY);
-				alias->m_arithmetic.m_z = 2 * (alias->m_arithmetic.m_z - HALF_WAY);
-				printf("\t\tnew vals[%llu][%llu]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low);
-			}
+			child_code = &(dictionary->m_huffman.m_codes[dictionary->m_huffman.m_code_offsets[nodes[i].m_right - nodes]]);
+			memcpy(child_code, code, depth);
+			child_code[depth] = '0';
+			child_code[depth + 1] = '\0';
+		}
+
+		if (nodes[i].m_left == NULL && nodes[i].m_right == NULL && i < dictionary->m_num_symbols)
+		{
+			int symbol_index;
 
-			if (advance_z && bit_representation == '1')
+			symbol_index = find_symbol_index(dictionary, nodes[i].m_symbol_info.m_symbol);
+			if (symbol_index >= 0)
 			{
-				printf("\t\tincrementing z\n");
-				assert(alias->m_arithmetic.m_z % 2 == 0);
-				alias->m_arithmetic.m_z++;
+				dictionary->m_huffman.m_leaf_of_symbol[symbol_index] = i;
 			}
 		}
+	}
 
-		while (SHOULD_SCALE_QUARTER(alias->m_arithmetic.m_interval_high, alias->m_arithmetic.m_interval_low))
+	dictionary_free(dictionary, depths);
+}
+
+
+void free_tree(struct dictionary_internal *dictionary)
+{
+	dictionary_free(dictionary, dictionary->m_huffman.m_codes);
+	dictionary->m_huffman.m_codes = NULL;
+	dictionary_free(dictionary, dictionary->m_huffman.m_code_offsets);
+	dictionary->m_huffman.m_code_offsets = NULL;
+	dictionary_free(dictionary, dictionary->m_huffman.m_leaf_of_symbol);
+	dictionary->m_huffman.m_leaf_of_symbol = NULL;
+	dictionary_free(dictionary, dictionary->m_huffman.m_decode_table);
+	dictionary->m_huffman.m_decode_table = NULL;
+	dictionary_free(dictionary, dictionary->m_huffman.m_code_values);
+	dictionary->m_huffman.m_code_values = NULL;
+	dictionary_free(dictionary, dictionary->m_huffman.m_code_lengths);
+	dictionary->m_huffman.m_code_lengths = NULL;
+
+	dictionary_free(dictionary, dictionary->m_huffman.m_nodes);
+	dictionary->m_huffman.m_nodes = NULL;
+	dictionary->m_huffman.m_num_nodes = 0;
+	dictionary->m_huffman.m_head = NULL;
+	dictionary->m_huffman.m_decode_cursor = NULL;
+}
+
+
+// every node's code and depth follow from its parent's, and parents sit above their children in the
+// node array; a leaf no deeper than the table fills every slot its code prefixes, and a node exactly
+// HUFFMAN_TABLE_BITS down takes the one slot of its path for the codes under it
+void make_decode_table(struct dictionary_internal *dictionary)
+{
+	struct huffman_table_entry *table;
+	struct node *nodes;
+	int num_nodes;
+	int *depths;
+	int *codes;
+	int i;
+
+	if (dictionary->m_huffman.m_decode_table != NULL)
+	{
+		return;
+	}
+
+	nodes = dictionary->m_huffman.m_nodes;
+	num_nodes = dictionary->m_huffman.m_num_nodes;
+
+	table = (struct huffman_table_entry *)dictionary_allocate(dictionary, sizeof(struct huffman_table_entry) * HUFFMAN_TABLE_SIZE);
+	depths = (int *)dictionary_allocate(dictionary, sizeof(int) * num_nodes);
+	codes = (int *)dictionary_allocate(dictionary, sizeof(int) * num_nodes);
+
+	for (i = 0; i < HUFFMAN_TABLE_SIZE; i++)
+	{
+		table[i].m_value = 0;
+		table[i].m_length = HUFFMAN_TABLE_INVALID;
+	}
+
+	for (i = 0; i < num_nodes - 1; i++)
+	{
+		depths[i] = -1; // stays that way under the nodes that take a slot, the tree finishes those
+	}
+
+	depths[num_nodes - 1] = 0;
+	codes[num_nodes - 1] = 0;
+
+	for (i = num_nodes - 1; i >= 0; i--)
+	{
+		int depth;
+
+		depth = depths[i];
+
+		if (depth < 0)
 		{
-			printf("\tscaling quarter! [%llu][%llu][%llu]\n",alias->m_arithmetic.m_interval_high,alias->m_arithmetic.m_interval_low,alias->m_arithmetic.m_z);
+			continue;
+		}
 
-			alias->m_arithmetic.m_interval_low = 2 * (alias->m_arithmetic.m_interval_low - ONE_QUARTER);
-			alias->m_arithmetic.m_interval_high = 2 * (alias->m_arithmetic.m_interval_high - ONE_QUARTER);
-			alias->m_arithmetic.m_z = 2 * (alias->m_arithmetic.m_z - ONE_QUARTER);
+		if (depth == HUFFMAN_TABLE_BITS && (nodes[i].m_left != NULL || nodes[i].m_right != NULL))
+		{
+			table[codes[i]].m_value = i;
+			table[codes[i]].m_length = HUFFMAN_TABLE_ESCAPE;
+			continue;
+		}
 
-			if (advance_z && bit_representation == '1')
+		if (nodes[i].m_left == NULL && nodes[i].m_right == NULL)
+		{
+			// the root of an empty tree looks like a leaf, but there's no code to decode
+			if (depth > 0 && depth <= HUFFMAN_TABLE_BITS)
 			{
-				assert(alias->m_arithmetic.m_z % 2 == 0);
-				alias->m_arithmetic.m_z++;
+				int first;
+				int j;
+
+				first = codes[i] << (HUFFMAN_TABLE_BITS - depth);
+
+				for (j = 0; j < (1 << (HUFFMAN_TABLE_BITS - depth)); j++)
+				{
+					table[first + j].m_value = nodes[i].m_symbol_info.m_symbol.m_value;
+					table[first + j].m_length = depth;
+				}
 			}
+
+			continue;
+		}
+
+		if (nodes[i].m_left != NULL)
+		{
+			depths[nodes[i].m_left - nodes] = depth + 1;
+			codes[nodes[i].m_left - nodes] = (codes[i] << 1) | 1;
+		}
+
+		if (nodes[i].m_right != NULL)
+		{
+			depths[nodes[i].m_right - nodes] = depth + 1;
+			codes[nodes[i].m_right - nodes] = codes[i] << 1;
 		}
 	}
 
-	return result;
+	dictionary_free(dictionary, depths);
+	dictionary_free(dictionary, codes);
+
+	dictionary->m_huffman.m_decode_table = table;
 }
 
-int find_symbol_index(struct dictionary_internal *dictionary,struct symbol sym)
+
+void start_packed_reader(struct packed_bit_reader *reader, const BYTE *source, int source_size)
 {
-	int i;
+	reader->m_cursor = source;
+	reader->m_end = source + source_size;
+	reader->m_bits = 0;
+	reader->m_num_bits = 0;
+	reader->m_padding_bits = 0;
+	reader->m_failed = false;
+
+	refill_packed_reader(reader);
+}
 
-//	printf("push find_symbol_index\n");
-	for(i=0; i<dictionary->m_num_symbols; i++)
+
+// tops the reader up to at least 57 bits, only whole bytes go in so the bits below stay zero
+void refill_packed_reader(struct packed_bit_reader *reader)
+{
+	while (reader->m_num_bits <= 56)
 	{
-		if (memcmp(&(dictionary->m_symbols[i].m_symbol), &sym, sizeof(struct symbol)) == 0)
+		if (reader->m_cursor < reader->m_end)
+		{
+			reader->m_bits |= (DWORD)*(reader->m_cursor) << (56 - reader->m_num_bits);
+			reader->m_cursor++;
+		}
+		else
 		{
-			break;
+			reader->m_padding_bits += 8;
 		}
+
+		reader->m_num_bits += 8;
 	}
+}
+
 
-	if (i == dictionary->m_num_symbols)
+// needs HUFFMAN_TABLE_BITS bits in the reader
+BYTE decode_huffman_byte(struct dictionary_internal *dictionary, struct packed_bit_reader *reader)
+{
+	const struct huffman_table_entry *entry;
+
+	entry = &(dictionary->m_huffman.m_decode_table[reader->m_bits >> (64 - HUFFMAN_TABLE_BITS)]);
+
+	if (entry->m_length == HUFFMAN_TABLE_ESCAPE || entry->m_length == HUFFMAN_TABLE_INVALID)
 	{
-		i = -1;
+		return decode_huffman_byte_from_tree(dictionary, reader, entry);
 	}
-//	printf("pop find_symbol_index\n");
 
-	return i;
+	reader->m_bits <<= entry->m_length;
+	reader->m_num_bits -= entry->m_length;
+
+	return (BYTE)entry->m_value;
 }
 
 
+// the rare codes longer than the table, one bit at a time from the node the table got to; the reader
+// is topped up again before returning so the caller's lookups still have their bits
+BYTE decode_huffman_byte_from_tree(struct dictionary_internal *dictionary, struct packed_bit_reader *reader, const struct huffman_table_entry *entry)
+{
+	struct node *cursor;
+
+	reader->m_bits <<= HUFFMAN_TABLE_BITS;
+	reader->m_num_bits -= HUFFMAN_TABLE_BITS;
 
-void find_symbol(struct dictionary_internal *dictionary,struct symbol sym, struct node *current_node)
-{	
-//	printf("find symbol[%d][%d]\n",depth,symbol);
-	if (dictionary->m_huffman.m_found == false)
+	if (entry->m_length == HUFFMAN_TABLE_INVALID)
 	{
-		dictionary->m_huffman.m_depth++;
+		reader->m_failed = true;
+		refill_packed_reader(reader);
+		return 0;
 	}
 
-	if ((current_node->m_left == NULL && current_node->m_right == NULL) &&
-		(current_node->m_symbol_info.m_symbol.m_value == sym.m_value))
+	cursor = &(dictionary->m_huffman.m_nodes[entry->m_value]);
+
+	while (cursor != NULL && (cursor->m_left != NULL || cursor->m_right != NULL))
 	{
-		dictionary->m_huffman.m_found = true;
-		dictionary->m_huffman.m_depth--;
-		dictionary->m_representation[dictionary->m_huffman.m_depth] = '\0';
+		if (reader->m_num_bits == 0)
+		{
+			refill_packed_reader(reader);
+		}
+
+		cursor = (reader->m_bits >> 63) ? cursor->m_left : cursor->m_right;
+		reader->m_bits <<= 1;
+		reader->m_num_bits--;
 	}
-	else
+
+	refill_packed_reader(reader);
+
+	if (cursor == NULL)
 	{
-		if ((dictionary->m_huffman.m_found == false) && (current_node->m_left != NULL))
-		{ 
-			dictionary->m_representation[dictionary->m_huffman.m_depth - 1] = '1';
-			find_symbol(dictionary, sym, current_node->m_left);
-		}
+		reader->m_failed = true;
+		return 0;
+	}
+
+	return (BYTE)cursor->m_symbol_info.m_symbol.m_value;
+}
+
+
+void decode_huffman_run(struct dictionary_internal *dictionary, struct packed_bit_reader *reader, BYTE *dest, int num_symbols)
+{
+	int i;
 
-		if ((dictionary->m_huffman.m_found == false) && (current_node->m_right != NULL))
-		{ 
-			dictionary->m_representation[dictionary->m_huffman.m_depth - 1] = '0';
-			find_symbol(dictionary, sym, current_node->m_right);
+	for (i = 0; i < num_symbols; i++)
+	{
+		if (reader->m_num_bits < HUFFMAN_TABLE_BITS)
+		{
+			refill_packed_reader(reader);
 		}
+
+		dest[i] = decode_huffman_byte(dictionary, reader);
 	}
+}
+
+
+// count from 1 to 32 bits off the top, as a number
+WORD take_packed_bits(struct packed_bit_reader *reader, int count)
+{
+	WORD result;
 
-	if (dictionary->m_huffman.m_found == false)
+	if (reader->m_num_bits < count)
 	{
-		dictionary->m_huffman.m_depth--;
+		refill_packed_reader(reader);
 	}
+
+	result = (WORD)(reader->m_bits >> (64 - count));
+	reader->m_bits <<= count;
+	reader->m_num_bits -= count;
+
+	return result;
+}
+
+
+// false when a code was bad or the codes ran past the end of the stream
+bool finish_huffman_reader(struct packed_bit_reader *reader)
+{
+	return reader->m_failed == false && reader->m_padding_bits <= reader->m_num_bits;
 }
 
 
-int find_min_node(int num_nodes, struct node **nodes)
+// the string codes over again as bits, so the packed encoder never touches a character
+void make_encode_table(struct dictionary_internal *dictionary)
 {
-	int result = -1;
-	int smallest_value = -1;
 	int i;
-	for (i=0; i<num_nodes; i++)
+
+	if (dictionary->m_huffman.m_code_values != NULL)
+	{
+		return;
+	}
+
+	dictionary->m_huffman.m_code_values = (WORD *)dictionary_allocate(dictionary, sizeof(WORD) * (dictionary->m_num_symbols + 1));
+	dictionary->m_huffman.m_code_lengths = (unsigned short *)dictionary_allocate(dictionary, sizeof(unsigned short) * (dictionary->m_num_symbols + 1));
+
+	for (i = 0; i < dictionary->m_num_symbols; i++)
 	{
-		if (nodes[i] != NULL)
+		const char *code;
+		WORD value;
+		int length;
+
+		code = &(dictionary->m_huffman.m_codes[dictionary->m_huffman.m_code_offsets[dictionary->m_huffman.m_leaf_of_symbol[i]]]);
+
+		value = 0;
+		for (length = 0; code[length] != '\0'; length++)
 		{
-			if (nodes[i]->m_symbol_info.m_count < smallest_value || smallest_value == -1)
-			{
-				smallest_value = nodes[i]->m_symbol_info.m_count;
-				result = i;
-			}
+			value = (value << 1) | (code[length] == '1' ? 1 : 0);
 		}
+
+		dictionary->m_huffman.m_code_values[i] = value;
+		dictionary->m_huffman.m_code_lengths[i] = (unsigned short)length;
 	}
-	return result;
 }
 
-void make_tree(struct dictionary_internal *dictionary)
+
+void start_packed_writer(struct packed_bit_writer *writer, BYTE *dest, int capacity)
 {
-	struct node **nodes = NULL;
+	writer->m_cursor = dest;
+	writer->m_end = dest + capacity;
+	writer->m_bits = 0;
+	writer->m_num_bits = 0;
+}
 
-	int num_nodes;
-	num_nodes = dictionary->m_num_symbols;
 
-	nodes = (struct node **) malloc(sizeof(struct node *) * num_nodes);
+// count is at most the bits of a WORD, and value has nothing set above them
+void put_packed_bits(struct packed_bit_writer *writer, WORD value, int count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	writer->m_bits |= (DWORD)value << (64 - writer->m_num_bits - count);
+	writer->m_num_bits += count;
+
+	if (writer->m_num_bits >= 32)
+	{
+		writer->m_cursor[0] = (BYTE)(writer->m_bits >> 56);
+		writer->m_cursor[1] = (BYTE)(writer->m_bits >> 48);
+		writer->m_cursor[2] = (BYTE)(writer->m_bits >> 40);
+		writer->m_cursor[3] = (BYTE)(writer->m_bits >> 32);
+		writer->m_cursor += 4;
+		writer->m_bits <<= 32;
+		writer->m_num_bits -= 32;
+	}
+}
+
+
+void put_packed_run(struct packed_bit_writer *writer, int bit, int count)
+{
+	while (count > 0)
+	{
+		int piece;
+
+		piece = count < 32 ? count : 32;
+		put_packed_bits(writer, bit ? (WORD)(0xFFFFFFFFu >> (32 - piece)) : 0, piece);
+		count -= piece;
+	}
+}
 
-	int total = 0;
 
+// what the string calls hand back, NULL when no bits came out
+const char *unpack_representation(struct dictionary_internal *dictionary, const BYTE *packed, struct packed_bit_writer *writer)
+{
+	int num_bits;
 	int i;
-	for (i=0; i<num_nodes; i++)
+
+	num_bits = (int)(writer->m_cursor - packed) * 8 + writer->m_num_bits;
+	finish_packed_bits(writer);
+
+	if (num_bits == 0)
+	{
+		return NULL;
+	}
+
+	assert(num_bits < MAX_REPRESENTATION_LENGTH);
+
+	for (i = 0; i < num_bits; i++)
+	{
+		dictionary->m_arithmetic.m_representation[i] = (packed[i >> 3] & (0x80 >> (i & 7))) ? '1' : '0';
+	}
+
+	dictionary->m_arithmetic.m_representation[num_bits] = '\0';
+
+	return dictionary->m_arithmetic.m_representation;
+}
+
+
+// position in m_symbols of the symbol source starts with, or -1 when the dictionary doesn't have it
+int next_symbol_index(struct dictionary_internal *dictionary, const BYTE *source, int length, int *symbol_length)
+{
+	struct symbol sym;
+
+	if (dictionary->m_alphabet_id == ALPHABET_BYTE)
 	{
-		nodes[i] = (struct node *) malloc(sizeof(struct node));
-		nodes[i]->m_symbol_info = dictionary->m_symbols[i];
-		nodes[i]->m_left = NULL;
-		nodes[i]->m_right = NULL;
+		*symbol_length = 1;
+		return dictionary->m_byte_symbol_index[source[0]];
+	}
 
-		total += nodes[i]->m_symbol_info.m_count;
+	*symbol_length = read_symbol_from_buffer(dictionary, source, length, &sym);
+	if (*symbol_length <= 0)
+	{
+		return -1;
 	}
-//	printf("total in make tree[%d]\n", total);
 
-	while (true)
+	return find_symbol_index(dictionary, sym);
+}
+
+
+int encode_huffman_run(struct dictionary_internal *dictionary, struct packed_bit_writer *writer, const BYTE *source, int length)
+{
+	int i;
+
+	i = 0;
+	while (i < length && writer->m_end - writer->m_cursor >= PACKED_SYMBOL_ROOM)
 	{
-		int min_node_1;
-		int min_node_2;
+		int symbol_index;
+		int symbol_length;
+		int code_length;
+
+		// the byte lookup spelled out, the call costs about a third of this loop
+		if (dictionary->m_alphabet_id == ALPHABET_BYTE)
+		{
+			symbol_index = dictionary->m_byte_symbol_index[source[i]];
+			symbol_length = 1;
+		}
+		else
+		{
+			symbol_index = next_symbol_index(dictionary, &(source[i]), length - i, &symbol_length);
+		}
 
-		struct node * node_1;
-		int node_1_count;
-		struct node * node_2;
-		int node_2_count;
-		struct node * additional;
+		if (symbol_index < 0)
+		{
+			return -1;
+		}
 
-		node_1 = NULL;
-		node_1_count = 0;
-		node_2 = NULL;
-		node_2_count = 0;
+		code_length = dictionary->m_huffman.m_code_lengths[symbol_index];
 
-		min_node_1 = find_min_node(num_nodes, nodes);
-		if (min_node_1 != -1)
+		if (code_length <= 32)
 		{
-			node_1= nodes[min_node_1];
-			nodes[min_node_1] = NULL;
-			node_1_count = node_1->m_symbol_info.m_count;
+			put_packed_bits(writer, dictionary->m_huffman.m_code_values[symbol_index], code_length);
 		}
-		
-		min_node_2 = find_min_node(num_nodes, nodes);
-		if (min_node_2 != -1)
+		else
 		{
-			node_2 = nodes[min_node_2];
-			nodes[min_node_2] = NULL;
-			node_2_count = node_2->m_symbol_info.m_count;
-		}	
+			const char *code;
 
-		additional = (struct node *) malloc(sizeof(struct node));
-		additional->m_symbol_info.m_count = node_1_count + node_2_count;
-		additional->m_left = node_1;
-		additional->m_right = node_2;
+			// only a tree with counts far apart gets this deep
+			code = &(dictionary->m_huffman.m_codes[dictionary->m_huffman.m_code_offsets[dictionary->m_huffman.m_leaf_of_symbol[symbol_index]]]);
+
+			while (*code != '\0')
+			{
+				put_packed_bits(writer, *code == '1' ? 1 : 0, 1);
+				code++;
+			}
+		}
+
+		i += symbol_length;
+	}
+
+	return i;
+}
+
+
+int encode_arithmetic_run(struct dictionary_internal *dictionary, struct packed_bit_writer *writer, const BYTE *source, int length)
+{
+	int i;
+
+	i = 0;
+	while (i < length && writer->m_end - writer->m_cursor >= PACKED_SYMBOL_ROOM)
+	{
+		int symbol_index;
+		int symbol_length;
 
-		if (find_min_node(num_nodes, nodes) == -1) 
+		symbol_index = next_symbol_index(dictionary, &(source[i]), length - i, &symbol_length);
+		if (symbol_index < 0)
 		{
-			dictionary->m_huffman.m_head = additional;
-			break;
+			return -1;
 		}
 
-		nodes[min_node_1] = additional;
+		encode_arithmetic_symbol(dictionary, symbol_index, writer);
+
+		i += symbol_length;
+	}
+
+	return i;
+}
+
+
+// the decoding side of encode_arithmetic_run(): z takes its first 32 bits in one go and then, after each
+// symbol, every bit its rescales left owed in one go more, instead of a bit at a time through
+// consume_arithmetic_bit(); returns the bytes written or -1 when they don't fit
+int decode_arithmetic_run(struct dictionary_internal *dictionary, struct packed_bit_reader *reader, BYTE *dest, int capacity)
+{
+	struct arithmetic_structure *alias;
+	struct symbol decoded_symbol;
+	int fill;
+
+	alias = &(dictionary->m_arithmetic);
+
+	assert(alias->m_is_z_initialized == false);
+
+	alias->m_z = take_packed_bits(reader, 32);
+	alias->m_is_z_initialized = true;
+
+	fill = 0;
+
+	while (decode_iteration(dictionary, &decoded_symbol) == true)
+	{
+		if (store_decoded_symbol(dictionary, decoded_symbol, dest, capacity, &fill) == false)
+		{
+			return -1;
+		}
+
+		// the rescales left z's low bits zero, the next bits of the stream fill them from the top down
+		while (alias->m_pending_bits > 0)
+		{
+			int count;
+
+			count = alias->m_pending_bits < 32 ? alias->m_pending_bits : 32;
+			alias->m_pending_bits -= count;
+			alias->m_z += (DWORD)take_packed_bits(reader, count) << alias->m_pending_bits;
+		}
 	}
 
-//	printf("root count[%d]\n", dictionary->m_head->m_symbol_info.m_count);
+	return fill;
 }
 
 
-void free_tree(struct node *head)
+bool store_decoded_symbol(struct dictionary_internal *dictionary, struct symbol sym, BYTE *dest, int capacity, int *fill)
 {
-	//TODO
+	int symbol_length;
+
+	if (dictionary->m_alphabet_id == ALPHABET_BYTE)
+	{
+		if (*fill >= capacity)
+		{
+			return false;
+		}
+
+		dest[*fill] = (BYTE)sym.m_value;
+		(*fill)++;
+
+		return true;
+	}
+
+	symbol_length = write_symbol_to_buffer(dictionary, sym, &(dest[*fill]), capacity - *fill);
+	if (symbol_length <= 0)
+	{
+		return false;
+	}
+
+	*fill += symbol_length;
+
+	return true;
 }
 
 
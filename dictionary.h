@@ -3,26 +3,81 @@
 
 
 #include "./common.h"
+#include "./arena.h"
 
 
 typedef void * DICTIONARY;
 
 
-DICTIONARY create_dictionary(BYTE algorithm_id);
+#define HUFFMAN_NUM_STREAMS 4
+
+#define PACKED_SYMBOL_ROOM 264 // bytes a packed writer needs free for any one symbol's bits
+
+
+// collects bits most significant first into [m_cursor, m_end); between calls fewer than 32 bits wait
+// in m_bits, finish_packed_bits() writes them out padded to a whole byte
+struct packed_bit_writer
+{
+	BYTE *m_cursor;
+	BYTE *m_end;
+	DWORD m_bits; // the waiting bits from the top down
+	int m_num_bits;
+};
+
+
+DICTIONARY create_dictionary(BYTE algorithm_id,BYTE alphabet_id,ARENA arena);
 void destroy_dictonary(DICTIONARY dictionary);
 
 void update_dictionary(DICTIONARY dictionary,struct symbol sym);
+void update_dictionary_buffer(DICTIONARY dictionary,const BYTE *source,int length);
 bool finalize_dictionary(DICTIONARY dictionary);
 
+// both only make sense between the last update and finalize_dictionary(); the estimates cover
+// the serialized dictionary plus the coded symbols
+void set_dictionary_algorithm(DICTIONARY dictionary,BYTE algorithm_id);
+void estimate_encoded_bits(DICTIONARY dictionary,DWORD *huffman_bits,DWORD *arithmetic_bits);
+
+// the bytes belong to the dictionary's arena when it was created with one, otherwise free() them
 void serialize_dictionary_to_bytes(DICTIONARY dictionary,int *num_bytes,BYTE **bytes);
-DICTIONARY deserialize_bytes_to_dictionary(int num_bytes,BYTE *bytes);
+DICTIONARY deserialize_bytes_to_dictionary(int num_bytes,BYTE *bytes,ARENA arena);
 
 const char *encode_symbol_to_bitstring(DICTIONARY dictionary,struct symbol sym);
 const char *encode_symbol_to_bitstring_flush(DICTIONARY dictionary);
 
 bool decode_consume_bit(DICTIONARY dictionary,char bit_representation, struct symbol *decoded_symbol);
+bool decode_pending_symbol(DICTIONARY dictionary, struct symbol *decoded_symbol);
 bool decode_consume_bit_flush(DICTIONARY dictionary, struct symbol *decoded_symbol);
 
+// the packed forms of the calls above for a whole buffer, the coder is picked once per call instead
+// of once per symbol or bit. encoding stops early once the writer has less than PACKED_SYMBOL_ROOM
+// bytes left, and returns the bytes of source coded so far or -1 when a symbol isn't in the dictionary
+int encode_buffer_packed(DICTIONARY dictionary,struct packed_bit_writer *writer,const BYTE *source,int length);
+void encode_flush_packed(DICTIONARY dictionary,struct packed_bit_writer *writer);
+// returns how many bits of the last byte it wrote are used, 0 when that's all of them or nothing was waiting
+int finish_packed_bits(struct packed_bit_writer *writer);
+
+// decodes a bitstream whose last byte has remainder_bits bits in use (0 for all of them) including
+// the coder's flush, into at most capacity bytes; returns the bytes written or -1 when they don't fit
+int decode_buffer_packed(DICTIONARY dictionary,const BYTE *source,int source_size,int remainder_bits,BYTE *dest,int capacity);
+
+// table driven decoding for ALPHABET_BYTE huffman dictionaries: exactly num_symbols bytes from a most
+// significant bit first bitstream padded out to a whole byte; false when a code isn't in the tree or
+// the stream runs out first
+bool decode_huffman_bytes(DICTIONARY dictionary,const BYTE *source,int source_size,BYTE *dest,int num_symbols);
+
+// the same for HUFFMAN_NUM_STREAMS independent bitstreams decoded side by side, stream i fills the
+// num_symbols[i] bytes of dest that follow the ones before it
+bool decode_huffman_bytes_x4(DICTIONARY dictionary,const BYTE *const *sources,const int *source_sizes,BYTE *dest,const int *num_symbols);
+
+// what the dictionary codes with, as the ALGORITHM_ and ALPHABET_ ids in common.h
+BYTE get_dictionary_algorithm(DICTIONARY dictionary);
+BYTE get_dictionary_alphabet(DICTIONARY dictionary);
+
+// split raw bytes into the dictionary's symbols and back; both return the number of bytes used,
+// or -1 when the symbol isn't in the dictionary or doesn't fit
+int read_symbol_from_buffer(DICTIONARY dictionary,const BYTE *source,int length,struct symbol *sym);
+int write_symbol_to_buffer(DICTIONARY dictionary,struct symbol sym,BYTE *dest,int capacity);
+
 void print_dictionary(DICTIONARY dictionary);
 
 
@@ -0,0 +1,562 @@
+#include "./lz77.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/////////////////////////////
+// private defines
+
+#define MIN_HASH_BITS 12
+#define MAX_HASH_BITS 20
+#define NO_POSITION -1
+#define NUM_DIRECT_CODES 16 // values below this are their own bucket code, with no extra bits
+#define SKIP_STRENGTH 5 // every this many positions in a row without a match the parser steps one byte further
+#define MAX_SKIP_STEP 32
+#define GOOD_LENGTH_DIVISOR 16 // past nice length / this a match cuts the rest of its chain short
+#define LAZY_LENGTH_DIVISOR 8 // past nice length / this a match is taken without the lazy check
+
+
+/////////////////////////////
+// Private Structures
+struct match_finder
+{
+	const BYTE *m_source;
+	int m_size;
+	int *m_head; // most recent position for each hash
+	int m_hash_bits; // a head per window position, within the limits above
+	int *m_previous; // next older position with the same hash, indexed by position & m_window_mask
+	int m_window_size;
+	int m_window_mask;
+	int m_max_chain_length;
+	int m_nice_length;
+	int m_next_insert; // every position below this is in the chains
+};
+
+struct extra_bits_writer
+{
+	BYTE *m_bytes;
+	int m_num_bytes;
+	DWORD m_buffer;
+	int m_num_bits;
+};
+
+struct extra_bits_reader
+{
+	const BYTE *m_bytes;
+	int m_num_bytes;
+	int m_position;
+	DWORD m_buffer;
+	int m_num_bits;
+};
+
+
+/////////////////////////////
+// Private Prototypes
+int round_window_size(int window_size,int size);
+WORD hash_position(const BYTE *source,int hash_bits);
+void insert_positions(struct match_finder *finder,int target);
+int find_longest_match(struct match_finder *finder,int position,int *distance);
+int common_length(const BYTE *a,const BYTE *b,int limit);
+
+void write_bucketed_value(BYTE *code,struct extra_bits_writer *writer,WORD value);
+bool read_bucketed_value(BYTE code,struct extra_bits_reader *reader,WORD *value);
+void write_extra_bits(struct extra_bits_writer *writer,WORD value,int num_bits);
+void flush_extra_bits(struct extra_bits_writer *writer);
+bool read_extra_bits(struct extra_bits_reader *reader,int num_bits,WORD *value);
+void copy_match(BYTE *dest,int distance,int length);
+
+
+/////////////////////////////
+// Public Functions
+bool lz77_parse(const BYTE *source,int size,int prefix_size,const struct lz77_parameters *parameters,ARENA arena,struct lz77_streams *streams)
+{
+	struct match_finder finder;
+	struct extra_bits_writer writer;
+	int position;
+	int run_start;
+	int length;
+	int distance;
+	bool have_match;
+	int misses;
+	int i;
+
+	memset(streams,0,sizeof(struct lz77_streams));
+
+	if (parameters->m_max_chain_length <= 0 || size < LZ77_MIN_MATCH)
+	{
+		return false;
+	}
+
+	// positions count from the start of the prefix, which only ever shows up as match candidates
+	finder.m_source = source - prefix_size;
+	finder.m_size = prefix_size + size;
+	finder.m_window_size = round_window_size(parameters->m_window_size,finder.m_size);
+	finder.m_window_mask = finder.m_window_size - 1;
+	finder.m_max_chain_length = parameters->m_max_chain_length;
+	finder.m_nice_length = parameters->m_nice_length < LZ77_MIN_MATCH ? LZ77_MIN_MATCH : parameters->m_nice_length;
+	finder.m_next_insert = 0;
+	finder.m_hash_bits = MIN_HASH_BITS;
+	while (finder.m_hash_bits < MAX_HASH_BITS && (1 << finder.m_hash_bits) < finder.m_window_size)
+	{
+		finder.m_hash_bits++;
+	}
+
+	finder.m_head = (int *)arena_allocate(arena,(1 << finder.m_hash_bits) * sizeof(int));
+	finder.m_previous = (int *)arena_allocate(arena,finder.m_window_size * sizeof(int));
+
+	for (i = 0; i < (1 << finder.m_hash_bits); i++)
+	{
+		finder.m_head[i] = NO_POSITION;
+	}
+
+	// every match covers at least LZ77_MIN_MATCH bytes, which bounds the command streams, and its
+	// extra bits never take more room than the bytes it covers plus a word for the run
+	streams->m_literals = (BYTE *)arena_allocate(arena,size);
+	streams->m_run_codes = (BYTE *)arena_allocate(arena,size / LZ77_MIN_MATCH + 1);
+	streams->m_length_codes = (BYTE *)arena_allocate(arena,size / LZ77_MIN_MATCH + 1);
+	streams->m_distance_codes = (BYTE *)arena_allocate(arena,size / LZ77_MIN_MATCH + 1);
+
+	writer.m_bytes = (BYTE *)arena_allocate(arena,size * 2 + sizeof(DWORD));
+	writer.m_num_bytes = 0;
+	writer.m_buffer = 0;
+	writer.m_num_bits = 0;
+
+	position = prefix_size;
+	run_start = prefix_size;
+	length = 0;
+	distance = 0;
+	have_match = false;
+	misses = 0;
+
+	while (position < finder.m_size)
+	{
+		if (have_match == false)
+		{
+			length = find_longest_match(&finder,position,&distance);
+		}
+
+		have_match = false;
+
+		// data that stops matching is likely incompressible, so the search thins out until a match
+		// turns up again; the skipped positions don't go into the chains either
+		if (length < LZ77_MIN_MATCH)
+		{
+			int step;
+
+			step = 1 + (misses >> SKIP_STRENGTH);
+			if (step > MAX_SKIP_STEP)
+			{
+				step = MAX_SKIP_STEP;
+			}
+
+			if (step > finder.m_size - position)
+			{
+				step = finder.m_size - position;
+			}
+
+			memcpy(streams->m_literals + streams->m_num_literals,finder.m_source + position,step);
+			streams->m_num_literals += step;
+			position += step;
+			misses++;
+
+			if (finder.m_next_insert < position - 1)
+			{
+				finder.m_next_insert = position - 1;
+			}
+			continue;
+		}
+
+		misses = 0;
+
+		// lazy evaluation: if the next position starts a longer match this byte goes out as a
+		// literal and that match is considered in its place
+		if (parameters->m_lazy_matching && length < finder.m_nice_length / LAZY_LENGTH_DIVISOR && position + 1 < finder.m_size)
+		{
+			int next_length;
+			int next_distance;
+
+			next_length = find_longest_match(&finder,position + 1,&next_distance);
+
+			if (next_length > length)
+			{
+				streams->m_literals[streams->m_num_literals++] = finder.m_source[position];
+				position++;
+				length = next_length;
+				distance = next_distance;
+				have_match = true;
+				continue;
+			}
+		}
+
+		write_bucketed_value(&(streams->m_run_codes[streams->m_num_matches]),&writer,position - run_start);
+		write_bucketed_value(&(streams->m_length_codes[streams->m_num_matches]),&writer,length - LZ77_MIN_MATCH);
+		write_bucketed_value(&(streams->m_distance_codes[streams->m_num_matches]),&writer,distance - 1);
+		streams->m_num_matches++;
+
+		position += length;
+		run_start = position;
+	}
+
+	write_bucketed_value(&(streams->m_run_codes[streams->m_num_matches]),&writer,position - run_start);
+	flush_extra_bits(&writer);
+
+	streams->m_extra_bits = writer.m_bytes;
+	streams->m_num_extra_bytes = writer.m_num_bytes;
+
+//	printf("lz77 size[%d] literals[%d] matches[%d] extra bytes[%d]\n", size, streams->m_num_literals, streams->m_num_matches, streams->m_num_extra_bytes);
+
+	return true;
+}
+
+bool lz77_reconstruct(const struct lz77_streams *streams,BYTE *dest,int size,int prefix_size)
+{
+	struct extra_bits_reader reader;
+	int fill;
+	int literal;
+	int i;
+
+	reader.m_bytes = streams->m_extra_bits;
+	reader.m_num_bytes = streams->m_num_extra_bytes;
+	reader.m_position = 0;
+	reader.m_buffer = 0;
+	reader.m_num_bits = 0;
+
+	fill = 0;
+	literal = 0;
+
+	for (i = 0; i <= streams->m_num_matches; i++)
+	{
+		WORD run;
+		WORD length;
+		WORD distance;
+
+		if (read_bucketed_value(streams->m_run_codes[i],&reader,&run) == false ||
+			run > (WORD)(streams->m_num_literals - literal) || run > (WORD)(size - fill))
+		{
+			return false;
+		}
+
+		memcpy(dest + fill,streams->m_literals + literal,run);
+		fill += run;
+		literal += run;
+
+		if (i == streams->m_num_matches)
+		{
+			break;
+		}
+
+		if (read_bucketed_value(streams->m_length_codes[i],&reader,&length) == false ||
+			read_bucketed_value(streams->m_distance_codes[i],&reader,&distance) == false)
+		{
+			return false;
+		}
+
+		length += LZ77_MIN_MATCH;
+		distance += 1;
+
+		if (distance > (WORD)(prefix_size + fill) || length > (WORD)(size - fill))
+		{
+			return false;
+		}
+
+		copy_match(dest + fill,distance,length);
+		fill += length;
+	}
+
+	return fill == size && literal == streams->m_num_literals;
+}
+
+
+/////////////////////////////
+// Private Functions
+
+// the chains only need to reach as far back as the block goes
+int round_window_size(int window_size,int size)
+{
+	int result;
+
+	if (window_size < LZ77_MIN_WINDOW_SIZE)
+	{
+		window_size = LZ77_MIN_WINDOW_SIZE;
+	}
+
+	if (window_size > LZ77_MAX_WINDOW_SIZE)
+	{
+		window_size = LZ77_MAX_WINDOW_SIZE;
+	}
+
+	result = LZ77_MIN_WINDOW_SIZE;
+	while (result < window_size && result < size)
+	{
+		result <<= 1;
+	}
+
+	return result;
+}
+
+// every byte of a minimum match goes into the hash, so a chain rarely holds a candidate that
+// can't match at all
+WORD hash_position(const BYTE *source,int hash_bits)
+{
+	WORD value;
+
+	value = ((WORD)source[0] << 24) | ((WORD)source[1] << 16) | ((WORD)source[2] << 8) | source[3];
+
+	return (value * 2654435761u) >> (32 - hash_bits);
+}
+
+void insert_positions(struct match_finder *finder,int target)
+{
+	int last;
+
+	// the hash reads LZ77_MIN_MATCH bytes, the final few positions can't start a match anyway
+	last = finder->m_size - LZ77_MIN_MATCH;
+	if (target > last + 1)
+	{
+		target = last + 1;
+	}
+
+	while (finder->m_next_insert < target)
+	{
+		WORD hash;
+		int position;
+
+		position = finder->m_next_insert;
+		hash = hash_position(finder->m_source + position,finder->m_hash_bits);
+
+		finder->m_previous[position & finder->m_window_mask] = finder->m_head[hash];
+		finder->m_head[hash] = position;
+		finder->m_next_insert++;
+	}
+}
+
+// walks the hash chain for position, looking only at positions already inserted before it
+int find_longest_match(struct match_finder *finder,int position,int *distance)
+{
+	int result;
+	int candidate;
+	int chain_length;
+	int limit;
+	const BYTE *current;
+
+	result = 0;
+	*distance = 0;
+
+	limit = finder->m_size - position;
+	if (limit > LZ77_MAX_MATCH)
+	{
+		limit = LZ77_MAX_MATCH;
+	}
+
+	if (limit < LZ77_MIN_MATCH)
+	{
+		return 0;
+	}
+
+	insert_positions(finder,position);
+
+	current = finder->m_source + position;
+	candidate = finder->m_head[hash_position(current,finder->m_hash_bits)];
+	chain_length = finder->m_max_chain_length;
+
+	while (candidate != NO_POSITION && position - candidate < finder->m_window_size && chain_length > 0)
+	{
+		const BYTE *previous;
+		int next;
+
+		previous = finder->m_source + candidate;
+
+		// a longer match has to agree at the byte just past the best one so far
+		if (previous[result] == current[result] && previous[0] == current[0])
+		{
+			int length;
+
+			length = common_length(previous,current,limit);
+			if (length > result)
+			{
+				result = length;
+				*distance = position - candidate;
+
+				if (length >= finder->m_nice_length || length == limit)
+				{
+					break;
+				}
+
+				// a decent match is in hand, only a quarter of the remaining search is worth it
+				if (length >= finder->m_nice_length / GOOD_LENGTH_DIVISOR && chain_length > 4)
+				{
+					chain_length >>= 2;
+				}
+			}
+		}
+
+		// slots get reused once a position falls out of the window, chains only ever go back in time
+		next = finder->m_previous[candidate & finder->m_window_mask];
+		if (next >= candidate)
+		{
+			break;
+		}
+
+		candidate = next;
+		chain_length--;
+	}
+
+	return result;
+}
+
+int common_length(const BYTE *a,const BYTE *b,int limit)
+{
+	int result;
+
+	result = 0;
+
+	while (result + (int)sizeof(DWORD) <= limit)
+	{
+		DWORD a_word;
+		DWORD b_word;
+
+		memcpy(&a_word,a + result,sizeof(DWORD));
+		memcpy(&b_word,b + result,sizeof(DWORD));
+
+		if (a_word != b_word)
+		{
+			break;
+		}
+
+		result += sizeof(DWORD);
+	}
+
+	while (result < limit && a[result] == b[result])
+	{
+		result++;
+	}
+
+	return result;
+}
+
+// values below NUM_DIRECT_CODES are the code itself, bigger ones code their top two bits and
+// the position of the highest one, and the remaining low bits go out as extra bits
+void write_bucketed_value(BYTE *code,struct extra_bits_writer *writer,WORD value)
+{
+	int highest_bit;
+
+	if (value < NUM_DIRECT_CODES)
+	{
+		*code = value;
+		return;
+	}
+
+	highest_bit = 31 - __builtin_clz(value);
+
+	*code = NUM_DIRECT_CODES + (highest_bit - 4) * 2 + ((value >> (highest_bit - 1)) & 1);
+	write_extra_bits(writer,value & ((1u << (highest_bit - 1)) - 1),highest_bit - 1);
+}
+
+bool read_bucketed_value(BYTE code,struct extra_bits_reader *reader,WORD *value)
+{
+	int highest_bit;
+	WORD extra;
+
+	if (code < NUM_DIRECT_CODES)
+	{
+		*value = code;
+		return true;
+	}
+
+	if (code >= LZ77_NUM_BUCKET_CODES)
+	{
+		return false;
+	}
+
+	highest_bit = (code - NUM_DIRECT_CODES) / 2 + 4;
+
+	if (read_extra_bits(reader,highest_bit - 1,&extra) == false)
+	{
+		return false;
+	}
+
+	*value = ((2u | ((code - NUM_DIRECT_CODES) & 1)) << (highest_bit - 1)) | extra;
+
+	return true;
+}
+
+// least significant bit first
+void write_extra_bits(struct extra_bits_writer *writer,WORD value,int num_bits)
+{
+	writer->m_buffer |= (DWORD)value << writer->m_num_bits;
+	writer->m_num_bits += num_bits;
+
+	while (writer->m_num_bits >= 8)
+	{
+		writer->m_bytes[writer->m_num_bytes++] = (BYTE)writer->m_buffer;
+		writer->m_buffer >>= 8;
+		writer->m_num_bits -= 8;
+	}
+}
+
+void flush_extra_bits(struct extra_bits_writer *writer)
+{
+	if (writer->m_num_bits > 0)
+	{
+		writer->m_bytes[writer->m_num_bytes++] = (BYTE)writer->m_buffer;
+		writer->m_buffer = 0;
+		writer->m_num_bits = 0;
+	}
+}
+
+bool read_extra_bits(struct extra_bits_reader *reader,int num_bits,WORD *value)
+{
+	while (reader->m_num_bits < num_bits)
+	{
+		if (reader->m_position >= reader->m_num_bytes)
+		{
+			return false;
+		}
+
+		reader->m_buffer |= (DWORD)reader->m_bytes[reader->m_position++] << reader->m_num_bits;
+		reader->m_num_bits += 8;
+	}
+
+	*value = (WORD)(reader->m_buffer & ((1ull << num_bits) - 1));
+	reader->m_buffer >>= num_bits;
+	reader->m_num_bits -= num_bits;
+
+	return true;
+}
+
+// source and destination overlap whenever the distance is shorter than the match, which repeats
+// the last distance bytes; eight at a time is safe as long as the distance is at least that
+void copy_match(BYTE *dest,int distance,int length)
+{
+	const BYTE *source;
+
+	source = dest - distance;
+
+	if (distance >= length)
+	{
+		memcpy(dest,source,length);
+		return;
+	}
+
+	if (distance >= (int)sizeof(DWORD))
+	{
+		while (length >= (int)sizeof(DWORD))
+		{
+			memcpy(dest,source,sizeof(DWORD));
+			dest += sizeof(DWORD);
+			source += sizeof(DWORD);
+			length -= sizeof(DWORD);
+		}
+	}
+	else if (distance == 1)
+	{
+		memset(dest,*source,length);
+		return;
+	}
+
+	while (length > 0)
+	{
+		*dest++ = *source++;
+		length--;
+	}
+}
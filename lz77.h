@@ -0,0 +1,51 @@
+#ifndef LZ77__H
+#define LZ77__H
+
+
+#include "./common.h"
+#include "./arena.h"
+
+
+#define LZ77_MIN_MATCH 4
+#define LZ77_MAX_MATCH (64 * 1024)
+#define LZ77_MIN_WINDOW_SIZE 1024
+#define LZ77_MAX_WINDOW_SIZE (16 * 1024 * 1024)
+
+// the length and distance values are written as one byte bucket code plus raw extra bits, so
+// the entropy coders only ever see byte alphabets
+#define LZ77_NUM_BUCKET_CODES 72
+
+
+struct lz77_parameters
+{
+	int m_window_size; // how far back a match may start, a power of two
+	int m_max_chain_length; // candidates tried per position, 0 turns the match finder off
+	int m_nice_length; // a match this long is taken without looking any further
+	bool m_lazy_matching; // check whether the next position has a longer match before taking one
+};
+
+// a block parsed into literal runs, each followed by a match, and a final literal run; every
+// stream is in command order and the extra bits are interleaved run, length, distance
+struct lz77_streams
+{
+	BYTE *m_literals;
+	int m_num_literals;
+	int m_num_matches;
+	BYTE *m_run_codes; // m_num_matches + 1 of them, the last one covers the trailing literals
+	BYTE *m_length_codes; // match length minus LZ77_MIN_MATCH
+	BYTE *m_distance_codes; // distance minus 1
+	BYTE *m_extra_bits;
+	int m_num_extra_bytes;
+};
+
+
+// fills streams with buffers from arena, which has to outlive them; the prefix_size bytes just in front
+// of source are there for matches to reach back into but aren't coded themselves, 0 for none
+bool lz77_parse(const BYTE *source,int size,int prefix_size,const struct lz77_parameters *parameters,ARENA arena,struct lz77_streams *streams);
+
+// rebuilds exactly size bytes into dest, false if the streams don't describe that many; the same
+// prefix_size bytes the parse saw have to be in front of dest already
+bool lz77_reconstruct(const struct lz77_streams *streams,BYTE *dest,int size,int prefix_size);
+
+
+#endif // LZ77__H
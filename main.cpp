@@ -0,0 +1,588 @@
+#include "common.h"
+#include "compressor.h"
+#include "benchmark.h"
+#include "archive.h"
+#include "FileInputStream.hpp"
+#include "FileOutputStream.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/////////////////////////////
+// Private Prototypes
+bool is_level_option(const char *option);
+bool parse_option(const char *option);
+bool parse_size(const char *text, DWORD *size);
+bool load_dictionary_option();
+bool load_reference_option();
+int train(const char *dictionary_filename, char **sample_filenames, int num_samples);
+int pack(const char *archive_filename, const char **paths, int num_paths);
+int unpack(const char *archive_filename, const char *directory, const char **names, int num_names);
+
+
+/////////////////////////////
+// Global Variables
+static BYTE g_algorithm_id = ALGORITHM_AUTO;
+static const char *g_dictionary_filename = NULL;
+static const char *g_reference_filename = NULL;
+static bool g_write_stats = false;
+static const char *g_stats_filename = NULL; // NULL with g_write_stats writes the stats to stdout
+static int g_num_threads = 0; // for pack, 0 is one per cpu
+
+
+/////////////////////////////
+// Public Functions
+int main(int argc, char *argv[])
+{
+	int result = 20;
+	int i;
+	int num_positional;
+
+	// a level sets several knobs at once, so it goes first and the specific options can override it
+	for (i = 1; i < argc; i++)
+	{
+		if (is_level_option(argv[i]))
+		{
+			g_algorithm_id = apply_compression_level(argv[i][1] - '0');
+		}
+	}
+
+	// options can go anywhere on the line, everything else keeps its position
+	num_positional = 1;
+	for (i = 1; i < argc; i++)
+	{
+		if (is_level_option(argv[i]))
+		{
+			continue;
+		}
+
+		if (argv[i][0] == '-' && argv[i][1] != '\0')
+		{
+			if (parse_option(argv[i]) == false)
+			{
+				printf("Unknown option [%s]\n", argv[i]);
+				return 1;
+			}
+		}
+		else
+		{
+			argv[num_positional] = argv[i];
+			num_positional++;
+		}
+	}
+	argc = num_positional;
+
+	if (argc >= 4 && strcmp(argv[1], "train") == 0)
+	{
+		return train(argv[2], &(argv[3]), argc - 3);
+	}
+
+	// an archive's entries decode with nothing but the archive, which keeps no dictionary or reference
+	if ((g_dictionary_filename != NULL || g_reference_filename != NULL) && argc >= 2 &&
+		(strcmp(argv[1], "pack") == 0 || strcmp(argv[1], "unpack") == 0 || strcmp(argv[1], "contents") == 0))
+	{
+		printf("Problem: --dictionary and --reference don't apply to archives\n");
+		return 1;
+	}
+
+	if (argc >= 4 && strcmp(argv[1], "pack") == 0)
+	{
+		return pack(argv[2], (const char **)&(argv[3]), argc - 3);
+	}
+
+	if (argc >= 4 && strcmp(argv[1], "unpack") == 0)
+	{
+		return unpack(argv[2], argv[3], (const char **)&(argv[4]), argc - 4);
+	}
+
+	if (argc == 3 && strcmp(argv[1], "contents") == 0)
+	{
+		return unpack(argv[2], NULL, NULL, 0);
+	}
+
+	if (load_dictionary_option() == false || load_reference_option() == false)
+	{
+		return 1;
+	}
+
+	if (argc == 3 && (argv[1][0] == 'b' || argv[1][0] == 'B'))
+	{
+		result = run_benchmark(argv[2], NULL) ? 0 : 1;
+	}
+	else if (argc == 4 && (argv[1][0] == 'b' || argv[1][0] == 'B'))
+	{
+		result = run_benchmark(argv[2], argv[3]) ? 0 : 1;
+	}
+	else if (argc == 3 && (argv[1][0] == 't' || argv[1][0] == 'T'))
+	{
+		FileInputStream *source;
+
+		source = new FileInputStream();
+
+		if (source->initialize(argv[2]))
+		{
+			result = perform_verification(source) ? 0 : 1;
+
+			if (g_write_stats && write_stats_json(get_last_stats(), g_stats_filename) == false)
+			{
+				result = 1;
+			}
+		}
+		else
+		{
+			result = 1;
+		}
+
+		source->shutdown();
+		delete source, source = NULL;
+	}
+	else if (argc == 3 && (argv[1][0] == 'l' || argv[1][0] == 'L'))
+	{
+		FileInputStream *source;
+
+		source = new FileInputStream();
+
+		if (source->initialize(argv[2]))
+		{
+			result = perform_listing(source) ? 0 : 1;
+		}
+		else
+		{
+			result = 1;
+		}
+
+		source->shutdown();
+		delete source, source = NULL;
+	}
+	else if (argc == 4 && (argv[1][0] == 'a' || argv[1][0] == 'A'))
+	{
+		FileInputStream *archive;
+		FileInputStream *source;
+		FileOutputStream *dest;
+
+		archive = new FileInputStream();
+		source = new FileInputStream();
+		dest = new FileOutputStream();
+
+		// the archive is open twice, read through one and written in place through the other
+		if (archive->initialize(argv[2]) && source->initialize(argv[3]) && dest->initializeForUpdate(argv[2]))
+		{
+			result = perform_append(g_algorithm_id, archive, dest, source) ? 0 : 1;
+
+			if (g_write_stats && write_stats_json(get_last_stats(), g_stats_filename) == false)
+			{
+				result = 1;
+			}
+		}
+		else
+		{
+			result = 1;
+		}
+
+		archive->shutdown();
+		source->shutdown();
+		dest->shutdown();
+
+		delete archive, archive = NULL;
+		delete source, source = NULL;
+		delete dest, dest = NULL;
+	}
+	else if (argc != 4) 
+	{
+		printf("Usage: compressor OPTION source-filename dest-filename.\n");
+		printf("       compressor t compressed-filename\n");
+		printf("       compressor l compressed-filename\n");
+		printf("       compressor a compressed-filename more-filename\n");
+		printf("       compressor b file-or-directory [json-filename]\n");
+		printf("       compressor train dictionary-filename sample-filename...\n");
+		printf("       compressor pack archive-filename file-or-directory...\n");
+		printf("       compressor unpack archive-filename dest-directory [name...]\n");
+		printf("       compressor contents archive-filename\n");
+		printf("OPTION = c -> compress; OPTION = d -> decompress; OPTION = t -> test; OPTION = l -> list blocks; OPTION = a -> append; OPTION = b -> benchmark\n");
+		printf("  -1 .. -9  fastest to smallest, -%d by default\n", DEFAULT_COMPRESSION_LEVEL);
+		printf("  --algorithm=auto|huffman|arithmetic|stored  coder for every block, auto picks per block\n");
+		printf("  --alphabet=auto|byte|pair|word  what the coders treat as one symbol when compressing\n");
+		printf("  --window=BYTES  how far back lz77 matches may reach, rounded up to a power of two\n");
+		printf("  --match-chain=N  lz77 candidates tried per position, 0 turns the lz77 stage off\n");
+		printf("  --dictionary=FILE  code with a dictionary from train, decoding needs the same one, not for archives\n");
+		printf("  --reference=FILE  store only what differs from an earlier version of the file, decoding needs the same one, not for archives\n");
+		printf("  --stats[=FILE]  per stage times and per block entropy as json, on stdout without a file\n");
+		printf("  --no-index  leave the block index off the end of the compressed file\n");
+		printf("  --no-split  one set of tables per block even where the data changes partway through\n");
+		printf("  --no-pipeline  read, code and write one block after another on a single thread\n");
+		printf("  --threads=N  files pack compresses at once, one per cpu by default\n");
+		printf("  --max-memory=BYTES[K|M|G]  smaller blocks and fewer threads to stay under it, decoding refuses what won't fit\n");
+		result = 0;
+	} 
+	else
+	{
+		FileInputStream *source;
+		FileOutputStream *dest;
+		bool open_file_1_test;
+		bool open_file_2_test;
+
+		source = new FileInputStream();
+		dest = new FileOutputStream();
+		open_file_1_test = source->initialize(argv[2]);
+		open_file_2_test = dest->initialize(argv[3]);
+
+		if (open_file_1_test && open_file_2_test) 
+		{
+			bool performance_test;
+			bool compress = (argv[1][0] == 'c' || argv[1][0] == 'C');
+
+			if (compress)
+			{
+				performance_test = perform_compression(g_algorithm_id,source,dest);
+
+			}
+			else
+			{
+				performance_test = perform_decompression(source,dest);
+			}
+
+			if (performance_test == true)
+			{
+				result = 0;
+			}
+			else
+			{
+				result = 1;
+			}
+
+			if (g_write_stats && write_stats_json(get_last_stats(), g_stats_filename) == false)
+			{
+				result = 1;
+			}
+
+		}
+		else
+		{
+			result = 1;
+		}
+
+		source->shutdown();
+		dest->shutdown();
+
+		delete source, source = NULL;
+		delete dest, dest = NULL;
+
+	} 
+
+	return result;
+}
+
+
+/////////////////////////////
+// Private Functions
+bool is_level_option(const char *option)
+{
+	return option[0] == '-' && option[1] >= '0' + MIN_COMPRESSION_LEVEL && option[1] <= '0' + MAX_COMPRESSION_LEVEL && option[2] == '\0';
+}
+
+bool parse_option(const char *option)
+{
+	bool result;
+
+	result = true;
+
+	if (strcmp(option, "--alphabet=auto") == 0)
+	{
+		set_alphabet(ALPHABET_AUTO);
+	}
+	else if (strcmp(option, "--algorithm=auto") == 0)
+	{
+		g_algorithm_id = ALGORITHM_AUTO;
+	}
+	else if (strcmp(option, "--algorithm=huffman") == 0)
+	{
+		g_algorithm_id = ALGORITHM_HUFFMAN;
+	}
+	else if (strcmp(option, "--algorithm=arithmetic") == 0)
+	{
+		g_algorithm_id = ALGORITHM_ARITHMETIC;
+	}
+	else if (strcmp(option, "--algorithm=stored") == 0)
+	{
+		g_algorithm_id = ALGORITHM_STORED;
+	}
+	else if (strcmp(option, "--alphabet=byte") == 0)
+	{
+		set_alphabet(ALPHABET_BYTE);
+	}
+	else if (strcmp(option, "--alphabet=pair") == 0)
+	{
+		set_alphabet(ALPHABET_PAIR);
+	}
+	else if (strcmp(option, "--alphabet=word") == 0)
+	{
+		set_alphabet(ALPHABET_WORD);
+	}
+	else if (strncmp(option, "--dictionary=", 13) == 0)
+	{
+		g_dictionary_filename = option + 13;
+	}
+	else if (strncmp(option, "--reference=", 12) == 0)
+	{
+		g_reference_filename = option + 12;
+	}
+	else if (strcmp(option, "--stats") == 0)
+	{
+		// the json gets stdout to itself
+		g_write_stats = true;
+		set_verbose(false);
+		set_collect_stats(true);
+	}
+	else if (strncmp(option, "--stats=", 8) == 0)
+	{
+		g_write_stats = true;
+		g_stats_filename = option + 8;
+		set_collect_stats(true);
+	}
+	else if (strcmp(option, "--no-index") == 0)
+	{
+		set_write_index(false);
+	}
+	else if (strcmp(option, "--no-split") == 0)
+	{
+		set_block_splitting(false);
+	}
+	else if (strcmp(option, "--no-pipeline") == 0)
+	{
+		set_pipelining(false);
+	}
+	else if (strncmp(option, "--threads=", 10) == 0)
+	{
+		g_num_threads = atoi(option + 10);
+	}
+	else if (strncmp(option, "--max-memory=", 13) == 0)
+	{
+		DWORD size;
+
+		result = parse_size(option + 13, &size);
+		if (result)
+		{
+			set_max_memory(size);
+		}
+	}
+	else if (strncmp(option, "--window=", 9) == 0 || strncmp(option, "--match-chain=", 14) == 0)
+	{
+		struct lz77_parameters parameters;
+		int value;
+
+		value = atoi(strchr(option, '=') + 1);
+
+		get_match_finder(&parameters);
+		if (option[2] == 'w')
+		{
+			parameters.m_window_size = value;
+		}
+		else
+		{
+			parameters.m_max_chain_length = value;
+		}
+		set_match_finder(&parameters);
+	}
+	else
+	{
+		result = false;
+	}
+
+	return result;
+}
+
+// a byte count with an optional K, M or G after it, in powers of 1024
+bool parse_size(const char *text, DWORD *size)
+{
+	char *end;
+
+	*size = strtoull(text, &end, 10);
+
+	if (end == text)
+	{
+		return false;
+	}
+
+	switch (*end)
+	{
+		case 'G' :
+		case 'g' :
+			*size *= 1024;
+			// falls through
+		case 'M' :
+		case 'm' :
+			*size *= 1024;
+			// falls through
+		case 'K' :
+		case 'k' :
+			*size *= 1024;
+			end++;
+			break;
+		default:
+			break;
+	}
+
+	return *end == '\0';
+}
+
+bool load_dictionary_option()
+{
+	FileInputStream *source;
+	bool result;
+
+	if (g_dictionary_filename == NULL)
+	{
+		return true;
+	}
+
+	source = new FileInputStream();
+
+	if (source->initialize(g_dictionary_filename))
+	{
+		result = load_trained_dictionary(source);
+	}
+	else
+	{
+		result = false;
+	}
+
+	source->shutdown();
+	delete source, source = NULL;
+
+	return result;
+}
+
+bool load_reference_option()
+{
+	FileInputStream *source;
+	bool result;
+
+	if (g_reference_filename == NULL)
+	{
+		return true;
+	}
+
+	// blocks coded with a trained dictionary skip the lz77 stage the reference goes through
+	if (g_dictionary_filename != NULL)
+	{
+		printf("Problem: --dictionary and --reference don't go together\n");
+		return false;
+	}
+
+	source = new FileInputStream();
+
+	if (source->initialize(g_reference_filename))
+	{
+		result = load_reference(source);
+	}
+	else
+	{
+		result = false;
+	}
+
+	source->shutdown();
+	delete source, source = NULL;
+
+	return result;
+}
+
+int train(const char *dictionary_filename, char **sample_filenames, int num_samples)
+{
+	FileInputStream **samples;
+	FileOutputStream *dest;
+	int result;
+	int i;
+
+	result = 0;
+	samples = (FileInputStream **)malloc(sizeof(FileInputStream *) * num_samples);
+
+	for (i = 0; i < num_samples; i++)
+	{
+		samples[i] = new FileInputStream();
+
+		if (samples[i]->initialize(sample_filenames[i]) == false)
+		{
+			result = 1;
+		}
+	}
+
+	dest = new FileOutputStream();
+
+	if (result == 0)
+	{
+		if (dest->initialize(dictionary_filename))
+		{
+			result = perform_training(g_algorithm_id, (InputStream **)samples, num_samples, dest) ? 0 : 1;
+		}
+		else
+		{
+			result = 1;
+		}
+	}
+
+	dest->shutdown();
+	delete dest, dest = NULL;
+
+	for (i = 0; i < num_samples; i++)
+	{
+		samples[i]->shutdown();
+		delete samples[i], samples[i] = NULL;
+	}
+	free(samples);
+
+	return result;
+}
+
+int pack(const char *archive_filename, const char **paths, int num_paths)
+{
+	FileOutputStream *dest;
+	int result;
+
+	dest = new FileOutputStream();
+
+	if (dest->initialize(archive_filename))
+	{
+		result = create_archive(g_algorithm_id, paths, num_paths, g_num_threads, dest) ? 0 : 1;
+	}
+	else
+	{
+		result = 1;
+	}
+
+	dest->shutdown();
+	delete dest, dest = NULL;
+
+	return result;
+}
+
+// a NULL directory lists the archive instead
+int unpack(const char *archive_filename, const char *directory, const char **names, int num_names)
+{
+	FileInputStream *source;
+	int result;
+
+	source = new FileInputStream();
+
+	if (source->initialize(archive_filename))
+	{
+		if (directory == NULL)
+		{
+			result = list_archive(source) ? 0 : 1;
+		}
+		else
+		{
+			result = extract_archive(source, directory, names, num_names) ? 0 : 1;
+		}
+	}
+	else
+	{
+		result = 1;
+	}
+
+	source->shutdown();
+	delete source, source = NULL;
+
+	return result;
+}
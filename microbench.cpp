@@ -0,0 +1,684 @@
+#include "common.h"
+#include "benchmark.h"
+#include "burrows_wheeler.h"
+#include "dictionary.h"
+#include "lz77.h"
+#include "arena.h"
+#include "FileInputStream.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	include <x86intrin.h>
+#	define HAS_CYCLE_COUNTER 1
+#else
+#	define HAS_CYCLE_COUNTER 0
+#endif
+
+
+/*
+	times each hot kernel on its own, on a fixed input, so a regression shows up against the stage
+	that caused it instead of being averaged into an end to end number
+
+	usage: microbench [input-filename]
+*/
+
+
+#define KERNEL_INPUT_SIZE (256 * 1024)
+#define KERNEL_REPETITIONS 7
+#define BWT_BATCH_SIZE 256
+#define BWT_INPUT_SIZE (32 * 1024) // the rotation matrix transforms are far slower than the coders
+#define LZ77_WINDOW_SIZE (1024 * 1024)
+#define LZ77_CHAIN_LENGTH 64
+#define LZ77_NICE_LENGTH 256
+
+
+/////////////////////////////
+// Private Structures
+struct kernel_context
+{
+	const BYTE *m_input;
+	int m_input_size;
+
+	BYTE *m_serialized_huffman;
+	int m_serialized_huffman_size;
+	BYTE *m_serialized_arithmetic;
+	int m_serialized_arithmetic_size;
+
+	char *m_huffman_bits; // '0'/'1' characters, the form decode_consume_bit() takes
+	int m_huffman_num_bits;
+	char *m_arithmetic_bits;
+	int m_arithmetic_num_bits;
+
+	BYTE *m_huffman_packed; // the same huffman bits eight to a byte, for the table decoders
+	int m_huffman_packed_size;
+	BYTE *m_arithmetic_packed;
+	int m_arithmetic_packed_size;
+	BYTE *m_quarters_packed[HUFFMAN_NUM_STREAMS]; // each quarter of the input coded on its own
+	int m_quarters_packed_sizes[HUFFMAN_NUM_STREAMS];
+	int m_quarter_sizes[HUFFMAN_NUM_STREAMS];
+
+	BYTE *m_bwt_encoded; // transformed batches, each BWT_BATCH_SIZE bytes
+	int *m_bwt_indices;
+	BYTE *m_bwt_block; // the whole input transformed as one block
+	int m_bwt_block_index;
+
+	struct lz77_parameters m_lz77_parameters;
+	struct lz77_streams m_lz77_streams; // the input parsed once up front, for the reconstruct kernel
+	ARENA m_lz77_arena;
+	ARENA m_parse_arena; // reset by every timed parse
+
+	DICTIONARY m_dictionary; // built by a kernel's prepare step, outside the timed region
+	BYTE *m_scratch;
+	DWORD m_checksum; // keeps the optimizer from discarding kernel results
+};
+
+struct kernel
+{
+	const char *m_name;
+	void (*m_prepare)(struct kernel_context *context);
+	void (*m_run)(struct kernel_context *context);
+};
+
+
+/////////////////////////////
+// Private Prototypes
+void setup_context(struct kernel_context *context,const BYTE *input,int input_size);
+int num_bwt_batches(struct kernel_context *context);
+void shutdown_context(struct kernel_context *context);
+void serialize_model(const BYTE *input,int input_size,BYTE algorithm_id,BYTE **bytes,int *num_bytes);
+void collect_bits(const BYTE *input,int input_size,const BYTE *serialized,int num_serialized,char **bits,int *num_bits);
+void pack_bits(const char *bits,int num_bits,BYTE **bytes,int *num_bytes);
+
+void prepare_nothing(struct kernel_context *context);
+void prepare_huffman_histogram(struct kernel_context *context);
+void prepare_huffman_dictionary(struct kernel_context *context);
+void prepare_arithmetic_dictionary(struct kernel_context *context);
+void prepare_bwt(struct kernel_context *context);
+void prepare_lz77_parse(struct kernel_context *context);
+
+void run_histogram(struct kernel_context *context);
+void run_huffman_build(struct kernel_context *context);
+void run_encode(struct kernel_context *context);
+void run_encode_packed(struct kernel_context *context);
+void run_decode_huffman(struct kernel_context *context);
+void run_decode_huffman_table(struct kernel_context *context);
+void run_decode_huffman_x4(struct kernel_context *context);
+void run_decode_arithmetic(struct kernel_context *context);
+void run_decode_arithmetic_packed(struct kernel_context *context);
+void run_bwt_encode(struct kernel_context *context);
+void run_bwt_decode(struct kernel_context *context);
+void run_bwt_doubling(struct kernel_context *context);
+void run_bwt_rank_inverse(struct kernel_context *context);
+void run_lz77_parse(struct kernel_context *context);
+void run_lz77_reconstruct(struct kernel_context *context);
+
+DWORD read_cycle_counter();
+
+
+/////////////////////////////
+// Global Variables
+static const struct kernel g_kernels[] =
+{
+	{"histogram", prepare_nothing, run_histogram},
+	{"huffman build", prepare_huffman_histogram, run_huffman_build},
+	{"huffman encode", prepare_huffman_dictionary, run_encode},
+	{"huffman encode pack", prepare_huffman_dictionary, run_encode_packed},
+	{"huffman decode", prepare_huffman_dictionary, run_decode_huffman},
+	{"huffman table", prepare_huffman_dictionary, run_decode_huffman_table},
+	{"huffman table x4", prepare_huffman_dictionary, run_decode_huffman_x4},
+	{"arithmetic encode", prepare_arithmetic_dictionary, run_encode},
+	{"arithmetic decode", prepare_arithmetic_dictionary, run_decode_arithmetic},
+	{"arith encode pack", prepare_arithmetic_dictionary, run_encode_packed},
+	{"arith decode pack", prepare_arithmetic_dictionary, run_decode_arithmetic_packed},
+	{"bwt sort", prepare_bwt, run_bwt_encode},
+	{"bwt inverse", prepare_bwt, run_bwt_decode},
+	{"bwt doubling", prepare_nothing, run_bwt_doubling},
+	{"bwt rank inverse", prepare_nothing, run_bwt_rank_inverse},
+	{"lz77 parse", prepare_lz77_parse, run_lz77_parse},
+	{"lz77 reconstruct", prepare_nothing, run_lz77_reconstruct},
+};
+
+
+/////////////////////////////
+// Public Functions
+int main(int argc, char *argv[])
+{
+	struct kernel_context context;
+	BYTE *input;
+	int input_size;
+	int k;
+
+	input_size = KERNEL_INPUT_SIZE;
+	input = (BYTE *)malloc(input_size);
+
+	if (argc > 1)
+	{
+		FileInputStream *source;
+
+		source = new FileInputStream();
+		if (source->initialize(argv[1]) == false)
+		{
+			delete source;
+			return 1;
+		}
+
+		// tile the file out to the fixed size so every run times the same amount of work
+		input_size = 0;
+		while (input_size < KERNEL_INPUT_SIZE)
+		{
+			int amount_read;
+
+			amount_read = source->read(&(input[input_size]),sizeof(BYTE),KERNEL_INPUT_SIZE - input_size);
+			if (amount_read <= 0)
+			{
+				if (input_size == 0)
+				{
+					break;
+				}
+				source->seek(0,SEEK_BEGINNING);
+			}
+			else
+			{
+				input_size += amount_read;
+			}
+		}
+
+		source->shutdown();
+		delete source, source = NULL;
+	}
+	else
+	{
+		struct synthetic_parameters parameters;
+
+		parameters.m_size = input_size;
+		parameters.m_alphabet_size = 64;
+		parameters.m_skew = 0.1f;
+		parameters.m_mean_run_length = 1;
+		parameters.m_seed = 2;
+
+		generate_synthetic_data(&parameters,input);
+	}
+
+	if (input_size == 0)
+	{
+		printf("nothing to time, the input is empty\n");
+		return 1;
+	}
+
+	setup_context(&context,input,input_size);
+
+	printf("input[%s] bytes[%d] repetitions[%d], median reported\n", argc > 1 ? argv[1] : "synthetic", input_size, KERNEL_REPETITIONS);
+	printf("%-20s %12s %12s %12s\n", "kernel", "ns/byte", "cycles/byte", "MB/s");
+
+	for (k = 0; k < (int)(sizeof(g_kernels) / sizeof(g_kernels[0])); k++)
+	{
+		double seconds[KERNEL_REPETITIONS];
+		double cycles[KERNEL_REPETITIONS];
+		int bytes;
+		int r;
+
+		bytes = context.m_input_size;
+		if (g_kernels[k].m_prepare == prepare_bwt)
+		{
+			bytes = num_bwt_batches(&context) * BWT_BATCH_SIZE;
+		}
+
+		for (r = 0; r < KERNEL_REPETITIONS; r++)
+		{
+			double start;
+			DWORD start_cycles;
+
+			g_kernels[k].m_prepare(&context);
+
+			start = now_in_seconds();
+			start_cycles = read_cycle_counter();
+
+			g_kernels[k].m_run(&context);
+
+			cycles[r] = (double)(read_cycle_counter() - start_cycles);
+			seconds[r] = now_in_seconds() - start;
+
+			if (context.m_dictionary != NULL)
+			{
+				destroy_dictonary(context.m_dictionary);
+				context.m_dictionary = NULL;
+			}
+		}
+
+		qsort(seconds,KERNEL_REPETITIONS,sizeof(double),compare_doubles);
+		qsort(cycles,KERNEL_REPETITIONS,sizeof(double),compare_doubles);
+
+		if (HAS_CYCLE_COUNTER)
+		{
+			printf("%-20s %12.3f %12.3f %12.2f\n", g_kernels[k].m_name, seconds[KERNEL_REPETITIONS / 2] * 1e9 / bytes, cycles[KERNEL_REPETITIONS / 2] / bytes, bytes / seconds[KERNEL_REPETITIONS / 2] / 1e6);
+		}
+		else
+		{
+			printf("%-20s %12.3f %12s %12.2f\n", g_kernels[k].m_name, seconds[KERNEL_REPETITIONS / 2] * 1e9 / bytes, "n/a", bytes / seconds[KERNEL_REPETITIONS / 2] / 1e6);
+		}
+		fflush(stdout);
+	}
+
+	// printed so the results can't be optimized away
+	printf("checksum[%llu]\n", context.m_checksum);
+
+	shutdown_context(&context);
+	free(input);
+
+	return 0;
+}
+
+
+/////////////////////////////
+// Private Functions
+void setup_context(struct kernel_context *context,const BYTE *input,int input_size)
+{
+	int num_batches;
+	int block_bytes_written;
+	int b;
+	int q;
+
+	memset(context,0,sizeof(struct kernel_context));
+
+	context->m_input = input;
+	context->m_input_size = input_size;
+	context->m_scratch = (BYTE *)malloc(input_size);
+
+	serialize_model(input,input_size,ALGORITHM_HUFFMAN,&(context->m_serialized_huffman),&(context->m_serialized_huffman_size));
+	serialize_model(input,input_size,ALGORITHM_ARITHMETIC,&(context->m_serialized_arithmetic),&(context->m_serialized_arithmetic_size));
+
+	collect_bits(input,input_size,context->m_serialized_huffman,context->m_serialized_huffman_size,&(context->m_huffman_bits),&(context->m_huffman_num_bits));
+	collect_bits(input,input_size,context->m_serialized_arithmetic,context->m_serialized_arithmetic_size,&(context->m_arithmetic_bits),&(context->m_arithmetic_num_bits));
+
+	pack_bits(context->m_huffman_bits,context->m_huffman_num_bits,&(context->m_huffman_packed),&(context->m_huffman_packed_size));
+	pack_bits(context->m_arithmetic_bits,context->m_arithmetic_num_bits,&(context->m_arithmetic_packed),&(context->m_arithmetic_packed_size));
+
+	for (q = 0; q < HUFFMAN_NUM_STREAMS; q++)
+	{
+		const BYTE *quarter;
+		char *bits;
+		int num_bits;
+
+		context->m_quarter_sizes[q] = input_size / HUFFMAN_NUM_STREAMS;
+		if (q == HUFFMAN_NUM_STREAMS - 1)
+		{
+			context->m_quarter_sizes[q] = input_size - context->m_quarter_sizes[0] * (HUFFMAN_NUM_STREAMS - 1);
+		}
+
+		quarter = &(input[q * context->m_quarter_sizes[0]]);
+
+		collect_bits(quarter,context->m_quarter_sizes[q],context->m_serialized_huffman,context->m_serialized_huffman_size,&bits,&num_bits);
+		pack_bits(bits,num_bits,&(context->m_quarters_packed[q]),&(context->m_quarters_packed_sizes[q]));
+		free(bits);
+	}
+
+	num_batches = num_bwt_batches(context);
+	context->m_bwt_encoded = (BYTE *)malloc(num_batches * BWT_BATCH_SIZE + 1);
+	context->m_bwt_indices = (int *)malloc(sizeof(int) * (num_batches + 1));
+
+	bwt_initialize(1,true);
+	for (b = 0; b < num_batches; b++)
+	{
+		int bytes_written;
+
+		bwt_encode(&(input[b * BWT_BATCH_SIZE]),1,BWT_BATCH_SIZE,&(context->m_bwt_encoded[b * BWT_BATCH_SIZE]),&(context->m_bwt_indices[b]),&bytes_written);
+	}
+
+	context->m_bwt_block = (BYTE *)malloc(input_size);
+	bwt_encode(input,1,input_size,context->m_bwt_block,&(context->m_bwt_block_index),&block_bytes_written);
+
+	context->m_lz77_parameters.m_window_size = LZ77_WINDOW_SIZE;
+	context->m_lz77_parameters.m_max_chain_length = LZ77_CHAIN_LENGTH;
+	context->m_lz77_parameters.m_nice_length = LZ77_NICE_LENGTH;
+	context->m_lz77_parameters.m_lazy_matching = true;
+
+	context->m_lz77_arena = create_arena(input_size * 4);
+	context->m_parse_arena = create_arena(input_size * 4);
+	lz77_parse(input,input_size,0,&(context->m_lz77_parameters),context->m_lz77_arena,&(context->m_lz77_streams));
+}
+
+int num_bwt_batches(struct kernel_context *context)
+{
+	return (context->m_input_size < BWT_INPUT_SIZE ? context->m_input_size : BWT_INPUT_SIZE) / BWT_BATCH_SIZE;
+}
+
+void shutdown_context(struct kernel_context *context)
+{
+	int q;
+
+	free(context->m_serialized_huffman);
+	free(context->m_serialized_arithmetic);
+	free(context->m_huffman_bits);
+	free(context->m_arithmetic_bits);
+	free(context->m_huffman_packed);
+	free(context->m_arithmetic_packed);
+
+	for (q = 0; q < HUFFMAN_NUM_STREAMS; q++)
+	{
+		free(context->m_quarters_packed[q]);
+	}
+
+	free(context->m_bwt_encoded);
+	free(context->m_bwt_indices);
+	free(context->m_bwt_block);
+	free(context->m_scratch);
+	destroy_arena(context->m_lz77_arena);
+	destroy_arena(context->m_parse_arena);
+}
+
+
+void serialize_model(const BYTE *input,int input_size,BYTE algorithm_id,BYTE **bytes,int *num_bytes)
+{
+	DICTIONARY dictionary;
+
+	dictionary = create_dictionary(algorithm_id,ALPHABET_BYTE,NULL);
+	update_dictionary_buffer(dictionary,input,input_size);
+	finalize_dictionary(dictionary);
+	serialize_dictionary_to_bytes(dictionary,num_bytes,bytes);
+	destroy_dictonary(dictionary);
+}
+
+
+void collect_bits(const BYTE *input,int input_size,const BYTE *serialized,int num_serialized,char **bits,int *num_bits)
+{
+	DICTIONARY dictionary;
+	const char *representation;
+	int capacity;
+	int i;
+
+	dictionary = deserialize_bytes_to_dictionary(num_serialized,(BYTE *)serialized,NULL);
+
+	capacity = input_size * 8 + 64;
+	*bits = (char *)malloc(capacity);
+	*num_bits = 0;
+
+	for (i = 0; i <= input_size; i++)
+	{
+		if (i < input_size)
+		{
+			struct symbol sym;
+
+			sym.m_value = input[i];
+			representation = encode_symbol_to_bitstring(dictionary,sym);
+		}
+		else
+		{
+			representation = encode_symbol_to_bitstring_flush(dictionary);
+		}
+
+		while (representation != NULL && *representation != '\0')
+		{
+			if (*num_bits == capacity)
+			{
+				capacity *= 2;
+				*bits = (char *)realloc(*bits,capacity);
+			}
+
+			(*bits)[*num_bits] = *representation;
+			(*num_bits)++;
+			representation++;
+		}
+	}
+
+	destroy_dictonary(dictionary);
+}
+
+
+// most significant bit first, the last byte padded with zeros
+void pack_bits(const char *bits,int num_bits,BYTE **bytes,int *num_bytes)
+{
+	int i;
+
+	*num_bytes = (num_bits + 7) / 8;
+	*bytes = (BYTE *)calloc(*num_bytes + 1,1);
+
+	for (i = 0; i < num_bits; i++)
+	{
+		if (bits[i] == '1')
+		{
+			(*bytes)[i / 8] |= 0x80 >> (i % 8);
+		}
+	}
+}
+
+
+void prepare_nothing(struct kernel_context *)
+{
+}
+
+void prepare_huffman_histogram(struct kernel_context *context)
+{
+	context->m_dictionary = create_dictionary(ALGORITHM_HUFFMAN,ALPHABET_BYTE,NULL);
+	update_dictionary_buffer(context->m_dictionary,context->m_input,context->m_input_size);
+}
+
+void prepare_huffman_dictionary(struct kernel_context *context)
+{
+	context->m_dictionary = deserialize_bytes_to_dictionary(context->m_serialized_huffman_size,context->m_serialized_huffman,NULL);
+}
+
+void prepare_arithmetic_dictionary(struct kernel_context *context)
+{
+	context->m_dictionary = deserialize_bytes_to_dictionary(context->m_serialized_arithmetic_size,context->m_serialized_arithmetic,NULL);
+}
+
+void prepare_bwt(struct kernel_context *)
+{
+}
+
+void prepare_lz77_parse(struct kernel_context *context)
+{
+	arena_reset(context->m_parse_arena);
+}
+
+
+void run_histogram(struct kernel_context *context)
+{
+	DICTIONARY dictionary;
+
+	dictionary = create_dictionary(ALGORITHM_HUFFMAN,ALPHABET_BYTE,NULL);
+	update_dictionary_buffer(dictionary,context->m_input,context->m_input_size);
+	context->m_dictionary = dictionary;
+}
+
+// the histogram is counted in the prepare step, so this is only the cost of turning a block's counts into its code
+void run_huffman_build(struct kernel_context *context)
+{
+	finalize_dictionary(context->m_dictionary);
+}
+
+void run_encode(struct kernel_context *context)
+{
+	int i;
+
+	for (i = 0; i < context->m_input_size; i++)
+	{
+		struct symbol sym;
+		const char *representation;
+
+		sym.m_value = context->m_input[i];
+		representation = encode_symbol_to_bitstring(context->m_dictionary,sym);
+
+		if (representation != NULL)
+		{
+			context->m_checksum += representation[0];
+		}
+	}
+}
+
+// the scratch buffer is refilled as often as it takes, the way the compressor hands chunks to its stream
+void run_encode_packed(struct kernel_context *context)
+{
+	struct packed_bit_writer writer;
+	int i;
+
+	writer.m_bits = 0;
+	writer.m_num_bits = 0;
+
+	i = 0;
+	while (i < context->m_input_size)
+	{
+		writer.m_cursor = context->m_scratch;
+		writer.m_end = context->m_scratch + context->m_input_size;
+
+		i += encode_buffer_packed(context->m_dictionary,&writer,&(context->m_input[i]),context->m_input_size - i);
+		context->m_checksum += context->m_scratch[0];
+	}
+
+	encode_flush_packed(context->m_dictionary,&writer);
+	context->m_checksum += finish_packed_bits(&writer);
+}
+
+void run_decode_huffman(struct kernel_context *context)
+{
+	struct symbol decoded_symbol;
+	int i;
+
+	for (i = 0; i < context->m_huffman_num_bits; i++)
+	{
+		if (decode_consume_bit(context->m_dictionary,context->m_huffman_bits[i],&decoded_symbol))
+		{
+			context->m_checksum += decoded_symbol.m_value;
+		}
+	}
+}
+
+void run_decode_huffman_table(struct kernel_context *context)
+{
+	decode_huffman_bytes(context->m_dictionary,context->m_huffman_packed,context->m_huffman_packed_size,context->m_scratch,context->m_input_size);
+	context->m_checksum += context->m_scratch[context->m_input_size - 1];
+}
+
+void run_decode_huffman_x4(struct kernel_context *context)
+{
+	decode_huffman_bytes_x4(context->m_dictionary,context->m_quarters_packed,context->m_quarters_packed_sizes,context->m_scratch,context->m_quarter_sizes);
+	context->m_checksum += context->m_scratch[context->m_input_size - 1];
+}
+
+void run_decode_arithmetic(struct kernel_context *context)
+{
+	struct symbol decoded_symbol;
+	int i;
+
+	for (i = 0; i < context->m_arithmetic_num_bits; i++)
+	{
+		bool test;
+
+		test = decode_consume_bit(context->m_dictionary,context->m_arithmetic_bits[i],&decoded_symbol);
+
+		while (test == true)
+		{
+			context->m_checksum += decoded_symbol.m_value;
+			test = decode_pending_symbol(context->m_dictionary,&decoded_symbol);
+		}
+	}
+
+	while (decode_consume_bit_flush(context->m_dictionary,&decoded_symbol))
+	{
+		context->m_checksum += decoded_symbol.m_value;
+	}
+}
+
+void run_decode_arithmetic_packed(struct kernel_context *context)
+{
+	decode_buffer_packed(context->m_dictionary,context->m_arithmetic_packed,context->m_arithmetic_packed_size,context->m_arithmetic_num_bits % 8,context->m_scratch,context->m_input_size);
+	context->m_checksum += context->m_scratch[context->m_input_size - 1];
+}
+
+void run_bwt_encode(struct kernel_context *context)
+{
+	int num_batches;
+	int b;
+
+	num_batches = num_bwt_batches(context);
+
+	bwt_initialize(1,true);
+	for (b = 0; b < num_batches; b++)
+	{
+		int index;
+		int bytes_written;
+
+		bwt_encode(&(context->m_input[b * BWT_BATCH_SIZE]),1,BWT_BATCH_SIZE,&(context->m_scratch[b * BWT_BATCH_SIZE]),&index,&bytes_written);
+		context->m_checksum += index;
+	}
+}
+
+void run_bwt_decode(struct kernel_context *context)
+{
+	int num_batches;
+	int b;
+
+	num_batches = num_bwt_batches(context);
+
+	bwt_initialize(1,false);
+	for (b = 0; b < num_batches; b++)
+	{
+		int symbols_written;
+
+		bwt_decode(&(context->m_bwt_encoded[b * BWT_BATCH_SIZE]),1,BWT_BATCH_SIZE,context->m_bwt_indices[b],&(context->m_scratch[b * BWT_BATCH_SIZE]),&symbols_written);
+		context->m_checksum += context->m_scratch[b * BWT_BATCH_SIZE];
+	}
+
+	assert(memcmp(context->m_scratch,context->m_input,num_batches * BWT_BATCH_SIZE) == 0);
+}
+
+
+// the whole input as one block, sorted by prefix doubling on one thread per cpu
+void run_bwt_doubling(struct kernel_context *context)
+{
+	int index;
+	int bytes_written;
+
+	bwt_set_sort(BWT_SORT_DOUBLING,0);
+	bwt_encode(context->m_input,1,context->m_input_size,context->m_scratch,&index,&bytes_written);
+	bwt_set_sort(BWT_SORT_AUTO,0);
+
+	context->m_checksum += index;
+
+	assert(index == context->m_bwt_block_index && memcmp(context->m_scratch,context->m_bwt_block,context->m_input_size) == 0);
+}
+
+void run_bwt_rank_inverse(struct kernel_context *context)
+{
+	int symbols_written;
+
+	bwt_decode(context->m_bwt_block,1,context->m_input_size,context->m_bwt_block_index,context->m_scratch,&symbols_written);
+	context->m_checksum += context->m_scratch[0];
+
+	assert(memcmp(context->m_scratch,context->m_input,context->m_input_size) == 0);
+}
+
+
+// match finding, lazy evaluation and the bucketing of lengths and distances, not the coders behind them
+void run_lz77_parse(struct kernel_context *context)
+{
+	struct lz77_streams streams;
+
+	lz77_parse(context->m_input,context->m_input_size,0,&(context->m_lz77_parameters),context->m_parse_arena,&streams);
+	context->m_checksum += streams.m_num_matches;
+}
+
+void run_lz77_reconstruct(struct kernel_context *context)
+{
+	bool test;
+
+	test = lz77_reconstruct(&(context->m_lz77_streams),context->m_scratch,context->m_input_size,0);
+	context->m_checksum += context->m_scratch[0];
+
+	assert(test == true && memcmp(context->m_scratch,context->m_input,context->m_input_size) == 0);
+}
+
+// time stamp counter ticks, which track the nominal clock rather than the boosted one
+DWORD read_cycle_counter()
+{
+#if HAS_CYCLE_COUNTER
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
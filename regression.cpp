@@ -0,0 +1,576 @@
+#include "common.h"
+#include "compressor.h"
+#include "archive.h"
+#include "benchmark.h"
+#include "FileInputStream.hpp"
+#include "FileOutputStream.hpp"
+#include "MemoryInputStream.hpp"
+#include "MemoryOutputStream.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+/*
+	round trips the paths a plain c / d of one file never takes: push streams fed and drained in random
+	pieces, appends, archives, deltas and a decode under a memory cap; prints a line per check and exits
+	non-zero if any failed
+
+	usage: regression_check [input-filename]
+*/
+
+
+#define CHECK_INPUT_SIZE (640 * 1024)
+#define CHECK_BLOCK_SIZE (64 * 1024) // small enough that the input makes a stream of many blocks
+#define SMALL_RECORD_SIZE 100
+#define MAX_PUSH_CHUNK (96 * 1024)
+#define DELTA_INSERT_OFFSET 10000
+#define DELTA_INSERT_SIZE 1000
+#define DELTA_MAX_RATIO 8 // an edit this small has to cost less than this fraction of the new file
+#define CAPPED_DECODE_MEMORY (6 * 1024 * 1024) // enough to decode the input as one block, not to pipeline it too
+
+
+/////////////////////////////
+// Private Structures
+struct check
+{
+	const char *m_name;
+	bool (*m_run)(const BYTE *input, int input_size);
+};
+
+
+/////////////////////////////
+// Private Prototypes
+bool read_input(const char *filename, BYTE **bytes, int *size);
+bool write_bytes(const char *filename, const BYTE *bytes, int size);
+bool same_file(const char *filename, const BYTE *bytes, int size);
+bool compress_bytes(const BYTE *input, int input_size, MemoryOutputStream *dest);
+bool decode_matches(const BYTE *compressed, int compressed_size, const BYTE *expected, int expected_size);
+bool push_through(PUSH_STREAM stream, const BYTE *input, int input_size, unsigned int seed, MemoryOutputStream *dest);
+
+bool check_push(const BYTE *input, int input_size);
+bool check_push_settings(const BYTE *input, int input_size);
+bool check_append(const BYTE *input, int input_size);
+bool check_archive(const BYTE *input, int input_size);
+bool check_delta(const BYTE *input, int input_size);
+bool check_capped_decode(const BYTE *input, int input_size);
+
+
+/////////////////////////////
+// Global Variables
+static const struct check g_checks[] =
+{
+	{"push", check_push},
+	{"push settings", check_push_settings},
+	{"append", check_append},
+	{"archive", check_archive},
+	{"delta", check_delta},
+	{"capped decode", check_capped_decode},
+};
+
+
+/////////////////////////////
+// Public Functions
+int main(int argc, char *argv[])
+{
+	struct synthetic_parameters parameters;
+	char directory[] = "/tmp/regression_XXXXXX";
+	BYTE *input;
+	int input_size;
+	int num_failed;
+	int c;
+
+	// half the input is the file, if there is one, and the rest synthetic, so blocks differ from each other
+	input = (BYTE *)malloc(CHECK_INPUT_SIZE);
+	input_size = 0;
+
+	if (argc > 1)
+	{
+		BYTE *bytes;
+		int size;
+
+		if (read_input(argv[1], &bytes, &size) == false)
+		{
+			return 1;
+		}
+
+		input_size = size < CHECK_INPUT_SIZE / 2 ? size : CHECK_INPUT_SIZE / 2;
+		memcpy(input, bytes, input_size);
+		free(bytes);
+	}
+
+	parameters.m_size = CHECK_INPUT_SIZE - input_size;
+	parameters.m_alphabet_size = 48;
+	parameters.m_skew = 0.2f;
+	parameters.m_mean_run_length = 2;
+	parameters.m_seed = 7;
+
+	generate_synthetic_data(&parameters, &(input[input_size]));
+	input_size = CHECK_INPUT_SIZE;
+
+	if (mkdtemp(directory) == NULL || chdir(directory) != 0)
+	{
+		printf("Problem: can't make a directory to work in\n");
+		return 1;
+	}
+
+	set_block_size(CHECK_BLOCK_SIZE);
+
+	num_failed = 0;
+
+	for (c = 0; c < (int)(sizeof(g_checks) / sizeof(g_checks[0])); c++)
+	{
+		bool passed;
+
+		// extracting turns it back on when it's done
+		set_verbose(false);
+
+		passed = g_checks[c].m_run(input, input_size);
+		printf("%-16s %s\n", g_checks[c].m_name, passed ? "ok" : "FAILED");
+		fflush(stdout);
+
+		if (passed == false)
+		{
+			num_failed++;
+		}
+	}
+
+	chdir("/");
+	rmdir(directory);
+	free(input);
+
+	return num_failed == 0 ? 0 : 1;
+}
+
+
+/////////////////////////////
+// Private Functions
+bool read_input(const char *filename, BYTE **bytes, int *size)
+{
+	FileInputStream source;
+	int capacity;
+	int amount_read;
+
+	if (source.initialize(filename) == false)
+	{
+		return false;
+	}
+
+	capacity = 64 * 1024;
+	*bytes = (BYTE *)malloc(capacity);
+	*size = 0;
+
+	while ((amount_read = source.read(&((*bytes)[*size]), sizeof(BYTE), capacity - *size)) > 0)
+	{
+		*size += amount_read;
+		if (*size == capacity)
+		{
+			capacity *= 2;
+			*bytes = (BYTE *)realloc(*bytes, capacity);
+		}
+	}
+
+	source.shutdown();
+
+	return true;
+}
+
+bool write_bytes(const char *filename, const BYTE *bytes, int size)
+{
+	FileOutputStream dest;
+	bool result;
+
+	if (dest.initialize(filename) == false)
+	{
+		return false;
+	}
+
+	result = size == 0 || dest.write((void *)bytes, sizeof(BYTE), size) == size;
+	dest.shutdown();
+
+	return result;
+}
+
+bool same_file(const char *filename, const BYTE *bytes, int size)
+{
+	BYTE *contents;
+	int contents_size;
+	bool result;
+
+	if (read_input(filename, &contents, &contents_size) == false)
+	{
+		return false;
+	}
+
+	result = contents_size == size && memcmp(contents, bytes, size) == 0;
+	free(contents);
+
+	return result;
+}
+
+
+bool compress_bytes(const BYTE *input, int input_size, MemoryOutputStream *dest)
+{
+	MemoryInputStream source;
+	bool result;
+
+	source.initialize(input, input_size);
+	dest->initialize(input_size > 0 ? input_size : 1);
+
+	result = perform_compression(ALGORITHM_AUTO, &source, dest);
+	source.shutdown();
+
+	return result;
+}
+
+bool decode_matches(const BYTE *compressed, int compressed_size, const BYTE *expected, int expected_size)
+{
+	MemoryInputStream source;
+	MemoryOutputStream dest;
+	bool result;
+
+	source.initialize(compressed, compressed_size);
+	dest.initialize(expected_size > 0 ? expected_size : 1);
+
+	result = perform_decompression(&source, &dest) && dest.getSize() == expected_size && memcmp(dest.getBuffer(), expected, expected_size) == 0;
+
+	dest.shutdown();
+	source.shutdown();
+
+	return result;
+}
+
+
+// feeds the stream pieces of random sizes and drains it into buffers of random sizes, as a caller
+// reading from a socket would
+bool push_through(PUSH_STREAM stream, const BYTE *input, int input_size, unsigned int seed, MemoryOutputStream *dest)
+{
+	BYTE *buffer;
+	int position;
+	int amount;
+
+	buffer = (BYTE *)malloc(MAX_PUSH_CHUNK);
+	position = 0;
+	srand(seed);
+
+	while (position < input_size)
+	{
+		int chunk;
+		int consumed;
+
+		chunk = 1 + rand() % (rand() % 2 ? 100 : MAX_PUSH_CHUNK);
+		if (chunk > input_size - position)
+		{
+			chunk = input_size - position;
+		}
+
+		consumed = push_write(stream, &(input[position]), chunk);
+		if (consumed < 0)
+		{
+			free(buffer);
+			return false;
+		}
+
+		position += consumed;
+
+		while ((amount = push_read(stream, buffer, 1 + rand() % MAX_PUSH_CHUNK)) > 0)
+		{
+			dest->write(buffer, sizeof(BYTE), amount);
+		}
+	}
+
+	if (push_finish(stream) == false)
+	{
+		free(buffer);
+		return false;
+	}
+
+	while ((amount = push_read(stream, buffer, MAX_PUSH_CHUNK)) > 0)
+	{
+		dest->write(buffer, sizeof(BYTE), amount);
+	}
+
+	free(buffer);
+
+	return push_done(stream);
+}
+
+
+// a push encoded stream decodes through both the push decoder and perform_decompression(), and a stream
+// from perform_compression() through the push decoder
+bool check_push(const BYTE *input, int input_size)
+{
+	PUSH_STREAM stream;
+	MemoryOutputStream encoded;
+	MemoryOutputStream decoded;
+	MemoryOutputStream compressed;
+	bool result;
+
+	encoded.initialize(input_size);
+	decoded.initialize(input_size);
+
+	stream = create_push_encoder(ALGORITHM_AUTO);
+	result = stream != NULL && push_through(stream, input, input_size, 1, &encoded);
+	destroy_push_stream(stream);
+
+	if (result)
+	{
+		stream = create_push_decoder();
+		result = push_through(stream, encoded.getBuffer(), encoded.getSize(), 2, &decoded);
+		destroy_push_stream(stream);
+
+		result = result && decoded.getSize() == input_size && memcmp(decoded.getBuffer(), input, input_size) == 0;
+		result = result && decode_matches(encoded.getBuffer(), encoded.getSize(), input, input_size);
+	}
+
+	if (result)
+	{
+		result = compress_bytes(input, input_size, &compressed);
+
+		decoded.rewind();
+		stream = create_push_decoder();
+		result = result && push_through(stream, compressed.getBuffer(), compressed.getSize(), 3, &decoded);
+		destroy_push_stream(stream);
+
+		result = result && decoded.getSize() == input_size && memcmp(decoded.getBuffer(), input, input_size) == 0;
+		compressed.shutdown();
+	}
+
+	decoded.shutdown();
+	encoded.shutdown();
+
+	return result;
+}
+
+
+// an encoder keeps the settings it was created with: changing every one of them while it runs leaves
+// its stream byte for byte what an encoder left alone writes
+bool check_push_settings(const BYTE *input, int input_size)
+{
+	PUSH_STREAM stream;
+	MemoryOutputStream undisturbed;
+	MemoryOutputStream disturbed;
+	struct lz77_parameters match_finder;
+	struct lz77_parameters no_matches;
+	BYTE alphabet_id;
+	int selection_margin;
+	bool result;
+
+	undisturbed.initialize(input_size);
+	disturbed.initialize(input_size);
+
+	stream = create_push_encoder(ALGORITHM_AUTO);
+	result = stream != NULL && push_through(stream, input, input_size, 4, &undisturbed);
+	destroy_push_stream(stream);
+
+	get_match_finder(&match_finder);
+	alphabet_id = get_alphabet();
+	selection_margin = get_selection_margin();
+
+	stream = create_push_encoder(ALGORITHM_AUTO);
+
+	no_matches = match_finder;
+	no_matches.m_max_chain_length = 0;
+	set_match_finder(&no_matches);
+	set_alphabet(ALPHABET_WORD);
+	set_selection_margin(50);
+	set_block_splitting(false);
+	set_block_size(CHECK_BLOCK_SIZE / 2);
+
+	result = result && stream != NULL && push_through(stream, input, input_size, 5, &disturbed);
+	destroy_push_stream(stream);
+
+	set_match_finder(&match_finder);
+	set_alphabet(alphabet_id);
+	set_selection_margin(selection_margin);
+	set_block_splitting(true);
+	set_block_size(CHECK_BLOCK_SIZE);
+
+	result = result && disturbed.getSize() == undisturbed.getSize() && memcmp(disturbed.getBuffer(), undisturbed.getBuffer(), undisturbed.getSize()) == 0;
+
+	disturbed.shutdown();
+	undisturbed.shutdown();
+
+	return result;
+}
+
+
+// a small record, which is framed as a single block, then more blocks on it twice
+bool check_append(const BYTE *input, int input_size)
+{
+	MemoryOutputStream compressed;
+	int split;
+	int i;
+	bool result;
+
+	result = compress_bytes(input, SMALL_RECORD_SIZE, &compressed) && write_bytes("append.bin", compressed.getBuffer(), compressed.getSize());
+	compressed.shutdown();
+
+	split = SMALL_RECORD_SIZE + (input_size - SMALL_RECORD_SIZE) / 2;
+
+	for (i = 0; i < 2 && result; i++)
+	{
+		FileInputStream archive;
+		FileInputStream source;
+		FileOutputStream dest;
+
+		if (i == 0)
+		{
+			result = write_bytes("more.bin", &(input[SMALL_RECORD_SIZE]), split - SMALL_RECORD_SIZE);
+		}
+		else
+		{
+			result = write_bytes("more.bin", &(input[split]), input_size - split);
+		}
+
+		if (result && archive.initialize("append.bin") && source.initialize("more.bin") && dest.initializeForUpdate("append.bin"))
+		{
+			result = perform_append(ALGORITHM_AUTO, &archive, &dest, &source);
+		}
+		else
+		{
+			result = false;
+		}
+
+		dest.shutdown();
+		source.shutdown();
+		archive.shutdown();
+	}
+
+	if (result)
+	{
+		BYTE *bytes;
+		int size;
+
+		result = read_input("append.bin", &bytes, &size);
+		result = result && decode_matches(bytes, size, input, input_size);
+		free(bytes);
+	}
+
+	remove("more.bin");
+	remove("append.bin");
+
+	return result;
+}
+
+
+// a tree with a nested, an empty and a small file packs and unpacks to the same bytes
+bool check_archive(const BYTE *input, int input_size)
+{
+	const char *paths[] = {"tree"};
+	FileOutputStream dest;
+	FileInputStream source;
+	bool result;
+
+	mkdir("tree", 0777);
+	mkdir("tree/nested", 0777);
+
+	result = write_bytes("tree/whole.bin", input, input_size) &&
+		write_bytes("tree/nested/half.bin", &(input[input_size / 2]), input_size / 2) &&
+		write_bytes("tree/nested/small.bin", input, SMALL_RECORD_SIZE) &&
+		write_bytes("tree/empty.bin", input, 0);
+
+	if (result && dest.initialize("tree.arc"))
+	{
+		result = create_archive(ALGORITHM_AUTO, paths, 1, 0, &dest);
+		dest.shutdown();
+	}
+	else
+	{
+		result = false;
+	}
+
+	mkdir("out", 0777);
+
+	if (result && source.initialize("tree.arc"))
+	{
+		result = extract_archive(&source, "out", NULL, 0);
+		source.shutdown();
+	}
+	else
+	{
+		result = false;
+	}
+
+	result = result && same_file("out/tree/whole.bin", input, input_size) &&
+		same_file("out/tree/nested/half.bin", &(input[input_size / 2]), input_size / 2) &&
+		same_file("out/tree/nested/small.bin", input, SMALL_RECORD_SIZE) &&
+		same_file("out/tree/empty.bin", input, 0);
+
+	remove("out/tree/nested/small.bin");
+	remove("out/tree/nested/half.bin");
+	remove("out/tree/whole.bin");
+	remove("out/tree/empty.bin");
+	rmdir("out/tree/nested");
+	rmdir("out/tree");
+	rmdir("out");
+	remove("tree.arc");
+	remove("tree/nested/small.bin");
+	remove("tree/nested/half.bin");
+	remove("tree/whole.bin");
+	remove("tree/empty.bin");
+	rmdir("tree/nested");
+	rmdir("tree");
+
+	return result;
+}
+
+
+// the input with a few bytes put in near its start round trips against the input as its reference,
+// and costs little more than the bytes put in
+bool check_delta(const BYTE *input, int input_size)
+{
+	MemoryInputStream reference;
+	MemoryOutputStream compressed;
+	BYTE *edited;
+	int edited_size;
+	int i;
+	bool result;
+
+	edited_size = input_size + DELTA_INSERT_SIZE;
+	edited = (BYTE *)malloc(edited_size);
+
+	memcpy(edited, input, DELTA_INSERT_OFFSET);
+	for (i = 0; i < DELTA_INSERT_SIZE; i++)
+	{
+		edited[DELTA_INSERT_OFFSET + i] = (BYTE)(i * 7);
+	}
+	memcpy(&(edited[DELTA_INSERT_OFFSET + DELTA_INSERT_SIZE]), &(input[DELTA_INSERT_OFFSET]), input_size - DELTA_INSERT_OFFSET);
+
+	reference.initialize(input, input_size);
+	result = load_reference(&reference);
+	reference.shutdown();
+
+	result = result && compress_bytes(edited, edited_size, &compressed);
+	result = result && compressed.getSize() < edited_size / DELTA_MAX_RATIO;
+	result = result && decode_matches(compressed.getBuffer(), compressed.getSize(), edited, edited_size);
+
+	unload_reference();
+	compressed.shutdown();
+	free(edited);
+
+	return result;
+}
+
+
+// a stream that's all one block never pipelines, so decoding it under a cap only has to fit the block
+bool check_capped_decode(const BYTE *input, int input_size)
+{
+	MemoryOutputStream compressed;
+	bool result;
+
+	set_block_size(input_size);
+	result = compress_bytes(input, input_size, &compressed);
+	set_block_size(CHECK_BLOCK_SIZE);
+
+	set_max_memory(CAPPED_DECODE_MEMORY);
+	result = result && decode_matches(compressed.getBuffer(), compressed.getSize(), input, input_size);
+	set_max_memory(0);
+
+	compressed.shutdown();
+
+	return result;
+}
@@ -0,0 +1,130 @@
+#include "./ring.h"
+
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+
+/////////////////////////////
+// private defines
+
+#define CACHE_LINE_SIZE 64
+#define RING_YIELD_COUNT 64 // waits this many times through sched_yield() before sleeping
+#define RING_SLEEP_MICROSECONDS 50
+
+
+/////////////////////////////
+// Private Structures
+struct ring_internal
+{
+	void **m_items;
+	int m_mask;
+
+	// each end on a line of its own, so the producer and consumer don't pull one line back and forth
+	char m_padding0[CACHE_LINE_SIZE];
+	int m_head; // next slot to pop, only the consumer writes it
+	char m_padding1[CACHE_LINE_SIZE];
+	int m_tail; // next slot to push, only the producer writes it
+	char m_padding2[CACHE_LINE_SIZE];
+};
+
+
+/////////////////////////////
+// Private Prototypes
+void ring_wait(int *num_waits);
+
+
+/////////////////////////////
+// Public Functions
+RING create_ring(int capacity)
+{
+	struct ring_internal *addition;
+	int size;
+
+	size = 1;
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+
+	addition = (struct ring_internal *)malloc(sizeof(struct ring_internal));
+	addition->m_items = (void **)malloc(sizeof(void *) * size);
+	addition->m_mask = size - 1;
+	addition->m_head = 0;
+	addition->m_tail = 0;
+
+	return (RING)addition;
+}
+
+void destroy_ring(RING ring)
+{
+	struct ring_internal *alias;
+
+	alias = (struct ring_internal *)ring;
+
+	if (alias != NULL)
+	{
+		free(alias->m_items);
+		free(alias);
+	}
+}
+
+
+void ring_push(RING ring,void *item)
+{
+	struct ring_internal *alias;
+	int tail;
+	int num_waits;
+
+	alias = (struct ring_internal *)ring;
+	tail = alias->m_tail;
+	num_waits = 0;
+
+	// the acquire pairs with the consumer's release, so a slot it has given back is really free
+	while (tail - __atomic_load_n(&(alias->m_head), __ATOMIC_ACQUIRE) > alias->m_mask)
+	{
+		ring_wait(&num_waits);
+	}
+
+	alias->m_items[tail & alias->m_mask] = item;
+	__atomic_store_n(&(alias->m_tail), tail + 1, __ATOMIC_RELEASE);
+}
+
+void *ring_pop(RING ring)
+{
+	struct ring_internal *alias;
+	void *result;
+	int head;
+	int num_waits;
+
+	alias = (struct ring_internal *)ring;
+	head = alias->m_head;
+	num_waits = 0;
+
+	// and this acquire pairs with the producer's release, so the item and whatever it points to are there
+	while (__atomic_load_n(&(alias->m_tail), __ATOMIC_ACQUIRE) == head)
+	{
+		ring_wait(&num_waits);
+	}
+
+	result = alias->m_items[head & alias->m_mask];
+	__atomic_store_n(&(alias->m_head), head + 1, __ATOMIC_RELEASE);
+
+	return result;
+}
+
+
+/////////////////////////////
+// Private Functions
+void ring_wait(int *num_waits)
+{
+	if (*num_waits < RING_YIELD_COUNT)
+	{
+		sched_yield();
+	}
+	else
+	{
+		usleep(RING_SLEEP_MICROSECONDS);
+	}
+
+	(*num_waits)++;
+}
@@ -0,0 +1,22 @@
+#ifndef RING__H
+#define RING__H
+
+
+#include "./common.h"
+
+
+// a bounded queue of pointers from exactly one producer thread to exactly one consumer thread, with no
+// locks: each side only ever writes its own end. a full ring holds the producer back and an empty one the
+// consumer, spinning briefly and then sleeping, so the slower stage sets the pace
+typedef void * RING;
+
+
+// capacity is rounded up to a power of two
+RING create_ring(int capacity);
+void destroy_ring(RING ring);
+
+void ring_push(RING ring,void *item);
+void *ring_pop(RING ring);
+
+
+#endif // RING__H
@@ -0,0 +1,298 @@
+#include "./stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+/////////////////////////////
+// private defines
+
+#define INITIAL_BLOCKS_CAPACITY 64
+
+
+/////////////////////////////
+// Private Prototypes
+double read_clock(clockid_t clock);
+double block_entropy(const BYTE *block,int size);
+
+
+/////////////////////////////
+// Public Functions
+void reset_stats(struct coder_stats *stats,bool compressing)
+{
+	struct block_stats *blocks;
+	int blocks_capacity;
+
+	if (stats == NULL)
+	{
+		return;
+	}
+
+	// the block array is kept, a stats structure that is reused stops allocating
+	blocks = stats->m_blocks;
+	blocks_capacity = stats->m_blocks_capacity;
+
+	memset(stats,0,sizeof(struct coder_stats));
+
+	stats->m_compressing = compressing;
+	stats->m_blocks = blocks;
+	stats->m_blocks_capacity = blocks_capacity;
+}
+
+void free_stats(struct coder_stats *stats)
+{
+	if (stats == NULL)
+	{
+		return;
+	}
+
+	free(stats->m_blocks);
+	memset(stats,0,sizeof(struct coder_stats));
+}
+
+
+void start_stage(struct coder_stats *stats,struct stage_timer *timer)
+{
+	if (stats == NULL)
+	{
+		return;
+	}
+
+	timer->m_wall_seconds = read_clock(CLOCK_MONOTONIC);
+	timer->m_cpu_seconds = read_clock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void stop_stage(struct coder_stats *stats,int stage,const struct stage_timer *timer,DWORD bytes_in,DWORD bytes_out)
+{
+	struct stage_stats *alias;
+
+	if (stats == NULL)
+	{
+		return;
+	}
+
+	alias = &(stats->m_stages[stage]);
+
+	alias->m_wall_seconds += read_clock(CLOCK_MONOTONIC) - timer->m_wall_seconds;
+	alias->m_cpu_seconds += read_clock(CLOCK_THREAD_CPUTIME_ID) - timer->m_cpu_seconds;
+	alias->m_bytes_in += bytes_in;
+	alias->m_bytes_out += bytes_out;
+	alias->m_calls++;
+}
+
+void finish_stats(struct coder_stats *stats,const struct stage_timer *timer,DWORD bytes_in,DWORD bytes_out)
+{
+	if (stats == NULL)
+	{
+		return;
+	}
+
+	stats->m_wall_seconds = read_clock(CLOCK_MONOTONIC) - timer->m_wall_seconds;
+	stats->m_cpu_seconds = read_clock(CLOCK_THREAD_CPUTIME_ID) - timer->m_cpu_seconds;
+	stats->m_bytes_in = bytes_in;
+	stats->m_bytes_out = bytes_out;
+}
+
+
+void add_block_stats(struct coder_stats *stats,const BYTE *block,int size,int payload_size,BYTE algorithm_id)
+{
+	struct block_stats *addition;
+
+	if (stats == NULL)
+	{
+		return;
+	}
+
+	if (stats->m_num_blocks == stats->m_blocks_capacity)
+	{
+		stats->m_blocks_capacity = stats->m_blocks_capacity == 0 ? INITIAL_BLOCKS_CAPACITY : stats->m_blocks_capacity * 2;
+		stats->m_blocks = (struct block_stats *)realloc(stats->m_blocks,sizeof(struct block_stats) * stats->m_blocks_capacity);
+	}
+
+	addition = &(stats->m_blocks[stats->m_num_blocks]);
+	stats->m_num_blocks++;
+
+	addition->m_uncompressed_size = size;
+	addition->m_payload_size = payload_size;
+	addition->m_algorithm_id = algorithm_id;
+	addition->m_entropy = block_entropy(block,size);
+}
+
+void drop_block_stats(struct coder_stats *stats,int first,int count)
+{
+	if (stats == NULL || count <= 0)
+	{
+		return;
+	}
+
+	memmove(&(stats->m_blocks[first]),&(stats->m_blocks[first + count]),sizeof(struct block_stats) * (stats->m_num_blocks - first - count));
+	stats->m_num_blocks -= count;
+}
+
+
+bool write_stats_json(const struct coder_stats *stats,const char *filename)
+{
+	FILE *fp;
+	int i;
+
+	if (filename == NULL)
+	{
+		fp = stdout;
+	}
+	else
+	{
+		fp = fopen(filename,"w");
+		if (fp == NULL)
+		{
+			printf("Problem opening file [%s].\n", filename);
+			return false;
+		}
+	}
+
+	fprintf(fp,"{\n  \"operation\": \"%s\", \"bytes_in\": %llu, \"bytes_out\": %llu, \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"mb_per_s\": %.3f,\n",
+		stats->m_compressing ? "compress" : "decompress",
+		stats->m_bytes_in,
+		stats->m_bytes_out,
+		stats->m_wall_seconds,
+		stats->m_cpu_seconds,
+		stats->m_wall_seconds > 0 ? stats->m_bytes_in / stats->m_wall_seconds / 1e6 : 0.0);
+
+	fprintf(fp,"  \"stages\": [\n");
+
+	for (i = 0; i < NUM_STAGES; i++)
+	{
+		const struct stage_stats *stage;
+
+		stage = &(stats->m_stages[i]);
+
+		fprintf(fp,"    {\"stage\": \"%s\", \"calls\": %d, \"bytes_in\": %llu, \"bytes_out\": %llu, \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"mb_per_s\": %.3f}%s\n",
+			stage_name(i),
+			stage->m_calls,
+			stage->m_bytes_in,
+			stage->m_bytes_out,
+			stage->m_wall_seconds,
+			stage->m_cpu_seconds,
+			stage->m_wall_seconds > 0 ? stage->m_bytes_in / stage->m_wall_seconds / 1e6 : 0.0,
+			i + 1 < NUM_STAGES ? "," : "");
+	}
+
+	fprintf(fp,"  ],\n  \"blocks\": [\n");
+
+	for (i = 0; i < stats->m_num_blocks; i++)
+	{
+		const struct block_stats *block;
+
+		block = &(stats->m_blocks[i]);
+
+		fprintf(fp,"    {\"uncompressed_bytes\": %d, \"payload_bytes\": %d, \"algorithm\": \"%s\", \"entropy_bits_per_byte\": %.4f, \"achieved_bits_per_byte\": %.4f}%s\n",
+			block->m_uncompressed_size,
+			block->m_payload_size,
+			algorithm_name(block->m_algorithm_id),
+			block->m_entropy,
+			block->m_uncompressed_size > 0 ? block->m_payload_size * 8.0 / block->m_uncompressed_size : 0.0,
+			i + 1 < stats->m_num_blocks ? "," : "");
+	}
+
+	fprintf(fp,"  ]\n}\n");
+
+	if (fp != stdout)
+	{
+		fclose(fp);
+	}
+
+	return true;
+}
+
+
+const char *stage_name(int stage)
+{
+	static const char *s_names[NUM_STAGES] = {"read", "histogram", "lz77", "model", "coding", "checksum", "write"};
+
+	if (stage < 0 || stage >= NUM_STAGES)
+	{
+		return "unknown";
+	}
+
+	return s_names[stage];
+}
+
+const char *algorithm_name(BYTE algorithm_id)
+{
+	const char *result;
+
+	switch (algorithm_id)
+	{
+		case ALGORITHM_HUFFMAN :
+			result = "huffman";
+			break;
+		case ALGORITHM_ARITHMETIC :
+			result = "arithmetic";
+			break;
+		case ALGORITHM_STORED :
+			result = "stored";
+			break;
+		case ALGORITHM_LZ77 :
+			result = "lz77";
+			break;
+		case ALGORITHM_TRAINED :
+			result = "trained";
+			break;
+		case ALGORITHM_AUTO :
+			result = "auto";
+			break;
+		default:
+			result = "unknown";
+			break;
+	}
+
+	return result;
+}
+
+
+/////////////////////////////
+// Private Functions
+double read_clock(clockid_t clock)
+{
+	struct timespec now;
+
+	clock_gettime(clock,&now);
+
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+
+double block_entropy(const BYTE *block,int size)
+{
+	int counts[256];
+	double result;
+	int i;
+
+	if (size <= 0)
+	{
+		return 0.0;
+	}
+
+	memset(counts,0,sizeof(counts));
+
+	for (i = 0; i < size; i++)
+	{
+		counts[block[i]]++;
+	}
+
+	result = 0.0;
+
+	for (i = 0; i < 256; i++)
+	{
+		if (counts[i] > 0)
+		{
+			double p;
+
+			p = (double)counts[i] / size;
+			result -= p * log2(p);
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,81 @@
+#ifndef STATS__H
+#define STATS__H
+
+
+#include "./common.h"
+
+
+// where a compression or decompression spends its time, in the order a block goes through them
+#define STAGE_READ 0 // pulling input off the stream
+#define STAGE_HISTOGRAM 1 // counting symbols and picking the alphabet and coder
+#define STAGE_LZ77 2 // the match finder on the way in, rebuilding matches on the way out
+#define STAGE_MODEL 3 // finalizing, serializing and deserializing dictionaries
+#define STAGE_CODING 4 // huffman or arithmetic coding of the symbols
+#define STAGE_CHECKSUM 5
+#define STAGE_WRITE 6 // handing output to the stream
+#define NUM_STAGES 7
+
+
+struct stage_stats
+{
+	double m_wall_seconds;
+	double m_cpu_seconds; // of the thread doing the work
+	DWORD m_bytes_in;
+	DWORD m_bytes_out;
+	int m_calls;
+};
+
+struct block_stats
+{
+	int m_uncompressed_size;
+	int m_payload_size;
+	BYTE m_algorithm_id;
+	double m_entropy; // order-0 bits per byte of the uncompressed block, what a byte coder could get down to
+};
+
+struct coder_stats
+{
+	bool m_compressing;
+	double m_wall_seconds; // the whole call
+	double m_cpu_seconds;
+	DWORD m_bytes_in;
+	DWORD m_bytes_out;
+	struct stage_stats m_stages[NUM_STAGES];
+
+	struct block_stats *m_blocks; // malloc()ed, free_stats() releases them
+	int m_num_blocks;
+	int m_blocks_capacity;
+};
+
+// a started clock, stop_stage() adds what passed since to a stage
+struct stage_timer
+{
+	double m_wall_seconds;
+	double m_cpu_seconds;
+};
+
+
+// every function below does nothing when stats is NULL, so call sites don't have to check
+void reset_stats(struct coder_stats *stats,bool compressing);
+void free_stats(struct coder_stats *stats);
+
+void start_stage(struct coder_stats *stats,struct stage_timer *timer);
+void stop_stage(struct coder_stats *stats,int stage,const struct stage_timer *timer,DWORD bytes_in,DWORD bytes_out);
+
+// the totals for the whole call, from a timer started before its first stage
+void finish_stats(struct coder_stats *stats,const struct stage_timer *timer,DWORD bytes_in,DWORD bytes_out);
+
+// counts the block's bytes for its entropy, so it costs a pass over the block
+void add_block_stats(struct coder_stats *stats,const BYTE *block,int size,int payload_size,BYTE algorithm_id);
+
+// takes back count blocks from first on, ones that were coded but not kept
+void drop_block_stats(struct coder_stats *stats,int first,int count);
+
+// filename NULL writes to stdout
+bool write_stats_json(const struct coder_stats *stats,const char *filename);
+
+const char *stage_name(int stage);
+const char *algorithm_name(BYTE algorithm_id);
+
+
+#endif // STATS__H